@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const struct {
+  const char *name;
+  bench_fn fn;
+  const char *usage;
+} benches[] = {
+  { "lookup", bench_lookup, "[count...]  userid lookup cost vs. number of accounts" },
+  { "authcheck", bench_authcheck, "[count...]  lookup + ban + expiry checks, flat vs. hot records" },
+  { "readscale", bench_readscale, "[threads...]  concurrent lookup throughput with a writer running" },
+  { "shardscale", bench_shardscale, "[shards...]  insert and lookup throughput vs. shard count and threads" },
+  { "journal", bench_journal, "[threads...]  durable journal appends/s with group commit" },
+  { "arena", bench_arena, "[count]  password verify latency with and without the hash arena" },
+  { "csprng", bench_csprng, "[threads...]  salts/s from /dev/urandom, getrandom() and the buffered CSPRNG" },
+  { "hashcore", bench_hashcore, "[count]  verify latency with each Argon2 kernel (ARGON2=bundled for the SIMD ones)" },
+  { "ratelimit", bench_ratelimit, "[addresses...]  rate limit checks/s as the number of distinct client addresses grows" },
+  { "loginbatch", bench_loginbatch, "[batch sizes...]  cost per login of handle_login() vs. handle_login_batch()" },
+  { "server", bench_server, "[client counts...]  logins/s and latency through the login server over loopback TCP" },
+  { "ioqueue", bench_ioqueue, "[logins]  system calls and time per login with direct writes vs. the io_uring queue" },
+  { "replies", bench_replies, "[logins]  time per handle_login() call for each outcome" },
+  { "timerwheel", bench_timerwheel, "[timers]  clock reads, and timer wheel vs. sweeping for deadlines" },
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static int report_fd = STDOUT_FILENO;
+
+uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void bench_quiet(void) {
+  if (report_fd != STDOUT_FILENO) {
+    return;
+  }
+  fflush(stdout);
+  report_fd = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  if (report_fd < 0 || devnull < 0) {
+    report_fd = STDOUT_FILENO;
+    return;
+  }
+  dup2(devnull, STDOUT_FILENO);
+  dup2(devnull, STDERR_FILENO);
+  close(devnull);
+}
+
+void bench_report(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vdprintf(report_fd, fmt, args);
+  va_end(args);
+}
+
+size_t bench_parse_count(const char *s) {
+  char *end;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (end == s) {
+    return 0;
+  }
+  if (*end == 'k' || *end == 'K') {
+    n *= 1000ULL;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    n *= 1000000ULL;
+    end++;
+  }
+  return *end == '\0' ? (size_t)n : 0;
+}
+
+void bench_userid(char *buf, size_t len, size_t i) {
+  snprintf(buf, len, "user%zu", i);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s <benchmark> [args...]\n\nBenchmarks:\n", prog);
+  for (size_t i = 0; i < NUM_BENCHES; i++) {
+    fprintf(stderr, "  %-12s %s\n", benches[i].name, benches[i].usage);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  for (size_t i = 0; i < NUM_BENCHES; i++) {
+    if (strcmp(argv[1], benches[i].name) == 0) {
+      return benches[i].fn(argc - 2, argv + 2);
+    }
+  }
+  fprintf(stderr, "Unknown benchmark '%s'\n", argv[1]);
+  usage(argv[0]);
+  return 1;
+}
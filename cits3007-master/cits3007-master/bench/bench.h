@@ -0,0 +1,51 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * @file bench.h
+ * @brief Shared helpers for the micro-benchmarks in this directory.
+ *
+ * Each benchmark is a function taking the remaining command-line
+ * arguments and returning a process exit status. Benchmarks are
+ * registered in the table in bench.c and built by scripts/bench.sh.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int (*bench_fn)(int argc, char **argv);
+
+// monotonic clock in nanoseconds
+uint64_t bench_now_ns(void);
+
+// silence the application's own log output (which goes to stdout and
+// stderr) for the rest of the run. Results should then be written with
+// bench_report(), which goes to the original stdout.
+void bench_quiet(void);
+
+// printf-style output to the original stdout
+void bench_report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// parse a count such as "1000", "10k" or "10M"; returns 0 if invalid
+size_t bench_parse_count(const char *s);
+
+// fill buf with a deterministic userid for index i
+void bench_userid(char *buf, size_t len, size_t i);
+
+// benchmarks
+int bench_lookup(int argc, char **argv);
+int bench_authcheck(int argc, char **argv);
+int bench_readscale(int argc, char **argv);
+int bench_shardscale(int argc, char **argv);
+int bench_journal(int argc, char **argv);
+int bench_arena(int argc, char **argv);
+int bench_csprng(int argc, char **argv);
+int bench_hashcore(int argc, char **argv);
+int bench_ratelimit(int argc, char **argv);
+int bench_loginbatch(int argc, char **argv);
+int bench_server(int argc, char **argv);
+int bench_ioqueue(int argc, char **argv);
+int bench_replies(int argc, char **argv);
+int bench_timerwheel(int argc, char **argv);
+
+#endif // BENCH_H
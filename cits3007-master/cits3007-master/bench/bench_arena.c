@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/account_internal.h"
+#include "../src/hasharena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_VERIFIES 20
+#define ARENA_PASSWORD "Ar3na!Password"
+
+/*
+ * Measures account_verify_hash() latency with the default hash profile
+ * when Argon2's working memory comes from malloc (a fresh mmap, faulted
+ * in page by page and unmapped after every call), from a pre-faulted
+ * hash arena slab, and from a slab on transparent huge pages. The
+ * difference is the page-fault and mmap/munmap cost of each verify.
+ */
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool run(const char *name, const char *hash, uint64_t *times, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint64_t t0 = bench_now_ns();
+    bool ok = account_verify_hash(hash, ARENA_PASSWORD);
+    times[i] = bench_now_ns() - t0;
+    if (!ok) {
+      bench_report("%s: verify failed\n", name);
+      return false;
+    }
+  }
+  qsort(times, n, sizeof(uint64_t), compare_u64);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += times[i];
+  }
+  bench_report("%-12s %10.2f %10.2f %10.2f\n", name, (double)sum / (double)n / 1e6,
+               (double)times[n / 2] / 1e6, (double)times[(n * 99 + 99) / 100 - 1] / 1e6);
+  return true;
+}
+
+int bench_arena(int argc, char **argv) {
+  size_t n = argc > 0 ? bench_parse_count(argv[0]) : DEFAULT_VERIFIES;
+  if (n == 0) {
+    bench_report("invalid verify count '%s'\n", argv[0]);
+    return 1;
+  }
+  uint64_t *times = calloc(n, sizeof(uint64_t));
+  char hash[HASH_LENGTH];
+  bench_quiet();
+  if (!times || !account_hash_password(ARENA_PASSWORD, hash)) {
+    bench_report("setup failed\n");
+    free(times);
+    return 1;
+  }
+
+  bench_report("%zu verifies of %s\n", n, hash);
+  bench_report("%-12s %10s %10s %10s\n", "memory", "mean ms", "p50 ms", "p99 ms");
+  bool ok = true;
+  hash_arena_release();
+  hash_arena_configure(false, false);
+  ok = ok && run("malloc", hash, times, n);
+
+  hash_arena_configure(true, false);
+  ok = ok && hash_arena_reserve(1, (size_t)ACCOUNT_HASH_M_COST * 1024);
+  ok = ok && run("arena", hash, times, n);
+
+  hash_arena_release();
+  hash_arena_configure(true, true);
+  ok = ok && hash_arena_reserve(1, (size_t)ACCOUNT_HASH_M_COST * 1024);
+  ok = ok && run("arena+thp", hash, times, n);
+
+  hash_arena_release();
+  free(times);
+  return ok ? 0 : 1;
+}
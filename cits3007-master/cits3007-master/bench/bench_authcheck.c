@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/db.h"
+#include "../src/store.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUERY_LEN 24
+#define NUM_QUERIES 1000000
+
+/*
+ * Measures the pre-authentication part of a login (find the account,
+ * then check its ban and expiry) with random access over n accounts.
+ *
+ * "flat" is the layout the store had before accounts were split: whole
+ * account_t records behind the same kind of tagged hash index, built
+ * here by the benchmark, pinned and unpinned as store_acquire() and
+ * store_release() did. "hot" is the store itself, where the same
+ * checks only read the cache-line-aligned account_auth_t records and
+ * never the email/birthdate table. Once the accounts no longer fit in
+ * cache the difference is the number of lines (and pages) each check
+ * pulls in.
+ */
+
+typedef struct {
+  uint32_t tag;
+  uint32_t rec;   // record number + 1; 0 marks an empty slot
+} flat_slot_t;
+
+static atomic_long flat_pinned;
+
+typedef struct {
+  account_t *records;
+  flat_slot_t *slots;
+  size_t mask;
+} flat_store_t;
+
+static bool flat_build(flat_store_t *fs, size_t n) {
+  // sized as the store sizes its own index
+  size_t num_slots = 2048;
+  while (n * 10 > num_slots * 7) {
+    num_slots *= 2;
+  }
+  fs->records = calloc(n, sizeof(account_t));
+  fs->slots = calloc(num_slots, sizeof(flat_slot_t));
+  fs->mask = num_slots - 1;
+  if (!fs->records || !fs->slots) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    account_t *acc = &fs->records[i];
+    bench_userid(acc->userid, sizeof(acc->userid), i);
+    memcpy(acc->birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+    uint64_t h = store_hash_userid(acc->userid);
+    size_t pos = h & fs->mask;
+    while (fs->slots[pos].rec != 0) {
+      pos = (pos + 1) & fs->mask;
+    }
+    fs->slots[pos].tag = (uint32_t)(h >> 32);
+    fs->slots[pos].rec = (uint32_t)(i + 1);
+  }
+  return true;
+}
+
+static const account_t *flat_find(const flat_store_t *fs, const char *userid) {
+  uint64_t h = store_hash_userid(userid);
+  uint32_t tag = (uint32_t)(h >> 32);
+  for (size_t pos = h & fs->mask; ; pos = (pos + 1) & fs->mask) {
+    const flat_slot_t *slot = &fs->slots[pos];
+    if (slot->rec == 0) {
+      return NULL;
+    }
+    const account_t *acc = &fs->records[slot->rec - 1];
+    if (slot->tag == tag && strncmp(acc->userid, userid, USER_ID_LENGTH) == 0) {
+      atomic_fetch_add_explicit(&flat_pinned, 1, memory_order_relaxed);
+      return acc;
+    }
+  }
+}
+
+static void flat_release(const account_t *acc) {
+  if (acc != NULL) {
+    atomic_fetch_sub_explicit(&flat_pinned, 1, memory_order_relaxed);
+  }
+}
+
+static void flat_free(flat_store_t *fs) {
+  free(fs->records);
+  free(fs->slots);
+}
+
+int bench_authcheck(int argc, char **argv) {
+  static const char *default_sizes[] = { "10k", "100k", "1M", "3M" };
+  const char **sizes = (const char **)argv;
+  int num_sizes = argc;
+  if (argc == 0) {
+    sizes = default_sizes;
+    num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+  }
+
+  char (*queries)[QUERY_LEN] = malloc(NUM_QUERIES * sizeof(*queries));
+  if (!queries) {
+    return 1;
+  }
+
+  bench_quiet();
+  bench_report("record sizes: account_t %zu bytes, account_auth_t %zu bytes\n",
+               sizeof(account_t), sizeof(account_auth_t));
+  bench_report("%12s %16s %16s %10s\n", "accounts", "flat checks/s", "hot checks/s", "speedup");
+
+  srand(12345);
+  for (int s = 0; s < num_sizes; s++) {
+    size_t n = bench_parse_count(sizes[s]);
+    if (n == 0) {
+      bench_report("invalid count '%s'\n", sizes[s]);
+      free(queries);
+      return 1;
+    }
+
+    flat_store_t flat;
+    if (!flat_build(&flat, n)) {
+      bench_report("out of memory at %zu accounts\n", n);
+      flat_free(&flat);
+      free(queries);
+      return 1;
+    }
+    store_close();
+    account_t acc;
+    memset(&acc, 0, sizeof(acc));
+    memcpy(acc.birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+    for (size_t i = 0; i < n; i++) {
+      bench_userid(acc.userid, sizeof(acc.userid), i);
+      if (!add_account_to_db(&acc)) {
+        bench_report("insert failed at %zu\n", i);
+        flat_free(&flat);
+        free(queries);
+        return 1;
+      }
+    }
+
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      size_t i = ((size_t)rand() * (size_t)RAND_MAX + (size_t)rand()) % n;
+      bench_userid(queries[q], QUERY_LEN, i);
+    }
+
+    size_t allowed = 0;
+    uint64_t t0 = bench_now_ns();
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      const account_t *a = flat_find(&flat, queries[q]);
+      allowed += a && !account_is_banned(a) && !account_is_expired(a);
+      flat_release(a);
+    }
+    uint64_t t1 = bench_now_ns();
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      const account_auth_t *a = store_acquire(queries[q]);
+      allowed += a && !store_is_banned(a) && !store_is_expired(a);
+      store_release(a);
+    }
+    uint64_t t2 = bench_now_ns();
+    flat_free(&flat);
+
+    if (allowed != 2 * NUM_QUERIES) {
+      bench_report("check mismatch: %zu of %d allowed\n", allowed, 2 * NUM_QUERIES);
+      free(queries);
+      return 1;
+    }
+    double flat_rate = NUM_QUERIES / ((double)(t1 - t0) / 1e9);
+    double hot_rate = NUM_QUERIES / ((double)(t2 - t1) / 1e9);
+    bench_report("%12zu %16.0f %16.0f %9.2fx\n", n, flat_rate, hot_rate, hot_rate / flat_rate);
+  }
+  store_close();
+  free(queries);
+  return 0;
+}
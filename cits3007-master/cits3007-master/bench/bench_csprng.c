@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/csprng.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SALT_BYTES 16
+#define MAX_THREADS 256
+#define RUN_NS 500000000ULL
+
+/*
+ * Measures salts generated per second as the number of threads drawing
+ * them grows, for three sources of random bytes: opening, reading and
+ * closing /dev/urandom for every salt (as account.c used to), one
+ * getrandom() call per salt, and csprng_bytes(), which calls
+ * getrandom() once per CSPRNG_BUFFER_BYTES and serves salts from a
+ * per-thread buffer.
+ */
+
+typedef bool (*source_fn)(unsigned char *buf, size_t len);
+
+static bool from_urandom(unsigned char *buf, size_t len) {
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  ssize_t got = read(fd, buf, len);
+  close(fd);
+  return got == (ssize_t)len;
+}
+
+static bool from_getrandom(unsigned char *buf, size_t len) {
+  return getrandom(buf, len, 0) == (ssize_t)len;
+}
+
+static bool from_csprng(unsigned char *buf, size_t len) {
+  return csprng_bytes(buf, len);
+}
+
+static const struct {
+  const char *name;
+  source_fn fn;
+} sources[] = {
+  { "urandom", from_urandom },
+  { "getrandom", from_getrandom },
+  { "csprng", from_csprng },
+};
+
+#define NUM_SOURCES (sizeof(sources) / sizeof(sources[0]))
+
+typedef struct {
+  source_fn fn;
+  uint64_t ops;
+} worker_t;
+
+static atomic_bool stopping;
+
+static void *drawer(void *arg) {
+  worker_t *w = arg;
+  unsigned char salt[SALT_BYTES];
+  uint64_t n = 0;
+  while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+    if (!w->fn(salt, sizeof(salt))) {
+      break;
+    }
+    n++;
+  }
+  w->ops = n;
+  return NULL;
+}
+
+static double salts_per_sec(source_fn fn, size_t threads) {
+  pthread_t tids[MAX_THREADS];
+  worker_t workers[MAX_THREADS];
+  atomic_store(&stopping, false);
+  uint64_t t0 = bench_now_ns();
+  for (size_t t = 0; t < threads; t++) {
+    workers[t] = (worker_t){ .fn = fn };
+    pthread_create(&tids[t], NULL, drawer, &workers[t]);
+  }
+  struct timespec pause = { .tv_sec = RUN_NS / 1000000000ULL, .tv_nsec = RUN_NS % 1000000000ULL };
+  nanosleep(&pause, NULL);
+  atomic_store(&stopping, true);
+  uint64_t total = 0;
+  for (size_t t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+    total += workers[t].ops;
+  }
+  return (double)total / ((double)(bench_now_ns() - t0) / 1e9);
+}
+
+int bench_csprng(int argc, char **argv) {
+  static const char *default_threads[] = { "1", "2", "4", "16" };
+  const char **counts = (const char **)argv;
+  int num_counts = argc;
+  if (argc == 0) {
+    counts = default_threads;
+    num_counts = sizeof(default_threads) / sizeof(default_threads[0]);
+  }
+
+  bench_quiet();
+  bench_report("%d-byte salts\n", SALT_BYTES);
+  bench_report("%8s", "threads");
+  for (size_t s = 0; s < NUM_SOURCES; s++) {
+    bench_report(" %14s", sources[s].name);
+  }
+  bench_report("   (salts/s)\n");
+  for (int c = 0; c < num_counts; c++) {
+    size_t threads = bench_parse_count(counts[c]);
+    if (threads == 0 || threads > MAX_THREADS) {
+      bench_report("invalid thread count '%s'\n", counts[c]);
+      return 1;
+    }
+    bench_report("%8zu", threads);
+    for (size_t s = 0; s < NUM_SOURCES; s++) {
+      bench_report(" %14.0f", salts_per_sec(sources[s].fn, threads));
+    }
+    bench_report("\n");
+  }
+  return 0;
+}
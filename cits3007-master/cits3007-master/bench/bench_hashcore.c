@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/hasharena.h"
+#include "../src/hashcore.h"
+#include "../src/hashprofile.h"
+
+#include <argon2.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_VERIFIES 10
+#define CORE_PASSWORD "C0re!Password"
+#define TAG_BYTES 32
+
+/*
+ * Measures verify latency with the default hash profile for each
+ * Argon2 kernel this build and CPU support: the system libargon2 alone,
+ * or the bundled Argon2's reference and SIMD block functions when built
+ * with ARGON2=bundled (see vendor/README.md). Run it both ways to
+ * compare the two. Working memory comes from a pre-faulted hash arena
+ * slab in every case, so the difference is the block function alone.
+ */
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool run(const char *name, const argon2_context *base, const unsigned char *tag,
+                uint64_t *times, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned char out[TAG_BYTES];
+    argon2_context ctx = *base;
+    ctx.out = out;
+    uint64_t t0 = bench_now_ns();
+    int result = hash_core_argon2id_verify(&ctx, (const char *)tag);
+    times[i] = bench_now_ns() - t0;
+    if (result != ARGON2_OK) {
+      bench_report("%s: verify failed: %s\n", name, argon2_error_message(result));
+      return false;
+    }
+  }
+  qsort(times, n, sizeof(uint64_t), compare_u64);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += times[i];
+  }
+  bench_report("%-12s %10.2f %10.2f %10.2f\n", name, (double)sum / (double)n / 1e6,
+               (double)times[n / 2] / 1e6, (double)times[(n * 99 + 99) / 100 - 1] / 1e6);
+  return true;
+}
+
+int bench_hashcore(int argc, char **argv) {
+  size_t n = argc > 0 ? bench_parse_count(argv[0]) : DEFAULT_VERIFIES;
+  if (n == 0) {
+    bench_report("invalid verify count '%s'\n", argv[0]);
+    return 1;
+  }
+  uint64_t *times = calloc(n, sizeof(uint64_t));
+  if (!times) {
+    return 1;
+  }
+  bench_quiet();
+
+  hash_profile_t profile = hash_profile_get();
+  unsigned char salt[16], tag[TAG_BYTES];
+  memset(salt, 0x5a, sizeof(salt));
+  argon2_context base = {
+    .out = tag, .outlen = sizeof(tag),
+    .pwd = (uint8_t *)CORE_PASSWORD, .pwdlen = sizeof(CORE_PASSWORD) - 1,
+    .salt = salt, .saltlen = sizeof(salt),
+    .t_cost = profile.t_cost, .m_cost = profile.m_cost,
+    .lanes = profile.parallelism, .threads = profile.parallelism,
+    .version = ARGON2_VERSION_13,
+    .allocate_cbk = hash_arena_alloc, .free_cbk = hash_arena_free,
+  };
+  hash_arena_configure(true, false);
+  if (!hash_arena_reserve(1, (size_t)profile.m_cost * 1024) || hash_core_argon2id(&base) != ARGON2_OK) {
+    bench_report("setup failed\n");
+    free(times);
+    return 1;
+  }
+
+  char spec[64];
+  hash_profile_format(&profile, spec, sizeof(spec));
+  bench_report("%zu verifies with %s, %s Argon2 (picks %s)\n", n, spec,
+               hash_core_bundled() ? "bundled" : "system", hash_core_kernel_name(hash_core_kernel()));
+  bench_report("%-12s %10s %10s %10s\n", "kernel", "mean ms", "p50 ms", "p99 ms");
+  bool ok = true;
+  hash_kernel_t chosen = hash_core_kernel();
+  for (int k = 0; k < HASH_KERNEL_COUNT && ok; k++) {
+    if (hash_core_set_kernel((hash_kernel_t)k)) {
+      ok = run(hash_core_kernel_name((hash_kernel_t)k), &base, tag, times, n);
+    }
+  }
+  hash_core_set_kernel(chosen);
+  hash_arena_release();
+  free(times);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/account_internal.h"
+#include "../src/db.h"
+#include "../src/hashprofile.h"
+#include "../src/ioqueue.h"
+#include "../src/login.h"
+#include "../src/login_batch.h"
+#include "../src/ratelimit.h"
+#include "../src/store.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACCOUNTS 1000
+#define DEFAULT_LOGINS 20000
+#define BATCH 64
+#define PASSWORD "BenchP@ss123"
+
+/*
+ * Compares the output side of a login written directly (a write() per
+ * message) with the io_uring queue (ioqueue.h): for handle_login() with
+ * the right password (two reply lines and a log line) and with an
+ * unknown userid (one reply line; its log line goes through
+ * log_message(), which the queue doesn't cover), and for
+ * handle_login_batch() with the right passwords in batches of
+ * BATCH, reports the write() and io_uring_enter() calls made per login
+ * and the time per login. Each call drains the queue before it
+ * returns, replies included (see ioqueue.h). Replies and log lines go
+ * to /dev/null; hashes use the cheapest Argon2 settings.
+ */
+
+static int devnull = -1;
+
+typedef enum { RUN_SUCCESS, RUN_UNKNOWN, RUN_BATCH } run_kind_t;
+
+static void run(run_kind_t kind, size_t logins, bool uring) {
+  static const char *names[] = { "success", "unknown user", "batch success" };
+  static login_request_t requests[BATCH];
+  static login_outcome_t outcomes[BATCH];
+  char userid[USER_ID_LENGTH];
+  login_session_data_t session;
+
+  ioqueue_stats_t before, after;
+  ioqueue_stats(&before);
+  uint64_t t0 = bench_now_ns();
+  if (kind == RUN_BATCH) {
+    static char userids[BATCH][USER_ID_LENGTH];
+    for (size_t base = 0; base < logins; base += BATCH) {
+      size_t n = logins - base < BATCH ? logins - base : BATCH;
+      for (size_t i = 0; i < n; i++) {
+        bench_userid(userids[i], sizeof(userids[i]), (base + i) % ACCOUNTS);
+        requests[i] = (login_request_t){ userids[i], PASSWORD, (ip4_addr_t)(base + i), time(NULL),
+                                         devnull };
+      }
+      handle_login_batch(requests, outcomes, n, devnull);
+    }
+  } else {
+    for (size_t i = 0; i < logins; i++) {
+      // Unknown userids are the ones past the last account.
+      bench_userid(userid, sizeof(userid), i % ACCOUNTS + (kind == RUN_UNKNOWN ? ACCOUNTS : 0));
+      handle_login(userid, PASSWORD, (ip4_addr_t)i, time(NULL), devnull, devnull, &session);
+    }
+  }
+  ioqueue_drain();
+  double ns = (double)(bench_now_ns() - t0) / (double)logins;
+  ioqueue_stats(&after);
+
+  double writes = (double)(after.direct - before.direct) / (double)logins;
+  double enters = (double)(after.submits - before.submits) / (double)logins;
+  bench_report("%-14s %-9s %12.3f %12.3f %10.3f %10.0f\n", names[kind],
+               uring ? "io_uring" : "write", writes, enters, writes + enters, ns);
+}
+
+int bench_ioqueue(int argc, char **argv) {
+  size_t logins = argc > 0 ? bench_parse_count(argv[0]) : DEFAULT_LOGINS;
+  if (logins == 0) {
+    bench_report("invalid login count '%s'\n", argv[0]);
+    return 1;
+  }
+
+  bench_quiet();
+  hash_profile_t cheap = { .t_cost = 1, .m_cost = 8, .parallelism = 1 };
+  ratelimit_config_t unlimited = { 0, 0, 0 };
+  account_t *accs = calloc(ACCOUNTS, sizeof(account_t));
+  devnull = open("/dev/null", O_WRONLY);
+  char hash[HASH_LENGTH];
+  if (!accs || devnull < 0 || !hash_profile_set(&cheap) || !account_hash_password(PASSWORD, hash)) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  ratelimit_configure(&unlimited);
+  store_close();
+  for (size_t i = 0; i < ACCOUNTS; i++) {
+    bench_userid(accs[i].userid, sizeof(accs[i].userid), i);
+    memcpy(accs[i].password_hash, hash, HASH_LENGTH);
+    memcpy(accs[i].birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+  }
+  store_add_batch(accs, ACCOUNTS);
+
+  bool uring = ioqueue_enable(true);
+  ioqueue_enable(false);
+  bench_report("%zu logins per run, hashes m=8,t=1%s\n", logins,
+               uring ? "" : " (io_uring not available)");
+  bench_report("%-14s %-9s %12s %12s %10s %10s\n", "logins", "output", "write/login",
+               "enter/login", "syscalls", "ns/login");
+  for (int kind = RUN_SUCCESS; kind <= RUN_BATCH; kind++) {
+    run((run_kind_t)kind, logins, false);
+    if (uring) {
+      ioqueue_enable(true);
+      run((run_kind_t)kind, logins, true);
+      ioqueue_enable(false);
+    }
+  }
+
+  store_close();
+  ratelimit_reset();
+  close(devnull);
+  free(accs);
+  return 0;
+}
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/journal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_FILE "bench_journal.wal"
+#define RECORD_BYTES 128   // about the size of a login counter record
+#define MAX_THREADS 256
+#define RUN_NS 1000000000ULL
+
+/*
+ * Measures durable appends per second to a journal in the current
+ * directory as the number of threads appending (each waiting for its
+ * record to be synced before the next) grows. With one thread every
+ * record costs an fdatasync(); with more, records that arrive while a
+ * sync is in progress share the next one, so throughput should grow
+ * with the number of threads until the disk's bandwidth, rather than
+ * its sync latency, is the limit.
+ */
+
+static journal_t *journal;
+static atomic_bool stopping;
+
+static void *appender(void *arg) {
+  uint64_t *ops = arg;
+  unsigned char record[RECORD_BYTES];
+  memset(record, 0x5a, sizeof(record));
+  uint64_t n = 0;
+  while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+    uint64_t pos = journal_append(journal, 1, record, sizeof(record));
+    if (pos == 0 || !journal_wait(journal, pos)) {
+      break;
+    }
+    n++;
+  }
+  *ops = n;
+  return NULL;
+}
+
+static bool ignore(uint16_t type, const void *payload, size_t len, void *ctx) {
+  (void)type;
+  (void)payload;
+  (void)len;
+  (void)ctx;
+  return true;
+}
+
+static bool nothing_to_sync(void *ctx) {
+  (void)ctx;
+  return true;
+}
+
+int bench_journal(int argc, char **argv) {
+  static const char *default_threads[] = { "1", "2", "4", "8", "16", "64", "256" };
+  const char **counts = (const char **)argv;
+  int num_counts = argc;
+  if (argc == 0) {
+    counts = default_threads;
+    num_counts = sizeof(default_threads) / sizeof(default_threads[0]);
+  }
+
+  bench_quiet();
+  unlink(JOURNAL_FILE);
+  journal = journal_open(JOURNAL_FILE, ignore, NULL, NULL);
+  if (!journal) {
+    bench_report("can't open %s\n", JOURNAL_FILE);
+    return 1;
+  }
+  bench_report("%d-byte records, each appended and waited for\n", RECORD_BYTES);
+  bench_report("%8s %16s %12s %16s\n", "threads", "records/s", "syncs/s", "records/sync");
+  for (int c = 0; c < num_counts; c++) {
+    size_t threads = bench_parse_count(counts[c]);
+    if (threads == 0 || threads > MAX_THREADS) {
+      bench_report("invalid thread count '%s'\n", counts[c]);
+      journal_close(journal);
+      return 1;
+    }
+    pthread_t tids[MAX_THREADS];
+    uint64_t ops[MAX_THREADS];
+    uint64_t syncs0, syncs1;
+    journal_checkpoint(journal, nothing_to_sync, NULL);
+    journal_stats(journal, NULL, &syncs0);
+    atomic_store(&stopping, false);
+    uint64_t t0 = bench_now_ns();
+    for (size_t t = 0; t < threads; t++) {
+      pthread_create(&tids[t], NULL, appender, &ops[t]);
+    }
+    struct timespec pause = { .tv_sec = RUN_NS / 1000000000ULL, .tv_nsec = RUN_NS % 1000000000ULL };
+    nanosleep(&pause, NULL);
+    atomic_store(&stopping, true);
+    uint64_t total = 0;
+    for (size_t t = 0; t < threads; t++) {
+      pthread_join(tids[t], NULL);
+      total += ops[t];
+    }
+    double secs = (double)(bench_now_ns() - t0) / 1e9;
+    journal_stats(journal, NULL, &syncs1);
+    uint64_t syncs = syncs1 - syncs0;
+    bench_report("%8zu %16.0f %12.0f %16.1f\n", threads, (double)total / secs,
+                 (double)syncs / secs, syncs ? (double)total / (double)syncs : 0.0);
+  }
+  journal_close(journal);
+  unlink(JOURNAL_FILE);
+  return 0;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/account_internal.h"
+#include "../src/db.h"
+#include "../src/hashprofile.h"
+#include "../src/login.h"
+#include "../src/login_batch.h"
+#include "../src/ratelimit.h"
+#include "../src/store.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACCOUNTS 100000
+#define LOGINS 20000
+#define MAX_BATCH 1024
+#define QUERY_LEN 24
+#define PASSWORD "BenchP@ss123"
+
+/*
+ * Measures the cost per login of handle_login() called once per login
+ * against handle_login_batch() with batches of the given sizes, over
+ * ACCOUNTS accounts picked at random. Hashes are made with the
+ * cheapest Argon2 settings (8 KiB, one pass), so that what is measured
+ * is mostly everything around the hash: lookups, clock reads, counter
+ * updates and the client and log writes. "unknown" logins name
+ * accounts that don't exist and stop after the lookup; "success" logins
+ * go all the way through, one password check each.
+ */
+
+static int devnull = -1;
+
+static double run(const char (*userids)[QUERY_LEN], size_t batch) {
+  static login_request_t requests[MAX_BATCH];
+  static login_outcome_t outcomes[MAX_BATCH];
+  login_session_data_t session;
+  uint64_t t0 = bench_now_ns();
+  if (batch == 0) {
+    for (size_t i = 0; i < LOGINS; i++) {
+      handle_login(userids[i], PASSWORD, (ip4_addr_t)i, time(NULL), devnull, devnull, &session);
+    }
+  } else {
+    for (size_t base = 0; base < LOGINS; base += batch) {
+      size_t n = LOGINS - base < batch ? LOGINS - base : batch;
+      for (size_t i = 0; i < n; i++) {
+        requests[i] = (login_request_t){ userids[base + i], PASSWORD,
+                                         (ip4_addr_t)(base + i), time(NULL), devnull };
+      }
+      handle_login_batch(requests, outcomes, n, devnull);
+    }
+  }
+  return (double)(bench_now_ns() - t0) / LOGINS;
+}
+
+int bench_loginbatch(int argc, char **argv) {
+  static const char *default_batches[] = { "1", "16", "64", "256" };
+  const char **sizes = (const char **)argv;
+  int num_sizes = argc;
+  if (argc == 0) {
+    sizes = default_batches;
+    num_sizes = sizeof(default_batches) / sizeof(default_batches[0]);
+  }
+
+  bench_quiet();
+  hash_profile_t cheap = { .t_cost = 1, .m_cost = 8, .parallelism = 1 };
+  ratelimit_config_t unlimited = { 0, 0, 0 };
+  char (*known)[QUERY_LEN] = malloc(LOGINS * sizeof(*known));
+  char (*unknown)[QUERY_LEN] = malloc(LOGINS * sizeof(*unknown));
+  account_t *accs = calloc(ACCOUNTS, sizeof(account_t));
+  devnull = open("/dev/null", O_WRONLY);
+  if (!known || !unknown || !accs || devnull < 0 || !hash_profile_set(&cheap)) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  ratelimit_configure(&unlimited);
+
+  // Every account gets the same hash; only the lookups need to differ.
+  char hash[HASH_LENGTH];
+  if (!account_hash_password(PASSWORD, hash)) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  store_close();
+  for (size_t i = 0; i < ACCOUNTS; i++) {
+    bench_userid(accs[i].userid, sizeof(accs[i].userid), i);
+    memcpy(accs[i].password_hash, hash, HASH_LENGTH);
+    memcpy(accs[i].birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+  }
+  store_add_batch(accs, ACCOUNTS);
+  srand(12345);
+  for (size_t i = 0; i < LOGINS; i++) {
+    bench_userid(known[i], QUERY_LEN, (size_t)rand() % ACCOUNTS);
+    bench_userid(unknown[i], QUERY_LEN, ACCOUNTS + (size_t)rand() % ACCOUNTS);
+  }
+
+  bench_report("%d accounts, %d logins per run, hashes m=8,t=1\n", ACCOUNTS, LOGINS);
+  bench_report("%10s %18s %18s\n", "batch", "unknown ns/login", "success ns/login");
+  for (int s = 0; s < num_sizes; s++) {
+    size_t batch = bench_parse_count(sizes[s]);
+    if (batch == 0 || batch > MAX_BATCH) {
+      bench_report("invalid batch size '%s'\n", sizes[s]);
+      return 1;
+    }
+    // Batches of 1 are handle_login() itself.
+    size_t arg = batch == 1 ? 0 : batch;
+    double miss = run((const char (*)[QUERY_LEN])unknown, arg);
+    double hit = run((const char (*)[QUERY_LEN])known, arg);
+    bench_report("%10s %18.0f %18.0f\n", batch == 1 ? "single" : sizes[s], miss, hit);
+  }
+
+  store_close();
+  ratelimit_reset();
+  close(devnull);
+  free(known);
+  free(unknown);
+  free(accs);
+  return 0;
+}
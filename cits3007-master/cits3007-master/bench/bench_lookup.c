@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/db.h"
+#include "../src/store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define QUERY_LEN 24
+#define NUM_QUERIES 1000000
+
+/*
+ * Measures account_lookup_by_userid (hits and misses) and
+ * add_account_to_db as the store grows. With the hashed index both
+ * should stay roughly flat in the number of accounts.
+ */
+int bench_lookup(int argc, char **argv) {
+  static const char *default_sizes[] = { "1k", "10k", "100k", "1M", "10M" };
+  const char **sizes = (const char **)argv;
+  int num_sizes = argc;
+  if (argc == 0) {
+    sizes = default_sizes;
+    num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+  }
+
+  char (*queries)[QUERY_LEN] = malloc(NUM_QUERIES * sizeof(*queries));
+  if (!queries) {
+    return 1;
+  }
+
+  bench_quiet();
+  bench_report("%12s %14s %14s %14s\n", "accounts", "insert ns/op", "hit ns/op", "miss ns/op");
+
+  srand(12345);
+  for (int s = 0; s < num_sizes; s++) {
+    size_t n = bench_parse_count(sizes[s]);
+    if (n == 0) {
+      bench_report("invalid count '%s'\n", sizes[s]);
+      free(queries);
+      return 1;
+    }
+    store_close();
+
+    account_t acc;
+    memset(&acc, 0, sizeof(acc));
+    memcpy(acc.birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+    uint64_t t0 = bench_now_ns();
+    for (size_t i = 0; i < n; i++) {
+      bench_userid(acc.userid, sizeof(acc.userid), i);
+      if (!add_account_to_db(&acc)) {
+        bench_report("insert failed at %zu\n", i);
+        free(queries);
+        return 1;
+      }
+    }
+    uint64_t t1 = bench_now_ns();
+
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      size_t i = ((size_t)rand() * (size_t)RAND_MAX + (size_t)rand()) % n;
+      bench_userid(queries[q], QUERY_LEN, i);
+    }
+    account_t out;
+    size_t found = 0;
+    uint64_t t2 = bench_now_ns();
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      found += account_lookup_by_userid(queries[q], &out);
+    }
+    uint64_t t3 = bench_now_ns();
+
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      bench_userid(queries[q], QUERY_LEN, n + q);
+    }
+    uint64_t t4 = bench_now_ns();
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+      found += account_lookup_by_userid(queries[q], &out);
+    }
+    uint64_t t5 = bench_now_ns();
+
+    if (found != NUM_QUERIES) {
+      bench_report("lookup mismatch: %zu of %d found\n", found, NUM_QUERIES);
+      free(queries);
+      return 1;
+    }
+    bench_report("%12zu %14.1f %14.1f %14.1f\n", n,
+                 (double)(t1 - t0) / (double)n,
+                 (double)(t3 - t2) / NUM_QUERIES,
+                 (double)(t5 - t4) / NUM_QUERIES);
+  }
+  store_close();
+  free(queries);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/ratelimit.h"
+
+#define CHECKS 10000000ULL
+#define BASE_TIME 1699999980
+
+/*
+ * Measures ratelimit_admit() calls per second when attempts come from
+ * a given number of distinct addresses, spread over the whole IPv4
+ * space. With few addresses every check hits a warm entry and most are
+ * shed; with millions the tables are far too small to hold them all,
+ * and entries are evicted to make room. Memory use is the same either
+ * way. The clock advances one second per million checks, so counts
+ * also roll over between windows.
+ */
+
+static double run(size_t addresses, double *shed, uint64_t *evicted) {
+  ratelimit_reset();
+  uint64_t x = 88172645463325252ULL;
+  uint64_t t0 = bench_now_ns();
+  for (uint64_t i = 0; i < CHECKS; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    // spread the chosen address index over the space with an odd multiplier
+    uint32_t ip = (uint32_t)((x % addresses) * 2654435761u);
+    ratelimit_admit(ip, BASE_TIME + (time_t)(i / 1000000));
+  }
+  uint64_t elapsed = bench_now_ns() - t0;
+  ratelimit_stats_t stats;
+  ratelimit_stats(&stats);
+  *shed = (double)(stats.shed_ip + stats.shed_subnet) / CHECKS;
+  *evicted = stats.evicted;
+  return (double)CHECKS / ((double)elapsed / 1e9);
+}
+
+int bench_ratelimit(int argc, char **argv) {
+  static const char *default_addresses[] = { "1k", "100k", "1M", "10M" };
+  const char **counts = (const char **)argv;
+  int num_counts = argc;
+  if (argc == 0) {
+    counts = default_addresses;
+    num_counts = sizeof(default_addresses) / sizeof(default_addresses[0]);
+  }
+
+  bench_quiet();
+  ratelimit_config_t config = ratelimit_config();
+  bench_report("%llu checks, limits %u/address and %u/24 per %us, %u entries per table\n",
+               CHECKS, config.ip_limit, config.subnet_limit, config.window_seconds,
+               RATELIMIT_SLOTS);
+  bench_report("%10s %14s %8s %10s\n", "addresses", "checks/s", "shed", "evicted");
+  for (int c = 0; c < num_counts; c++) {
+    size_t addresses = bench_parse_count(counts[c]);
+    if (addresses == 0) {
+      bench_report("invalid address count '%s'\n", counts[c]);
+      return 1;
+    }
+    double shed;
+    uint64_t evicted;
+    double rate = run(addresses, &shed, &evicted);
+    bench_report("%10zu %14.0f %7.1f%% %10llu\n", addresses, rate, shed * 100,
+                 (unsigned long long)evicted);
+  }
+  ratelimit_reset();
+  return 0;
+}
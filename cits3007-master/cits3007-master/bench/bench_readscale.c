@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/db.h"
+#include "../src/store.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_ACCOUNTS 1000000
+#define MAX_THREADS 64
+#define RUN_NS 1000000000ULL
+
+/*
+ * Measures lookup throughput (store_acquire + store_read_auth +
+ * store_release on random accounts) as the number of reader threads
+ * grows, while one writer thread keeps recording logins against random
+ * accounts and inserting new ones. Lookups take no locks, so they
+ * should scale with the number of cores until memory bandwidth runs
+ * out; the writer should make no difference to them.
+ */
+
+static atomic_bool running;
+static atomic_bool stopping;
+
+static void *reader(void *arg) {
+  uint64_t *ops = arg;
+  unsigned seed = (unsigned)*ops;
+  char userid[USER_ID_LENGTH];
+  account_auth_t state;
+  while (!atomic_load_explicit(&running, memory_order_acquire)) {
+  }
+  uint64_t n = 0;
+  while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+    bench_userid(userid, sizeof(userid), (size_t)rand_r(&seed) % NUM_ACCOUNTS);
+    const account_auth_t *rec = store_acquire(userid);
+    if (rec) {
+      store_read_auth(rec, &state);
+      store_release(rec);
+      n++;
+    }
+  }
+  *ops = n;
+  return NULL;
+}
+
+static void *writer(void *arg) {
+  uint64_t *ops = arg;
+  unsigned seed = 1;
+  char userid[USER_ID_LENGTH];
+  account_t acc;
+  memset(&acc, 0, sizeof(acc));
+  memcpy(acc.birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+  uint64_t n = 0;
+  size_t next = NUM_ACCOUNTS;
+  while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+    bench_userid(userid, sizeof(userid), (size_t)rand_r(&seed) % NUM_ACCOUNTS);
+    const account_auth_t *rec = store_acquire(userid);
+    store_record_login_success(rec, 0x7F000001);
+    store_release(rec);
+    if (n % 16 == 0) {
+      bench_userid(acc.userid, sizeof(acc.userid), next++);
+      add_account_to_db(&acc);
+    }
+    n++;
+  }
+  *ops = n;
+  return NULL;
+}
+
+int bench_readscale(int argc, char **argv) {
+  static const char *default_threads[] = { "1", "2", "4", "8", "16", "32" };
+  const char **counts = (const char **)argv;
+  int num_counts = argc;
+  if (argc == 0) {
+    counts = default_threads;
+    num_counts = sizeof(default_threads) / sizeof(default_threads[0]);
+  }
+
+  bench_quiet();
+  account_t acc;
+  memset(&acc, 0, sizeof(acc));
+  memcpy(acc.birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+  for (size_t i = 0; i < NUM_ACCOUNTS; i++) {
+    bench_userid(acc.userid, sizeof(acc.userid), i);
+    if (!add_account_to_db(&acc)) {
+      bench_report("insert failed at %zu\n", i);
+      return 1;
+    }
+  }
+
+  bench_report("%d accounts, one writer thread recording logins and inserting\n", NUM_ACCOUNTS);
+  bench_report("%8s %16s %16s %10s %14s\n", "readers", "lookups/s", "per thread", "scaling", "writes/s");
+  double base = 0;
+  for (int c = 0; c < num_counts; c++) {
+    size_t threads = bench_parse_count(counts[c]);
+    if (threads == 0 || threads > MAX_THREADS) {
+      bench_report("invalid thread count '%s'\n", counts[c]);
+      return 1;
+    }
+    pthread_t tids[MAX_THREADS], wtid;
+    uint64_t ops[MAX_THREADS], wops = 0;
+    atomic_store(&running, false);
+    atomic_store(&stopping, false);
+    for (size_t t = 0; t < threads; t++) {
+      ops[t] = t + 1;  // also the reader's seed
+      pthread_create(&tids[t], NULL, reader, &ops[t]);
+    }
+    pthread_create(&wtid, NULL, writer, &wops);
+
+    uint64_t t0 = bench_now_ns();
+    atomic_store_explicit(&running, true, memory_order_release);
+    struct timespec pause = { .tv_sec = RUN_NS / 1000000000ULL, .tv_nsec = RUN_NS % 1000000000ULL };
+    nanosleep(&pause, NULL);
+    atomic_store(&stopping, true);
+    uint64_t total = 0;
+    for (size_t t = 0; t < threads; t++) {
+      pthread_join(tids[t], NULL);
+      total += ops[t];
+    }
+    pthread_join(wtid, NULL);
+    double secs = (double)(bench_now_ns() - t0) / 1e9;
+
+    double rate = (double)total / secs;
+    if (c == 0) {
+      base = rate / (double)threads;
+    }
+    bench_report("%8zu %16.0f %16.0f %9.2fx %14.0f\n", threads, rate, rate / (double)threads,
+                 rate / base, (double)wops / secs);
+  }
+  store_close();
+  return 0;
+}
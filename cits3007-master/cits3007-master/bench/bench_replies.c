@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/account_internal.h"
+#include "../src/db.h"
+#include "../src/hashprofile.h"
+#include "../src/login.h"
+#include "../src/ratelimit.h"
+#include "../src/store.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ACCOUNTS 1000
+#define DEFAULT_LOGINS 50000
+#define PASSWORD "BenchP@ss123"
+
+/*
+ * Time per handle_login() call for each outcome, replies and log
+ * lines going to /dev/null: what it costs to decide the outcome and
+ * tell the client and the log about it. Only "success" hashes (with the
+ * cheapest Argon2 settings); "bad password" logs in to accounts already
+ * past the failure limit, which are refused without hashing. The
+ * accounts of each kind are distinct ranges of bench_userid() indexes.
+ */
+
+enum {
+  GOOD = 0,                 // index ranges of each kind of account
+  LOCKED = ACCOUNTS,
+  BANNED = 2 * ACCOUNTS,
+  EXPIRED = 3 * ACCOUNTS,
+  UNKNOWN = 4 * ACCOUNTS,   // not stored
+  STORED = 4 * ACCOUNTS
+};
+
+typedef struct {
+  const char *name;
+  login_result_t expect;
+  size_t base;              // index of the first account used
+  const char *password;     // NULL: leave the password out
+  bool rate_limited;        // from an address over its limit
+} outcome_t;
+
+static int devnull = -1;
+static ip4_addr_t next_ip = 0x0B000000;
+
+static double run(const outcome_t *o, size_t logins, size_t *mismatched) {
+  char userid[USER_ID_LENGTH];
+  login_session_data_t session;
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < logins; i++) {
+    bench_userid(userid, sizeof(userid), o->base + i % ACCOUNTS);
+    // Limited logins all come from one address; the others each from
+    // a new one, so the limit never applies to them.
+    ip4_addr_t ip = o->rate_limited ? 0x0A000001 : next_ip++;
+    login_result_t result = handle_login(userid, o->password, ip, time(NULL),
+                                         devnull, devnull, &session);
+    *mismatched += result != o->expect;
+  }
+  return (double)(bench_now_ns() - t0) / (double)logins;
+}
+
+int bench_replies(int argc, char **argv) {
+  size_t logins = argc > 0 ? bench_parse_count(argv[0]) : DEFAULT_LOGINS;
+  if (logins == 0) {
+    bench_report("invalid login count '%s'\n", argv[0]);
+    return 1;
+  }
+
+  bench_quiet();
+  hash_profile_t cheap = { .t_cost = 1, .m_cost = 8, .parallelism = 1 };
+  account_t *accs = calloc(STORED, sizeof(account_t));
+  devnull = open("/dev/null", O_WRONLY);
+  char hash[HASH_LENGTH];
+  if (!accs || devnull < 0 || !hash_profile_set(&cheap) || !account_hash_password(PASSWORD, hash)) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  time_t now = time(NULL);
+  store_close();
+  for (size_t i = 0; i < STORED; i++) {
+    bench_userid(accs[i].userid, sizeof(accs[i].userid), i);
+    memcpy(accs[i].password_hash, hash, HASH_LENGTH);
+    memcpy(accs[i].birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+    if (i >= LOCKED && i < BANNED) {
+      accs[i].login_fail_count = 1000;
+    } else if (i >= BANNED && i < EXPIRED) {
+      accs[i].unban_time = now + 24 * 60 * 60;
+    } else if (i >= EXPIRED) {
+      accs[i].expiration_time = now - 1;
+    }
+  }
+  store_add_batch(accs, STORED);
+
+  const outcome_t outcomes[] = {
+    { "success", LOGIN_SUCCESS, GOOD, PASSWORD, false },
+    { "user not found", LOGIN_FAIL_USER_NOT_FOUND, UNKNOWN, PASSWORD, false },
+    { "bad password", LOGIN_FAIL_BAD_PASSWORD, LOCKED, "WrongP@ss123", false },
+    { "account banned", LOGIN_FAIL_ACCOUNT_BANNED, BANNED, PASSWORD, false },
+    { "account expired", LOGIN_FAIL_ACCOUNT_EXPIRED, EXPIRED, PASSWORD, false },
+    { "rate limited", LOGIN_FAIL_IP_BANNED, GOOD, PASSWORD, true },
+    { "internal error", LOGIN_FAIL_INTERNAL_ERROR, GOOD, NULL, false },
+  };
+  ratelimit_config_t limits = { 1, 0, 3600 };
+  ratelimit_configure(&limits);
+  ratelimit_reset();
+
+  bench_report("%zu logins per outcome, hashes m=8,t=1\n", logins);
+  bench_report("%-16s %10s\n", "outcome", "ns/login");
+  int status = 0;
+  for (size_t k = 0; k < sizeof(outcomes) / sizeof(outcomes[0]); k++) {
+    size_t mismatched = 0;
+    double ns = run(&outcomes[k], logins, &mismatched);
+    // The first limited login is let through; any others are a bug.
+    if (mismatched > (outcomes[k].rate_limited ? 1u : 0u)) {
+      bench_report("%-16s %zu logins had another outcome\n", outcomes[k].name, mismatched);
+      status = 1;
+      continue;
+    }
+    bench_report("%-16s %10.0f\n", outcomes[k].name, ns);
+  }
+
+  limits = (ratelimit_config_t){ RATELIMIT_DEFAULT_IP_LIMIT, RATELIMIT_DEFAULT_SUBNET_LIMIT,
+                                 RATELIMIT_DEFAULT_WINDOW };
+  ratelimit_configure(&limits);
+  ratelimit_reset();
+  store_close();
+  close(devnull);
+  free(accs);
+  return status;
+}
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/account_internal.h"
+#include "../src/db.h"
+#include "../src/hashprofile.h"
+#include "../src/ratelimit.h"
+#include "../src/server.h"
+#include "../src/store.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define ACCOUNTS 10000
+#define LOGINS_PER_RUN 20000
+#define MAX_CLIENTS 1024
+#define PASSWORD "BenchP@ss123"
+
+/*
+ * Drives the login server (server.h) over loopback TCP end to end: each
+ * client thread has one connection and sends LOGIN requests for random
+ * accounts one after another, waiting for each reply. Reports logins
+ * per second and the latency a client sees, for each of the given
+ * numbers of concurrent clients. Hashes use the cheapest Argon2
+ * settings, so the figures are mostly the server's own overhead.
+ */
+
+typedef struct {
+  uint16_t port;
+  size_t logins;
+  unsigned seed;
+  uint64_t *latencies;
+  bool failed;
+} client_t;
+
+static void *client_main(void *arg) {
+  client_t *cl = arg;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(cl->port) };
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    cl->failed = true;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  char request[128];
+  char reply[1024];
+  char userid[USER_ID_LENGTH];
+  for (size_t i = 0; i < cl->logins && !cl->failed; i++) {
+    bench_userid(userid, sizeof(userid), (size_t)rand_r(&cl->seed) % ACCOUNTS);
+    int len = snprintf(request, sizeof(request), "LOGIN %s %s\n", userid, PASSWORD);
+    uint64_t t0 = bench_now_ns();
+    if (write(fd, request, (size_t)len) != len) {
+      cl->failed = true;
+      break;
+    }
+    // Every reply ends with its RESULT line.
+    size_t got = 0;
+    for (;;) {
+      ssize_t n = read(fd, reply + got, sizeof(reply) - 1 - got);
+      if (n <= 0) {
+        cl->failed = true;
+        break;
+      }
+      got += (size_t)n;
+      reply[got] = '\0';
+      char *result = strstr(reply, "RESULT ");
+      if (result && strchr(result, '\n')) {
+        cl->failed = strncmp(result, "RESULT 0\n", 9) != 0;
+        break;
+      }
+      if (got == sizeof(reply) - 1) {
+        cl->failed = true;
+        break;
+      }
+    }
+    cl->latencies[i] = bench_now_ns() - t0;
+  }
+  close(fd);
+  return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool run(size_t clients, uint64_t *latencies) {
+  static client_t cls[MAX_CLIENTS];
+  static pthread_t threads[MAX_CLIENTS];
+  size_t per_client = LOGINS_PER_RUN / clients;
+  size_t total = per_client * clients;
+  uint64_t t0 = bench_now_ns();
+  size_t started = 0;
+  for (; started < clients; started++) {
+    cls[started] = (client_t){ server_tcp_port(), per_client, (unsigned)(started + 1),
+                               latencies + started * per_client, false };
+    if (pthread_create(&threads[started], NULL, client_main, &cls[started]) != 0) {
+      break;
+    }
+  }
+  bool ok = started == clients;
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    ok = ok && !cls[i].failed;
+  }
+  double seconds = (double)(bench_now_ns() - t0) / 1e9;
+  if (!ok) {
+    bench_report("%10zu  run failed\n", clients);
+    return false;
+  }
+  qsort(latencies, total, sizeof(uint64_t), compare_u64);
+  bench_report("%10zu %12.0f %10.1f %10.1f %10.1f\n", clients, (double)total / seconds,
+               latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3,
+               latencies[total - 1] / 1e3);
+  return true;
+}
+
+int bench_server(int argc, char **argv) {
+  static const char *default_clients[] = { "1", "4", "16", "64" };
+  const char **counts = (const char **)argv;
+  int num_counts = argc;
+  if (argc == 0) {
+    counts = default_clients;
+    num_counts = sizeof(default_clients) / sizeof(default_clients[0]);
+  }
+
+  bench_quiet();
+  hash_profile_t cheap = { .t_cost = 1, .m_cost = 8, .parallelism = 1 };
+  ratelimit_config_t unlimited = { 0, 0, 0 };
+  account_t *accs = calloc(ACCOUNTS, sizeof(account_t));
+  uint64_t *latencies = malloc(LOGINS_PER_RUN * sizeof(uint64_t));
+  int devnull = open("/dev/null", O_WRONLY);
+  char hash[HASH_LENGTH];
+  if (!accs || !latencies || devnull < 0 || !hash_profile_set(&cheap)
+      || !account_hash_password(PASSWORD, hash)) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  ratelimit_configure(&unlimited);
+  store_close();
+  for (size_t i = 0; i < ACCOUNTS; i++) {
+    bench_userid(accs[i].userid, sizeof(accs[i].userid), i);
+    memcpy(accs[i].password_hash, hash, HASH_LENGTH);
+    memcpy(accs[i].birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+  }
+  store_add_batch(accs, ACCOUNTS);
+
+  server_config_t config = { .tcp_address = "127.0.0.1", .log_fd = devnull };
+  if (!server_start(&config)) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  bench_report("%d accounts, %d logins per run over loopback TCP, hashes m=8,t=1\n",
+               ACCOUNTS, LOGINS_PER_RUN);
+  bench_report("%10s %12s %10s %10s %10s\n", "clients", "logins/s", "p50 us", "p99 us", "max us");
+  int status = 0;
+  for (int c = 0; c < num_counts && status == 0; c++) {
+    size_t clients = bench_parse_count(counts[c]);
+    if (clients == 0 || clients > MAX_CLIENTS) {
+      bench_report("invalid client count '%s'\n", counts[c]);
+      status = 1;
+    } else if (!run(clients, latencies)) {
+      status = 1;
+    }
+  }
+
+  server_stop();
+  store_close();
+  ratelimit_reset();
+  close(devnull);
+  free(accs);
+  free(latencies);
+  return status;
+}
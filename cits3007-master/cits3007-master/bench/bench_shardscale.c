@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/db.h"
+#include "../src/store.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_ACCOUNTS 400000
+#define NUM_LOOKUPS 2000000
+#define MAX_THREADS 64
+
+/*
+ * Measures insert and lookup throughput against the number of shards
+ * the store is split into, for 1 to 16 threads. Each step starts from
+ * an empty in-memory store; the threads first insert NUM_ACCOUNTS
+ * accounts between them (disjoint userids), then look up random ones.
+ *
+ * With one shard every insert goes through the same writer lock, and
+ * index rebuilds stall all writers at once; with more shards inserts
+ * only contend when they land in the same shard, and each rebuild is
+ * a fraction of the size. Lookups take no locks either way, so they
+ * should be unaffected by the shard count.
+ */
+
+typedef struct {
+  size_t first;
+  size_t count;
+  unsigned seed;
+  size_t failed;
+} worker_t;
+
+static atomic_bool running;
+
+static void *inserter(void *arg) {
+  worker_t *w = arg;
+  account_t acc;
+  memset(&acc, 0, sizeof(acc));
+  memcpy(acc.birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+  while (!atomic_load_explicit(&running, memory_order_acquire)) {
+  }
+  for (size_t i = w->first; i < w->first + w->count; i++) {
+    bench_userid(acc.userid, sizeof(acc.userid), i);
+    w->failed += !add_account_to_db(&acc);
+  }
+  return NULL;
+}
+
+static void *looker(void *arg) {
+  worker_t *w = arg;
+  char userid[USER_ID_LENGTH];
+  account_auth_t state;
+  while (!atomic_load_explicit(&running, memory_order_acquire)) {
+  }
+  for (size_t i = 0; i < w->count; i++) {
+    bench_userid(userid, sizeof(userid), (size_t)rand_r(&w->seed) % NUM_ACCOUNTS);
+    const account_auth_t *rec = store_acquire(userid);
+    w->failed += rec == NULL;
+    if (rec) {
+      store_read_auth(rec, &state);
+      store_release(rec);
+    }
+  }
+  return NULL;
+}
+
+/* Run fn on `threads` threads over `total` items; returns items/sec. */
+static double run(void *(*fn)(void *), size_t threads, size_t total, size_t *failed) {
+  pthread_t tids[MAX_THREADS];
+  worker_t workers[MAX_THREADS];
+  atomic_store(&running, false);
+  for (size_t t = 0; t < threads; t++) {
+    workers[t].first = total * t / threads;
+    workers[t].count = total * (t + 1) / threads - workers[t].first;
+    workers[t].seed = (unsigned)t + 1;
+    workers[t].failed = 0;
+    pthread_create(&tids[t], NULL, fn, &workers[t]);
+  }
+  uint64_t t0 = bench_now_ns();
+  atomic_store_explicit(&running, true, memory_order_release);
+  for (size_t t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+    *failed += workers[t].failed;
+  }
+  return (double)total / ((double)(bench_now_ns() - t0) / 1e9);
+}
+
+int bench_shardscale(int argc, char **argv) {
+  static const char *default_shards[] = { "1", "4", "16" };
+  static const size_t thread_counts[] = { 1, 2, 4, 8, 16 };
+  const char **counts = (const char **)argv;
+  int num_counts = argc;
+  if (argc == 0) {
+    counts = default_shards;
+    num_counts = sizeof(default_shards) / sizeof(default_shards[0]);
+  }
+
+  bench_quiet();
+  bench_report("%d inserts, then %d random lookups, per step\n", NUM_ACCOUNTS, NUM_LOOKUPS);
+  bench_report("%8s %8s %16s %16s\n", "shards", "threads", "inserts/s", "lookups/s");
+  for (int c = 0; c < num_counts; c++) {
+    size_t shards = bench_parse_count(counts[c]);
+    if (shards == 0 || shards > STORE_MAX_SHARDS) {
+      bench_report("invalid shard count '%s'\n", counts[c]);
+      return 1;
+    }
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+      size_t threads = thread_counts[i];
+      store_close();
+      if (!store_configure_shards(shards)) {
+        return 1;
+      }
+      size_t failed = 0;
+      double inserts = run(inserter, threads, NUM_ACCOUNTS, &failed);
+      double lookups = run(looker, threads, NUM_LOOKUPS, &failed);
+      if (failed != 0) {
+        bench_report("%zu operations failed\n", failed);
+        return 1;
+      }
+      bench_report("%8zu %8zu %16.0f %16.0f\n", shards, threads, inserts, lookups);
+    }
+  }
+  store_close();
+  store_configure_shards(1);
+  return 0;
+}
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../src/timerwheel.h"
+#include "../src/wallclock.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_TIMERS 1000000
+#define CLOCK_READS 10000000
+#define HORIZON 3600          // deadlines fall within this many seconds
+
+/*
+ * Two halves of the deadline machinery. First, the time per read of
+ * the time of day: time(), clock_gettime() with CLOCK_REALTIME and
+ * CLOCK_REALTIME_COARSE, and wallclock_now() with and without the
+ * ticker. Second, keeping track of a number of deadlines (as sessions
+ * do) spread over an hour: the time per add and per cancel on a timer
+ * wheel, and the time per second of moving the wheel on, against that
+ * of sweeping through every deadline each second as session_expire()
+ * does.
+ */
+
+typedef struct {
+  wheel_timer_t timer;
+  time_t expires;
+} deadline_t;
+
+static volatile time_t sink;
+
+static time_t read_time(void) {
+  return time(NULL);
+}
+
+static time_t read_realtime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec;
+}
+
+static time_t read_coarse(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return ts.tv_sec;
+}
+
+static void clock_row(const char *name, time_t (*read)(void)) {
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < CLOCK_READS; i++) {
+    sink = read();
+  }
+  bench_report("%-28s %10.2f\n", name, (double)(bench_now_ns() - t0) / CLOCK_READS);
+}
+
+static void expired(wheel_timer_t *timer, void *arg) {
+  (void)timer;
+  (*(size_t *)arg)++;
+}
+
+int bench_timerwheel(int argc, char **argv) {
+  size_t n = argc > 0 ? bench_parse_count(argv[0]) : DEFAULT_TIMERS;
+  if (n == 0) {
+    bench_report("invalid timer count '%s'\n", argv[0]);
+    return 1;
+  }
+
+  bench_report("%-28s %10s\n", "clock read", "ns/read");
+  clock_row("time()", read_time);
+  clock_row("CLOCK_REALTIME", read_realtime);
+  clock_row("CLOCK_REALTIME_COARSE", read_coarse);
+  clock_row("wallclock_now(), no ticker", wallclock_now);
+  if (wallclock_start()) {
+    clock_row("wallclock_now(), ticker", wallclock_now);
+    wallclock_stop();
+  }
+
+  deadline_t *deadlines = calloc(n, sizeof(deadline_t));
+  timerwheel_t *wheel = malloc(sizeof(timerwheel_t));
+  if (!deadlines || !wheel) {
+    bench_report("setup failed\n");
+    return 1;
+  }
+  time_t start = 1700000000;
+  srand(1);
+  for (size_t i = 0; i < n; i++) {
+    deadlines[i].expires = start + 1 + rand() % HORIZON;
+  }
+
+  timerwheel_init(wheel, start);
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < n; i++) {
+    timerwheel_add(wheel, &deadlines[i].timer, deadlines[i].expires);
+  }
+  double add_ns = (double)(bench_now_ns() - t0) / (double)n;
+  // Cancel every other one, as logouts would.
+  t0 = bench_now_ns();
+  for (size_t i = 0; i < n; i += 2) {
+    timerwheel_cancel(wheel, &deadlines[i].timer);
+  }
+  double cancel_ns = (double)(bench_now_ns() - t0) / (double)((n + 1) / 2);
+  size_t fired = 0;
+  t0 = bench_now_ns();
+  for (time_t t = start + 1; t <= start + HORIZON; t++) {
+    timerwheel_advance(wheel, t, expired, &fired);
+  }
+  double advance_ns = (double)(bench_now_ns() - t0) / HORIZON;
+
+  // The same hour by sweeping: look at every deadline each second.
+  size_t swept = 0;
+  t0 = bench_now_ns();
+  for (time_t t = start + 1; t <= start + HORIZON; t++) {
+    for (size_t i = 1; i < n; i += 2) {
+      if (deadlines[i].expires == t) {
+        swept++;
+      }
+    }
+  }
+  double sweep_ns = (double)(bench_now_ns() - t0) / HORIZON;
+
+  bench_report("\n%zu deadlines over %d seconds, half cancelled\n", n, HORIZON);
+  bench_report("%-28s %10.1f\n", "wheel add ns/timer", add_ns);
+  bench_report("%-28s %10.1f\n", "wheel cancel ns/timer", cancel_ns);
+  bench_report("%-28s %10.0f\n", "wheel advance ns/second", advance_ns);
+  bench_report("%-28s %10.0f\n", "sweep ns/second", sweep_ns);
+  int status = 0;
+  if (fired != swept || fired != n / 2) {
+    bench_report("wheel expired %zu deadlines, expected %zu\n", fired, swept);
+    status = 1;
+  }
+  free(wheel);
+  free(deadlines);
+  return status;
+}
@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Build and run the micro-benchmarks in bench/.
+# Like test.sh, this builds outside the Makefile: every .c file in src
+# except the application main is linked with the benchmark driver.
+
+usage() {
+    echo "Usage: $0 <benchmark> [args...]"
+    echo "Run '$0 --list' to list the available benchmarks."
+    echo "Set BENCH_CFLAGS to override the optimisation flags (default: -O2 -g)."
+    echo "Set ARGON2=bundled to use the vendored Argon2 (see vendor/README.md)."
+    exit 1
+}
+
+if [ $# -eq 0 ]; then
+    usage
+fi
+
+BENCH_CFLAGS=${BENCH_CFLAGS:--O2 -g}
+PKG_DEPS=$(grep -v "^#" libraries.txt | grep -v "^check$" | xargs)
+ARGON2_FLAGS=
+if [ "$ARGON2" = "bundled" ]; then
+    make argon2 || exit 1
+    PKG_DEPS=$(echo $PKG_DEPS | tr ' ' '\n' | grep -v "^libargon2$" | xargs)
+    ARGON2_DIR=${ARGON2_DIR:-vendor/phc-winner-argon2}
+    ARGON2_FLAGS="-DHASH_CORE_BUNDLED -I$ARGON2_DIR/include -I$ARGON2_DIR/src"
+    ARGON2_LINK=build/argon2/libargon2-bundled.a
+fi
+if [ -n "$PKG_DEPS" ]; then
+    PKG_CFLAGS=$(pkg-config --cflags $PKG_DEPS)
+    PKG_LIBS=$(pkg-config --libs $PKG_DEPS)
+fi
+
+mkdir -p bin
+gcc -o bin/bench \
+    $(find src -name "*.c" ! -name "alternate_main.c") \
+    bench/*.c \
+    -Isrc \
+    $ARGON2_FLAGS \
+    $PKG_CFLAGS \
+    $BENCH_CFLAGS \
+    -std=c11 -pedantic-errors -Wall -Wextra \
+    $ARGON2_LINK \
+    $PKG_LIBS \
+    -pthread -lm
+
+if [ $? -ne 0 ]; then
+    echo "Failed to compile benchmarks!"
+    exit 1
+fi
+
+if [ "$1" = "--list" ]; then
+    ./bin/bench
+    exit 0
+fi
+
+./bin/bench "$@"
@@ -1,11 +1,22 @@
 #define _GNU_SOURCE
 #include "account.h"
+#include "account_internal.h"
+#include "csprng.h"
+#include "db.h"
+#include "hasharena.h"
+#include "hashbudget.h"
+#include "hashcore.h"
+#include "hashpool.h"
+#include "hashprofile.h"
 #include "logging.h"
+#include "rehash.h"
+#include "session.h"
+#include "store.h"
+#include "wallclock.h"
 #include <argon2.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <ctype.h>
 #include <time.h>
 #include <stdio.h>
@@ -23,48 +34,7 @@
 
 static bool validate_email(const char *email);
 static bool is_password_strong(const char *password);
-static bool generate_secure_random(unsigned char *buffer, size_t length);
-static bool is_account_rate_limited(const account_t *acc);
-
-#define MAX_ACCOUNTS 10000
-
-static account_t dummy_db[MAX_ACCOUNTS];
-static int num_accounts = 0;
-
-bool add_account_to_db(const account_t *acc) {
-    if (!acc || num_accounts >= MAX_ACCOUNTS) {
-        log_message(LOG_ERROR, "db_add_account: Can't add account to database");
-        return false;
-    }
-
-    for (int i = 0; i < num_accounts; i++) {
-        if (strncmp(dummy_db[i].userid, acc->userid, USER_ID_LENGTH) == 0) {
-            log_message(LOG_WARN, "db_add_account: User ID %s has already been used", acc->userid);
-            return false;
-        }
-    }
-    dummy_db[num_accounts] = *acc;
-    num_accounts++;
-    return true;
-}
-
-bool account_lookup_by_userid(const char *userid, account_t *acc) {
-    if (userid == NULL || acc == NULL) {
-        log_message(LOG_ERROR, "account_lookup_by_userid: NULL argument(s)");
-        return false;
-    }
-
-    for (int i = 0; i < num_accounts; ++i) {
-        if (strncmp(dummy_db[i].userid, userid, USER_ID_LENGTH) == 0) {
-            *acc = dummy_db[i];  // Safe because it's a struct copy
-            log_message(LOG_INFO, "User '%s' found in database", userid);
-            return true;
-        }
-    }
-
-    log_message(LOG_WARN, "User '%s' not found", userid);
-    return false;
-}
+static bool is_account_rate_limited(unsigned int login_fail_count);
 
 bool account_validate_birthday(const char *birthday) {
   //YYYY-MM-DD
@@ -120,108 +90,290 @@ bool account_validate_birthday(const char *birthday) {
   return true;
 }
 
-account_t *account_create(const char *userid, const char *plaintext_password,
-                          const char *email, const char *birthdate
-                      )
+/**
+ * Check the fields of a prospective new account.
+ *
+ * Returns NULL if they are acceptable, or a short description of the
+ * first problem found.
+ */
+const char *account_check_new(const char *userid, const char *plaintext_password,
+                              const char *email, const char *birthdate)
 {
   if (userid[0] == '\0') {
-    log_message(LOG_ERROR, "account_create: Must input a user ID");
-    return NULL;
+    return "Must input a user ID";
   }
   for (size_t i = 0; i < strlen(userid); i++) {
     if (userid[i] == ' ' || !isprint((unsigned char)userid[i])) {
-      log_message(LOG_ERROR, "account_create: User ID has invalid characters");
-    return NULL;
+      return "User ID has invalid characters";
     }
   }
   // validate email
   if (strlen(email) >= EMAIL_LENGTH) {
-    log_message(LOG_ERROR,"account_create: Invalid email error");
-    return NULL;
+    return "Invalid email error";
   }
   for (size_t i = 0; i < strlen(email); i++) {
     if (email[i] == ' ' || !isprint((unsigned char)email[i])) {
-      log_message(LOG_ERROR,"account_create: Invalid email error");
-      return NULL;
+      return "Invalid email error";
     }
   }
 
   //validate birthday
   if (!account_validate_birthday(birthdate)) {
-    log_message(LOG_ERROR,"account_create: Invalid birthday error");
-    return NULL;
+    return "Invalid birthday error";
   }
 
   if (strlen(userid) >= USER_ID_LENGTH) {
-    log_message(LOG_ERROR, "account_create: User ID too long");
-    return NULL;
+    return "User ID too long";
   }
-  
+
   if (!is_password_strong(plaintext_password)) {
-    log_message(LOG_ERROR, "account_create: Password is not strong enough");
-    return NULL;
-  }
-  // try to allocate memory for the account
-  account_t *account = malloc(sizeof(account_t));
-  if (!account) {
-    log_message(LOG_ERROR,"account_create: Failed to allocate memory");
-    return NULL;
+    return "Password is not strong enough";
   }
+  return NULL;
+}
+
+/**
+ * Fill in a new account record from already-checked fields. The
+ * password hash is left empty and all other fields get their defaults.
+ */
+void account_init_new(account_t *account, const char *userid,
+                      const char *email, const char *birthdate)
+{
   memset(account, 0, sizeof(account_t));
 
   strncpy(account->userid, userid, USER_ID_LENGTH - 1);
   account->userid[USER_ID_LENGTH - 1] = '\0';
-  strncpy(account->birthdate, birthdate, BIRTHDATE_LENGTH - 1);
-  account->birthdate[BIRTHDATE_LENGTH - 1] = '\0';
+  // birthdate is exactly BIRTHDATE_LENGTH chars and not null-terminated
+  memcpy(account->birthdate, birthdate, BIRTHDATE_LENGTH);
   strncpy(account->email, email, EMAIL_LENGTH - 1);
   account->email[EMAIL_LENGTH - 1] = '\0';
 
-  // PASSWORD HASHING
-  uint32_t t_cost = 3;        //iterations 
-  uint32_t m_cost = 1 << 16;  // 64 MiB memory cost
-  uint32_t parallelism = 1;   // threads
-  unsigned char salt[16];
-  if (!generate_secure_random(salt, sizeof(salt))) {
+  account->unban_time = 0;                // Ban the account up until this time (0 = no ban)
+  account->expiration_time = 0;           // Account is only valid until this time (0 = unlimited)
+  account->login_count = 0;         // Number of successful auth attempts, default = 0
+  account->login_fail_count = 0;    // Number of unsuccessful auth attempts, default = 0
+  account->last_login_time = 0;           // Time of last successful login, default = time 0.
+  account->last_ip = 0;               // Last IP connected from, default = 0
+}
+
+static const char base64_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Append src to dst (of total size `cap`, currently `*len` chars long)
+ * as unpadded base64, the form encoded Argon2 hashes use. Returns false
+ * if it doesn't fit.
+ */
+static bool base64_append(char *dst, size_t cap, size_t *len,
+                          const unsigned char *src, size_t n) {
+  if (*len + (n * 4 + 2) / 3 >= cap) {
+    return false;
+  }
+  char *out = dst + *len;
+  for (size_t i = 0; i < n; i += 3) {
+    uint32_t v = (uint32_t)src[i] << 16;
+    v |= i + 1 < n ? (uint32_t)src[i + 1] << 8 : 0;
+    v |= i + 2 < n ? (uint32_t)src[i + 2] : 0;
+    size_t chars = n - i >= 3 ? 4 : n - i + 1;
+    for (size_t c = 0; c < chars; c++) {
+      *out++ = base64_chars[(v >> (18 - 6 * c)) & 63];
+    }
+  }
+  *out = '\0';
+  *len = (size_t)(out - dst);
+  return true;
+}
+
+/**
+ * Decode unpadded base64 from src, up to the first character that isn't
+ * part of it, into dst (of size cap). Stores the end of the input in
+ * *end and returns the number of bytes decoded, or 0 if the input was
+ * empty, malformed or too long.
+ */
+static size_t base64_decode(unsigned char *dst, size_t cap, const char *src, const char **end) {
+  size_t n = 0;
+  uint32_t v = 0;
+  size_t bits = 0;
+  const char *s = src;
+  for (const char *c; *s != '\0' && (c = strchr(base64_chars, *s)) != NULL; s++) {
+    v = (v << 6) | (uint32_t)(c - base64_chars);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      if (n == cap) {
+        return 0;
+      }
+      dst[n++] = (unsigned char)(v >> bits);
+    }
+  }
+  *end = s;
+  // 6 bits left over can't come from any whole number of bytes
+  return bits < 6 ? n : 0;
+}
+
+/**
+ * Write the encoded form of an Argon2id (version 1.3) hash into
+ * hash, as argon2id_hash_encoded() would. Returns false if it doesn't fit.
+ */
+static bool encode_hash(char hash[HASH_LENGTH], const hash_profile_t *profile,
+                        const unsigned char *salt, size_t salt_len,
+                        const unsigned char *raw, size_t raw_len) {
+  int n = snprintf(hash, HASH_LENGTH, "$argon2id$v=%d$m=%u,t=%u,p=%u$", ARGON2_VERSION_13,
+                   profile->m_cost, profile->t_cost, profile->parallelism);
+  if (n < 0 || n >= HASH_LENGTH - 1) {
+    return false;
+  }
+  size_t len = (size_t)n;
+  if (!base64_append(hash, HASH_LENGTH - 1, &len, salt, salt_len)) {
+    return false;
+  }
+  hash[len++] = '$';
+  return base64_append(hash, HASH_LENGTH, &len, raw, raw_len);
+}
+
+/** An encoded Argon2id hash, taken apart. */
+typedef struct {
+  hash_profile_t profile;
+  uint32_t version;
+  unsigned char salt[HASH_LENGTH];
+  size_t salt_len;
+  unsigned char hash[HASH_LENGTH];
+  size_t hash_len;
+} decoded_hash_t;
+
+/**
+ * Parse "$argon2id$v=19$m=...,t=...,p=...$<salt>$<hash>", as written by
+ * libargon2 (or account_hash_password()). Returns false if it isn't one.
+ */
+static bool decode_hash(const char *encoded, decoded_hash_t *out) {
+  static const char prefix[] = "$argon2id$";
+  if (strncmp(encoded, prefix, sizeof(prefix) - 1) != 0) {
+    return false;
+  }
+  const char *s = encoded + sizeof(prefix) - 1;
+  out->version = ARGON2_VERSION_10;   // hashes from before v= was added
+  if (strncmp(s, "v=", 2) == 0) {
+    char *end;
+    out->version = (uint32_t)strtoul(s + 2, &end, 10);
+    if (*end != '$') {
+      return false;
+    }
+    s = end + 1;
+  }
+  if (!hash_profile_parse(s, &out->profile) || (s = strchr(s, '$')) == NULL) {
+    return false;
+  }
+  out->salt_len = base64_decode(out->salt, sizeof(out->salt), s + 1, &s);
+  if (out->salt_len == 0 || *s != '$') {
+    return false;
+  }
+  out->hash_len = base64_decode(out->hash, sizeof(out->hash), s + 1, &s);
+  return out->hash_len > 0 && *s == '\0';
+}
+
+/**
+ * An Argon2 context for the given costs whose working memory comes
+ * from the hash arena (hasharena.h) rather than a fresh malloc.
+ */
+static argon2_context hash_context(const hash_profile_t *profile, uint32_t version,
+                                   const char *password, unsigned char *salt, size_t salt_len,
+                                   unsigned char *out, size_t out_len) {
+  argon2_context ctx = {
+    .out = out, .outlen = (uint32_t)out_len,
+    .pwd = (uint8_t *)password, .pwdlen = (uint32_t)strlen(password),
+    .salt = salt, .saltlen = (uint32_t)salt_len,
+    .t_cost = profile->t_cost, .m_cost = profile->m_cost,
+    .lanes = profile->parallelism, .threads = profile->parallelism,
+    .version = version,
+    .allocate_cbk = hash_arena_alloc, .free_cbk = hash_arena_free,
+    .flags = ARGON2_DEFAULT_FLAGS,
+  };
+  return ctx;
+}
+
+/**
+ * Hash a plaintext password with Argon2id and a fresh random salt,
+ * writing the encoded result (always null terminated) to hash.
+ * Returns false and logs an error on failure.
+ */
+bool account_hash_password(const char *plaintext_password, char hash[HASH_LENGTH]) {
+  unsigned char salt[ACCOUNT_SALT_LENGTH];
+  if (!csprng_bytes(salt, sizeof(salt))) {
     log_message(LOG_ERROR, "Failed to generate secure random salt for password hash");
-    free(account);
-    return NULL;
+    return false;
   }
 
-  char hash[HASH_LENGTH];
   memset(hash, 0, HASH_LENGTH);
+  hash_profile_t profile = hash_profile_get();
+  // Spread the hash over idle workers' cores while there are any, as
+  // long as every lane keeps its 8 blocks. (None are claimed unless
+  // the bundled Argon2 runs lanes on the pool; see hashcore.h.)
+  uint32_t max_lanes = hash_profile_max_lanes();
+  uint32_t lanes_by_memory = profile.m_cost / (2 * ARGON2_SYNC_POINTS);
+  if (max_lanes > lanes_by_memory) {
+    max_lanes = lanes_by_memory;
+  }
+  uint32_t extra = max_lanes > profile.parallelism ? hashpool_claim_lanes(max_lanes - profile.parallelism) : 0;
+  profile.parallelism += extra;
+  unsigned char raw[ACCOUNT_HASH_OUTPUT_LENGTH];
+  argon2_context ctx = hash_context(&profile, ARGON2_VERSION_13, plaintext_password,
+                                    salt, sizeof(salt), raw, sizeof(raw));
+  size_t memory = (size_t)profile.m_cost * 1024;
+  int result = ARGON2_MEMORY_ALLOCATION_ERROR;
+  if (hash_budget_acquire(memory)) {
+    result = hash_core_argon2id(&ctx);
+    hash_budget_release(memory);
+  }
+  hashpool_release_lanes(extra);
 
-  size_t password_len = strlen(plaintext_password);
-
-  int result = argon2id_hash_encoded(
-    t_cost, m_cost, parallelism,
-    plaintext_password, password_len,
-    salt, sizeof(salt),
-    32, 
-    hash, HASH_LENGTH - 1 
-  );
+  if (result == ARGON2_OK && !encode_hash(hash, &profile, salt, sizeof(salt), raw, sizeof(raw))) {
+    result = ARGON2_ENCODING_FAIL;
+  }
+  explicit_bzero(salt, sizeof(salt));
+  explicit_bzero(raw, sizeof(raw));
 
   if (result != ARGON2_OK) {
-    log_message(LOG_ERROR, "Failed to hash password during update: %s", argon2_error_message(result));
-    free(account);
+    log_message(LOG_ERROR, "Failed to hash password: %s", argon2_error_message(result));
+    memset(hash, 0, HASH_LENGTH);
+    return false;
+  }
+  return true;
+}
+
+account_t *account_create(const char *userid, const char *plaintext_password,
+                          const char *email, const char *birthdate
+                      )
+{
+  const char *problem = account_check_new(userid, plaintext_password, email, birthdate);
+  if (problem) {
+    log_message(LOG_ERROR, "account_create: %s", problem);
+    return NULL;
+  }
+  // try to allocate memory for the account
+  account_t *account = malloc(sizeof(account_t));
+  if (!account) {
+    log_message(LOG_ERROR,"account_create: Failed to allocate memory");
     return NULL;
   }
+  account_init_new(account, userid, email, birthdate);
 
-  strncpy(account->password_hash, hash, HASH_LENGTH - 1);
-  account->password_hash[HASH_LENGTH - 1] = '\0';
-  memset(hash, 0, HASH_LENGTH); //no pass remnants in memory
+  // PASSWORD HASHING
+  if (!account_hash_password(plaintext_password, account->password_hash)) {
+    free(account);
+    return NULL;
+  }
 
-  account->unban_time = 0;                // Ban the account up until this time (0 = no ban)
-  account->expiration_time = 0;           // Account is only valid until this time (0 = unlimited)
-  account->login_count = 0;         // Number of successful auth attempts, default = 0
-  account->login_fail_count = 0;    // Number of unsuccessful auth attempts, default = 0
-  account->last_login_time = 0;           // Time of last successful login, default = time 0.
-  account->last_ip = 0;               // Last IP connected from, default = 0
-  
   if (!add_account_to_db(account)) {
     log_message(LOG_ERROR, "account_create: Failed to add the account to database");
     account_free(account);
     return NULL;
   }
+  // pick up the account id the store assigned
+  const account_auth_t *stored = store_acquire(account->userid);
+  if (stored) {
+    account->account_id = stored->account_id;
+    store_release(stored);
+  }
   return account;
 }
 
@@ -267,32 +419,6 @@ static bool is_password_strong(const char *password) {
     return diversity >= 3;
 }
 
-/**
- * Generate cryptographically secure random bytes
- */
-static bool generate_secure_random(unsigned char *buffer, size_t length) {
-    /* Use /dev/urandom for secure random data */
-    int fd = open("/dev/urandom", O_RDONLY);
-    if (fd == -1) {
-        log_message(LOG_ERROR, "Failed to open /dev/urandom");
-        return false;
-    }
-    
-    size_t bytes_read = 0;
-    while (bytes_read < length) {
-        ssize_t result = read(fd, buffer + bytes_read, length - bytes_read);
-        if (result <= 0) {
-            close(fd);
-            log_message(LOG_ERROR, "Failed to read from /dev/urandom");
-            return false;
-        }
-        bytes_read += result;
-    }
-    
-    close(fd);
-    return true;
-}
-
 /*
  * Check if an account is currently banned
  */
@@ -302,14 +428,29 @@ bool account_is_banned(const account_t *acc) {
         log_message(LOG_WARN, "NULL account passed to account_is_banned");
         return false;
     }
-    
+    return account_ban_active(acc->unban_time);
+}
+
+/**
+ * Check if a ban ending at unban_time is still in force
+ */
+bool account_ban_active(time_t unban_time) {
     /* If unban_time is 0, the account is not banned */
-    if (acc->unban_time == 0) {
+    if (unban_time == 0) {
         return false;
     }
     
-    /* Get current time */
-    time_t current_time = time(NULL);
+    /* Current time, from the clock shared with the rest of the login */
+    return account_ban_active_at(unban_time, wallclock_now());
+}
+
+/**
+ * Check if a ban ending at unban_time is in force at current_time
+ */
+bool account_ban_active_at(time_t unban_time, time_t current_time) {
+    if (unban_time == 0) {
+        return false;
+    }
     if (current_time == (time_t)-1) {
         /* Failed to get system time - log error and fail securely */
         log_message(LOG_ERROR, "Failed to get system time in account_is_banned");
@@ -317,7 +458,7 @@ bool account_is_banned(const account_t *acc) {
     }
     
     /* Account is banned if current time is less than unban_time */
-    return current_time < acc->unban_time;
+    return current_time < unban_time;
 }
 
 /**
@@ -329,14 +470,29 @@ bool account_is_expired(const account_t *acc) {
         log_message(LOG_WARN, "NULL account passed to account_is_expired");
         return false;
     }
-    
+    return account_expiry_passed(acc->expiration_time);
+}
+
+/**
+ * Check if an expiration time has been reached
+ */
+bool account_expiry_passed(time_t expiration_time) {
     /* If expiration_time is 0, the account never expires */
-    if (acc->expiration_time == 0) {
+    if (expiration_time == 0) {
         return false;
     }
     
-    /* Get current time */
-    time_t current_time = time(NULL);
+    /* Current time, from the clock shared with the rest of the login */
+    return account_expiry_passed_at(expiration_time, wallclock_now());
+}
+
+/**
+ * Check if an expiration time has been reached by current_time
+ */
+bool account_expiry_passed_at(time_t expiration_time, time_t current_time) {
+    if (expiration_time == 0) {
+        return false;
+    }
     if (current_time == (time_t)-1) {
         /* Failed to get system time - log error and fail securely */
         log_message(LOG_ERROR, "Failed to get system time in account_is_expired");
@@ -344,23 +500,19 @@ bool account_is_expired(const account_t *acc) {
     }
     
     /* Account is expired if current time is greater than or equal to expiration_time */
-    return current_time >= acc->expiration_time;
+    return current_time >= expiration_time;
 }
 
 /**
  * Check if an account is rate limited due to too many failed login attempts
  */
-static bool is_account_rate_limited(const account_t *acc) {
-    if (acc == NULL) {
-        return false;
-    }
-    
+static bool is_account_rate_limited(unsigned int login_fail_count) {
     /* Rate limiting threshold - increases exponentially with failures */
-    if (acc->login_fail_count < 3) {
+    if (login_fail_count < 3) {
         return false;  /* Allow up to 3 failures without limits */
-    } else if (acc->login_fail_count < 5) {
+    } else if (login_fail_count < 5) {
         return false;  /* Allow up to 5 failures */
-    } else if (acc->login_fail_count < 10) {
+    } else if (login_fail_count < 10) {
         /* Between 5-10 failures - implement a soft rate limit */
         return true;
     } else {
@@ -379,40 +531,104 @@ bool account_validate_password(const account_t *acc, const char *plaintext_passw
         log_message(LOG_WARN, "NULL parameter passed to account_validate_password");
         return false;
     }
+    if (!account_check_password(acc->password_hash, acc->unban_time, acc->expiration_time,
+                                acc->login_fail_count, plaintext_password)) {
+        return false;
+    }
+    /* Bring the stored hash up to the current settings while we have the password */
+    rehash_if_outdated(acc->userid, acc->password_hash, plaintext_password);
+    return true;
+}
 
+/**
+ * The checks made by account_validate_password, applied to just the
+ * fields they need
+ */
+bool account_check_password(const char *password_hash, time_t unban_time,
+                            time_t expiration_time, unsigned int login_fail_count,
+                            const char *plaintext_password) {
+    return account_password_precheck(password_hash, unban_time, expiration_time, login_fail_count)
+        && account_verify_hash(password_hash, plaintext_password);
+}
+
+bool account_password_precheck(const char *password_hash, time_t unban_time,
+                               time_t expiration_time, unsigned int login_fail_count) {
+    return account_password_precheck_at(password_hash, unban_time, expiration_time,
+                                        login_fail_count, wallclock_now());
+}
+
+bool account_password_precheck_at(const char *password_hash, time_t unban_time,
+                                  time_t expiration_time, unsigned int login_fail_count,
+                                  time_t now) {
     /* Check if the hash is empty or invalid */
-    if (strlen(acc->password_hash) == 0) {
+    if (strlen(password_hash) == 0) {
         log_message(LOG_ERROR, "Account has no password hash");
         return false;
     }
 
     /* Check for account ban status */
-    if (account_is_banned(acc)) {
+    if (account_ban_active_at(unban_time, now)) {
         log_message(LOG_WARN, "Password validation attempted on banned account");
         return false;
     }
     
     /* Check for account expiration */
-    if (account_is_expired(acc)) {
+    if (account_expiry_passed_at(expiration_time, now)) {
         log_message(LOG_WARN, "Password validation attempted on expired account");
         return false;
     }
     
     /* Check for rate limiting */
-    if (is_account_rate_limited(acc)) {
+    if (is_account_rate_limited(login_fail_count)) {
         log_message(LOG_WARN, "Password validation rate limited due to too many failures");
         return false;
     }
+    return true;
+}
 
+hash_check_t account_check_hash(const char *password_hash, const char *plaintext_password) {
     /* Use Argon2 to verify the password against the stored hash */
-    int result = argon2id_verify(acc->password_hash, plaintext_password, strlen(plaintext_password));
+    decoded_hash_t decoded;
+    unsigned char computed[HASH_LENGTH];
+    int result = ARGON2_DECODING_FAIL;
+    if (decode_hash(password_hash, &decoded)) {
+        /* Wait for memory to run it in, but don't count a refusal against the user */
+        size_t memory = (size_t)decoded.profile.m_cost * 1024;
+        if (!hash_budget_acquire(memory)) {
+            return HASH_CHECK_OVERLOADED;
+        }
+        argon2_context ctx = hash_context(&decoded.profile, decoded.version, plaintext_password,
+                                          decoded.salt, decoded.salt_len,
+                                          computed, decoded.hash_len);
+        result = hash_core_argon2id_verify(&ctx, (const char *)decoded.hash);
+        hash_budget_release(memory);
+        explicit_bzero(computed, sizeof(computed));
+    }
     
     /* Log security-relevant events */
     if (result != ARGON2_OK) {
         log_message(LOG_WARN, "Failed password validation attempt");
     }
     
-    return (result == ARGON2_OK);
+    return result == ARGON2_OK ? HASH_CHECK_MATCH : HASH_CHECK_MISMATCH;
+}
+
+bool account_verify_hash(const char *password_hash, const char *plaintext_password) {
+    return account_check_hash(password_hash, plaintext_password) == HASH_CHECK_MATCH;
+}
+
+bool account_hash_outdated(const char *password_hash) {
+    decoded_hash_t decoded;
+    if (password_hash == NULL || !decode_hash(password_hash, &decoded)) {
+        return false;
+    }
+    hash_profile_t current = hash_profile_get();
+    return decoded.version != ARGON2_VERSION_13
+        || decoded.hash_len != ACCOUNT_HASH_OUTPUT_LENGTH
+        || decoded.profile.m_cost != current.m_cost
+        || decoded.profile.t_cost != current.t_cost
+        || decoded.profile.parallelism < current.parallelism
+        || decoded.profile.parallelism > hash_profile_max_lanes();
 }
 
 /**
@@ -431,43 +647,10 @@ bool account_update_password(account_t *acc, const char *new_plaintext_password)
         return false;
     }
 
-    /* Argon2 parameters (tuned for security) */
-    uint32_t t_cost = 3;        /* Number of iterations */
-    uint32_t m_cost = 1 << 16;  /* 64 MiB memory cost */
-    uint32_t parallelism = 1;   /* Number of threads */
-    
-    /* Generate a cryptographically secure random salt */
-    unsigned char salt[16];
-    if (!generate_secure_random(salt, sizeof(salt))) {
-        log_message(LOG_ERROR, "Failed to generate secure random salt for password hash");
+    /* Hash the password using Argon2id, straight into the account */
+    if (!account_hash_password(new_plaintext_password, acc->password_hash)) {
         return false;
     }
-
-    /* Create a buffer for the hashed password */
-    char hash[HASH_LENGTH];
-    memset(hash, 0, HASH_LENGTH);
-
-    /* Password length for hash calculation */
-    size_t password_len = strlen(new_plaintext_password);
-
-    /* Hash the password using Argon2id */
-    int result = argon2id_hash_encoded(
-        t_cost, m_cost, parallelism,
-        new_plaintext_password, password_len,
-        salt, sizeof(salt),
-        32, /* Hash length in bytes */
-        hash, HASH_LENGTH - 1 /* Ensure space for null terminator */
-    );
-
-    if (result != ARGON2_OK) {
-        log_message(LOG_ERROR, "Failed to hash password during update: %s", 
-                   argon2_error_message(result));
-        return false;
-    }
-
-    /* Update the account with the new hash */
-    strncpy(acc->password_hash, hash, HASH_LENGTH - 1);
-    acc->password_hash[HASH_LENGTH - 1] = '\0'; /* Ensure null termination */
     
     /* Log the password change event */
     log_message(LOG_INFO, "Password successfully updated");
@@ -475,6 +658,9 @@ bool account_update_password(account_t *acc, const char *new_plaintext_password)
     /* Reset login failure count after successful password update */
     acc->login_fail_count = 0;
     acc->unban_time = 0;  // Remove any ban
+
+    /* Sessions started with the old password end with it */
+    session_revoke_account(acc->account_id);
     
     return true;
 }
@@ -486,7 +672,7 @@ void account_record_login_success(account_t *acc, ip4_addr_t ip) { //DONE
   }
   acc->login_count += 1; // increment successful‐login count
   acc->login_fail_count = 0; // reset consecutive failures
-  acc->last_login_time = time(NULL);
+  acc->last_login_time = wallclock_now();
   acc->last_ip = ip;
 }
 
@@ -505,6 +691,9 @@ void account_set_unban_time(account_t *acc, time_t t) { //DONE
     return;
   } 
   acc->unban_time = t;
+  if (t > wallclock_now()) {
+    session_revoke_account(acc->account_id);
+  }
 }
 void account_set_expiration_time(account_t *acc, time_t t) { //DONE
   if (acc == NULL) {
@@ -552,6 +741,29 @@ bool account_print_summary(const account_t *acct, int fd) {
   return true;
 }
 
+size_t account_hash_parallelism(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long pages = sysconf(_SC_AVPHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t threads = cpus > 0 ? (size_t)cpus : 1;
+  size_t hash_pages = (size_t)hash_profile_get().m_cost * 1024 / (size_t)(page_size > 0 ? page_size : 1);
+  if (pages > 0 && page_size > 0 && hash_pages > 0) {
+    size_t by_memory = (size_t)pages / hash_pages;
+    if (by_memory < threads) {
+      threads = by_memory;
+    }
+  }
+  return threads > 0 ? threads : 1;
+}
+
+bool account_email_acceptable(const char *email) {
+  return !validate_email(email);
+}
+
+bool account_password_acceptable(const char *password) {
+  return is_password_strong(password);
+}
+
 static bool validate_email(const char *email) {
     // Basic email validation - returns true if invalid, false if valid
     // (Note: the logic in account_set_email expects true for invalid emails)
@@ -0,0 +1,98 @@
+#ifndef ACCOUNT_INTERNAL_H
+#define ACCOUNT_INTERNAL_H
+
+#include "account.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * @file account_internal.h
+ * @brief Account helpers shared between account.c and bulk import.
+ */
+
+// Argon2id parameters used for new password hashes, unless the hash
+// profile (hashprofile.h) has been changed
+#define ACCOUNT_HASH_T_COST        3          // iterations
+#define ACCOUNT_HASH_M_COST        (1 << 16)  // memory cost in KiB (64 MiB)
+#define ACCOUNT_HASH_PARALLELISM   1          // lanes
+#define ACCOUNT_HASH_OUTPUT_LENGTH 32         // raw hash length in bytes
+#define ACCOUNT_SALT_LENGTH        16
+
+// check the fields of a prospective new account. returns NULL if they
+// are acceptable, otherwise a short description of the first problem.
+const char *account_check_new(const char *userid, const char *plaintext_password,
+                              const char *email, const char *birthdate);
+
+// fill in a new account from checked fields; the password hash is left
+// empty and all other fields get their default values.
+void account_init_new(account_t *acc, const char *userid,
+                      const char *email, const char *birthdate);
+
+// hash a plaintext password with a fresh salt into hash (always null
+// terminated). returns false and logs an error on failure, including
+// when the hash memory budget (hashbudget.h) has no room in time.
+bool account_hash_password(const char *plaintext_password, char hash[HASH_LENGTH]);
+
+// whether a ban ending at unban_time (0 = no ban) is in force
+bool account_ban_active(time_t unban_time);
+
+// whether expiration_time (0 = never) has been reached
+bool account_expiry_passed(time_t expiration_time);
+
+// as the two above, but as of now rather than the clock's current
+// reading, for callers checking many accounts at one time
+bool account_ban_active_at(time_t unban_time, time_t now);
+bool account_expiry_passed_at(time_t expiration_time, time_t now);
+
+// the checks made by account_validate_password(), applied to just the
+// fields they need: ban, expiry and failure rate limit, then the hash.
+bool account_check_password(const char *password_hash, time_t unban_time,
+                            time_t expiration_time, unsigned int login_fail_count,
+                            const char *plaintext_password);
+
+// the cheap part of account_check_password(): everything but the hash.
+// returns false (and logs) if the password can't be accepted whatever
+// it is.
+bool account_password_precheck(const char *password_hash, time_t unban_time,
+                               time_t expiration_time, unsigned int login_fail_count);
+
+// as account_password_precheck(), as of now
+bool account_password_precheck_at(const char *password_hash, time_t unban_time,
+                                  time_t expiration_time, unsigned int login_fail_count,
+                                  time_t now);
+
+// the expensive part: whether plaintext_password matches password_hash.
+bool account_verify_hash(const char *password_hash, const char *plaintext_password);
+
+// outcome of account_check_hash()
+typedef enum {
+  HASH_CHECK_MISMATCH,    // wrong password, or not a hash we can check
+  HASH_CHECK_MATCH,
+  HASH_CHECK_OVERLOADED   // not checked: no room in the hash memory budget (hashbudget.h)
+} hash_check_t;
+
+// as account_verify_hash(), but telling a refusal by the memory budget
+// apart from a wrong password.
+hash_check_t account_check_hash(const char *password_hash, const char *plaintext_password);
+
+// whether password_hash was made with other settings than a new hash
+// would be (see hashprofile.h); any lane count a new hash might get
+// counts as current. false if it can't be parsed at all.
+bool account_hash_outdated(const char *password_hash);
+
+// how many password hashes can sensibly run at once: one per CPU, but
+// no more than the available memory has room for.
+size_t account_hash_parallelism(void);
+
+// whether email would be accepted by account_set_email()
+bool account_email_acceptable(const char *email);
+
+// whether password is strong enough for account_update_password()
+bool account_password_acceptable(const char *password);
+
+// whether birthday is a valid YYYY-MM-DD date
+bool account_validate_birthday(const char *birthday);
+
+#endif // ACCOUNT_INTERNAL_H
@@ -3,8 +3,19 @@
 #include "account.h"
 #include "db.h"
 #include "logging.h"
+#include "hashbudget.h"
+#include "hashcore.h"
+#include "hashprofile.h"
+#include "import.h"
+#include "ioqueue.h"
+#include "ratelimit.h"
+#include "server.h"
+#include "store.h"
 
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>
@@ -14,10 +25,125 @@ const char *new_strong_password = "NewStrongP@ss456";
 const char *valid_email = "deez@tungsahur.com";
 const char *valid_birthday = "2001-06-12";
 
-int main(int argc, char *argv[]) {
-  (void) argc;
-  (void) argv;
+static void usage(const char *prog) {
+  printf("Usage: %s [--store PATH] [--shards N] [--hash-profile SPEC | --calibrate MS\n"
+         "          [--hash-memory MIB]] [--hash-budget MIB] [--max-lanes N]\n"
+         "          [--rate-limit IP,SUBNET,SECONDS] [--import FILE [--threads N]]\n"
+         "          [--listen PORT] [--listen-unix PATH [--unix-unlimited]] [--loops N]\n"
+         "          [--io-uring]\n", prog);
+  printf("  --store PATH    keep accounts in the persistent store at PATH\n");
+  printf("  --shards N      split a new store into N shards (default: 1)\n");
+  printf("  --hash-profile SPEC  Argon2id costs for new hashes, e.g. m=65536,t=3,p=1\n");
+  printf("  --calibrate MS  pick the strongest costs whose p99 hash time is under MS ms\n");
+  printf("  --hash-memory MIB  memory each hash may use when calibrating (default: 64)\n");
+  printf("  --hash-budget MIB  most memory all password hashes in progress may use\n"
+         "                  (default: half of physical memory)\n");
+  printf("  --max-lanes N   let new hashes use up to N lanes while hash workers are idle\n");
+  printf("  --rate-limit IP,SUBNET,SECONDS  login attempts allowed per address and per /24\n"
+         "                  in a sliding window (default: 30,300,60; 0 for no limit)\n");
+  printf("  --import FILE   bulk-import accounts from FILE (one per line:\n");
+  printf("                  userid<TAB>password<TAB>email<TAB>birthdate) and exit\n");
+  printf("  --threads N     hashing threads for --import (default: one per CPU)\n");
+  printf("  --listen PORT   serve logins on 127.0.0.1:PORT until interrupted (see server.h)\n");
+  printf("  --listen-unix PATH  serve logins on the Unix socket PATH\n");
+  printf("  --unix-unlimited  don't rate limit Unix socket clients (a trusted front end\n"
+         "                  that limits by its own clients' addresses)\n");
+  printf("  --loops N       event-loop threads for the server (default: one per CPU)\n");
+  printf("  --io-uring      write login replies and log lines through io_uring\n");
+  printf("With no --import or --listen, runs a demonstration of the account system.\n");
+}
+
+/* Time Argon2 here and use the strongest profile that meets target_ms. */
+static bool calibrate(double target_ms, uint32_t memory_mib) {
+  hash_calibration_t goal = {
+    .target_p99_ms = target_ms,
+    .max_m_cost = memory_mib * 1024,
+  };
+  hash_profile_t chosen;
+  double p99;
+  if (!hash_profile_calibrate(&goal, &chosen, &p99)) {
+    return false;
+  }
+  char text[64];
+  hash_profile_format(&chosen, text, sizeof(text));
+  printf("Calibrated hash profile %s (p99 %.1f ms)\n", text, p99);
+  return hash_profile_set(&chosen);
+}
 
+/* Parse "IP,SUBNET,SECONDS" into config. */
+static bool parse_rate_limit(const char *spec, ratelimit_config_t *config) {
+  char *end;
+  unsigned long ip = strtoul(spec, &end, 10);
+  if (end == spec || *end != ',') {
+    return false;
+  }
+  const char *next = end + 1;
+  unsigned long subnet = strtoul(next, &end, 10);
+  if (end == next || *end != ',') {
+    return false;
+  }
+  next = end + 1;
+  unsigned long seconds = strtoul(next, &end, 10);
+  if (end == next || *end != '\0' || seconds == 0) {
+    return false;
+  }
+  config->ip_limit = (uint32_t)ip;
+  config->subnet_limit = (uint32_t)subnet;
+  config->window_seconds = (uint32_t)seconds;
+  return true;
+}
+
+static int run_import(const char *path, size_t threads) {
+  import_stats_t stats;
+  if (!account_import_file(path, threads, &stats)) {
+    return 1;
+  }
+  printf("Imported %zu of %zu accounts (%zu invalid, %zu duplicate, %zu failed)\n",
+         stats.imported, stats.entries, stats.invalid, stats.duplicates, stats.failed);
+  printf("%.2f seconds, %.1f accounts/sec\n", stats.seconds, stats.accounts_per_sec);
+  return 0;
+}
+
+/* Serve logins until SIGINT or SIGTERM. */
+static int run_server(const char *port, const char *path, bool unix_unlimited, size_t loops) {
+  // Block the signals before any server thread starts, so they all
+  // inherit the mask and only sigwait() below sees them.
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+  server_config_t config = {
+    .tcp_address = port ? "127.0.0.1" : NULL,
+    .tcp_port = port ? (uint16_t)strtoul(port, NULL, 10) : 0,
+    .unix_path = path,
+    .unix_unlimited = unix_unlimited,
+    .loops = loops,
+    .log_fd = STDERR_FILENO,
+  };
+  if (!server_start(&config)) {
+    return 1;
+  }
+  if (port) {
+    printf("Serving logins on 127.0.0.1:%u\n", server_tcp_port());
+  }
+  if (path) {
+    printf("Serving logins on %s\n", path);
+  }
+  fflush(stdout);
+  int sig;
+  sigwait(&stop_signals, &sig);
+  server_stats_t stats;
+  server_stats(&stats);
+  server_stop();
+  printf("Stopped: %llu connections, %llu logins, %llu bad requests\n",
+         (unsigned long long)stats.accepted, (unsigned long long)stats.logins,
+         (unsigned long long)stats.errors);
+  return 0;
+}
+
+static int run_demo(void) {
  // Test logging functionality
   log_message(LOG_INFO, "Starting account system test");
   log_message(LOG_DEBUG, "Creating test account");
@@ -77,4 +203,105 @@ int main(int argc, char *argv[]) {
   // Cleanup
   account_free(acc);
   return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *store_file = NULL;
+  const char *import_file = NULL;
+  size_t threads = 0;
+  size_t shards = 1;
+  const char *profile_spec = NULL;
+  double calibrate_ms = 0;
+  uint32_t hash_memory_mib = hash_profile_get().m_cost / 1024;
+  size_t hash_budget_mib = 0;
+  uint32_t max_lanes = 0;
+  const char *rate_limit_spec = NULL;
+  const char *listen_port = NULL;
+  const char *listen_path = NULL;
+  bool unix_unlimited = false;
+  size_t loops = 0;
+  bool io_uring = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+      store_file = argv[++i];
+    } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc) {
+      import_file = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      shards = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--hash-profile") == 0 && i + 1 < argc) {
+      profile_spec = argv[++i];
+    } else if (strcmp(argv[i], "--calibrate") == 0 && i + 1 < argc) {
+      calibrate_ms = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--hash-budget") == 0 && i + 1 < argc) {
+      hash_budget_mib = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--hash-memory") == 0 && i + 1 < argc) {
+      hash_memory_mib = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--max-lanes") == 0 && i + 1 < argc) {
+      max_lanes = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--rate-limit") == 0 && i + 1 < argc) {
+      rate_limit_spec = argv[++i];
+    } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+      listen_port = argv[++i];
+    } else if (strcmp(argv[i], "--listen-unix") == 0 && i + 1 < argc) {
+      listen_path = argv[++i];
+    } else if (strcmp(argv[i], "--unix-unlimited") == 0) {
+      unix_unlimited = true;
+    } else if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+      loops = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--io-uring") == 0) {
+      io_uring = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!store_configure_shards(shards)) {
+    return 1;
+  }
+  hash_budget_configure(hash_budget_mib << 20, 0);
+  if (profile_spec) {
+    hash_profile_t profile;
+    if (!hash_profile_parse(profile_spec, &profile)) {
+      log_message(LOG_ERROR, "Invalid hash profile: %s", profile_spec);
+      return 1;
+    }
+    if (!hash_profile_set(&profile)) {
+      return 1;
+    }
+  } else if (calibrate_ms > 0 && !calibrate(calibrate_ms, hash_memory_mib)) {
+    return 1;
+  }
+  if (max_lanes > 0 && !hash_core_bundled()) {
+    log_message(LOG_WARN, "--max-lanes needs the bundled Argon2 (make ARGON2=bundled); ignoring it");
+  }
+  hash_profile_set_max_lanes(max_lanes);
+  if (rate_limit_spec) {
+    ratelimit_config_t limits;
+    if (!parse_rate_limit(rate_limit_spec, &limits)) {
+      log_message(LOG_ERROR, "Invalid rate limit: %s", rate_limit_spec);
+      return 1;
+    }
+    ratelimit_configure(&limits);
+  }
+  if (io_uring) {
+    ioqueue_enable(true);   // logs and carries on without it if unavailable
+  }
+  if (store_file && !store_open(store_file)) {
+    return 1;
+  }
+  int status;
+  if (import_file) {
+    status = run_import(import_file, threads);
+  } else if (listen_port || listen_path) {
+    status = run_server(listen_port, listen_path, unix_unlimited, loops);
+  } else {
+    status = run_demo();
+  }
+  ioqueue_drain();
+  store_close();
+  return status;
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include "csprng.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
+#include "banned.h"
+
+typedef struct {
+  unsigned char bytes[CSPRNG_BUFFER_BYTES];
+  size_t used;            // bytes[used..] are still to be handed out
+  unsigned int forks;     // fork_count when the buffer was filled
+} csprng_buffer_t;
+
+static _Thread_local csprng_buffer_t buffer = { .used = CSPRNG_BUFFER_BYTES };
+
+/* Bumped in the child after every fork, to invalidate inherited buffers. */
+static atomic_uint fork_count;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void after_fork_in_child(void) {
+  atomic_fetch_add_explicit(&fork_count, 1, memory_order_relaxed);
+}
+
+static void register_atfork(void) {
+  pthread_atfork(NULL, NULL, after_fork_in_child);
+}
+
+/* Fill buf from the kernel, however many calls that takes. */
+static bool fill(unsigned char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = getrandom(buf, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log_message(LOG_ERROR, "csprng: getrandom failed: %s", strerror(errno));
+      return false;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+bool csprng_bytes(void *buf, size_t len) {
+  if (buf == NULL) {
+    return false;
+  }
+  pthread_once(&atfork_once, register_atfork);
+  unsigned char *out = buf;
+
+  // Requests as big as the buffer gain nothing from it.
+  if (len >= CSPRNG_BUFFER_BYTES) {
+    if (!fill(out, len)) {
+      explicit_bzero(out, len);
+      return false;
+    }
+    return true;
+  }
+
+  unsigned int forks = atomic_load_explicit(&fork_count, memory_order_relaxed);
+  if (buffer.forks != forks) {
+    explicit_bzero(buffer.bytes, sizeof(buffer.bytes));
+    buffer.used = CSPRNG_BUFFER_BYTES;
+    buffer.forks = forks;
+  }
+  while (len > 0) {
+    if (buffer.used == CSPRNG_BUFFER_BYTES) {
+      if (!fill(buffer.bytes, sizeof(buffer.bytes))) {
+        explicit_bzero(buf, (size_t)(out - (unsigned char *)buf) + len);
+        return false;
+      }
+      buffer.used = 0;
+    }
+    size_t n = CSPRNG_BUFFER_BYTES - buffer.used;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(out, buffer.bytes + buffer.used, n);
+    explicit_bzero(buffer.bytes + buffer.used, n);
+    buffer.used += n;
+    out += n;
+    len -= n;
+  }
+  return true;
+}
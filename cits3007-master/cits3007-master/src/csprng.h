@@ -0,0 +1,31 @@
+#ifndef CSPRNG_H
+#define CSPRNG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file csprng.h
+ * @brief Cryptographically secure random bytes for salts and tokens.
+ *
+ * Bytes come from the kernel's getrandom(), which needs no file
+ * descriptor (so works in a chroot and when the process is out of
+ * them). To keep that to one system call per many requests, each
+ * thread draws CSPRNG_BUFFER_BYTES at a time into a buffer of its own
+ * and hands them out from there. Bytes are wiped from the buffer as
+ * they are handed out, and never handed out twice.
+ *
+ * A forked child would otherwise share the contents of its parent's
+ * buffer, and so produce the same "random" bytes as the parent; after
+ * a fork, buffered bytes are discarded and the buffer refilled.
+ */
+
+#define CSPRNG_BUFFER_BYTES 4096
+
+/**
+ * Fill buf with len random bytes. Returns false (and logs) if the
+ * kernel couldn't supply them; buf is then zeroed.
+ */
+bool csprng_bytes(void *buf, size_t len);
+
+#endif // CSPRNG_H
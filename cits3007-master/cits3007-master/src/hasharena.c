@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include "hasharena.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "banned.h"
+
+/* Transparent huge pages are 2 MiB on the platforms we run on. */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+typedef struct {
+  uint8_t *base;
+  size_t size;
+  bool in_use;
+} slab_t;
+
+/*
+ * Everything below is guarded by arena_lock. `mapping` counts slabs
+ * being mapped outside the lock, so the table never overfills.
+ */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static slab_t slabs[HASH_ARENA_MAX_SLABS];
+static size_t num_slabs = 0;
+static size_t mapping = 0;
+static bool enabled = true;
+static bool huge_pages = false;
+static uint64_t reused = 0;
+static uint64_t mapped = 0;
+static uint64_t fallback = 0;
+
+/**
+ * Map a slab of at least `bytes` and fault in every page of it, storing
+ * its actual size in *size. Returns NULL (and logs) on failure.
+ */
+static uint8_t *map_slab(size_t bytes, bool huge, size_t *size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t align = huge ? HUGE_PAGE_SIZE : page;
+  size_t len = (bytes + align - 1) & ~(align - 1);
+  // Huge pages need a 2 MiB aligned range: map a little extra and trim.
+  size_t span = huge ? len + align : len;
+  uint8_t *p = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    log_message(LOG_ERROR, "hash_arena: Can't map %zu bytes: %s", span, strerror(errno));
+    return NULL;
+  }
+  if (huge) {
+    size_t head = (align - ((uintptr_t)p & (align - 1))) & (align - 1);
+    if (head > 0) {
+      munmap(p, head);
+    }
+    if (span - head > len) {
+      munmap(p + head + len, span - head - len);
+    }
+    p += head;
+    if (madvise(p, len, MADV_HUGEPAGE) != 0) {
+      log_message(LOG_WARN, "hash_arena: No transparent huge pages: %s", strerror(errno));
+    }
+  }
+  for (size_t off = 0; off < len; off += page) {
+    p[off] = 0;
+  }
+  *size = len;
+  return p;
+}
+
+/* The smallest free slab of at least `bytes`, or NULL; the caller holds arena_lock. */
+static slab_t *find_free(size_t bytes) {
+  slab_t *best = NULL;
+  for (size_t i = 0; i < num_slabs; i++) {
+    slab_t *s = &slabs[i];
+    if (!s->in_use && s->size >= bytes && (best == NULL || s->size < best->size)) {
+      best = s;
+    }
+  }
+  return best;
+}
+
+/**
+ * Map a new slab and add it to the table, in use or not. Called
+ * without arena_lock, after claiming room for it with `mapping`.
+ */
+static uint8_t *add_slab(size_t bytes, bool huge, bool in_use) {
+  size_t size = 0;
+  uint8_t *base = map_slab(bytes, huge, &size);
+  pthread_mutex_lock(&arena_lock);
+  mapping--;
+  if (base) {
+    slabs[num_slabs++] = (slab_t){ .base = base, .size = size, .in_use = in_use };
+    mapped += in_use;
+  }
+  pthread_mutex_unlock(&arena_lock);
+  return base;
+}
+
+void hash_arena_configure(bool on, bool huge) {
+  pthread_mutex_lock(&arena_lock);
+  enabled = on;
+  huge_pages = huge;
+  pthread_mutex_unlock(&arena_lock);
+}
+
+bool hash_arena_enabled(void) {
+  pthread_mutex_lock(&arena_lock);
+  bool on = enabled;
+  pthread_mutex_unlock(&arena_lock);
+  return on;
+}
+
+bool hash_arena_reserve(size_t want, size_t bytes) {
+  for (;;) {
+    pthread_mutex_lock(&arena_lock);
+    size_t have = 0;
+    for (size_t i = 0; i < num_slabs; i++) {
+      have += !slabs[i].in_use && slabs[i].size >= bytes;
+    }
+    bool room = num_slabs + mapping < HASH_ARENA_MAX_SLABS;
+    bool huge = huge_pages;
+    if (have < want && room) {
+      mapping++;
+    }
+    pthread_mutex_unlock(&arena_lock);
+
+    if (have >= want) {
+      return true;
+    }
+    if (!room) {
+      log_message(LOG_ERROR, "hash_arena_reserve: No room for %zu slabs", want);
+      return false;
+    }
+    if (!add_slab(bytes, huge, false)) {
+      return false;
+    }
+  }
+}
+
+void hash_arena_release(void) {
+  pthread_mutex_lock(&arena_lock);
+  for (size_t i = 0; i < num_slabs; ) {
+    if (slabs[i].in_use) {
+      i++;
+      continue;
+    }
+    munmap(slabs[i].base, slabs[i].size);
+    slabs[i] = slabs[--num_slabs];
+  }
+  pthread_mutex_unlock(&arena_lock);
+}
+
+void hash_arena_stats(hash_arena_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&arena_lock);
+  memset(stats, 0, sizeof(*stats));
+  stats->slabs = num_slabs;
+  for (size_t i = 0; i < num_slabs; i++) {
+    stats->free += !slabs[i].in_use;
+    stats->bytes += slabs[i].size;
+  }
+  stats->reused = reused;
+  stats->mapped = mapped;
+  stats->fallback = fallback;
+  pthread_mutex_unlock(&arena_lock);
+}
+
+int hash_arena_alloc(uint8_t **memory, size_t bytes) {
+  pthread_mutex_lock(&arena_lock);
+  bool room = false;
+  bool huge = huge_pages;
+  if (enabled) {
+    slab_t *s = find_free(bytes);
+    if (s) {
+      s->in_use = true;
+      reused++;
+      *memory = s->base;
+      pthread_mutex_unlock(&arena_lock);
+      return 0;
+    }
+    room = num_slabs + mapping < HASH_ARENA_MAX_SLABS;
+    if (room) {
+      mapping++;
+    }
+  }
+  pthread_mutex_unlock(&arena_lock);
+
+  if (room && (*memory = add_slab(bytes, huge, true)) != NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&arena_lock);
+  fallback++;
+  pthread_mutex_unlock(&arena_lock);
+  *memory = malloc(bytes);
+  return *memory ? 0 : -1;
+}
+
+void hash_arena_free(uint8_t *memory, size_t bytes) {
+  (void)bytes;
+  pthread_mutex_lock(&arena_lock);
+  for (size_t i = 0; i < num_slabs; i++) {
+    if (slabs[i].base == memory) {
+      slabs[i].in_use = false;
+      pthread_mutex_unlock(&arena_lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&arena_lock);
+  free(memory);
+}
@@ -0,0 +1,72 @@
+#ifndef HASHARENA_H
+#define HASHARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file hasharena.h
+ * @brief Reusable working memory for Argon2.
+ *
+ * Each Argon2 call needs m_cost KiB of working memory (64 MiB by
+ * default). Left to itself libargon2 mallocs it, which for a block that
+ * size means a fresh mmap, a page fault on every page as the hash first
+ * touches it, and a munmap at the end. The arena keeps those blocks
+ * ("slabs") mapped and already faulted in between calls instead, and
+ * hands them to libargon2 through the allocate_cbk/free_cbk hooks of
+ * argon2_context.
+ *
+ * Slabs are made on demand, or up front with hash_arena_reserve(). A
+ * slab is only ever used by one hash at a time; libargon2 wipes its
+ * working memory before giving it back. At most HASH_ARENA_MAX_SLABS
+ * are kept; beyond that, memory comes from malloc as before.
+ */
+
+#define HASH_ARENA_MAX_SLABS 64
+
+typedef struct {
+  size_t slabs;        // slabs currently mapped
+  size_t free;         // of which not in use
+  size_t bytes;        // total size of the mapped slabs
+  uint64_t reused;     // allocations served by an existing slab
+  uint64_t mapped;     // allocations that had to map a new slab
+  uint64_t fallback;   // allocations left to malloc (arena full or disabled)
+} hash_arena_stats_t;
+
+/**
+ * Turn the arena on or off (it starts on), and choose whether new slabs
+ * ask for transparent huge pages. While it is off, hash_arena_alloc()
+ * behaves like malloc(); slabs already mapped are kept.
+ */
+void hash_arena_configure(bool enabled, bool huge_pages);
+
+/** Whether hash_arena_alloc() currently hands out slabs. */
+bool hash_arena_enabled(void);
+
+/**
+ * Make sure at least `slabs` free slabs of at least `bytes` each are
+ * mapped and faulted in, so the first hashes that use them don't pay
+ * for it. Returns false (and logs) if that many couldn't be mapped.
+ */
+bool hash_arena_reserve(size_t slabs, size_t bytes);
+
+/**
+ * Unmap every slab that is not in use.
+ */
+void hash_arena_release(void);
+
+/**
+ * Current counters of the arena.
+ */
+void hash_arena_stats(hash_arena_stats_t *stats);
+
+/**
+ * argon2_context allocate_cbk and free_cbk. alloc stores a block of at
+ * least `bytes` in *memory and returns 0, or returns -1 if there is
+ * none to be had.
+ */
+int hash_arena_alloc(uint8_t **memory, size_t bytes);
+void hash_arena_free(uint8_t *memory, size_t bytes);
+
+#endif // HASHARENA_H
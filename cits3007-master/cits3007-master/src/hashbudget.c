@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include "hashbudget.h"
+#include "logging.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "banned.h"
+
+/*
+ * Everything below is guarded by budget_lock. Callers waiting for
+ * memory sleep on budget_freed, which uses the monotonic clock so that
+ * deadlines aren't moved by changes to the time of day.
+ */
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t budget_freed;
+static pthread_once_t budget_once = PTHREAD_ONCE_INIT;
+static size_t budget = 0;         // 0 until configured or first used
+static unsigned int wait_ms = HASH_BUDGET_DEFAULT_WAIT_MS;
+static size_t in_use = 0;
+static size_t waiting = 0;
+static size_t max_waiting = 0;
+static uint64_t admitted = 0;
+static uint64_t delayed = 0;
+static uint64_t rejected = 0;
+static uint64_t wait_ns = 0;
+static uint64_t max_wait_ns = 0;
+
+static void budget_init(void) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&budget_freed, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+static size_t default_budget(void) {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page_size <= 0) {
+    return (size_t)1 << 30;
+  }
+  return (size_t)pages * (size_t)page_size / 2;
+}
+
+static uint64_t timespec_ns(const struct timespec *ts) {
+  return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+/*
+ * Whether `bytes` can be taken now; the caller holds budget_lock. A
+ * request bigger than the whole budget fits once nothing else is held.
+ */
+static bool fits(size_t bytes) {
+  size_t need = bytes < budget ? bytes : budget;
+  return in_use + need <= budget;
+}
+
+void hash_budget_configure(size_t bytes, unsigned int max_wait_ms) {
+  pthread_once(&budget_once, budget_init);
+  pthread_mutex_lock(&budget_lock);
+  budget = bytes ? bytes : default_budget();
+  wait_ms = max_wait_ms ? max_wait_ms : HASH_BUDGET_DEFAULT_WAIT_MS;
+  // A bigger budget may let waiting callers in now.
+  pthread_cond_broadcast(&budget_freed);
+  pthread_mutex_unlock(&budget_lock);
+}
+
+bool hash_budget_acquire(size_t bytes) {
+  pthread_once(&budget_once, budget_init);
+  pthread_mutex_lock(&budget_lock);
+  if (budget == 0) {
+    budget = default_budget();
+  }
+  if (fits(bytes)) {
+    in_use += bytes;
+    admitted++;
+    pthread_mutex_unlock(&budget_lock);
+    return true;
+  }
+
+  struct timespec start, deadline;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t until = timespec_ns(&start) + (uint64_t)wait_ms * 1000000ULL;
+  deadline.tv_sec = (time_t)(until / 1000000000ULL);
+  deadline.tv_nsec = (long)(until % 1000000000ULL);
+
+  waiting++;
+  if (waiting > max_waiting) {
+    max_waiting = waiting;
+  }
+  bool ok = true;
+  while (!fits(bytes)) {
+    if (pthread_cond_timedwait(&budget_freed, &budget_lock, &deadline) != 0 && !fits(bytes)) {
+      ok = false;
+      break;
+    }
+  }
+  waiting--;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t waited = timespec_ns(&now) - timespec_ns(&start);
+  wait_ns += waited;
+  if (waited > max_wait_ns) {
+    max_wait_ns = waited;
+  }
+  if (ok) {
+    in_use += bytes;
+    admitted++;
+    delayed++;
+  } else {
+    rejected++;
+  }
+  size_t held = in_use;
+  pthread_mutex_unlock(&budget_lock);
+
+  if (!ok) {
+    log_message(LOG_WARN, "hash_budget: Gave up after %llu ms waiting for %zu bytes (%zu in use)",
+                (unsigned long long)(waited / 1000000), bytes, held);
+  }
+  return ok;
+}
+
+void hash_budget_release(size_t bytes) {
+  pthread_mutex_lock(&budget_lock);
+  in_use = bytes < in_use ? in_use - bytes : 0;
+  if (waiting > 0) {
+    pthread_cond_broadcast(&budget_freed);
+  }
+  pthread_mutex_unlock(&budget_lock);
+}
+
+void hash_budget_stats(hash_budget_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&budget_lock);
+  memset(stats, 0, sizeof(*stats));
+  stats->budget = budget ? budget : default_budget();
+  stats->in_use = in_use;
+  stats->waiting = waiting;
+  stats->max_waiting = max_waiting;
+  stats->admitted = admitted;
+  stats->delayed = delayed;
+  stats->rejected = rejected;
+  stats->wait_ns = wait_ns;
+  stats->max_wait_ns = max_wait_ns;
+  pthread_mutex_unlock(&budget_lock);
+}
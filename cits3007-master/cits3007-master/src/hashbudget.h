@@ -0,0 +1,64 @@
+#ifndef HASHBUDGET_H
+#define HASHBUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file hashbudget.h
+ * @brief Memory budget for password hashes in progress.
+ *
+ * Every Argon2 hash or verify holds its memory cost (64 MiB by default)
+ * for as long as it runs, so a burst of logins can use more memory than
+ * the machine has. The budget caps the total: a hash must acquire its
+ * memory cost from it before starting and release it when done. When
+ * the budget is used up, callers wait for memory to be released, but
+ * only until a deadline; after that they are turned away so the caller
+ * can fail the request cheaply.
+ *
+ * account_hash_password() and account_verify_hash() go through the
+ * budget, so nothing else normally needs to call it.
+ */
+
+typedef struct {
+  size_t budget;          // bytes that may be held at once
+  size_t in_use;          // bytes held now
+  size_t waiting;         // callers waiting for memory now
+  size_t max_waiting;     // most callers ever waiting at once
+  uint64_t admitted;      // acquisitions granted
+  uint64_t delayed;       // of which had to wait first
+  uint64_t rejected;      // acquisitions that gave up at the deadline
+  uint64_t wait_ns;       // total time spent waiting, admitted or not
+  uint64_t max_wait_ns;   // longest wait
+} hash_budget_stats_t;
+
+/** How long hash_budget_acquire() waits by default, in milliseconds. */
+#define HASH_BUDGET_DEFAULT_WAIT_MS 1000
+
+/**
+ * Set the budget in bytes and the longest a caller may wait for it.
+ * 0 for bytes means half the machine's physical memory; 0 for wait_ms
+ * means HASH_BUDGET_DEFAULT_WAIT_MS. Memory already held stays held.
+ */
+void hash_budget_configure(size_t bytes, unsigned int wait_ms);
+
+/**
+ * Take `bytes` from the budget, waiting until the deadline if it isn't
+ * there. Requests bigger than the whole budget are admitted once
+ * nothing else is held. Returns false (and logs) if the deadline passed
+ * first; nothing is then held.
+ */
+bool hash_budget_acquire(size_t bytes);
+
+/**
+ * Return `bytes` taken by hash_budget_acquire().
+ */
+void hash_budget_release(size_t bytes);
+
+/**
+ * Current settings and counters of the budget.
+ */
+void hash_budget_stats(hash_budget_stats_t *stats);
+
+#endif // HASHBUDGET_H
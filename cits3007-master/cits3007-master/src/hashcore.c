@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+#include "hashcore.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define HASH_CORE_X86 1
+#endif
+#ifdef HASH_CORE_BUNDLED
+#include "core.h"               // vendored upstream sources (see vendor/README.md)
+#include "thread.h"
+#endif
+#include "banned.h"
+
+#ifdef HASH_CORE_BUNDLED
+/*
+ * Upstream's core calls fill_segment() for every segment of every lane.
+ * The Makefile builds upstream's ref.c and opt.c with fill_segment
+ * renamed to the functions below, opt.c once per instruction set, and
+ * the fill_segment() here hands each call to the current kernel's.
+ */
+typedef void (*fill_segment_fn)(const argon2_instance_t *instance, argon2_position_t position);
+
+void hash_core_fill_segment_ref(const argon2_instance_t *instance, argon2_position_t position);
+#ifdef HASH_CORE_X86
+void hash_core_fill_segment_ssse3(const argon2_instance_t *instance, argon2_position_t position);
+void hash_core_fill_segment_avx2(const argon2_instance_t *instance, argon2_position_t position);
+void hash_core_fill_segment_avx512(const argon2_instance_t *instance, argon2_position_t position);
+#endif
+#endif
+
+static const char *const kernel_names[HASH_KERNEL_COUNT] = {
+  [HASH_KERNEL_LIBRARY] = "libargon2",
+  [HASH_KERNEL_REF] = "ref",
+  [HASH_KERNEL_SSSE3] = "ssse3",
+  [HASH_KERNEL_AVX2] = "avx2",
+  [HASH_KERNEL_AVX512] = "avx512",
+};
+
+#ifdef HASH_CORE_BUNDLED
+static const fill_segment_fn kernel_fills[HASH_KERNEL_COUNT] = {
+  [HASH_KERNEL_REF] = hash_core_fill_segment_ref,
+#ifdef HASH_CORE_X86
+  [HASH_KERNEL_SSSE3] = hash_core_fill_segment_ssse3,
+  [HASH_KERNEL_AVX2] = hash_core_fill_segment_avx2,
+  [HASH_KERNEL_AVX512] = hash_core_fill_segment_avx512,
+#endif
+};
+#define DEFAULT_KERNEL HASH_KERNEL_REF
+#else
+#define DEFAULT_KERNEL HASH_KERNEL_LIBRARY
+#endif
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static atomic_int current_kernel = DEFAULT_KERNEL;
+static _Atomic(hash_lane_runner_fn) lane_runner = NULL;
+
+bool hash_core_bundled(void) {
+#ifdef HASH_CORE_BUNDLED
+  return true;
+#else
+  return false;
+#endif
+}
+
+const char *hash_core_kernel_name(hash_kernel_t kernel) {
+  return (unsigned)kernel < HASH_KERNEL_COUNT ? kernel_names[kernel] : "unknown";
+}
+
+bool hash_core_kernel_supported(hash_kernel_t kernel) {
+  switch (kernel) {
+#ifdef HASH_CORE_BUNDLED
+  case HASH_KERNEL_REF:
+    return true;
+#ifdef HASH_CORE_X86
+  case HASH_KERNEL_SSSE3:
+    return __builtin_cpu_supports("ssse3");
+  case HASH_KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case HASH_KERNEL_AVX512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+#else
+  case HASH_KERNEL_LIBRARY:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+static void select_kernel(void) {
+  for (int k = HASH_KERNEL_COUNT - 1; k > DEFAULT_KERNEL; k--) {
+    if (hash_core_kernel_supported((hash_kernel_t)k)) {
+      atomic_store(&current_kernel, k);
+      return;
+    }
+  }
+}
+
+hash_kernel_t hash_core_kernel(void) {
+  pthread_once(&kernel_once, select_kernel);
+  return (hash_kernel_t)atomic_load(&current_kernel);
+}
+
+bool hash_core_set_kernel(hash_kernel_t kernel) {
+  pthread_once(&kernel_once, select_kernel);
+  if (!hash_core_kernel_supported(kernel)) {
+    return false;
+  }
+  atomic_store(&current_kernel, (int)kernel);
+  return true;
+}
+
+void hash_core_set_lane_runner(hash_lane_runner_fn runner) {
+  atomic_store(&lane_runner, runner);
+}
+
+#ifdef HASH_CORE_BUNDLED
+/*
+ * libargon2's threading backend, in place of upstream's thread.c. For
+ * each slice, upstream's fill_memory_blocks_mt() creates a thread per
+ * lane and then joins them. Here creating one only queues the lane on
+ * the calling thread's list, and a join runs everything queued through
+ * the lane runner. So when a join returns, every lane created before it
+ * has finished, which is all upstream relies on. The app hashes with as
+ * many threads as lanes, so a slice's lanes all run at once.
+ */
+#define QUEUED_LANES_INLINE 16
+
+typedef struct {
+  argon2_thread_func_t func;
+  void *args;
+} queued_lane_t;
+
+static _Thread_local queued_lane_t queued_inline[QUEUED_LANES_INLINE];
+static _Thread_local queued_lane_t *queued = NULL;
+static _Thread_local uint32_t queued_count = 0;
+static _Thread_local uint32_t queued_size = 0;
+
+/* Forget the queued lanes, and any memory holding them. */
+static void queued_clear(void) {
+  if (queued != queued_inline) {
+    free(queued);
+  }
+  queued = queued_inline;
+  queued_size = QUEUED_LANES_INLINE;
+  queued_count = 0;
+}
+
+int argon2_thread_create(argon2_thread_handle_t *handle, argon2_thread_func_t func, void *args) {
+  if (queued == NULL) {
+    queued_clear();
+  }
+  if (handle == NULL || func == NULL) {
+    return -1;
+  }
+  if (queued_count == queued_size) {
+    queued_lane_t *more = malloc(2 * (size_t)queued_size * sizeof(*more));
+    if (more == NULL) {
+      // upstream gives up on the hash, and frees what the queue points to
+      queued_clear();
+      return -1;
+    }
+    memcpy(more, queued, queued_count * sizeof(*more));
+    if (queued != queued_inline) {
+      free(queued);
+    }
+    queued = more;
+    queued_size *= 2;
+  }
+  queued[queued_count++] = (queued_lane_t){ func, args };
+  memset(handle, 0, sizeof(*handle));
+  return 0;
+}
+
+static void run_queued_lane(void *arg, uint32_t index) {
+  queued_lane_t *lane = (queued_lane_t *)arg + index;
+  lane->func(lane->args);
+}
+
+int argon2_thread_join(argon2_thread_handle_t handle) {
+  (void)handle;
+  if (queued_count > 0) {
+    hash_lane_runner_fn runner = atomic_load(&lane_runner);
+    if (runner != NULL) {
+      runner(run_queued_lane, queued, queued_count);
+    } else {
+      for (uint32_t i = 0; i < queued_count; i++) {
+        run_queued_lane(queued, i);
+      }
+    }
+    queued_clear();
+  }
+  return 0;
+}
+
+/* Lanes return from their function instead; this must not end a pool worker. */
+void argon2_thread_exit(void) {
+}
+
+void fill_segment(const argon2_instance_t *instance, argon2_position_t position) {
+  kernel_fills[atomic_load_explicit(&current_kernel, memory_order_relaxed)](instance, position);
+}
+#endif
+
+int hash_core_argon2id(argon2_context *ctx) {
+  pthread_once(&kernel_once, select_kernel);
+  return argon2id_ctx(ctx);
+}
+
+int hash_core_argon2id_verify(argon2_context *ctx, const char *hash) {
+  pthread_once(&kernel_once, select_kernel);
+  return argon2id_verify_ctx(ctx, hash);
+}
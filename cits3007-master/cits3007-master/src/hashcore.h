@@ -0,0 +1,100 @@
+#ifndef HASHCORE_H
+#define HASHCORE_H
+
+#include <argon2.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @file hashcore.h
+ * @brief The Argon2 implementation the app hashes with.
+ *
+ * By default the app links the system's libargon2 (libraries.txt).
+ * Distribution builds of it often use upstream's portable reference
+ * code for the block function, which is where nearly all of a hash's
+ * time goes. Built with `make ARGON2=bundled`, the app instead compiles
+ * the upstream Argon2 sources vendored under vendor/ (see
+ * vendor/README.md), with upstream's optimised block function built
+ * once per x86 instruction set alongside the reference one. Each of
+ * those is a kernel; the widest one the running CPU supports is picked
+ * the first time a hash is run.
+ *
+ * Either way, hash with hash_core_argon2id() and verify with
+ * hash_core_argon2id_verify(), which behave exactly as argon2id_ctx()
+ * and argon2id_verify_ctx().
+ *
+ * The bundled build also replaces libargon2's threading backend: the
+ * lanes of each slice of a hash with threads > 1 are filled through
+ * the lane runner (the hash pool sets one that runs them on its idle
+ * workers), rather than on threads libargon2 starts for each slice.
+ */
+
+typedef enum {
+  HASH_KERNEL_LIBRARY,    // the system libargon2, built however it was built
+  HASH_KERNEL_REF,        // bundled: upstream's portable C (ref.c)
+  HASH_KERNEL_SSSE3,      // bundled: upstream's opt.c with 128-bit vectors
+  HASH_KERNEL_AVX2,       // bundled: opt.c with 256-bit vectors
+  HASH_KERNEL_AVX512,     // bundled: opt.c with 512-bit vectors (AVX-512F)
+  HASH_KERNEL_COUNT
+} hash_kernel_t;
+
+/**
+ * Whether the app was built with the bundled Argon2 (`make
+ * ARGON2=bundled`) rather than linked with the system's libargon2.
+ */
+bool hash_core_bundled(void);
+
+/**
+ * Name of a kernel, e.g. "avx2".
+ */
+const char *hash_core_kernel_name(hash_kernel_t kernel);
+
+/**
+ * Whether this build and the running CPU can use a kernel: only
+ * HASH_KERNEL_LIBRARY without the bundled Argon2, and only the others
+ * with it.
+ */
+bool hash_core_kernel_supported(hash_kernel_t kernel);
+
+/**
+ * The kernel hashes run with: the widest supported one, unless set
+ * otherwise.
+ */
+hash_kernel_t hash_core_kernel(void);
+
+/**
+ * Make hashes run with a kernel. Returns false (and changes nothing) if
+ * it isn't supported.
+ */
+bool hash_core_set_kernel(hash_kernel_t kernel);
+
+/**
+ * Fills lane `index`'s segment of the slice being filled.
+ */
+typedef void (*hash_lane_fn)(void *arg, uint32_t index);
+
+/**
+ * Runs fn(arg, i) for every i below count, possibly several at once on
+ * other threads, and returns once all of them have.
+ */
+typedef void (*hash_lane_runner_fn)(hash_lane_fn fn, void *arg, uint32_t count);
+
+/**
+ * With the bundled Argon2, have the lanes of each slice filled through
+ * runner, or (if NULL) one after another on the hashing thread. The
+ * system libargon2 fills lanes on threads of its own, so this changes
+ * nothing without the bundled Argon2.
+ */
+void hash_core_set_lane_runner(hash_lane_runner_fn runner);
+
+/**
+ * Argon2id as argon2id_ctx(), with the current kernel.
+ */
+int hash_core_argon2id(argon2_context *ctx);
+
+/**
+ * Verification as argon2id_verify_ctx(), with the current kernel.
+ */
+int hash_core_argon2id_verify(argon2_context *ctx, const char *hash);
+
+#endif // HASHCORE_H
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include "hashpool.h"
+#include "account_internal.h"
+#include "hasharena.h"
+#include "hashcore.h"
+#include "hashprofile.h"
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "banned.h"
+
+typedef struct {
+  hash_job_kind_t kind;
+  char hash[HASH_LENGTH];     // verify: the encoded hash to check against
+  char *password;             // owned copy, wiped when the job is done
+  hash_done_fn done;
+  void *arg;
+} job_t;
+
+/*
+ * The lanes of one slice of a multi-lane hash, shared out among the
+ * hashing thread and idle workers. It lives on the hashing thread's
+ * stack, on the `lanes` list while any of its lanes are untaken.
+ */
+typedef struct lane_batch {
+  hash_lane_fn fn;
+  void *arg;
+  uint32_t count;
+  uint32_t next;              // next lane to hand out
+  uint32_t finished;
+  struct lane_batch *link;
+} lane_batch_t;
+
+/*
+ * Everything below is guarded by pool_lock. The queue is a ring of
+ * `capacity` jobs starting at queue_head. Workers take lanes before
+ * jobs, since a lane finishes a hash that is already under way.
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static job_t *queue = NULL;
+static size_t capacity = 0;
+static size_t queue_head = 0;
+static size_t queue_len = 0;
+static pthread_t *workers = NULL;
+static size_t num_workers = 0;
+static bool running = false;
+static bool stopping = false;
+static uint64_t submitted = 0;
+static uint64_t rejected = 0;
+static uint64_t completed = 0;
+static size_t in_progress = 0;
+static pthread_cond_t lanes_finished = PTHREAD_COND_INITIALIZER;
+static lane_batch_t *lanes = NULL;
+static size_t lanes_claimed = 0;
+static uint64_t lanes_helped = 0;
+
+/* Take the next untaken lane of the first batch; the caller holds pool_lock. */
+static lane_batch_t *take_lane(uint32_t *index) {
+  lane_batch_t *b = lanes;
+  *index = b->next++;
+  if (b->next == b->count) {
+    lanes = b->link;
+  }
+  return b;
+}
+
+/* Run a lane taken with take_lane(); the caller holds pool_lock. */
+static void run_lane(lane_batch_t *b, uint32_t index) {
+  pthread_mutex_unlock(&pool_lock);
+  b->fn(b->arg, index);
+  pthread_mutex_lock(&pool_lock);
+  if (++b->finished == b->count) {
+    pthread_cond_broadcast(&lanes_finished);
+  }
+}
+
+/*
+ * The lane runner behind the bundled Argon2's threads: offer the
+ * slice's lanes to idle workers, run whichever ones nobody takes, then
+ * wait for the rest.
+ * Nothing waits on a lane that isn't already running, so a hash makes
+ * progress even when every worker is busy.
+ */
+static void run_lanes(hash_lane_fn fn, void *arg, uint32_t count) {
+  lane_batch_t batch = { .fn = fn, .arg = arg, .count = count };
+  pthread_mutex_lock(&pool_lock);
+  if (running && !stopping) {
+    batch.link = lanes;
+    lanes = &batch;
+    for (uint32_t i = 1; i < count; i++) {
+      pthread_cond_signal(&pool_work);
+    }
+  } else {
+    batch.next = count;
+    pthread_mutex_unlock(&pool_lock);
+    for (uint32_t i = 0; i < count; i++) {
+      fn(arg, i);
+    }
+    return;
+  }
+  while (batch.next < count) {
+    // Our batch may no longer be first; take from it directly.
+    uint32_t index = batch.next++;
+    if (batch.next == count) {
+      lane_batch_t **p = &lanes;
+      while (*p != &batch) {
+        p = &(*p)->link;
+      }
+      *p = batch.link;
+    }
+    run_lane(&batch, index);
+  }
+  while (batch.finished < count) {
+    pthread_cond_wait(&lanes_finished, &pool_lock);
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+static void run_job(job_t *job) {
+  hash_result_t result;
+  memset(&result, 0, sizeof(result));
+  result.kind = job->kind;
+  if (job->kind == HASH_JOB_VERIFY) {
+    hash_check_t check = account_check_hash(job->hash, job->password);
+    result.ok = check == HASH_CHECK_MATCH;
+    result.overloaded = check == HASH_CHECK_OVERLOADED;
+  } else {
+    result.ok = account_hash_password(job->password, result.hash);
+  }
+  explicit_bzero(job->password, strlen(job->password));
+  free(job->password);
+  job->done(&result, job->arg);
+  explicit_bzero(&result, sizeof(result));
+}
+
+static void *worker_main(void *unused) {
+  (void)unused;
+  pthread_mutex_lock(&pool_lock);
+  for (;;) {
+    while (queue_len == 0 && lanes == NULL && !stopping) {
+      pthread_cond_wait(&pool_work, &pool_lock);
+    }
+    if (lanes != NULL) {
+      uint32_t index;
+      lane_batch_t *b = take_lane(&index);
+      lanes_helped++;
+      run_lane(b, index);
+      continue;
+    }
+    if (queue_len == 0) {
+      break;
+    }
+    job_t job = queue[queue_head];
+    queue_head = (queue_head + 1) % capacity;
+    queue_len--;
+    in_progress++;
+    pthread_mutex_unlock(&pool_lock);
+
+    run_job(&job);
+
+    pthread_mutex_lock(&pool_lock);
+    in_progress--;
+    completed++;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return NULL;
+}
+
+/* Start the workers; the caller holds pool_lock. */
+static bool pool_start_locked(size_t want_workers, size_t want_capacity) {
+  if (want_workers == 0) {
+    want_workers = account_hash_parallelism();
+  }
+  if (want_capacity == 0) {
+    want_capacity = want_workers * HASHPOOL_QUEUE_PER_WORKER;
+  }
+  queue = calloc(want_capacity, sizeof(job_t));
+  workers = calloc(want_workers, sizeof(pthread_t));
+  if (!queue || !workers) {
+    log_message(LOG_ERROR, "hashpool: Failed to allocate memory");
+    free(queue);
+    free(workers);
+    queue = NULL;
+    workers = NULL;
+    return false;
+  }
+  capacity = want_capacity;
+  queue_head = queue_len = 0;
+  stopping = false;
+  for (num_workers = 0; num_workers < want_workers; num_workers++) {
+    if (pthread_create(&workers[num_workers], NULL, worker_main, NULL) != 0) {
+      break;
+    }
+  }
+  if (num_workers == 0) {
+    log_message(LOG_ERROR, "hashpool: Can't start worker threads");
+    free(queue);
+    free(workers);
+    queue = NULL;
+    workers = NULL;
+    return false;
+  }
+  if (num_workers < want_workers) {
+    log_message(LOG_WARN, "hashpool: Only started %zu of %zu workers", num_workers, want_workers);
+  }
+  // Fault in working memory for every worker now, not on their first hashes
+  size_t hash_bytes = (size_t)hash_profile_get().m_cost * 1024;
+  if (!hash_arena_reserve(num_workers, hash_bytes)) {
+    log_message(LOG_WARN, "hashpool: Workers will allocate their own hash memory");
+  }
+  hash_core_set_lane_runner(run_lanes);
+  running = true;
+  return true;
+}
+
+bool hashpool_start(size_t want_workers, size_t want_capacity) {
+  pthread_mutex_lock(&pool_lock);
+  bool ok = false;
+  if (running) {
+    log_message(LOG_ERROR, "hashpool_start: Pool is already running");
+  } else {
+    ok = pool_start_locked(want_workers, want_capacity);
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return ok;
+}
+
+void hashpool_stop(void) {
+  pthread_mutex_lock(&pool_lock);
+  if (!running || stopping) {
+    pthread_mutex_unlock(&pool_lock);
+    return;
+  }
+  stopping = true;
+  pthread_cond_broadcast(&pool_work);
+  pthread_mutex_unlock(&pool_lock);
+
+  for (size_t i = 0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  free(queue);
+  free(workers);
+  queue = NULL;
+  workers = NULL;
+  num_workers = 0;
+  capacity = 0;
+  running = false;
+  stopping = false;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+static bool submit(job_t *job) {
+  pthread_mutex_lock(&pool_lock);
+  bool ok = !stopping && (running || pool_start_locked(0, 0));
+  if (ok && queue_len == capacity) {
+    rejected++;
+    ok = false;
+  }
+  if (ok) {
+    queue[(queue_head + queue_len) % capacity] = *job;
+    queue_len++;
+    submitted++;
+    pthread_cond_signal(&pool_work);
+  }
+  pthread_mutex_unlock(&pool_lock);
+  if (!ok) {
+    explicit_bzero(job->password, strlen(job->password));
+    free(job->password);
+  }
+  return ok;
+}
+
+bool hashpool_submit_verify(const char *encoded_hash, const char *plaintext_password,
+                            hash_done_fn done, void *arg) {
+  if (encoded_hash == NULL || plaintext_password == NULL || done == NULL) {
+    log_message(LOG_ERROR, "hashpool_submit_verify: NULL argument(s)");
+    return false;
+  }
+  job_t job = { .kind = HASH_JOB_VERIFY, .done = done, .arg = arg };
+  strncpy(job.hash, encoded_hash, HASH_LENGTH - 1);
+  job.password = strdup(plaintext_password);
+  if (!job.password) {
+    log_message(LOG_ERROR, "hashpool_submit_verify: Failed to allocate memory");
+    return false;
+  }
+  return submit(&job);
+}
+
+bool hashpool_submit_hash(const char *plaintext_password, hash_done_fn done, void *arg) {
+  if (plaintext_password == NULL || done == NULL) {
+    log_message(LOG_ERROR, "hashpool_submit_hash: NULL argument(s)");
+    return false;
+  }
+  job_t job = { .kind = HASH_JOB_HASH, .done = done, .arg = arg };
+  job.password = strdup(plaintext_password);
+  if (!job.password) {
+    log_message(LOG_ERROR, "hashpool_submit_hash: Failed to allocate memory");
+    return false;
+  }
+  return submit(&job);
+}
+
+uint32_t hashpool_claim_lanes(uint32_t want) {
+  if (!hash_core_bundled()) {
+    return 0;
+  }
+  pthread_mutex_lock(&pool_lock);
+  size_t busy = in_progress + lanes_claimed;
+  size_t idle = running && !stopping && queue_len == 0 && busy < num_workers ? num_workers - busy : 0;
+  uint32_t granted = want < idle ? want : (uint32_t)idle;
+  lanes_claimed += granted;
+  pthread_mutex_unlock(&pool_lock);
+  return granted;
+}
+
+void hashpool_release_lanes(uint32_t claimed) {
+  pthread_mutex_lock(&pool_lock);
+  lanes_claimed = claimed < lanes_claimed ? lanes_claimed - claimed : 0;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void hashpool_stats(hashpool_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool_lock);
+  stats->submitted = submitted;
+  stats->rejected = rejected;
+  stats->completed = completed;
+  stats->queued = queue_len;
+  stats->running = in_progress;
+  stats->workers = num_workers;
+  stats->capacity = capacity;
+  stats->lanes_claimed = lanes_claimed;
+  stats->lanes_helped = lanes_helped;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void hash_future_init(hash_future_t *future) {
+  pthread_mutex_init(&future->lock, NULL);
+  pthread_cond_init(&future->cond, NULL);
+  future->done = false;
+  memset(&future->result, 0, sizeof(future->result));
+}
+
+void hash_future_done(const hash_result_t *result, void *arg) {
+  hash_future_t *future = arg;
+  pthread_mutex_lock(&future->lock);
+  future->result = *result;
+  future->done = true;
+  pthread_cond_signal(&future->cond);
+  pthread_mutex_unlock(&future->lock);
+}
+
+const hash_result_t *hash_future_wait(hash_future_t *future) {
+  pthread_mutex_lock(&future->lock);
+  while (!future->done) {
+    pthread_cond_wait(&future->cond, &future->lock);
+  }
+  pthread_mutex_unlock(&future->lock);
+  return &future->result;
+}
+
+void hash_future_destroy(hash_future_t *future) {
+  explicit_bzero(&future->result, sizeof(future->result));
+  pthread_cond_destroy(&future->cond);
+  pthread_mutex_destroy(&future->lock);
+}
@@ -0,0 +1,148 @@
+#ifndef HASHPOOL_H
+#define HASHPOOL_H
+
+#include "account.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file hashpool.h
+ * @brief Worker pool for password hashing and verification.
+ *
+ * Argon2 takes tens of milliseconds and tens of megabytes per call, so
+ * rather than running it on whatever thread handles a request, jobs are
+ * queued for a fixed set of worker threads and their results handed to
+ * a completion callback, called on the worker. hash_future_t wraps a
+ * callback for callers that would rather wait for the result.
+ *
+ * The queue is bounded: once it is full, submitting fails straight
+ * away, so that a burst of requests is turned away cheaply instead of
+ * piling up behind the workers.
+ *
+ * The pool starts with default settings on first use, unless
+ * hashpool_start() was called first. Starting it reserves a hash arena
+ * slab (hasharena.h) per worker, so workers begin with their Argon2
+ * memory already faulted in.
+ *
+ * With the bundled Argon2 (`make ARGON2=bundled`, see hashcore.h),
+ * idle workers also help with hashes of more than one lane: the pool
+ * becomes the lane runner behind libargon2's threading, and the lanes
+ * of each slice are shared out among the hashing thread and whichever
+ * workers have nothing else to do. When the pool is lightly loaded, new
+ * hashes may claim idle workers' time with hashpool_claim_lanes() to
+ * use more lanes than the hash profile's (see
+ * hash_profile_set_max_lanes()). The system libargon2 starts threads
+ * of its own for lanes instead, so without the bundled Argon2 there is
+ * nothing to claim.
+ */
+
+typedef enum {
+  HASH_JOB_VERIFY,   // check a password against an encoded hash
+  HASH_JOB_HASH      // hash a password with a fresh salt
+} hash_job_kind_t;
+
+typedef struct {
+  hash_job_kind_t kind;
+  bool ok;                    // verify: the password matched; hash: hashing succeeded
+  bool overloaded;            // verify: not checked, for lack of room in the hash memory budget
+  char hash[HASH_LENGTH];     // hash: the encoded hash (empty otherwise)
+} hash_result_t;
+
+/**
+ * Completion callback, called once per accepted job on a worker
+ * thread. result is only valid for the duration of the call.
+ */
+typedef void (*hash_done_fn)(const hash_result_t *result, void *arg);
+
+typedef struct {
+  uint64_t submitted;   // jobs accepted
+  uint64_t rejected;    // jobs turned away because the queue was full
+  uint64_t completed;   // jobs finished
+  size_t queued;        // jobs waiting for a worker now
+  size_t running;       // jobs being worked on now
+  size_t workers;
+  size_t capacity;      // most jobs that may wait at once
+  size_t lanes_claimed; // extra lanes claimed by hashes now
+  uint64_t lanes_helped; // lanes of other threads' hashes run by workers
+} hashpool_stats_t;
+
+/**
+ * Start the pool with the given number of worker threads and queue
+ * capacity; 0 for either picks a default (account_hash_parallelism()
+ * workers, and a queue of HASHPOOL_QUEUE_PER_WORKER jobs per worker).
+ * Returns false (and logs) if the pool is already running or the
+ * threads can't be started.
+ */
+bool hashpool_start(size_t workers, size_t capacity);
+
+#define HASHPOOL_QUEUE_PER_WORKER 32
+
+/**
+ * Stop the pool: jobs already queued are finished and their callbacks
+ * called, then the workers exit. Submitting again restarts the pool.
+ */
+void hashpool_stop(void);
+
+/**
+ * Queue a check of plaintext_password against encoded_hash. The
+ * password is copied (and wiped once used), so the caller's buffers
+ * may be reused as soon as this returns. Returns false (and does not
+ * call done) if the queue is full or an argument is NULL.
+ */
+bool hashpool_submit_verify(const char *encoded_hash, const char *plaintext_password,
+                            hash_done_fn done, void *arg);
+
+/**
+ * Queue hashing of plaintext_password, as account_hash_password()
+ * would. Returns false as for hashpool_submit_verify().
+ */
+bool hashpool_submit_hash(const char *plaintext_password, hash_done_fn done, void *arg);
+
+/**
+ * Claim up to `want` extra lanes for a hash about to start: as many as
+ * there are workers neither running a job nor claimed by another hash,
+ * or none if jobs are waiting, the pool isn't running, or the app hashes
+ * with the system libargon2 (which wouldn't use them). Under load
+ * this is always 0, so hashes keep to one lane per job and the pool to
+ * its full throughput. Release the claim with hashpool_release_lanes()
+ * once the hash is done.
+ */
+uint32_t hashpool_claim_lanes(uint32_t want);
+
+void hashpool_release_lanes(uint32_t claimed);
+
+/**
+ * Current counters and settings of the pool.
+ */
+void hashpool_stats(hashpool_stats_t *stats);
+
+/**
+ * A completion to wait on. Initialise it, submit a job with
+ * hash_future_done as the callback and the future as its argument,
+ * then hash_future_wait() for the result.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool done;
+  hash_result_t result;
+} hash_future_t;
+
+void hash_future_init(hash_future_t *future);
+void hash_future_done(const hash_result_t *result, void *future);
+
+/**
+ * Wait for the job to complete and return its result, which stays
+ * valid until hash_future_destroy().
+ */
+const hash_result_t *hash_future_wait(hash_future_t *future);
+
+/**
+ * Release the future's resources and wipe its result.
+ */
+void hash_future_destroy(hash_future_t *future);
+
+#endif // HASHPOOL_H
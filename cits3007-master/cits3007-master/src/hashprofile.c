@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include "hashprofile.h"
+#include "account_internal.h"
+#include "hashcore.h"
+#include "logging.h"
+
+#include <argon2.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "banned.h"
+
+/* Hashes timed per calibration candidate, unless the caller says otherwise. */
+#define CALIBRATE_DEFAULT_SAMPLES 10
+
+/* Never calibrate to more passes than this. */
+#define CALIBRATE_MAX_T_COST 16
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static hash_profile_t profile = {
+  .t_cost = ACCOUNT_HASH_T_COST,
+  .m_cost = ACCOUNT_HASH_M_COST,
+  .parallelism = ACCOUNT_HASH_PARALLELISM,
+};
+static uint32_t max_lanes = 0;
+
+static bool profile_valid(const hash_profile_t *p) {
+  return p->t_cost >= ARGON2_MIN_TIME && p->parallelism >= ARGON2_MIN_LANES
+      && p->parallelism <= ARGON2_MAX_LANES
+      && p->m_cost >= ARGON2_SYNC_POINTS * 2 * p->parallelism;
+}
+
+hash_profile_t hash_profile_get(void) {
+  pthread_mutex_lock(&profile_lock);
+  hash_profile_t p = profile;
+  pthread_mutex_unlock(&profile_lock);
+  return p;
+}
+
+bool hash_profile_set(const hash_profile_t *p) {
+  if (p == NULL || !profile_valid(p)) {
+    log_message(LOG_ERROR, "hash_profile_set: Invalid Argon2 parameters");
+    return false;
+  }
+  pthread_mutex_lock(&profile_lock);
+  profile = *p;
+  pthread_mutex_unlock(&profile_lock);
+  char text[64];
+  hash_profile_format(p, text, sizeof(text));
+  log_message(LOG_INFO, "Password hashes will use %s", text);
+  return true;
+}
+
+void hash_profile_set_max_lanes(uint32_t lanes) {
+  pthread_mutex_lock(&profile_lock);
+  max_lanes = lanes < ARGON2_MAX_LANES ? lanes : ARGON2_MAX_LANES;
+  pthread_mutex_unlock(&profile_lock);
+}
+
+uint32_t hash_profile_max_lanes(void) {
+  pthread_mutex_lock(&profile_lock);
+  uint32_t lanes = max_lanes > profile.parallelism ? max_lanes : profile.parallelism;
+  pthread_mutex_unlock(&profile_lock);
+  return lanes;
+}
+
+bool hash_profile_parse(const char *spec, hash_profile_t *out) {
+  if (spec == NULL || out == NULL) {
+    return false;
+  }
+  hash_profile_t p = { 0, 0, 0 };
+  const char *s = spec;
+  for (;;) {
+    char key = s[0];
+    if ((key != 'm' && key != 't' && key != 'p') || s[1] != '='
+        || s[2] < '0' || s[2] > '9') {
+      return false;
+    }
+    errno = 0;
+    char *end;
+    unsigned long value = strtoul(s + 2, &end, 10);
+    if (errno != 0 || value == 0 || value > UINT32_MAX) {
+      return false;
+    }
+    uint32_t *field = key == 'm' ? &p.m_cost : key == 't' ? &p.t_cost : &p.parallelism;
+    if (*field != 0) {
+      return false;  // given twice
+    }
+    *field = (uint32_t)value;
+    if (*end != ',') {
+      break;
+    }
+    s = end + 1;
+  }
+  if (p.m_cost == 0 || p.t_cost == 0 || p.parallelism == 0) {
+    return false;
+  }
+  *out = p;
+  return true;
+}
+
+bool hash_profile_format(const hash_profile_t *p, char *buf, size_t len) {
+  if (p == NULL || buf == NULL) {
+    return false;
+  }
+  int n = snprintf(buf, len, "m=%u,t=%u,p=%u", p->m_cost, p->t_cost, p->parallelism);
+  return n > 0 && (size_t)n < len;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Time `samples` raw hashes with profile p, returning the 99th
+ * percentile in milliseconds, or a negative value if Argon2 failed.
+ */
+static double measure_p99(const hash_profile_t *p, size_t samples) {
+  static const char password[] = "calibration password";
+  unsigned char salt[ACCOUNT_SALT_LENGTH];
+  unsigned char out[ACCOUNT_HASH_OUTPUT_LENGTH];
+  memset(salt, 0x5a, sizeof(salt));
+  double *times = malloc(samples * sizeof(double));
+  if (!times) {
+    return -1;
+  }
+  for (size_t i = 0; i < samples; i++) {
+    double start = now_ms();
+    argon2_context ctx = {
+      .out = out, .outlen = sizeof(out),
+      .pwd = (uint8_t *)password, .pwdlen = sizeof(password) - 1,
+      .salt = salt, .saltlen = sizeof(salt),
+      .t_cost = p->t_cost, .m_cost = p->m_cost,
+      .lanes = p->parallelism, .threads = p->parallelism,
+      .version = ARGON2_VERSION_13,
+    };
+    int result = hash_core_argon2id(&ctx);
+    times[i] = now_ms() - start;
+    if (result != ARGON2_OK) {
+      log_message(LOG_ERROR, "hash_profile_calibrate: %s", argon2_error_message(result));
+      free(times);
+      return -1;
+    }
+  }
+  qsort(times, samples, sizeof(double), compare_doubles);
+  size_t rank = (samples * 99 + 99) / 100;   // ceil(0.99 n)
+  double p99 = times[rank - 1];
+  free(times);
+  return p99;
+}
+
+bool hash_profile_calibrate(const hash_calibration_t *goal, hash_profile_t *chosen,
+                            double *p99_ms) {
+  if (goal == NULL || chosen == NULL || goal->target_p99_ms <= 0) {
+    log_message(LOG_ERROR, "hash_profile_calibrate: Invalid goal");
+    return false;
+  }
+  uint32_t lanes = goal->parallelism ? goal->parallelism : 1;
+  size_t samples = goal->samples ? goal->samples : CALIBRATE_DEFAULT_SAMPLES;
+  uint32_t floor_m = HASH_CALIBRATE_MIN_M_COST < goal->max_m_cost
+                   ? HASH_CALIBRATE_MIN_M_COST : goal->max_m_cost;
+  uint32_t m = 1;
+  while (m <= goal->max_m_cost / 2) {
+    m *= 2;
+  }
+
+  for (; m >= floor_m && m > 0; m /= 2) {
+    hash_profile_t p = { .t_cost = 1, .m_cost = m, .parallelism = lanes };
+    if (!profile_valid(&p)) {
+      break;
+    }
+    double one = measure_p99(&p, samples);
+    if (one < 0) {
+      return false;
+    }
+    log_message(LOG_INFO, "hash_profile_calibrate: m=%u,t=1: p99 %.1f ms", m, one);
+    if (one > goal->target_p99_ms) {
+      continue;
+    }
+
+    // A hash costs roughly a fixed setup plus t passes, so the target
+    // over one hash's time is a safe first guess at t. Work down from
+    // there to a t that fits, then see whether more passes still do.
+    double best = one;
+    uint32_t t = (uint32_t)(goal->target_p99_ms / one);
+    if (t > CALIBRATE_MAX_T_COST) {
+      t = CALIBRATE_MAX_T_COST;
+    }
+    uint32_t fits = 1;
+    for (; t > 1; t--) {
+      p.t_cost = t;
+      double ms = measure_p99(&p, samples);
+      if (ms < 0) {
+        return false;
+      }
+      log_message(LOG_INFO, "hash_profile_calibrate: m=%u,t=%u: p99 %.1f ms", m, t, ms);
+      if (ms <= goal->target_p99_ms) {
+        fits = t;
+        best = ms;
+        break;
+      }
+    }
+    for (t = fits + 1; t <= CALIBRATE_MAX_T_COST; t++) {
+      p.t_cost = t;
+      double ms = measure_p99(&p, samples);
+      if (ms < 0 || ms > goal->target_p99_ms) {
+        break;
+      }
+      fits = t;
+      best = ms;
+    }
+    p.t_cost = fits;
+    *chosen = p;
+    if (p99_ms) {
+      *p99_ms = best;
+    }
+    return true;
+  }
+  log_message(LOG_ERROR, "hash_profile_calibrate: No profile within %u KiB meets %.1f ms",
+              goal->max_m_cost, goal->target_p99_ms);
+  return false;
+}
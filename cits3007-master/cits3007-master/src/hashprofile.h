@@ -0,0 +1,98 @@
+#ifndef HASHPROFILE_H
+#define HASHPROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file hashprofile.h
+ * @brief Argon2id cost settings for new password hashes.
+ *
+ * Every new password hash is made with the current profile. Existing
+ * hashes carry their own parameters, so changing the profile never
+ * stops old passwords from verifying.
+ *
+ * The profile starts out as the ACCOUNT_HASH_* defaults in
+ * account_internal.h. It can be set explicitly, or chosen by
+ * hash_profile_calibrate() to suit the machine.
+ */
+
+typedef struct {
+  uint32_t t_cost;        // iterations
+  uint32_t m_cost;        // memory, in KiB
+  uint32_t parallelism;   // lanes
+} hash_profile_t;
+
+/**
+ * The profile new hashes are made with.
+ */
+hash_profile_t hash_profile_get(void);
+
+/**
+ * Make p the current profile. Returns false (and logs) if Argon2 would
+ * reject it: every cost must be at least 1, and m_cost at least 8 KiB
+ * per lane.
+ */
+bool hash_profile_set(const hash_profile_t *p);
+
+/**
+ * Parse a profile written as in an encoded Argon2 hash: comma-separated
+ * "m=", "t=" and "p=" settings, in any order (for example
+ * "m=65536,t=3,p=1"). Parsing stops at the first character that can't
+ * be part of the list, such as the '$' after it in an encoded hash.
+ * Returns false if any of the three is missing or malformed.
+ */
+bool hash_profile_parse(const char *spec, hash_profile_t *out);
+
+/**
+ * Write p as "m=...,t=...,p=..." into buf. Returns false if it didn't fit.
+ */
+bool hash_profile_format(const hash_profile_t *p, char *buf, size_t len);
+
+/** What hash_profile_calibrate() should aim for. */
+typedef struct {
+  double target_p99_ms;       // slowest acceptable hash, 99th percentile
+  uint32_t max_m_cost;        // memory each hash may use, in KiB
+  uint32_t parallelism;       // lanes (0 means 1)
+  size_t samples;             // hashes timed per candidate (0 for a default)
+} hash_calibration_t;
+
+/** Smallest memory cost calibration will consider, in KiB, unless the budget is smaller. */
+#define HASH_CALIBRATE_MIN_M_COST (8 * 1024)
+
+/**
+ * Time Argon2id hashes on this machine, with the implementation the
+ * app was built to use (hashcore.h), and pick the strongest profile
+ * that fits the goal: the largest power-of-two memory cost within the
+ * budget for which at least one pass meets the target, then
+ * as many passes as still do. Memory comes first because it is what
+ * makes guessing expensive on dedicated hardware.
+ *
+ * On success stores the profile in *chosen and its measured 99th
+ * percentile time in *p99_ms (if not NULL); the current profile is not
+ * changed. Returns false (and logs) if even the cheapest candidate
+ * misses the target.
+ */
+bool hash_profile_calibrate(const hash_calibration_t *goal, hash_profile_t *chosen,
+                            double *p99_ms);
+
+/**
+ * Let new hashes use up to max_lanes lanes, rather than the profile's
+ * parallelism, when there are idle hash workers to run them (see
+ * hashpool_claim_lanes()). A hash then takes about 1/p of the time on
+ * p cores, for the same memory and passes. 0 turns this off, which is
+ * the default. Only builds with the bundled Argon2 (hashcore.h) run
+ * lanes on the hash workers, so other builds never use the extra lanes.
+ *
+ * Hashes with any number of lanes from the profile's parallelism up to
+ * max_lanes count as current, so they aren't rehashed on login.
+ */
+void hash_profile_set_max_lanes(uint32_t max_lanes);
+
+/**
+ * The most lanes a new hash may use: at least the profile's parallelism.
+ */
+uint32_t hash_profile_max_lanes(void);
+
+#endif // HASHPROFILE_H
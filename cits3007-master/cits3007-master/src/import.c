@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include "import.h"
+#include "account_internal.h"
+#include "logging.h"
+#include "store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "banned.h"
+
+/* Upper bound on hashing threads, whatever the machine reports. */
+#define IMPORT_MAX_THREADS 256
+
+typedef struct {
+  account_t *accounts;          // accounts to hash, in batch order
+  const char **passwords;       // matching plaintext passwords
+  size_t count;
+  atomic_size_t next;           // next account to hash
+  atomic_size_t failed;
+} hash_work_t;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * As many threads as account_hash_parallelism() allows, but no more
+ * than there are passwords.
+ */
+static size_t default_threads(size_t count) {
+  size_t threads = account_hash_parallelism();
+  return threads < count ? threads : count;
+}
+
+static void *hash_worker(void *arg) {
+  hash_work_t *work = arg;
+  for (;;) {
+    size_t i = atomic_fetch_add(&work->next, 1);
+    if (i >= work->count) {
+      return NULL;
+    }
+    if (!account_hash_password(work->passwords[i], work->accounts[i].password_hash)) {
+      work->accounts[i].password_hash[0] = '\0';
+      atomic_fetch_add(&work->failed, 1);
+    }
+  }
+}
+
+/**
+ * Hash every password in work, using up to `threads` threads (the
+ * calling thread included).
+ */
+static void hash_all(hash_work_t *work, size_t threads) {
+  if (threads > IMPORT_MAX_THREADS) {
+    threads = IMPORT_MAX_THREADS;
+  }
+  pthread_t tids[IMPORT_MAX_THREADS];
+  size_t started = 0;
+  for (; started + 1 < threads; started++) {
+    if (pthread_create(&tids[started], NULL, hash_worker, work) != 0) {
+      log_message(LOG_WARN, "import: Only started %zu hashing threads", started + 1);
+      break;
+    }
+  }
+  hash_worker(work);
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+}
+
+/**
+ * Open-addressing set of batch entries keyed by userid, used to find
+ * userids repeated within a batch in a single pass.
+ */
+typedef struct {
+  uint32_t *slots;   // entry index + 1; 0 marks an empty slot
+  size_t mask;
+} userid_set_t;
+
+static bool userid_set_init(userid_set_t *set, size_t count) {
+  size_t size = 16;
+  while (size < count * 2) {
+    size *= 2;
+  }
+  set->slots = calloc(size, sizeof(uint32_t));
+  set->mask = size - 1;
+  return set->slots != NULL;
+}
+
+/**
+ * Add entries[i] to the set. Returns false if its userid was already
+ * present.
+ */
+static bool userid_set_add(userid_set_t *set, const import_entry_t *entries, size_t i) {
+  size_t pos = store_hash_userid(entries[i].userid) & set->mask;
+  while (set->slots[pos] != 0) {
+    if (strncmp(entries[set->slots[pos] - 1].userid, entries[i].userid, USER_ID_LENGTH) == 0) {
+      return false;
+    }
+    pos = (pos + 1) & set->mask;
+  }
+  set->slots[pos] = (uint32_t)(i + 1);
+  return true;
+}
+
+bool account_import(const import_entry_t *entries, size_t count,
+                    size_t threads, import_stats_t *stats) {
+  import_stats_t local;
+  if (stats == NULL) {
+    stats = &local;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->entries = count;
+  if (count == 0) {
+    return true;
+  }
+  if (entries == NULL || count >= UINT32_MAX) {
+    log_message(LOG_ERROR, "account_import: Invalid batch");
+    return false;
+  }
+  double start = now_seconds();
+
+  userid_set_t seen;
+  account_t *accounts = malloc(count * sizeof(account_t));
+  const char **passwords = malloc(count * sizeof(char *));
+  if (!accounts || !passwords || !userid_set_init(&seen, count)) {
+    log_message(LOG_ERROR, "account_import: Failed to allocate memory");
+    free(accounts);
+    free(passwords);
+    return false;
+  }
+
+  // Single validation pass: field checks, then duplicates within the
+  // batch and against the store.
+  size_t valid = 0;
+  for (size_t i = 0; i < count; i++) {
+    const import_entry_t *e = &entries[i];
+    if (!e->userid || !e->password || !e->email || !e->birthdate) {
+      log_message(LOG_WARN, "account_import: Entry %zu: Missing field", i + 1);
+      stats->invalid++;
+      continue;
+    }
+    const char *problem = account_check_new(e->userid, e->password, e->email, e->birthdate);
+    if (problem) {
+      log_message(LOG_WARN, "account_import: Entry %zu: %s", i + 1, problem);
+      stats->invalid++;
+      continue;
+    }
+    if (!userid_set_add(&seen, entries, i) || store_contains(e->userid)) {
+      log_message(LOG_WARN, "account_import: Entry %zu: User ID %s has already been used",
+                  i + 1, e->userid);
+      stats->duplicates++;
+      continue;
+    }
+    account_init_new(&accounts[valid], e->userid, e->email, e->birthdate);
+    passwords[valid] = e->password;
+    valid++;
+  }
+  free(seen.slots);
+
+  // Hash in parallel, then drop any that failed and insert the rest.
+  hash_work_t work = { .accounts = accounts, .passwords = passwords, .count = valid };
+  atomic_init(&work.next, 0);
+  atomic_init(&work.failed, 0);
+  if (valid > 0) {
+    hash_all(&work, threads ? threads : default_threads(valid));
+  }
+  stats->failed = atomic_load(&work.failed);
+
+  size_t hashed = 0;
+  for (size_t i = 0; i < valid; i++) {
+    if (accounts[i].password_hash[0] != '\0') {
+      if (hashed != i) {
+        accounts[hashed] = accounts[i];
+      }
+      hashed++;
+    }
+  }
+  stats->imported = store_add_batch(accounts, hashed);
+  stats->duplicates += hashed - stats->imported;
+
+  explicit_bzero(accounts, count * sizeof(account_t));
+  free(accounts);
+  free(passwords);
+
+  stats->seconds = now_seconds() - start;
+  stats->accounts_per_sec = stats->seconds > 0 ? (double)stats->imported / stats->seconds : 0;
+  log_message(LOG_INFO, "account_import: Imported %zu of %zu accounts in %.2fs (%.1f accounts/sec)",
+              stats->imported, count, stats->seconds, stats->accounts_per_sec);
+  return true;
+}
+
+/**
+ * Split one line into its four tab-separated fields, in place.
+ * Returns false if it doesn't have exactly four.
+ */
+static bool parse_line(char *line, import_entry_t *entry) {
+  char *fields[4];
+  size_t n = 0;
+  fields[n++] = line;
+  for (char *p = line; *p != '\0'; p++) {
+    if (*p == '\t') {
+      if (n == 4) {
+        return false;
+      }
+      *p = '\0';
+      fields[n++] = p + 1;
+    }
+  }
+  if (n != 4) {
+    return false;
+  }
+  entry->userid = fields[0];
+  entry->password = fields[1];
+  entry->email = fields[2];
+  entry->birthdate = fields[3];
+  return true;
+}
+
+bool account_import_file(const char *path, size_t threads, import_stats_t *stats) {
+  import_stats_t local;
+  if (stats == NULL) {
+    stats = &local;
+  }
+  memset(stats, 0, sizeof(*stats));
+  if (path == NULL) {
+    log_message(LOG_ERROR, "account_import_file: NULL path");
+    return false;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    log_message(LOG_ERROR, "account_import_file: Can't read '%s': %s", path, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size == 0) {
+    close(fd);
+    return account_import(NULL, 0, threads, stats);
+  }
+
+  // Read the whole file, plus a terminating NUL, so that lines can be
+  // split in place.
+  char *text = malloc(size + 1);
+  size_t got = 0;
+  while (text && got < size) {
+    ssize_t r = read(fd, text + got, size - got);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    got += (size_t)r;
+  }
+  close(fd);
+  if (!text || got != size) {
+    log_message(LOG_ERROR, "account_import_file: Can't read '%s'", path);
+    if (text) {
+      explicit_bzero(text, got);
+    }
+    free(text);
+    return false;
+  }
+  text[size] = '\0';
+
+  size_t lines = 0;
+  for (size_t i = 0; i < size; i++) {
+    lines += text[i] == '\n';
+  }
+  import_entry_t *entries = malloc((lines + 1) * sizeof(import_entry_t));
+  if (!entries) {
+    log_message(LOG_ERROR, "account_import_file: Failed to allocate memory");
+    explicit_bzero(text, size);
+    free(text);
+    return false;
+  }
+
+  size_t count = 0;
+  size_t malformed = 0;
+  size_t line_no = 0;
+  char *line = text;
+  while (line < text + size) {
+    char *end = memchr(line, '\n', (size_t)(text + size - line));
+    if (end == NULL) {
+      end = text + size;
+    }
+    *end = '\0';
+    if (end > line && end[-1] == '\r') {
+      end[-1] = '\0';
+    }
+    line_no++;
+    if (line[0] != '\0' && line[0] != '#') {
+      if (parse_line(line, &entries[count])) {
+        count++;
+      } else {
+        log_message(LOG_WARN, "account_import_file: %s:%zu: Expected 4 tab-separated fields",
+                    path, line_no);
+        malformed++;
+      }
+    }
+    line = end + 1;
+  }
+
+  bool ok = account_import(entries, count, threads, stats);
+  stats->entries += malformed;
+  stats->invalid += malformed;
+
+  // The buffer holds the plaintext passwords.
+  explicit_bzero(text, size);
+  free(text);
+  free(entries);
+  return ok;
+}
@@ -0,0 +1,62 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file import.h
+ * @brief Bulk account import.
+ *
+ * A batch is validated in a single pass (field checks, plus duplicate
+ * userids within the batch and against the store), the Argon2id hashes
+ * are computed on a pool of worker threads, and the surviving accounts
+ * are added to the store in one batch insert. Entries that fail any
+ * step are skipped, logged and counted; the rest are still imported.
+ */
+
+typedef struct {
+  const char *userid;
+  const char *password;   // plaintext
+  const char *email;
+  const char *birthdate;  // YYYY-MM-DD
+} import_entry_t;
+
+typedef struct {
+  size_t entries;          // entries (or non-blank, non-comment lines) read
+  size_t imported;         // accounts added to the store
+  size_t invalid;          // entries that failed validation or didn't parse
+  size_t duplicates;       // userids repeated in the batch or already stored
+  size_t failed;           // entries whose password couldn't be hashed
+  double seconds;          // wall-clock time for the whole import
+  double accounts_per_sec; // imported / seconds
+} import_stats_t;
+
+/**
+ * Import a batch of accounts.
+ *
+ * threads is the number of hashing threads to use; 0 picks one per
+ * online CPU, limited by the memory available for Argon2's working
+ * memory. stats, if non-NULL, is filled in.
+ *
+ * Returns false only if the import could not run at all (e.g. memory
+ * allocation failed); skipped entries are reported through stats.
+ */
+bool account_import(const import_entry_t *entries, size_t count,
+                    size_t threads, import_stats_t *stats);
+
+/**
+ * Import accounts from a file with one account per line, as four
+ * tab-separated fields:
+ *
+ *     userid<TAB>password<TAB>email<TAB>birthdate
+ *
+ * Blank lines and lines starting with '#' are ignored. Lines without
+ * exactly four fields are counted as invalid. Plaintext passwords are
+ * wiped from memory once hashed.
+ *
+ * Returns false if the file can't be read or the import can't run.
+ */
+bool account_import_file(const char *path, size_t threads, import_stats_t *stats);
+
+#endif // IMPORT_H
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include "ioqueue.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "banned.h"
+
+/* A write queued or in flight, pointing into its batch's buffer. */
+typedef struct {
+  int fd;
+  uint32_t len;
+  const char *data;
+} queued_write_t;
+
+/* One submission's worth of writes and their bytes. */
+typedef struct {
+  queued_write_t writes[IOQUEUE_DEPTH];
+  size_t count;
+  size_t used;
+  char data[IOQUEUE_BATCH_BYTES];
+} batch_t;
+
+/*
+ * A thread's io_uring instance. Writes are queued in batches[filling];
+ * the other batch is the previous submission, whose writes (in_flight
+ * of them still) must stay put until their completions come back.
+ */
+typedef struct {
+  int fd;
+  uint32_t *sq_tail;
+  uint32_t sq_mask;
+  uint32_t *sq_array;
+  struct io_uring_sqe *sqes;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;             // NULL if the CQ shares sq_map
+  size_t cq_map_len;
+  size_t sqes_len;
+  int filling;
+  size_t in_flight;
+  batch_t batches[2];
+} ring_t;
+
+static atomic_bool enabled;
+static atomic_bool unavailable;   // setting up a ring has failed before
+static _Thread_local ring_t *ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static atomic_uint_fast64_t queued;
+static atomic_uint_fast64_t submits;
+static atomic_uint_fast64_t direct;
+static atomic_uint_fast64_t retried;
+static atomic_uint_fast64_t failed;
+
+static void count(atomic_uint_fast64_t *counter) {
+  atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  count(&submits);
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Write all of iov to fd, however many writev() calls that takes. */
+static bool direct_writev(int fd, struct iovec *iov, int n) {
+  while (n > 0) {
+    count(&direct);
+    ssize_t done = writev(fd, iov, n);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      count(&failed);
+      return false;
+    }
+    while (n > 0 && (size_t)done >= iov->iov_len) {
+      done -= (ssize_t)iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + done;
+      iov->iov_len -= (size_t)done;
+    }
+  }
+  return true;
+}
+
+static void direct_write(int fd, const void *data, size_t len) {
+  struct iovec iov = { (void *)data, len };
+  direct_writev(fd, &iov, 1);
+}
+
+static void ring_close(ring_t *r) {
+  if (r->sqes) {
+    munmap(r->sqes, r->sqes_len);
+  }
+  if (r->cq_map) {
+    munmap(r->cq_map, r->cq_map_len);
+  }
+  if (r->sq_map) {
+    munmap(r->sq_map, r->sq_map_len);
+  }
+  close(r->fd);
+  free(r);
+}
+
+static ring_t *ring_open(void) {
+  ring_t *r = calloc(1, sizeof(ring_t));
+  if (!r) {
+    return NULL;
+  }
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  r->fd = uring_setup(IOQUEUE_DEPTH, &params);
+  if (r->fd < 0) {
+    free(r);
+    return NULL;
+  }
+  // Writes at the file position (offset -1) and no lost completions.
+  uint32_t needed = IORING_FEAT_RW_CUR_POS | IORING_FEAT_NODROP;
+  if ((params.features & needed) != needed) {
+    ring_close(r);
+    return NULL;
+  }
+
+  r->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  r->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && r->cq_map_len > r->sq_map_len) {
+    r->sq_map_len = r->cq_map_len;
+  }
+  r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_map == MAP_FAILED) {
+    r->sq_map = NULL;
+    ring_close(r);
+    return NULL;
+  }
+  char *cq = r->sq_map;
+  if (!single) {
+    r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_map == MAP_FAILED) {
+      r->cq_map = NULL;
+      ring_close(r);
+      return NULL;
+    }
+    cq = r->cq_map;
+  }
+  r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    r->sqes = NULL;
+    ring_close(r);
+    return NULL;
+  }
+
+  char *sq = r->sq_map;
+  r->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+  r->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+  r->sq_array = (uint32_t *)(sq + params.sq_off.array);
+  r->cq_head = (uint32_t *)(cq + params.cq_off.head);
+  r->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+  r->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return r;
+}
+
+/*
+ * Collect the completions that are in, and with wait, wait for the
+ * rest of the previous submission. A write that came up short or was
+ * cancelled (the chain stops at the first that fails) is finished here
+ * with write(); completions arrive in chain order, so that keeps the
+ * order too.
+ */
+static void ring_reap(ring_t *r, bool wait) {
+  batch_t *previous = &r->batches[r->filling ^ 1];
+  for (;;) {
+    uint32_t head = *r->cq_head;
+    uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+      const queued_write_t *w = &previous->writes[cqe->user_data];
+      if (cqe->res == (int32_t)w->len) {
+        // done
+      } else if (cqe->res >= 0) {
+        count(&retried);
+        direct_write(w->fd, w->data + cqe->res, w->len - (uint32_t)cqe->res);
+      } else if (cqe->res == -ECANCELED) {
+        count(&retried);
+        direct_write(w->fd, w->data, w->len);
+      } else {
+        count(&failed);
+      }
+      r->in_flight--;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    if (!wait || r->in_flight == 0) {
+      return;
+    }
+    if (uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      // Can't happen with a working ring; don't spin on it.
+      log_message(LOG_ERROR, "ioqueue: io_uring_enter failed: %s", strerror(errno));
+      return;
+    }
+  }
+}
+
+/*
+ * Hand the queued writes to the kernel as one linked chain, after the
+ * previous submission has finished, and start filling the other batch.
+ * With wait, the same io_uring_enter() also waits for the whole chain
+ * to complete (the completion queue is empty to begin with, as the
+ * previous submission has been reaped).
+ */
+static void ring_submit(ring_t *r, bool wait) {
+  batch_t *b = &r->batches[r->filling];
+  if (b->count == 0) {
+    if (r->in_flight > 0) {
+      ring_reap(r, false);
+    }
+    return;
+  }
+  ring_reap(r, true);
+
+  uint32_t tail = *r->sq_tail;
+  for (size_t i = 0; i < b->count; i++) {
+    struct io_uring_sqe *sqe = &r->sqes[tail & r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = b->writes[i].fd;
+    sqe->addr = (uint64_t)(uintptr_t)b->writes[i].data;
+    sqe->len = b->writes[i].len;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = i;
+    sqe->flags = i + 1 < b->count ? IOSQE_IO_LINK : 0;
+    r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+    tail++;
+  }
+  __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+  size_t submitted = 0;
+  unsigned min_complete = wait ? (unsigned)b->count : 0;
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  while (submitted < b->count) {
+    // A short submission returns without waiting, so this can't hang.
+    int n = uring_enter(r->fd, (unsigned)(b->count - submitted), min_complete, flags);
+    if (n > 0) {
+      submitted += (size_t)n;
+    } else if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      // The kernel took none of what's left; write it out here.
+      log_message(LOG_ERROR, "ioqueue: io_uring_enter failed: %s", strerror(errno));
+      for (size_t i = submitted; i < b->count; i++) {
+        direct_write(b->writes[i].fd, b->writes[i].data, b->writes[i].len);
+      }
+      break;
+    }
+  }
+  r->in_flight = submitted;
+  r->filling ^= 1;
+  r->batches[r->filling].count = 0;
+  r->batches[r->filling].used = 0;
+}
+
+static void ring_drain(ring_t *r) {
+  ring_submit(r, true);
+  ring_reap(r, true);
+}
+
+/* A thread exiting takes its ring with it, after finishing its writes. */
+static void ring_destroy(void *arg) {
+  ring_t *r = arg;
+  ring_drain(r);
+  ring_close(r);
+}
+
+static void ring_key_init(void) {
+  pthread_key_create(&ring_key, ring_destroy);
+}
+
+/* This thread's ring, set up on first use; NULL if it can't be. */
+static ring_t *thread_ring(void) {
+  if (ring || atomic_load_explicit(&unavailable, memory_order_relaxed)) {
+    return ring;
+  }
+  pthread_once(&ring_once, ring_key_init);
+  ring = ring_open();
+  if (!ring) {
+    atomic_store(&unavailable, true);
+    return NULL;
+  }
+  pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+bool ioqueue_enable(bool on) {
+  if (on && !thread_ring()) {
+    log_message(LOG_WARN, "ioqueue: io_uring is not available; writing directly");
+    on = false;
+  }
+  atomic_store(&enabled, on);
+  return on;
+}
+
+bool ioqueue_enabled(void) {
+  return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+void ioqueue_writev(int fd, struct iovec *iov, int n) {
+  size_t len = 0;
+  for (int i = 0; i < n; i++) {
+    len += iov[i].iov_len;
+  }
+  if (len == 0) {
+    return;
+  }
+  ring_t *r = ioqueue_enabled() ? thread_ring() : ring;
+  if (r && ioqueue_enabled() && len <= IOQUEUE_BATCH_BYTES) {
+    batch_t *b = &r->batches[r->filling];
+    if (b->count == IOQUEUE_DEPTH || b->used + len > IOQUEUE_BATCH_BYTES) {
+      ring_submit(r, false);
+      b = &r->batches[r->filling];
+    }
+    queued_write_t *w = &b->writes[b->count++];
+    w->fd = fd;
+    w->len = (uint32_t)len;
+    w->data = b->data + b->used;
+    for (int i = 0; i < n; i++) {
+      memcpy(b->data + b->used, iov[i].iov_base, iov[i].iov_len);
+      b->used += iov[i].iov_len;
+    }
+    count(&queued);
+    return;
+  }
+  // Not queueing, but anything queued before must still go first.
+  if (r && (r->in_flight > 0 || r->batches[r->filling].count > 0)) {
+    ring_drain(r);
+  }
+  direct_writev(fd, iov, n);
+}
+
+void ioqueue_write(int fd, const void *data, size_t len) {
+  struct iovec iov = { (void *)data, len };
+  ioqueue_writev(fd, &iov, 1);
+}
+
+void ioqueue_submit(void) {
+  if (ring) {
+    ring_submit(ring, false);
+  }
+}
+
+void ioqueue_drain(void) {
+  if (ring) {
+    ring_drain(ring);
+  }
+}
+
+void ioqueue_stats(ioqueue_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->queued = atomic_load(&queued);
+  stats->submits = atomic_load(&submits);
+  stats->direct = atomic_load(&direct);
+  stats->retried = atomic_load(&retried);
+  stats->failed = atomic_load(&failed);
+}
@@ -0,0 +1,102 @@
+#ifndef IOQUEUE_H
+#define IOQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * @file ioqueue.h
+ * @brief Batched writes through io_uring, for login replies and logs.
+ *
+ * A login writes a few short messages (the reply to the client, a log
+ * line), each of which used to be a write() of its own. With the queue
+ * enabled, ioqueue_write() instead copies the message into a buffer of
+ * the calling thread and queues it on the thread's io_uring instance,
+ * and ioqueue_submit() hands everything queued since the last call to
+ * the kernel in a single io_uring_enter(). The writes then complete in
+ * the background, and each submit collects the completions of the one
+ * before without waiting for them; or ioqueue_drain() submits them and
+ * waits for them to complete, in that same io_uring_enter().
+ *
+ * Writes from one thread reach each descriptor in the order they were
+ * queued: each submission is one linked chain, and a thread waits for
+ * its previous submission to finish before making another. A write that
+ * comes up short, or is cancelled because one before it did, is
+ * finished with write() when its completion is collected.
+ *
+ * A queued write only looks up its descriptor when the kernel issues
+ * it, and one redone with write() not until the next submit. So leave
+ * writes in the background with ioqueue_submit() only on descriptors
+ * known to stay open until then (one the program keeps for its whole
+ * life). Finish with ioqueue_drain() before returning to a caller that
+ * may close the descriptor as soon as the call returns, or a write
+ * could reach whatever reuses the number. handle_login() and friends
+ * drain once per login (or per batch), as they write to the caller's
+ * client_output_fd and log_fd.
+ *
+ * The queue is off unless ioqueue_enable() turns it on, and wherever
+ * io_uring can't be set up (an old kernel, a seccomp filter, or the
+ * io_uring_disabled sysctl) every call simply writes straight away, as
+ * before. The ring is set up with raw system calls, so no liburing is
+ * needed.
+ */
+
+/** Writes per submission; more than that submits early. */
+#define IOQUEUE_DEPTH 64
+
+/** Bytes of queued writes per submission; bigger writes aren't queued. */
+#define IOQUEUE_BATCH_BYTES (16 * 1024)
+
+typedef struct {
+  uint64_t queued;      // writes queued on a ring
+  uint64_t submits;     // io_uring_enter() calls, including waits
+  uint64_t direct;      // write()/writev() calls made instead
+  uint64_t retried;     // queued writes finished with write()
+  uint64_t failed;      // writes that failed
+} ioqueue_stats_t;
+
+/**
+ * Turn the queue on or off. Returns whether it is now on, which when
+ * asking for on is false if io_uring isn't available here.
+ */
+bool ioqueue_enable(bool on);
+
+/** Whether ioqueue_write() currently queues. */
+bool ioqueue_enabled(void);
+
+/**
+ * Write len bytes of data to fd: queue them on this thread's ring, or,
+ * if the queue is off (or they don't fit in a submission), write them
+ * now, after anything this thread already has queued.
+ */
+void ioqueue_write(int fd, const void *data, size_t len);
+
+/**
+ * As ioqueue_write(), with the data gathered from iov into one write.
+ * iov may be changed, as when writing it straight away takes more than
+ * one writev().
+ */
+void ioqueue_writev(int fd, struct iovec *iov, int count);
+
+/**
+ * Submit this thread's queued writes, and collect any finished ones.
+ * Does nothing (cheaply) if the thread has nothing queued.
+ */
+void ioqueue_submit(void);
+
+/**
+ * Submit this thread's queued writes and wait until all of them are
+ * done, in one system call: before returning to a caller that may
+ * close the descriptors written to, before reading what they wrote, or
+ * before the program exits (a thread that exits drains its own).
+ */
+void ioqueue_drain(void);
+
+/**
+ * Counters across all threads since the program started.
+ */
+void ioqueue_stats(ioqueue_stats_t *stats);
+
+#endif // IOQUEUE_H
@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "banned.h"
+
+/*
+ * File layout: a 16-byte header, then records. Each record is a
+ * 12-byte header followed by its payload; the checksum covers the
+ * length, type and payload, so a torn or partly written record fails
+ * it.
+ *
+ * Positions handed out by journal_append() count record bytes since
+ * the journal was opened, and never go backwards, so a checkpoint
+ * (which moves records to the front of a new file) doesn't disturb
+ * anyone waiting on one.
+ */
+
+#define JOURNAL_MAGIC       "OOJOURN"
+#define JOURNAL_VERSION     1
+#define JOURNAL_HEADER_SIZE 16
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} file_header_t;
+
+typedef struct {
+  uint32_t length;     // payload bytes
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t crc;        // CRC-32 of the fields above and the payload
+} record_header_t;
+
+#define RECORD_HEADER_SIZE sizeof(record_header_t)
+
+struct journal {
+  char *path;
+  int fd;
+  pthread_mutex_t lock;
+  pthread_cond_t flushed;        // signalled when a flush finishes
+  pthread_mutex_t checkpoint_lock;
+
+  unsigned char *buf;            // records appended but not yet written
+  size_t buf_len;
+  size_t buf_cap;
+  unsigned char *spare;          // the buffer the last flush wrote
+  size_t spare_cap;
+
+  uint64_t appended;             // position after the last record appended
+  uint64_t durable;              // position after the last record synced
+  uint64_t file_base;            // position of the first record in the file
+  bool flushing;                 // a flush (or checkpoint) owns the file
+  bool failed;                   // a write failed; nothing more is accepted
+
+  uint64_t records;
+  uint64_t syncs;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    crc_table[i] = c;
+  }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static uint32_t record_crc(const record_header_t *h, const void *payload) {
+  uint32_t crc = crc32_update(0xFFFFFFFFu, h, offsetof(record_header_t, crc));
+  return ~crc32_update(crc, payload, h->length);
+}
+
+static bool write_all(int fd, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+/* Flush the directory holding path, so that a rename into it is durable. */
+static bool sync_parent(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir = slash ? strndup(path, (size_t)(slash - path) + 1) : strdup(".");
+  if (!dir) {
+    return false;
+  }
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  free(dir);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+/**
+ * Read and replay the records in an open journal file, returning the
+ * file offset just past the last good one, or 0 if apply failed.
+ */
+static off_t replay(int fd, const char *path, journal_apply_fn apply, void *ctx,
+                    size_t *replayed) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  unsigned char *data = malloc(size ? size : 1);
+  size_t got = 0;
+  while (data && got < size) {
+    ssize_t r = read(fd, data + got, size - got);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    got += (size_t)r;
+  }
+  if (!data || got != size) {
+    log_message(LOG_ERROR, "journal: Can't read '%s'", path);
+    free(data);
+    return 0;
+  }
+
+  size_t pos = JOURNAL_HEADER_SIZE;
+  size_t count = 0;
+  while (pos + RECORD_HEADER_SIZE <= size) {
+    record_header_t h;
+    memcpy(&h, data + pos, RECORD_HEADER_SIZE);
+    if (h.length > JOURNAL_MAX_PAYLOAD || h.length > size - pos - RECORD_HEADER_SIZE
+        || record_crc(&h, data + pos + RECORD_HEADER_SIZE) != h.crc) {
+      break;
+    }
+    if (!apply(h.type, data + pos + RECORD_HEADER_SIZE, h.length, ctx)) {
+      log_message(LOG_ERROR, "journal: Failed to replay record %zu of '%s'", count + 1, path);
+      free(data);
+      return 0;
+    }
+    pos += RECORD_HEADER_SIZE + h.length;
+    count++;
+  }
+  if (pos < size) {
+    log_message(LOG_WARN, "journal: Discarding %zu bytes of incomplete records from '%s'",
+                size - pos, path);
+  }
+  free(data);
+  *replayed = count;
+  return (off_t)pos;
+}
+
+journal_t *journal_open(const char *path, journal_apply_fn apply, void *ctx, size_t *replayed) {
+  size_t count = 0;
+  if (path == NULL || apply == NULL) {
+    log_message(LOG_ERROR, "journal_open: NULL argument(s)");
+    return NULL;
+  }
+  pthread_once(&crc_once, crc_init);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    log_message(LOG_ERROR, "journal_open: Can't open '%s': %s", path, strerror(errno));
+    return NULL;
+  }
+  file_header_t fh;
+  ssize_t n = read(fd, &fh, sizeof(fh));
+  off_t end;
+  if (n == 0) {
+    // new journal
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, JOURNAL_MAGIC, sizeof(fh.magic));
+    fh.version = JOURNAL_VERSION;
+    if (!write_all(fd, (const unsigned char *)&fh, sizeof(fh)) || fdatasync(fd) != 0
+        || !sync_parent(path)) {
+      log_message(LOG_ERROR, "journal_open: Can't initialise '%s'", path);
+      close(fd);
+      return NULL;
+    }
+    end = JOURNAL_HEADER_SIZE;
+  } else if (n != (ssize_t)sizeof(fh) || memcmp(fh.magic, JOURNAL_MAGIC, sizeof(fh.magic)) != 0
+             || fh.version != JOURNAL_VERSION) {
+    log_message(LOG_ERROR, "journal_open: '%s' is not a compatible journal", path);
+    close(fd);
+    return NULL;
+  } else if ((end = replay(fd, path, apply, ctx, &count)) == 0) {
+    close(fd);
+    return NULL;
+  }
+  // New records go straight after the last good one.
+  if (ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) != end) {
+    log_message(LOG_ERROR, "journal_open: Can't truncate '%s': %s", path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  journal_t *j = calloc(1, sizeof(journal_t));
+  if (!j || !(j->path = strdup(path))) {
+    log_message(LOG_ERROR, "journal_open: Failed to allocate memory");
+    free(j);
+    close(fd);
+    return NULL;
+  }
+  j->fd = fd;
+  pthread_mutex_init(&j->lock, NULL);
+  pthread_cond_init(&j->flushed, NULL);
+  pthread_mutex_init(&j->checkpoint_lock, NULL);
+  j->appended = j->durable = (uint64_t)(end - JOURNAL_HEADER_SIZE);
+  if (replayed) {
+    *replayed = count;
+  }
+  return j;
+}
+
+uint64_t journal_append(journal_t *j, uint16_t type, const void *payload, size_t len) {
+  if (j == NULL || (payload == NULL && len > 0) || len > JOURNAL_MAX_PAYLOAD) {
+    log_message(LOG_ERROR, "journal_append: Invalid record");
+    return 0;
+  }
+  record_header_t h = { .length = (uint32_t)len, .type = type };
+  h.crc = record_crc(&h, payload);
+
+  pthread_mutex_lock(&j->lock);
+  size_t needed = j->buf_len + RECORD_HEADER_SIZE + len;
+  if (!j->failed && needed > j->buf_cap) {
+    size_t cap = j->buf_cap ? j->buf_cap * 2 : 64 * 1024;
+    while (cap < needed) {
+      cap *= 2;
+    }
+    unsigned char *buf = realloc(j->buf, cap);
+    if (buf) {
+      j->buf = buf;
+      j->buf_cap = cap;
+    }
+  }
+  if (j->failed || needed > j->buf_cap) {
+    pthread_mutex_unlock(&j->lock);
+    log_message(LOG_ERROR, "journal_append: Can't append to '%s'", j->path);
+    return 0;
+  }
+  memcpy(j->buf + j->buf_len, &h, RECORD_HEADER_SIZE);
+  if (len > 0) {
+    memcpy(j->buf + j->buf_len + RECORD_HEADER_SIZE, payload, len);
+  }
+  j->buf_len = needed;
+  j->appended += RECORD_HEADER_SIZE + len;
+  j->records++;
+  uint64_t pos = j->appended;
+  pthread_mutex_unlock(&j->lock);
+  return pos;
+}
+
+/*
+ * Take ownership of the file for a flush or checkpoint: wait for any
+ * flush in progress, then detach the pending records. Called and
+ * returns with j->lock held; *out and *len receive the records, and
+ * the journal's positions are unchanged until flush_end().
+ */
+static void flush_begin(journal_t *j, unsigned char **out, size_t *len) {
+  while (j->flushing) {
+    pthread_cond_wait(&j->flushed, &j->lock);
+  }
+  j->flushing = true;
+  *out = j->buf;
+  *len = j->buf_len;
+  j->buf = j->spare;
+  j->buf_cap = j->spare_cap;
+  j->buf_len = 0;
+  j->spare_cap = 0;
+}
+
+static void flush_end(journal_t *j, unsigned char *out, size_t cap, uint64_t durable, bool ok) {
+  j->spare = out;
+  j->spare_cap = cap;
+  if (ok) {
+    j->durable = durable;
+  } else {
+    j->failed = true;
+  }
+  j->flushing = false;
+  pthread_cond_broadcast(&j->flushed);
+}
+
+bool journal_wait(journal_t *j, uint64_t pos) {
+  if (j == NULL || pos == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&j->lock);
+  while (j->durable < pos && !j->failed) {
+    if (j->flushing) {
+      // someone else is flushing; their flush may not cover pos, in
+      // which case the next one will
+      pthread_cond_wait(&j->flushed, &j->lock);
+      continue;
+    }
+    unsigned char *out;
+    size_t len;
+    size_t cap = j->buf_cap;
+    flush_begin(j, &out, &len);
+    uint64_t target = j->appended;
+    pthread_mutex_unlock(&j->lock);
+
+    bool ok = write_all(j->fd, out, len) && fdatasync(j->fd) == 0;
+    if (!ok) {
+      log_message(LOG_ERROR, "journal: Can't write '%s': %s", j->path, strerror(errno));
+    }
+
+    pthread_mutex_lock(&j->lock);
+    j->syncs++;
+    flush_end(j, out, cap, target, ok);
+  }
+  bool ok = j->durable >= pos;
+  pthread_mutex_unlock(&j->lock);
+  return ok;
+}
+
+/*
+ * Copy bytes [from, to) of the old journal file to fd.
+ */
+static bool copy_range(int from_fd, off_t from, off_t to, int fd) {
+  unsigned char chunk[64 * 1024];
+  while (from < to) {
+    size_t want = (size_t)(to - from) < sizeof(chunk) ? (size_t)(to - from) : sizeof(chunk);
+    ssize_t n = pread(from_fd, chunk, want, from);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0 || !write_all(fd, chunk, (size_t)n)) {
+      return false;
+    }
+    from += n;
+  }
+  return true;
+}
+
+bool journal_checkpoint(journal_t *j, journal_sync_fn sync, void *ctx) {
+  if (j == NULL || sync == NULL) {
+    return false;
+  }
+  pthread_mutex_lock(&j->checkpoint_lock);
+  pthread_mutex_lock(&j->lock);
+  uint64_t cut = j->appended;
+  bool failed = j->failed;
+  pthread_mutex_unlock(&j->lock);
+
+  // Everything up to cut was applied before it was appended, so once
+  // the caller's state is synced those records are redundant.
+  if (failed || !sync(ctx)) {
+    pthread_mutex_unlock(&j->checkpoint_lock);
+    return false;
+  }
+
+  size_t tmp_len = strlen(j->path) + 5;
+  char *tmp_path = malloc(tmp_len);
+  int fd = -1;
+  if (tmp_path) {
+    snprintf(tmp_path, tmp_len, "%s.tmp", j->path);
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  }
+
+  pthread_mutex_lock(&j->lock);
+  unsigned char *out;
+  size_t len;
+  size_t cap = j->buf_cap;
+  flush_begin(j, &out, &len);
+  uint64_t target = j->appended;
+  uint64_t written = j->durable;
+  uint64_t base = j->file_base;
+  pthread_mutex_unlock(&j->lock);
+
+  // The new file holds the records from cut on: first those already
+  // written to the old file, then those still in memory.
+  file_header_t fh;
+  memset(&fh, 0, sizeof(fh));
+  memcpy(fh.magic, JOURNAL_MAGIC, sizeof(fh.magic));
+  fh.version = JOURNAL_VERSION;
+  size_t skip = cut > written ? (size_t)(cut - written) : 0;
+  bool ok = fd >= 0
+      && write_all(fd, (const unsigned char *)&fh, sizeof(fh))
+      && (cut >= written
+          || copy_range(j->fd, (off_t)(JOURNAL_HEADER_SIZE + cut - base),
+                        (off_t)(JOURNAL_HEADER_SIZE + written - base), fd))
+      && write_all(fd, out + skip, len - skip)
+      && fdatasync(fd) == 0
+      && rename(tmp_path, j->path) == 0;
+  if (ok && !sync_parent(j->path)) {
+    log_message(LOG_WARN, "journal: Can't sync the directory of '%s'", j->path);
+  }
+  if (!ok) {
+    log_message(LOG_ERROR, "journal: Checkpoint of '%s' failed: %s", j->path, strerror(errno));
+    if (tmp_path) {
+      unlink(tmp_path);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    // Leave the old file in use, with the detached records written to
+    // it as a flush would have.
+    ok = write_all(j->fd, out, len) && fdatasync(j->fd) == 0;
+    pthread_mutex_lock(&j->lock);
+    j->syncs++;
+    flush_end(j, out, cap, target, ok);
+    pthread_mutex_unlock(&j->lock);
+    free(tmp_path);
+    pthread_mutex_unlock(&j->checkpoint_lock);
+    return false;
+  }
+
+  pthread_mutex_lock(&j->lock);
+  int old_fd = j->fd;
+  j->fd = fd;
+  j->file_base = cut;
+  j->syncs++;
+  flush_end(j, out, cap, target, true);
+  pthread_mutex_unlock(&j->lock);
+  close(old_fd);
+  free(tmp_path);
+  pthread_mutex_unlock(&j->checkpoint_lock);
+  return true;
+}
+
+size_t journal_size(journal_t *j) {
+  if (j == NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&j->lock);
+  size_t size = (size_t)(j->appended - j->file_base);
+  pthread_mutex_unlock(&j->lock);
+  return size;
+}
+
+void journal_stats(journal_t *j, uint64_t *records, uint64_t *syncs) {
+  if (j == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&j->lock);
+  if (records) {
+    *records = j->records;
+  }
+  if (syncs) {
+    *syncs = j->syncs;
+  }
+  pthread_mutex_unlock(&j->lock);
+}
+
+void journal_close(journal_t *j) {
+  if (j == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&j->lock);
+  uint64_t end = j->appended;
+  pthread_mutex_unlock(&j->lock);
+  if (end > 0 && !journal_wait(j, end)) {
+    log_message(LOG_ERROR, "journal_close: Records were lost from '%s'", j->path);
+  }
+  close(j->fd);
+  pthread_mutex_destroy(&j->checkpoint_lock);
+  pthread_cond_destroy(&j->flushed);
+  pthread_mutex_destroy(&j->lock);
+  free(j->buf);
+  free(j->spare);
+  free(j->path);
+  free(j);
+}
@@ -0,0 +1,93 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file journal.h
+ * @brief Append-only write-ahead journal with group commit.
+ *
+ * A journal is a file of checksummed records, each an opaque payload
+ * with a caller-defined type. Appending a record only copies it into
+ * memory and returns its position; journal_wait() makes it durable.
+ * Whichever waiter finds no flush in progress writes out everything
+ * appended so far and calls fdatasync() once for all of it, while the
+ * others wait for that flush (or the next one) to cover their records.
+ * Many concurrent writers therefore share each sync.
+ *
+ * On opening, the records already in the file are replayed in order.
+ * Replay stops at the first record that is incomplete or fails its
+ * checksum, as the tail of a write interrupted by a crash would, and
+ * the file is truncated there.
+ *
+ * journal_checkpoint() bounds the file's size: once the caller's state
+ * is durable on its own, the records it covers are dropped by writing
+ * the remainder to a new file and renaming it into place.
+ */
+
+typedef struct journal journal_t;
+
+/**
+ * Called for each record replayed by journal_open(), in file order.
+ * Returning false stops the replay and fails the open.
+ */
+typedef bool (*journal_apply_fn)(uint16_t type, const void *payload, size_t len, void *ctx);
+
+/**
+ * Called by journal_checkpoint() to make the caller's state durable.
+ */
+typedef bool (*journal_sync_fn)(void *ctx);
+
+/** Largest payload a record may carry. */
+#define JOURNAL_MAX_PAYLOAD 4096
+
+/**
+ * Open (creating if necessary) the journal at path, passing each
+ * record already in it to apply. If replayed is not NULL, the number
+ * of records replayed is stored there. Returns NULL (and logs) on
+ * failure.
+ */
+journal_t *journal_open(const char *path, journal_apply_fn apply, void *ctx, size_t *replayed);
+
+/**
+ * Append a record. Returns its position, to pass to journal_wait(), or
+ * 0 (and logs) if the journal has failed or the payload is too large.
+ * Appends are ordered: a record is replayed after every record whose
+ * append returned before its own began.
+ */
+uint64_t journal_append(journal_t *j, uint16_t type, const void *payload, size_t len);
+
+/**
+ * Wait until the record at position pos, and every record before it,
+ * is on disk. Returns false if the journal failed to write it.
+ */
+bool journal_wait(journal_t *j, uint64_t pos);
+
+/**
+ * Drop the records already appended from the journal. sync is called
+ * first and must make everything those records describe durable
+ * without the journal; records appended meanwhile are kept. Returns
+ * false (and leaves the journal as it was) if sync or the rewrite
+ * fails.
+ */
+bool journal_checkpoint(journal_t *j, journal_sync_fn sync, void *ctx);
+
+/**
+ * Bytes of records currently in the journal, written or not.
+ */
+size_t journal_size(journal_t *j);
+
+/**
+ * Records appended and fdatasync() calls made since the journal was
+ * opened. Either pointer may be NULL.
+ */
+void journal_stats(journal_t *j, uint64_t *records, uint64_t *syncs);
+
+/**
+ * Make every appended record durable, then close the journal.
+ */
+void journal_close(journal_t *j);
+
+#endif // JOURNAL_H
@@ -1,65 +1,757 @@
 #define _GNU_SOURCE
 #include "login.h"
+#include "login_async.h"
+#include "login_batch.h"
 #include "logging.h"
 #include "db.h"
+#include "store.h"
 #include "account.h"
+#include "account_internal.h"
+#include "hashpool.h"
+#include "ioqueue.h"
+#include "ratelimit.h"
+#include "rehash.h"
+#include "session.h"
 
-#include <unistd.h>    // for write(), dprintf()
+#include <limits.h>    // for IOV_MAX
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>     // for vsnprintf()
+#include <sys/uio.h>   // for struct iovec
+#include <stdlib.h>    // for malloc()
 #include <string.h>    // for strlen()
 #include <time.h>      // for time_t
 #include "banned.h"
 
+/*
+ * A login has three stages: the checks that need no hashing
+ * (login_admit, then login_begin), the password hash itself, and
+ * recording and reporting the outcome (login_finish). handle_login()
+ * runs them in turn; handle_login_async() runs the hash on the hashing
+ * pool and the last stage on whichever worker ran it;
+ * handle_login_batch() runs each stage for a whole batch before moving
+ * on to the next. A successful login whose stored hash predates the
+ * current hash settings also queues a rehash (see rehash.h).
+ *
+ * Replies and log lines for descriptors go through ioqueue_write(),
+ * and each of those entry points drains them once it is done with a
+ * login (or batch), so that with the io_uring queue on (ioqueue.h) they
+ * cost one system call between them. Draining, rather than leaving
+ * them to complete in the background, means they have all been written
+ * when the entry point returns: the caller may close client_output_fd
+ * or log_fd straight after, and a queued reply, session token and all,
+ * could otherwise reach whichever connection gets its number.
+ */
 
-login_result_t handle_login(const char *userid, const char *password,
-                            ip4_addr_t client_ip, time_t login_time,
-                            int client_output_fd, int log_fd,
-                            login_session_data_t *session)
+/* Longest reply to a client: "Login successful!" and a session token. */
+#define LOGIN_REPLY_MAX 128
+
+/* Longest log line; longer ones are cut short. */
+#define LOGIN_LOG_LINE_MAX 256
+
+/* A growable run of log lines. */
+typedef struct {
+    char *text;
+    size_t len;
+    size_t cap;
+} login_text_t;
+
+/* A batch's log lines, by where they will go. */
+typedef struct {
+    login_text_t to_log_fd;
+    login_text_t warnings;  // for log_message(LOG_WARN)
+    login_text_t errors;    // for log_message(LOG_ERROR)
+} login_log_t;
+
+/*
+ * Where a login's messages go. A single login writes each one as it is
+ * produced. A login in a batch keeps its reply in `reply` and its log
+ * lines in the batch's login_log_t, and the batch writes them all out
+ * together once every login in it is done (see batch_flush()). A login
+ * from handle_login_async_reply() keeps its reply to hand to its
+ * callback.
+ */
+typedef struct {
+    int client_output_fd;
+    int log_fd;
+    login_log_t *batch;     // NULL: write log lines straight away
+    bool keep_reply;        // keep the reply in `reply` instead of writing it
+    size_t reply_len;
+    char reply[LOGIN_REPLY_MAX];
+} login_out_t;
+
+static void login_out_init(login_out_t *out, int client_output_fd, int log_fd)
+{
+    out->client_output_fd = client_output_fd;
+    out->log_fd = log_fd;
+    out->batch = NULL;
+    out->keep_reply = false;
+    out->reply_len = 0;
+}
+
+/* A constant message and its length. */
+typedef struct {
+    const char *text;
+    size_t len;
+} login_message_t;
+
+#define LOGIN_MESSAGE(s) { s, sizeof(s) - 1 }
+
+/* What the client is told of each outcome. */
+static const login_message_t login_replies[] = {
+    [LOGIN_SUCCESS] = LOGIN_MESSAGE("Login successful!\n"),
+    [LOGIN_FAIL_USER_NOT_FOUND] = LOGIN_MESSAGE("Login failed: user not found.\n"),
+    [LOGIN_FAIL_BAD_PASSWORD] = LOGIN_MESSAGE("Login failed: incorrect password.\n"),
+    [LOGIN_FAIL_ACCOUNT_EXPIRED] = LOGIN_MESSAGE("Login failed: account expired.\n"),
+    [LOGIN_FAIL_ACCOUNT_BANNED] = LOGIN_MESSAGE("Login failed: account banned.\n"),
+    [LOGIN_FAIL_IP_BANNED] = LOGIN_MESSAGE("Login failed: too many attempts from your address.\n"),
+    [LOGIN_FAIL_INTERNAL_ERROR] = LOGIN_MESSAGE("Login failed: internal error.\n"),
+};
+
+/*
+ * Send the client the reply for result, followed by suffix_len bytes
+ * of suffix (e.g. a session token line), in a single write.
+ */
+static void login_reply(login_out_t *out, login_result_t result,
+                        const char *suffix, size_t suffix_len)
+{
+    const login_message_t *reply = &login_replies[result];
+    if (!out->keep_reply) {
+        struct iovec iov[2] = {
+            { (void *)reply->text, reply->len },
+            { (void *)suffix, suffix_len },
+        };
+        ioqueue_writev(out->client_output_fd, iov, suffix_len > 0 ? 2 : 1);
+        return;
+    }
+    size_t len = reply->len + suffix_len;
+    if (len > sizeof(out->reply)) {
+        len = sizeof(out->reply);   // can't happen with replies as they are
+    }
+    memcpy(out->reply, reply->text, reply->len < len ? reply->len : len);
+    if (len > reply->len) {
+        memcpy(out->reply + reply->len, suffix, len - reply->len);
+    }
+    out->reply_len = len;
+}
+
+static bool text_append(login_text_t *t, const char *line, size_t len)
 {
-    if (!userid || !password || !session) {
-        const char *msg = "Login failed: internal error.\n";
-        dprintf(client_output_fd, "%s", msg);
-        log_message(LOG_ERROR, "ERROR: handle_login: NULL input\n");
-        return LOGIN_FAIL_INTERNAL_ERROR;
+    if (t->len + len > t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 1024;
+        while (cap < t->len + len) {
+            cap *= 2;
+        }
+        char *text = realloc(t->text, cap);
+        if (!text) {
+            return false;
+        }
+        t->text = text;
+        t->cap = cap;
     }
+    memcpy(t->text + t->len, line, len);
+    t->len += len;
+    return true;
+}
 
-    account_t acc;
-    if (!account_lookup_by_userid(userid, &acc)) {
-        const char *msg = "Login failed: user not found.\n";
-        dprintf(client_output_fd, "%s", msg);
-        log_message(LOG_ERROR, "ERROR: User '%s' not found\n", userid);
+/*
+ * Log a line of len bytes, through log_message() (level LOG_WARN or
+ * LOG_ERROR) or, with level LOG_INFO, to log_fd. line must be
+ * null-terminated.
+ */
+static void login_log_line(login_out_t *out, log_level_t level, const char *line, size_t len)
+{
+    if (out->batch != NULL) {
+        login_text_t *t = level == LOG_INFO ? &out->batch->to_log_fd
+                        : level == LOG_WARN ? &out->batch->warnings
+                        : &out->batch->errors;
+        if (text_append(t, line, len)) {
+            return;
+        }
+    }
+    if (level == LOG_INFO) {
+        ioqueue_write(out->log_fd, line, len);
+    } else {
+        log_message(level, "%s", line);
+    }
+}
+
+/* Log a formatted message, as login_log_line(). */
+__attribute__((format(__printf__, 3, 4)))
+static void login_log(login_out_t *out, log_level_t level, const char *fmt, ...)
+{
+    char line[LOGIN_LOG_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    login_log_line(out, level, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+/*
+ * Log head, name and tail run together, as login_log_line(): the
+ * usual shape of line, naming a user, put together without going
+ * through printf.
+ */
+static void login_log_name(login_out_t *out, log_level_t level,
+                           const char *head, const char *name, const char *tail)
+{
+    char line[LOGIN_LOG_LINE_MAX];
+    size_t len = 0;
+    const char *parts[3] = { head, name, tail };
+    for (int i = 0; i < 3; i++) {
+        size_t n = strnlen(parts[i], sizeof(line) - 1 - len);
+        memcpy(line + len, parts[i], n);
+        len += n;
+    }
+    line[len] = '\0';
+    login_log_line(out, level, line, len);
+}
+
+/**
+ * Turn the client away if its address, or its /24, has made too many
+ * attempts lately (see ratelimit.h), before anything is looked up or
+ * hashed. Returns LOGIN_SUCCESS if the login may go on.
+ */
+static login_result_t login_admit(ip4_addr_t client_ip, time_t login_time, login_out_t *out)
+{
+    ratelimit_verdict_t verdict = ratelimit_admit(client_ip, login_time);
+    if (verdict == RATELIMIT_ADMIT) {
+        return LOGIN_SUCCESS;
+    }
+    login_reply(out, LOGIN_FAIL_IP_BANNED, NULL, 0);
+    login_log(out, LOG_WARN, "WARNING: Too many login attempts from %s %u.%u.%u.%u\n",
+              verdict == RATELIMIT_SHED_IP ? "address" : "network",
+              (client_ip >> 24) & 0xff, (client_ip >> 16) & 0xff,
+              (client_ip >> 8) & 0xff, client_ip & 0xff);
+    return LOGIN_FAIL_IP_BANNED;
+}
+
+/**
+ * Check that the account acc (NULL if userid wasn't found) may log in
+ * at all, as of now. Returns LOGIN_SUCCESS if the password should be
+ * checked next, with the account's state copied to *state; otherwise
+ * the failure has been reported and acc released.
+ */
+static login_result_t login_check(const char *userid, const account_auth_t *acc,
+                                  account_auth_t *state, time_t now, login_out_t *out)
+{
+    if (!acc) {
+        login_reply(out, LOGIN_FAIL_USER_NOT_FOUND, NULL, 0);
+        login_log_name(out, LOG_ERROR, "ERROR: User '", userid, "' not found\n");
         return LOGIN_FAIL_USER_NOT_FOUND;
     }
 
-    if (account_is_banned(&acc)) {
-        const char *msg = "Login failed: account banned.\n";
-        dprintf(client_output_fd, "%s", msg);
-        log_message(LOG_WARN, "WARNING: User '%s' is banned\n", userid);
+    // Decide on one consistent copy of the account's current state; the
+    // counters are still updated on the stored record itself.
+    store_read_auth(acc, state);
+
+    if (account_ban_active_at(state->unban_time, now)) {
+        login_reply(out, LOGIN_FAIL_ACCOUNT_BANNED, NULL, 0);
+        login_log_name(out, LOG_WARN, "WARNING: User '", userid, "' is banned\n");
+        store_release(acc);
+        explicit_bzero(state, sizeof(*state));
         return LOGIN_FAIL_ACCOUNT_BANNED;
     }
 
-    if (account_is_expired(&acc)) {
-        const char *msg = "Login failed: account expired.\n";
-        dprintf(client_output_fd, "%s", msg);
-        log_message(LOG_WARN, "WARNING: user '%s' is expired\n", userid);
+    if (account_expiry_passed_at(state->expiration_time, now)) {
+        login_reply(out, LOGIN_FAIL_ACCOUNT_EXPIRED, NULL, 0);
+        login_log_name(out, LOG_WARN, "WARNING: user '", userid, "' is expired\n");
+        store_release(acc);
+        explicit_bzero(state, sizeof(*state));
         return LOGIN_FAIL_ACCOUNT_EXPIRED;
     }
+    return LOGIN_SUCCESS;
+}
+
+/* Fail a login whose arguments were missing. */
+static login_result_t login_bad_input(login_out_t *out, const char *caller)
+{
+    login_reply(out, LOGIN_FAIL_INTERNAL_ERROR, NULL, 0);
+    login_log_name(out, LOG_ERROR, "ERROR: ", caller, ": NULL input\n");
+    return LOGIN_FAIL_INTERNAL_ERROR;
+}
+
+/**
+ * Look up the account and check it may log in at all as of now.
+ * Returns LOGIN_SUCCESS if the password should be checked next, with
+ * the record acquired in *acc and its state copied to *state; otherwise
+ * the failure has been reported and nothing is held.
+ */
+static login_result_t login_begin(const char *userid, const char *password, time_t now,
+                                  login_out_t *out,
+                                  const account_auth_t **acc, account_auth_t *state)
+{
+    if (!userid || !password) {
+        return login_bad_input(out, "handle_login");
+    }
+
+    // Work on the stored authentication record in place rather than on
+    // a copy of the whole account.
+    *acc = store_acquire(userid);
+    return login_check(userid, *acc, state, now, out);
+}
 
-    if (!account_validate_password(&acc, password)) {
-        const char *msg = "Login failed: incorrect password.\n";
-        dprintf(client_output_fd, "%s", msg);
-        log_message(LOG_WARN, "WARNING: incorrect password for user '%s'\n", userid);
-        account_record_login_failure(&acc);
+/**
+ * Fail a login whose password couldn't be checked because too many
+ * others are being checked already. This says nothing about the
+ * password, so unlike a wrong one it isn't counted against the account.
+ */
+static login_result_t login_overloaded(const account_auth_t *acc, account_auth_t *state,
+                                       login_out_t *out)
+{
+    login_reply(out, LOGIN_FAIL_INTERNAL_ERROR, NULL, 0);
+    login_log_name(out, LOG_WARN, "WARNING: Too many logins in progress; rejected '",
+                   state->userid, "'\n");
+    store_release(acc);
+    explicit_bzero(state, sizeof(*state));
+    return LOGIN_FAIL_INTERNAL_ERROR;
+}
+
+/**
+ * Record and report the outcome of the password check, fill in the
+ * session on success, and release what login_begin() acquired.
+ * login_time is recorded as the account's last login time and the
+ * session's start.
+ */
+static login_result_t login_finish(const account_auth_t *acc, account_auth_t *state,
+                                   bool password_ok, ip4_addr_t client_ip,
+                                   time_t login_time, login_out_t *out,
+                                   login_session_data_t *session)
+{
+    if (!password_ok) {
+        login_reply(out, LOGIN_FAIL_BAD_PASSWORD, NULL, 0);
+        login_log_name(out, LOG_WARN, "WARNING: incorrect password for user '",
+                       state->userid, "'\n");
+        store_record_login_failure(acc);
+        store_release(acc);
+        explicit_bzero(state, sizeof(*state));
         return LOGIN_FAIL_BAD_PASSWORD;
     }
 
-    account_record_login_success(&acc, client_ip);
+    store_record_login_success_at(acc, client_ip, login_time);
 
-    dprintf(client_output_fd, "Login successful!\n");
-    dprintf(log_fd, "INFO: user '%s' logged in successfully\n", userid);
+    login_log_name(out, LOG_INFO, "INFO: user '", state->userid, "' logged in successfully\n");
 
-    session->account_id = acc.account_id;
+    session->account_id = state->account_id;
     session->session_start = login_time;
-    session->expiration_time = acc.expiration_time;
+    session->expiration_time = state->expiration_time;
+
+    // Later requests can present this instead of the password; it goes
+    // out in the same write as the reply.
+    static const char prefix[] = "Session token: ";
+    char line[sizeof(prefix) - 1 + SESSION_TOKEN_TEXT_LENGTH];
+    size_t line_len = 0;
+    session_token_t token;
+    if (session_issue(session, &token)) {
+        memcpy(line, prefix, sizeof(prefix) - 1);
+        session_token_format(&token, line + sizeof(prefix) - 1);
+        line_len = sizeof(line);
+        line[line_len - 1] = '\n';   // in place of the token's terminator
+        explicit_bzero(&token, sizeof(token));
+    }
+    login_reply(out, LOGIN_SUCCESS, line, line_len);
+    explicit_bzero(line, sizeof(line));
+    store_release(acc);
+    explicit_bzero(state, sizeof(*state));
 
     return LOGIN_SUCCESS;
 }
+
+/* handle_login(), up to submitting its output. */
+static login_result_t login_now(const char *userid, const char *password,
+                                ip4_addr_t client_ip, time_t login_time,
+                                int client_output_fd, int log_fd,
+                                login_session_data_t *session)
+{
+    login_out_t out;
+    login_out_init(&out, client_output_fd, log_fd);
+    if (!session) {
+        return login_bad_input(&out, "handle_login");
+    }
+
+    login_result_t result = login_admit(client_ip, login_time, &out);
+    if (result != LOGIN_SUCCESS) {
+        return result;
+    }
+    // The caller's login_time is "now" for every check of the login.
+    const account_auth_t *acc;
+    account_auth_t state;
+    result = login_begin(userid, password, login_time, &out, &acc, &state);
+    if (result != LOGIN_SUCCESS) {
+        return result;
+    }
+    hash_check_t check = HASH_CHECK_MISMATCH;
+    if (account_password_precheck_at(state.password_hash, state.unban_time,
+                                     state.expiration_time, state.login_fail_count,
+                                     login_time)) {
+        check = account_check_hash(state.password_hash, password);
+    }
+    if (check == HASH_CHECK_OVERLOADED) {
+        return login_overloaded(acc, &state, &out);
+    }
+    if (check == HASH_CHECK_MATCH) {
+        rehash_if_outdated(state.userid, state.password_hash, password);
+    }
+    return login_finish(acc, &state, check == HASH_CHECK_MATCH, client_ip,
+                        login_time, &out, session);
+}
+
+login_result_t handle_login(const char *userid, const char *password,
+                            ip4_addr_t client_ip, time_t login_time,
+                            int client_output_fd, int log_fd,
+                            login_session_data_t *session)
+{
+    login_result_t result = login_now(userid, password, client_ip, login_time,
+                                      client_output_fd, log_fd, session);
+    ioqueue_drain();
+    return result;
+}
+
+/* A login waiting on the hashing pool. */
+typedef struct {
+    const account_auth_t *acc;
+    account_auth_t state;
+    ip4_addr_t client_ip;
+    time_t login_time;
+    login_out_t out;
+    login_done_fn done;        // one of these two is set
+    login_reply_fn reply_done;
+    void *arg;
+    char *rehash_password;   // copy of the password, only if the hash is outdated
+} pending_login_t;
+
+/* Pass an asynchronous login's outcome (and, if kept, reply) on. */
+static void login_settle(login_out_t *out, login_result_t result,
+                         const login_session_data_t *session,
+                         login_done_fn done, login_reply_fn reply_done, void *arg)
+{
+    ioqueue_drain();
+    if (reply_done) {
+        reply_done(result, session, out->reply, out->reply_len, arg);
+        explicit_bzero(out->reply, out->reply_len);
+    } else {
+        done(result, session, arg);
+    }
+}
+
+static void login_verified(const hash_result_t *result, void *arg)
+{
+    pending_login_t *p = arg;
+    if (p->rehash_password) {
+        if (result->ok) {
+            rehash_if_outdated(p->state.userid, p->state.password_hash, p->rehash_password);
+        }
+        explicit_bzero(p->rehash_password, strlen(p->rehash_password));
+        free(p->rehash_password);
+    }
+    login_session_data_t session;
+    login_result_t outcome = result->overloaded
+        ? login_overloaded(p->acc, &p->state, &p->out)
+        : login_finish(p->acc, &p->state, result->ok, p->client_ip,
+                       p->login_time, &p->out, &session);
+    login_settle(&p->out, outcome, outcome == LOGIN_SUCCESS ? &session : NULL,
+                 p->done, p->reply_done, p->arg);
+    explicit_bzero(p, sizeof(*p));
+    free(p);
+}
+
+/* handle_login_async() and handle_login_async_reply(), with out set up. */
+static void login_async(const char *userid, const char *password,
+                        ip4_addr_t client_ip, time_t login_time, login_out_t *out,
+                        login_done_fn done, login_reply_fn reply_done, void *arg)
+{
+    login_result_t result = login_admit(client_ip, login_time, out);
+    if (result != LOGIN_SUCCESS) {
+        login_settle(out, result, NULL, done, reply_done, arg);
+        return;
+    }
+    pending_login_t *p = malloc(sizeof(pending_login_t));
+    if (!p) {
+        login_reply(out, LOGIN_FAIL_INTERNAL_ERROR, NULL, 0);
+        log_message(LOG_ERROR, "ERROR: handle_login_async: Failed to allocate memory\n");
+        login_settle(out, LOGIN_FAIL_INTERNAL_ERROR, NULL, done, reply_done, arg);
+        return;
+    }
+    p->out = *out;
+    result = login_begin(userid, password, login_time, &p->out, &p->acc, &p->state);
+    if (result != LOGIN_SUCCESS) {
+        login_settle(&p->out, result, NULL, done, reply_done, arg);
+        free(p);
+        return;
+    }
+
+    // Failures that don't depend on the password (rate limiting) are
+    // settled here too.
+    if (!account_password_precheck_at(p->state.password_hash, p->state.unban_time,
+                                      p->state.expiration_time, p->state.login_fail_count,
+                                      login_time)) {
+        login_session_data_t session;
+        result = login_finish(p->acc, &p->state, false, client_ip, login_time,
+                              &p->out, &session);
+        login_settle(&p->out, result, NULL, done, reply_done, arg);
+        free(p);
+        return;
+    }
+
+    p->client_ip = client_ip;
+    p->login_time = login_time;
+    p->done = done;
+    p->reply_done = reply_done;
+    p->arg = arg;
+    p->rehash_password = account_hash_outdated(p->state.password_hash) ? strdup(password) : NULL;
+    if (!hashpool_submit_verify(p->state.password_hash, password, login_verified, p)) {
+        if (p->rehash_password) {
+            explicit_bzero(p->rehash_password, strlen(p->rehash_password));
+            free(p->rehash_password);
+        }
+        result = login_overloaded(p->acc, &p->state, &p->out);
+        login_settle(&p->out, result, NULL, done, reply_done, arg);
+        explicit_bzero(p, sizeof(*p));
+        free(p);
+    }
+}
+
+void handle_login_async(const char *userid, const char *password,
+                        ip4_addr_t client_ip, time_t login_time,
+                        int client_output_fd, int log_fd,
+                        login_done_fn done, void *arg)
+{
+    if (!done) {
+        log_message(LOG_ERROR, "ERROR: handle_login_async: NULL callback\n");
+        return;
+    }
+    login_out_t out;
+    login_out_init(&out, client_output_fd, log_fd);
+    login_async(userid, password, client_ip, login_time, &out, done, NULL, arg);
+}
+
+void handle_login_async_reply(const char *userid, const char *password,
+                              ip4_addr_t client_ip, time_t login_time, int log_fd,
+                              login_reply_fn done, void *arg)
+{
+    if (!done) {
+        log_message(LOG_ERROR, "ERROR: handle_login_async_reply: NULL callback\n");
+        return;
+    }
+    login_out_t out;
+    login_out_init(&out, -1, log_fd);
+    out.keep_reply = true;
+    login_async(userid, password, client_ip, login_time, &out, NULL, done, arg);
+}
+
+/* Counts down a batch's password checks on the hashing pool. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t pending;
+} batch_wait_t;
+
+/* A login in a batch, as it moves through the stages. */
+typedef struct {
+    const account_auth_t *acc;
+    account_auth_t state;
+    hash_check_t check;
+    bool check_here;        // the pool had no room: check on the calling thread
+    batch_wait_t *wait;
+    login_out_t out;
+} batch_login_t;
+
+static void batch_verified(const hash_result_t *result, void *arg)
+{
+    batch_login_t *b = arg;
+    b->check = result->overloaded ? HASH_CHECK_OVERLOADED
+             : result->ok ? HASH_CHECK_MATCH : HASH_CHECK_MISMATCH;
+    batch_wait_t *wait = b->wait;
+    pthread_mutex_lock(&wait->lock);
+    if (--wait->pending == 0) {
+        pthread_cond_signal(&wait->cond);
+    }
+    pthread_mutex_unlock(&wait->lock);
+}
+
+/*
+ * Write out a batch's messages: one write per client descriptor,
+ * carrying the replies to every login in the batch that uses it (in
+ * batch order), then one of the lines for log_fd, all submitted
+ * together, and one log_message() call per level.
+ */
+static void batch_flush(batch_login_t *logins, size_t count, login_log_t *log, int log_fd)
+{
+    struct iovec iov[IOV_MAX];
+    for (size_t i = 0; i < count; i++) {
+        int fd = logins[i].out.client_output_fd;
+        if (fd < 0) {
+            continue;   // already written, along with an earlier login's
+        }
+        int n = 0;
+        for (size_t j = i; j < count; j++) {
+            if (logins[j].out.client_output_fd != fd) {
+                continue;
+            }
+            logins[j].out.client_output_fd = -1;
+            if (logins[j].out.reply_len == 0) {
+                continue;
+            }
+            iov[n].iov_base = logins[j].out.reply;
+            iov[n].iov_len = logins[j].out.reply_len;
+            if (++n == IOV_MAX) {
+                ioqueue_writev(fd, iov, n);
+                n = 0;
+            }
+        }
+        ioqueue_writev(fd, iov, n);
+    }
+
+    if (log->to_log_fd.len > 0) {
+        struct iovec lines = { log->to_log_fd.text, log->to_log_fd.len };
+        ioqueue_writev(log_fd, &lines, 1);
+    }
+    ioqueue_drain();
+    if (log->warnings.len > 0) {
+        log_message(LOG_WARN, "%.*s", (int)log->warnings.len, log->warnings.text);
+    }
+    if (log->errors.len > 0) {
+        log_message(LOG_ERROR, "%.*s", (int)log->errors.len, log->errors.text);
+    }
+    free(log->to_log_fd.text);
+    free(log->warnings.text);
+    free(log->errors.text);
+}
+
+size_t handle_login_batch(const login_request_t *requests, login_outcome_t *outcomes,
+                          size_t count, int log_fd)
+{
+    if (count == 0) {
+        return 0;
+    }
+    if (!requests || !outcomes) {
+        log_message(LOG_ERROR, "ERROR: handle_login_batch: NULL input\n");
+        return 0;
+    }
+
+    size_t bytes = count * sizeof(batch_login_t);   // a multiple of its alignment
+    batch_login_t *logins = aligned_alloc(_Alignof(batch_login_t), bytes);
+    const char **userids = malloc(count * sizeof(*userids));
+    const account_auth_t **found = malloc(count * sizeof(*found));
+    if (!logins || !userids || !found) {
+        // No room to batch: log in one at a time instead.
+        free(logins);
+        free(userids);
+        free(found);
+        size_t succeeded = 0;
+        for (size_t i = 0; i < count; i++) {
+            const login_request_t *r = &requests[i];
+            outcomes[i].result = handle_login(r->userid, r->password, r->client_ip, r->login_time,
+                                              r->client_output_fd, log_fd, &outcomes[i].session);
+            succeeded += outcomes[i].result == LOGIN_SUCCESS;
+        }
+        return succeeded;
+    }
+
+    login_log_t log = { { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 } };
+    batch_wait_t wait = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+
+    // Checks needing neither the account nor a hash.
+    for (size_t i = 0; i < count; i++) {
+        const login_request_t *r = &requests[i];
+        batch_login_t *b = &logins[i];
+        login_out_init(&b->out, r->client_output_fd, log_fd);
+        b->out.batch = &log;
+        b->out.keep_reply = true;
+        b->acc = NULL;
+        b->wait = &wait;
+        b->check = HASH_CHECK_MISMATCH;
+        b->check_here = false;
+        userids[i] = NULL;
+        outcomes[i].result = login_admit(r->client_ip, r->login_time, &b->out);
+        if (outcomes[i].result != LOGIN_SUCCESS) {
+            continue;
+        }
+        if (!r->userid || !r->password) {
+            outcomes[i].result = login_bad_input(&b->out, "handle_login_batch");
+            continue;
+        }
+        userids[i] = r->userid;
+    }
+
+    // Every lookup at once, then the checks of each account's state.
+    store_acquire_batch(userids, count, found);
+    for (size_t i = 0; i < count; i++) {
+        batch_login_t *b = &logins[i];
+        if (!userids[i]) {
+            continue;
+        }
+        b->acc = found[i];
+        outcomes[i].result = login_check(userids[i], b->acc, &b->state, requests[i].login_time,
+                                         &b->out);
+        if (outcomes[i].result != LOGIN_SUCCESS) {
+            b->acc = NULL;
+        }
+    }
+
+    // Hand the password checks to the hashing pool, checking here any it
+    // has no room for, then wait for the rest.
+    for (size_t i = 0; i < count; i++) {
+        batch_login_t *b = &logins[i];
+        if (!b->acc || !account_password_precheck_at(b->state.password_hash, b->state.unban_time,
+                                                     b->state.expiration_time,
+                                                     b->state.login_fail_count,
+                                                     requests[i].login_time)) {
+            continue;
+        }
+        pthread_mutex_lock(&wait.lock);
+        wait.pending++;
+        pthread_mutex_unlock(&wait.lock);
+        if (!hashpool_submit_verify(b->state.password_hash, requests[i].password,
+                                    batch_verified, b)) {
+            pthread_mutex_lock(&wait.lock);
+            wait.pending--;
+            pthread_mutex_unlock(&wait.lock);
+            b->check_here = true;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (logins[i].check_here) {
+            logins[i].check = account_check_hash(logins[i].state.password_hash,
+                                                 requests[i].password);
+        }
+    }
+    pthread_mutex_lock(&wait.lock);
+    while (wait.pending > 0) {
+        pthread_cond_wait(&wait.cond, &wait.lock);
+    }
+    pthread_mutex_unlock(&wait.lock);
+
+    // Record and report every outcome, then write them all out.
+    size_t succeeded = 0;
+    for (size_t i = 0; i < count; i++) {
+        batch_login_t *b = &logins[i];
+        if (!b->acc) {
+            continue;
+        }
+        if (b->check == HASH_CHECK_OVERLOADED) {
+            outcomes[i].result = login_overloaded(b->acc, &b->state, &b->out);
+            continue;
+        }
+        if (b->check == HASH_CHECK_MATCH) {
+            rehash_if_outdated(b->state.userid, b->state.password_hash, requests[i].password);
+        }
+        outcomes[i].result = login_finish(b->acc, &b->state, b->check == HASH_CHECK_MATCH,
+                                          requests[i].client_ip, requests[i].login_time, &b->out,
+                                          &outcomes[i].session);
+        succeeded += outcomes[i].result == LOGIN_SUCCESS;
+    }
+    batch_flush(logins, count, &log, log_fd);
+
+    pthread_mutex_destroy(&wait.lock);
+    pthread_cond_destroy(&wait.cond);
+    explicit_bzero(logins, bytes);
+    free(logins);
+    free(userids);
+    free(found);
+    return succeeded;
+}
@@ -0,0 +1,60 @@
+#ifndef LOGIN_ASYNC_H
+#define LOGIN_ASYNC_H
+
+#include "login.h"
+
+#include <stddef.h>
+
+/**
+ * @file login_async.h
+ * @brief Logins whose password check runs on the hashing pool.
+ */
+
+/**
+ * Called exactly once with the outcome of handle_login_async(). session
+ * is filled in on LOGIN_SUCCESS and NULL otherwise, and is only valid
+ * for the duration of the call.
+ */
+typedef void (*login_done_fn)(login_result_t result, const login_session_data_t *session,
+                              void *arg);
+
+/**
+ * As handle_login(), but without blocking the calling thread on the
+ * password hash.
+ *
+ * Outcomes that need no hashing (bad arguments, unknown user, banned
+ * or expired account, too many recent failures) are decided, reported
+ * to the client and passed to done before this returns. Otherwise the
+ * password is checked on the hashing pool (see hashpool.h), and the
+ * rest of the login (counters, client and log messages, then done)
+ * happens on a pool worker once it has been. If the pool's queue is
+ * full the login fails straight away with LOGIN_FAIL_INTERNAL_ERROR, as
+ * it does if the check then can't get memory from the hash budget (see
+ * hashbudget.h) in time; neither counts as a failed login.
+ *
+ * client_output_fd and log_fd must stay open until done is called.
+ */
+void handle_login_async(const char *userid, const char *password,
+                        ip4_addr_t client_ip, time_t login_time,
+                        int client_output_fd, int log_fd,
+                        login_done_fn done, void *arg);
+
+/**
+ * Called exactly once with the outcome of handle_login_async_reply(),
+ * as for login_done_fn, and the text handle_login() would have written
+ * to the client: reply_len bytes at reply, not NUL-terminated, valid
+ * for the duration of the call.
+ */
+typedef void (*login_reply_fn)(login_result_t result, const login_session_data_t *session,
+                               const char *reply, size_t reply_len, void *arg);
+
+/**
+ * As handle_login_async(), but handing the reply to done rather than
+ * writing it to a descriptor, for callers that must not block on a
+ * slow client (see server.h).
+ */
+void handle_login_async_reply(const char *userid, const char *password,
+                              ip4_addr_t client_ip, time_t login_time, int log_fd,
+                              login_reply_fn done, void *arg);
+
+#endif // LOGIN_ASYNC_H
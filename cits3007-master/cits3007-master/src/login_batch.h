@@ -0,0 +1,47 @@
+#ifndef LOGIN_BATCH_H
+#define LOGIN_BATCH_H
+
+#include "login.h"
+
+#include <stddef.h>
+
+/**
+ * @file login_batch.h
+ * @brief Logins handled a batch at a time.
+ */
+
+/** One login in a batch: the arguments handle_login() would take. */
+typedef struct {
+  const char *userid;
+  const char *password;
+  ip4_addr_t client_ip;
+  time_t login_time;
+  int client_output_fd;
+} login_request_t;
+
+/** The outcome of one login in a batch. */
+typedef struct {
+  login_result_t result;
+  login_session_data_t session;   // filled in on LOGIN_SUCCESS
+} login_outcome_t;
+
+/**
+ * Handle count logins, as handle_login() would each of them, setting
+ * outcomes[i] to the outcome of requests[i]. Returns the number that
+ * succeeded.
+ *
+ * Each login's checks are made as of its own login_time, as
+ * handle_login() would make them. Each stage is run for the whole batch
+ * before the next: the accounts are all looked up together (see
+ * store_acquire_batch()); the password checks are all handed to the
+ * hashing pool at once, any it has no room for being checked on the
+ * calling thread while the pool works on the rest; and once every
+ * outcome is known, the replies are written with one writev() per
+ * client descriptor (replies to logins sharing a descriptor in batch
+ * order), the lines for log_fd with one write, and the other log lines
+ * with one log_message() call per level.
+ */
+size_t handle_login_batch(const login_request_t *requests, login_outcome_t *outcomes,
+                          size_t count, int log_fd);
+
+#endif // LOGIN_BATCH_H
@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include "mapfile.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "banned.h"
+
+static size_t page_round(size_t n) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (n + page - 1) & ~(page - 1);
+}
+
+/**
+ * Make bytes [from, to) of the reserved range usable. File-backed
+ * mappings map the matching region of the file over the reservation;
+ * anonymous mappings just lift the PROT_NONE protection.
+ */
+static bool map_range(mapfile_t *mf, size_t from, size_t to) {
+  if (to <= from) {
+    return true;
+  }
+  if (mf->fd < 0) {
+    return mprotect(mf->base + from, to - from, PROT_READ | PROT_WRITE) == 0;
+  }
+  void *p = mmap(mf->base + from, to - from, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, mf->fd, (off_t)from);
+  return p != MAP_FAILED;
+}
+
+bool mapfile_open(mapfile_t *mf, const char *path, size_t reserve, size_t size) {
+  memset(mf, 0, sizeof(*mf));
+  mf->fd = -1;
+
+  size_t file_size = 0;
+  if (path != NULL) {
+    mf->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (mf->fd < 0) {
+      log_message(LOG_ERROR, "mapfile_open: Can't open '%s': %s", path, strerror(errno));
+      return false;
+    }
+    struct stat st;
+    if (fstat(mf->fd, &st) != 0) {
+      log_message(LOG_ERROR, "mapfile_open: Can't stat '%s': %s", path, strerror(errno));
+      mapfile_close(mf);
+      return false;
+    }
+    file_size = (size_t)st.st_size;
+  }
+
+  size = page_round(size > file_size ? size : file_size);
+  reserve = page_round(reserve > size ? reserve : size);
+
+  // Reserve address space only; nothing is committed until mapped.
+  void *base = MAP_FAILED;
+  while (base == MAP_FAILED) {
+    base = mmap(NULL, reserve, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+      if (reserve <= size) {
+        log_message(LOG_ERROR, "mapfile_open: Can't reserve address space: %s", strerror(errno));
+        mapfile_close(mf);
+        return false;
+      }
+      reserve = page_round(reserve / 2 > size ? reserve / 2 : size);
+    }
+  }
+  mf->base = base;
+  mf->reserved = reserve;
+
+  if (mf->fd >= 0 && size > file_size && ftruncate(mf->fd, (off_t)size) != 0) {
+    log_message(LOG_ERROR, "mapfile_open: Can't size '%s': %s", path, strerror(errno));
+    mapfile_close(mf);
+    return false;
+  }
+  if (!map_range(mf, 0, size)) {
+    log_message(LOG_ERROR, "mapfile_open: Can't map %zu bytes: %s", size, strerror(errno));
+    mapfile_close(mf);
+    return false;
+  }
+  mf->size = size;
+  return true;
+}
+
+bool mapfile_grow(mapfile_t *mf, size_t new_size) {
+  if (new_size <= mf->size) {
+    return true;
+  }
+  new_size = page_round(new_size);
+  if (new_size > mf->reserved) {
+    log_message(LOG_ERROR, "mapfile_grow: %zu bytes exceeds the %zu reserved", new_size, mf->reserved);
+    return false;
+  }
+  if (mf->fd >= 0 && ftruncate(mf->fd, (off_t)new_size) != 0) {
+    log_message(LOG_ERROR, "mapfile_grow: Can't extend file: %s", strerror(errno));
+    return false;
+  }
+  if (!map_range(mf, mf->size, new_size)) {
+    log_message(LOG_ERROR, "mapfile_grow: Can't map %zu bytes: %s", new_size, strerror(errno));
+    return false;
+  }
+  mf->size = new_size;
+  return true;
+}
+
+bool mapfile_sync(mapfile_t *mf) {
+  if (mf->fd < 0 || mf->size == 0) {
+    return true;
+  }
+  if (msync(mf->base, mf->size, MS_SYNC) != 0) {
+    log_message(LOG_ERROR, "mapfile_sync: msync failed: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void mapfile_close(mapfile_t *mf) {
+  if (mf->base != NULL) {
+    munmap(mf->base, mf->reserved);
+  }
+  if (mf->fd >= 0) {
+    close(mf->fd);
+  }
+  mf->base = NULL;
+  mf->reserved = 0;
+  mf->size = 0;
+  mf->fd = -1;
+}
@@ -0,0 +1,60 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file mapfile.h
+ * @brief Growable memory mappings with stable addresses.
+ *
+ * A mapfile reserves a large range of address space up front and maps
+ * its backing file (or anonymous memory) into the start of that range.
+ * Growing the mapping maps more of the range; existing contents are
+ * never copied or moved, so pointers into the mapping stay valid for
+ * as long as it is open.
+ */
+
+typedef struct {
+  unsigned char *base;  // start of the reserved address range
+  size_t reserved;      // bytes of address space reserved
+  size_t size;          // bytes currently mapped (and the file length)
+  int fd;               // backing file, or -1 for anonymous memory
+} mapfile_t;
+
+/**
+ * Open a mapping.
+ *
+ * If path is NULL the mapping is backed by anonymous memory. Otherwise
+ * the file is opened (created if necessary, with mode 0600) and mapped
+ * shared, so changes to the mapping are written back to it.
+ *
+ * At least `reserve` bytes of address space are reserved where possible;
+ * if the system refuses, smaller reservations are tried down to `size`.
+ * The initial mapped size is the larger of `size` and the current file
+ * length, rounded up to a whole number of pages.
+ *
+ * Returns true on success; on failure logs an error and leaves mf closed.
+ */
+bool mapfile_open(mapfile_t *mf, const char *path, size_t reserve, size_t size);
+
+/**
+ * Grow the mapping (and backing file) to at least new_size bytes.
+ * Does nothing if the mapping is already that large.
+ * Returns false if new_size exceeds the reserved range or the file
+ * could not be extended.
+ */
+bool mapfile_grow(mapfile_t *mf, size_t new_size);
+
+/**
+ * Flush a file-backed mapping to disk. Always succeeds for anonymous
+ * mappings.
+ */
+bool mapfile_sync(mapfile_t *mf);
+
+/**
+ * Unmap and close. Safe to call on a mapping that is already closed.
+ */
+void mapfile_close(mapfile_t *mf);
+
+#endif // MAPFILE_H
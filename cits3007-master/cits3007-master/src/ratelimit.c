@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "ratelimit.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include "banned.h"
+
+/*
+ * Each table entry is one word:
+ *
+ *   bits 32-63  key (an address, or an address >> 8 for a /24)
+ *   bits 20-31  number of the window last counted in, modulo 4096
+ *   bits 10-19  attempts in that window
+ *   bits  0-9   attempts in the window before it
+ *
+ * An all-zero word is an empty entry (or, equivalently, key 0 with no
+ * attempts). A key lives in the BUCKET_SLOTS entries of the cache line
+ * its hash picks, so a lookup touches one line.
+ */
+#define BUCKET_SLOTS 8
+#define WINDOW_MASK 0xfffu
+#define COUNT_MASK 0x3ffu
+
+static _Atomic uint64_t ip_table[RATELIMIT_SLOTS];
+static _Atomic uint64_t subnet_table[RATELIMIT_SLOTS];
+
+static atomic_uint ip_limit = RATELIMIT_DEFAULT_IP_LIMIT;
+static atomic_uint subnet_limit = RATELIMIT_DEFAULT_SUBNET_LIMIT;
+static atomic_uint window_seconds = RATELIMIT_DEFAULT_WINDOW;
+
+static atomic_uint_fast64_t shed_ip;
+static atomic_uint_fast64_t shed_subnet;
+static atomic_uint_fast64_t evicted;
+
+typedef struct {
+  uint32_t key;
+  uint32_t window;
+  uint32_t current;
+  uint32_t previous;
+} entry_t;
+
+static entry_t unpack(uint64_t w) {
+  entry_t e = {
+    .key = (uint32_t)(w >> 32),
+    .window = (uint32_t)(w >> 20) & WINDOW_MASK,
+    .current = (uint32_t)(w >> 10) & COUNT_MASK,
+    .previous = (uint32_t)w & COUNT_MASK,
+  };
+  return e;
+}
+
+static uint64_t pack(const entry_t *e) {
+  return (uint64_t)e->key << 32 | (uint64_t)(e->window & WINDOW_MASK) << 20
+       | (uint64_t)(e->current & COUNT_MASK) << 10 | (e->previous & COUNT_MASK);
+}
+
+/* Move e on to window `now_window`, dropping counts that have aged out. */
+static void roll(entry_t *e, uint32_t now_window) {
+  uint32_t age = (now_window - e->window) & WINDOW_MASK;
+  if (age == 1) {
+    e->previous = e->current;
+    e->current = 0;
+  } else if (age != 0) {
+    e->previous = 0;
+    e->current = 0;
+  }
+  e->window = now_window & WINDOW_MASK;
+}
+
+/*
+ * Attempts in the last window_seconds: all of the current window's, and
+ * the share of the previous window's that still overlaps.
+ */
+static uint32_t estimate(const entry_t *e, uint32_t elapsed, uint32_t window) {
+  return e->current + (uint32_t)((uint64_t)e->previous * (window - elapsed) / window);
+}
+
+static _Atomic uint64_t *bucket_for(_Atomic uint64_t *table, uint32_t key) {
+  uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+  size_t slot = (size_t)(h >> 32) & (RATELIMIT_SLOTS - 1);
+  return &table[slot & ~(size_t)(BUCKET_SLOTS - 1)];
+}
+
+/*
+ * Count an attempt by key in table, unless it has already reached
+ * limit. Returns whether it was counted.
+ */
+static bool admit(_Atomic uint64_t *table, uint32_t key, uint32_t limit,
+                  uint32_t now_window, uint32_t elapsed, uint32_t window) {
+  if (limit == 0) {
+    return true;
+  }
+  _Atomic uint64_t *bucket = bucket_for(table, key);
+  for (;;) {
+    // The key's own entry if it has one; otherwise the least active
+    // entry in the bucket, which empty and aged-out ones always are.
+    _Atomic uint64_t *slot = NULL;
+    uint64_t seen = 0;
+    entry_t e = { 0 };
+    uint32_t least = UINT32_MAX;
+    for (int i = 0; i < BUCKET_SLOTS; i++) {
+      uint64_t w = atomic_load_explicit(&bucket[i], memory_order_relaxed);
+      entry_t candidate = unpack(w);
+      if (candidate.key == key) {
+        slot = &bucket[i];
+        seen = w;
+        e = candidate;
+        least = 0;
+        break;
+      }
+      roll(&candidate, now_window);
+      uint32_t active = estimate(&candidate, elapsed, window);
+      if (active < least) {
+        slot = &bucket[i];
+        seen = w;
+        least = active;
+      }
+    }
+    bool replacing = unpack(seen).key != key;
+    if (replacing) {
+      e = (entry_t){ .key = key, .window = now_window };
+    }
+    roll(&e, now_window);
+    if (estimate(&e, elapsed, window) >= limit) {
+      return false;
+    }
+    if (e.current < COUNT_MASK) {
+      e.current++;
+    }
+    if (atomic_compare_exchange_weak_explicit(slot, &seen, pack(&e),
+                                              memory_order_relaxed, memory_order_relaxed)) {
+      if (replacing && least > 0) {
+        atomic_fetch_add_explicit(&evicted, 1, memory_order_relaxed);
+      }
+      return true;
+    }
+  }
+}
+
+/*
+ * Take back an attempt admit() counted by key in window now_window,
+ * if its entry is still there and still in that window.
+ */
+static void refund(_Atomic uint64_t *table, uint32_t key, uint32_t now_window) {
+  _Atomic uint64_t *bucket = bucket_for(table, key);
+  for (int i = 0; i < BUCKET_SLOTS; i++) {
+    uint64_t w = atomic_load_explicit(&bucket[i], memory_order_relaxed);
+    for (;;) {
+      entry_t e = unpack(w);
+      if (e.key != key || e.window != (now_window & WINDOW_MASK) || e.current == 0) {
+        break;
+      }
+      e.current--;
+      if (atomic_compare_exchange_weak_explicit(&bucket[i], &w, pack(&e),
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+}
+
+void ratelimit_configure(const ratelimit_config_t *config) {
+  if (config == NULL) {
+    return;
+  }
+  uint32_t ip = config->ip_limit < RATELIMIT_MAX_LIMIT ? config->ip_limit : RATELIMIT_MAX_LIMIT;
+  uint32_t subnet = config->subnet_limit < RATELIMIT_MAX_LIMIT ? config->subnet_limit : RATELIMIT_MAX_LIMIT;
+  atomic_store(&ip_limit, ip);
+  atomic_store(&subnet_limit, subnet);
+  atomic_store(&window_seconds, config->window_seconds ? config->window_seconds : RATELIMIT_DEFAULT_WINDOW);
+}
+
+ratelimit_config_t ratelimit_config(void) {
+  ratelimit_config_t config = {
+    .ip_limit = atomic_load(&ip_limit),
+    .subnet_limit = atomic_load(&subnet_limit),
+    .window_seconds = atomic_load(&window_seconds),
+  };
+  return config;
+}
+
+ratelimit_verdict_t ratelimit_admit(ip4_addr_t ip, time_t now) {
+  if (ip == RATELIMIT_NO_ADDRESS) {
+    return RATELIMIT_ADMIT;
+  }
+  uint32_t window = atomic_load_explicit(&window_seconds, memory_order_relaxed);
+  uint64_t t = now > 0 ? (uint64_t)now : 0;
+  uint32_t now_window = (uint32_t)(t / window);
+  uint32_t elapsed = (uint32_t)(t % window);
+
+  uint32_t per_ip = atomic_load_explicit(&ip_limit, memory_order_relaxed);
+  if (!admit(ip_table, ip, per_ip, now_window, elapsed, window)) {
+    atomic_fetch_add_explicit(&shed_ip, 1, memory_order_relaxed);
+    return RATELIMIT_SHED_IP;
+  }
+  if (!admit(subnet_table, ip >> 8, atomic_load_explicit(&subnet_limit, memory_order_relaxed),
+             now_window, elapsed, window)) {
+    // Turned away for its neighbours' attempts, not its own: it
+    // shouldn't use up one of its own.
+    if (per_ip != 0) {
+      refund(ip_table, ip, now_window);
+    }
+    atomic_fetch_add_explicit(&shed_subnet, 1, memory_order_relaxed);
+    return RATELIMIT_SHED_SUBNET;
+  }
+  return RATELIMIT_ADMIT;
+}
+
+void ratelimit_reset(void) {
+  for (size_t i = 0; i < RATELIMIT_SLOTS; i++) {
+    atomic_store_explicit(&ip_table[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&subnet_table[i], 0, memory_order_relaxed);
+  }
+  atomic_store(&shed_ip, 0);
+  atomic_store(&shed_subnet, 0);
+  atomic_store(&evicted, 0);
+}
+
+void ratelimit_stats(ratelimit_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->shed_ip = atomic_load(&shed_ip);
+  stats->shed_subnet = atomic_load(&shed_subnet);
+  stats->evicted = atomic_load(&evicted);
+}
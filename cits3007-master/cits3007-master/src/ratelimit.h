@@ -0,0 +1,100 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include "account.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @file ratelimit.h
+ * @brief Per-address login rate limiting.
+ *
+ * Every login attempt costs an Argon2 hash, so a client guessing
+ * passwords as fast as it can ties up the hashing pool. handle_login()
+ * asks ratelimit_admit() first, before looking anything up, and turns
+ * the client away if its address, or the /24 network it is in, has
+ * made more than its limit of attempts lately. Only admitted attempts
+ * count, so a client that keeps trying is let through at about the
+ * limit's rate.
+ *
+ * "Lately" is a sliding window: attempts in the current window plus
+ * those in the previous one, scaled by how much of it still overlaps
+ * the last window_seconds.
+ *
+ * Counts are kept in two fixed-size tables (one for addresses, one for
+ * /24s) of RATELIMIT_SLOTS 64-bit words each, updated with
+ * compare-and-swap and no locks. When a table is full, the least active
+ * entry in the neighbourhood of a new one is forgotten, so a flood of
+ * distinct addresses costs memory nothing and can at worst let some
+ * attempts through that would have been counted.
+ */
+
+/**
+ * The address of a client that has none, such as one on a Unix socket
+ * (0.0.0.0, never the source of a real connection). Its attempts are
+ * always admitted and never counted: all such clients would otherwise
+ * share one address's limit.
+ */
+#define RATELIMIT_NO_ADDRESS 0
+
+/** Entries per table; a power of two. */
+#define RATELIMIT_SLOTS (1u << 16)
+
+/** Counts saturate here, so no limit can usefully be higher. */
+#define RATELIMIT_MAX_LIMIT 1023
+
+#define RATELIMIT_DEFAULT_IP_LIMIT 30
+#define RATELIMIT_DEFAULT_SUBNET_LIMIT 300
+#define RATELIMIT_DEFAULT_WINDOW 60
+
+typedef struct {
+  uint32_t ip_limit;        // attempts per window from one address (0: no limit)
+  uint32_t subnet_limit;    // attempts per window from one /24 (0: no limit)
+  uint32_t window_seconds;  // how long it takes attempts to be forgotten
+} ratelimit_config_t;
+
+typedef enum {
+  RATELIMIT_ADMIT,          // go ahead
+  RATELIMIT_SHED_IP,        // the address is over its limit
+  RATELIMIT_SHED_SUBNET     // the address's /24 is over its limit
+} ratelimit_verdict_t;
+
+typedef struct {
+  uint64_t shed_ip;         // attempts turned away for their address
+  uint64_t shed_subnet;     // attempts turned away for their /24
+  uint64_t evicted;         // active entries forgotten to make room
+} ratelimit_stats_t;
+
+/**
+ * Set the limits and window (0 for the window means the default).
+ * Limits above RATELIMIT_MAX_LIMIT are lowered to it.
+ */
+void ratelimit_configure(const ratelimit_config_t *config);
+
+/**
+ * The current limits and window.
+ */
+ratelimit_config_t ratelimit_config(void);
+
+/**
+ * Decide whether an attempt from ip at time now may go ahead, and if
+ * so count it against both the address and its /24. An attempt turned
+ * away is counted against neither, and one from RATELIMIT_NO_ADDRESS
+ * is always admitted.
+ */
+ratelimit_verdict_t ratelimit_admit(ip4_addr_t ip, time_t now);
+
+/**
+ * Forget every address's attempts, and zero the counters.
+ */
+void ratelimit_reset(void);
+
+/**
+ * Counters since the last reset.
+ */
+void ratelimit_stats(ratelimit_stats_t *stats);
+
+#endif // RATELIMIT_H
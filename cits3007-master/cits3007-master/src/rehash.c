@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include "rehash.h"
+#include "account_internal.h"
+#include "hashpool.h"
+#include "logging.h"
+#include "store.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "banned.h"
+
+/* What the new hash replaces. */
+typedef struct {
+  char userid[USER_ID_LENGTH];
+  char old_hash[HASH_LENGTH];
+} rehash_job_t;
+
+static atomic_uint_fast64_t queued;
+static atomic_uint_fast64_t upgraded;
+static atomic_uint_fast64_t stale;
+static atomic_uint_fast64_t failed;
+
+static void rehash_done(const hash_result_t *result, void *arg) {
+  rehash_job_t *job = arg;
+  if (!result->ok) {
+    atomic_fetch_add(&failed, 1);
+  } else if (store_replace_password_hash(job->userid, job->old_hash, result->hash)) {
+    atomic_fetch_add(&upgraded, 1);
+    log_message(LOG_INFO, "Upgraded password hash of '%s'", job->userid);
+  } else {
+    atomic_fetch_add(&stale, 1);
+  }
+  explicit_bzero(job, sizeof(*job));
+  free(job);
+}
+
+bool rehash_if_outdated(const char *userid, const char *password_hash,
+                        const char *plaintext_password) {
+  if (userid == NULL || password_hash == NULL || plaintext_password == NULL
+      || !account_hash_outdated(password_hash)) {
+    return false;
+  }
+  rehash_job_t *job = malloc(sizeof(rehash_job_t));
+  if (!job) {
+    log_message(LOG_ERROR, "rehash_if_outdated: Failed to allocate memory");
+    return false;
+  }
+  memset(job, 0, sizeof(*job));
+  strncpy(job->userid, userid, USER_ID_LENGTH - 1);
+  strncpy(job->old_hash, password_hash, HASH_LENGTH - 1);
+  // Logins come first: if the pool is busy, the next login can try again.
+  if (!hashpool_submit_hash(plaintext_password, rehash_done, job)) {
+    atomic_fetch_add(&failed, 1);
+    explicit_bzero(job, sizeof(*job));
+    free(job);
+    return false;
+  }
+  atomic_fetch_add(&queued, 1);
+  return true;
+}
+
+void rehash_stats(rehash_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  stats->queued = atomic_load(&queued);
+  stats->upgraded = atomic_load(&upgraded);
+  stats->stale = atomic_load(&stale);
+  stats->failed = atomic_load(&failed);
+}
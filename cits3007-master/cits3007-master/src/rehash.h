@@ -0,0 +1,42 @@
+#ifndef REHASH_H
+#define REHASH_H
+
+#include "account.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @file rehash.h
+ * @brief Moving stored password hashes to the current hash profile.
+ *
+ * Encoded hashes carry the settings they were made with, so after the
+ * hash profile (hashprofile.h) changes, existing accounts go on
+ * verifying with the old settings. The only time the plaintext is at
+ * hand to make a new hash is a successful login, so that is when the
+ * login code calls rehash_if_outdated(). The new hash is made on the
+ * hashing pool, after the login has been answered, and stored only if
+ * the account's hash hasn't changed in the meantime.
+ */
+
+typedef struct {
+  uint64_t queued;      // rehashes handed to the pool
+  uint64_t upgraded;    // new hashes stored
+  uint64_t stale;       // not stored: the hash had changed, or the account gone
+  uint64_t failed;      // hashing failed or the pool was full
+} rehash_stats_t;
+
+/**
+ * If password_hash, the hash plaintext_password has just been verified
+ * against for userid, was made with other settings than the current
+ * hash profile, queue a rehash of it. Returns true if one was queued.
+ */
+bool rehash_if_outdated(const char *userid, const char *password_hash,
+                        const char *plaintext_password);
+
+/**
+ * Counters of rehashes so far.
+ */
+void rehash_stats(rehash_stats_t *stats);
+
+#endif // REHASH_H
@@ -0,0 +1,753 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "login_async.h"
+#include "logging.h"
+#include "ratelimit.h"
+#include "wallclock.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "banned.h"
+
+#define MAX_EVENTS 64
+#define MAX_LOOPS 256
+#define MAX_LISTENERS 2
+#define UNIX_CLIENT_IP 0x7F000001   // 127.0.0.1
+
+/*
+ * Everything registered with a loop's epoll instance starts with one
+ * of these, so an event's data.ptr says what it is for.
+ */
+typedef enum {
+  ENTRY_LISTENER,
+  ENTRY_WAKE,
+  ENTRY_CONN
+} entry_kind_t;
+
+typedef struct {
+  entry_kind_t kind;
+  int fd;
+  bool is_unix;
+} listener_t;
+
+typedef struct loop loop_t;
+
+/*
+ * A client connection. It belongs to the loop that accepted it, but
+ * logins finish on hashing pool workers, which write the reply and
+ * start the next request themselves; the lock covers all of that.
+ *
+ * A connection is only closed when nothing is using it: no login in
+ * progress (busy) and no thread working through its requests
+ * (processing). Closing takes it off epoll, and the loop frees it once
+ * it has dealt with the events it already has in hand, any of which
+ * might be for it.
+ */
+typedef struct conn {
+  entry_kind_t kind;
+  int fd;
+  ip4_addr_t ip;
+  loop_t *loop;
+  struct conn *prev, *next;   // on the loop's list, under loop->lock
+  pthread_mutex_t lock;       // guards everything below
+  uint32_t events;            // what epoll is watching for
+  bool watched;               // registered with epoll
+  bool busy;                  // a login is in progress
+  bool processing;            // a thread is in conn_process()
+  bool read_closed;           // no more requests: EOF, QUIT or an error
+  bool broken;                // the socket failed; nothing more is written
+  bool closed;
+  bool buried;                // handed to the loop to be freed
+  size_t in_len;
+  char in[SERVER_MAX_LINE * 4];
+  char *out;
+  size_t out_len;
+  size_t out_sent;
+  size_t out_cap;
+} conn_t;
+
+struct loop {
+  entry_kind_t kind;          // ENTRY_WAKE: events on wake_fd
+  int wake_fd;
+  int epoll_fd;
+  pthread_t thread;
+  bool started;
+  pthread_mutex_t lock;       // guards conns and dead
+  conn_t *conns;              // open connections
+  conn_t *dead;               // closed, to be freed by the loop
+};
+
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool running = false;
+static atomic_bool stopping;
+static listener_t listeners[MAX_LISTENERS];
+static size_t num_listeners = 0;
+static loop_t *loops = NULL;
+static size_t num_loops = 0;
+static uint16_t tcp_port = 0;
+static int log_fd = -1;
+static char *unix_path = NULL;
+static bool unix_unlimited = false;
+
+static atomic_uint_fast64_t accepted;
+static atomic_uint_fast64_t logins;
+static atomic_uint_fast64_t errors;
+static atomic_size_t open_conns;
+static atomic_size_t in_flight;   // logins handed to handle_login_async_reply()
+
+static void conn_process(conn_t *c);
+
+/* Make epoll watch c for what it is waiting on now. */
+static void conn_watch(conn_t *c) {
+  if (!c->watched) {
+    return;
+  }
+  uint32_t want = 0;
+  if (!c->read_closed && c->in_len < sizeof(c->in)) {
+    want |= EPOLLIN;
+  }
+  if (c->out_sent < c->out_len) {
+    want |= EPOLLOUT;
+  }
+  if (want != c->events) {
+    struct epoll_event ev = { .events = want, .data.ptr = c };
+    epoll_ctl(c->loop->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+  }
+}
+
+static void conn_unwatch(conn_t *c) {
+  if (c->watched) {
+    epoll_ctl(c->loop->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->watched = false;
+  }
+}
+
+/* Give up on the socket: drop whatever is buffered either way. */
+static void conn_break(conn_t *c) {
+  c->broken = true;
+  c->read_closed = true;
+  explicit_bzero(c->in, c->in_len);
+  c->in_len = 0;
+  if (c->out) {
+    explicit_bzero(c->out, c->out_len);
+  }
+  c->out_len = 0;
+  c->out_sent = 0;
+  conn_unwatch(c);
+}
+
+/* Write as much buffered output as the socket will take. */
+static void conn_flush(conn_t *c) {
+  while (c->out_sent < c->out_len) {
+    ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn_break(c);
+      }
+      return;
+    }
+    c->out_sent += (size_t)n;
+  }
+  // Replies carry session tokens, so don't leave them lying about.
+  if (c->out) {
+    explicit_bzero(c->out, c->out_len);
+  }
+  c->out_len = 0;
+  c->out_sent = 0;
+}
+
+/* Queue output for c, to go with the next conn_flush(). */
+static void conn_queue(conn_t *c, const char *data, size_t len) {
+  if (c->broken) {
+    return;
+  }
+  if (c->out_len + len > c->out_cap) {
+    if (c->out_sent > 0) {
+      memmove(c->out, c->out + c->out_sent, c->out_len - c->out_sent);
+      explicit_bzero(c->out + c->out_len - c->out_sent, c->out_sent);
+      c->out_len -= c->out_sent;
+      c->out_sent = 0;
+    }
+    if (c->out_len + len > c->out_cap) {
+      size_t cap = c->out_cap ? c->out_cap * 2 : 1024;
+      while (cap < c->out_len + len) {
+        cap *= 2;
+      }
+      char *out = malloc(cap);
+      if (!out) {
+        log_message(LOG_ERROR, "server: Out of memory for client output");
+        conn_break(c);
+        return;
+      }
+      if (c->out) {
+        memcpy(out, c->out, c->out_len);
+        explicit_bzero(c->out, c->out_cap);
+        free(c->out);
+      }
+      c->out = out;
+      c->out_cap = cap;
+    }
+  }
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+}
+
+/* Queue output for c and try to send it straight away. */
+static void conn_send(conn_t *c, const char *data, size_t len) {
+  conn_queue(c, data, len);
+  conn_flush(c);
+}
+
+static void conn_error(conn_t *c, const char *reply) {
+  atomic_fetch_add_explicit(&errors, 1, memory_order_relaxed);
+  conn_send(c, reply, strlen(reply));
+}
+
+/* Hand c to its loop to be freed. */
+static void conn_bury(conn_t *c) {
+  loop_t *loop = c->loop;
+  pthread_mutex_lock(&loop->lock);
+  if (c->prev) {
+    c->prev->next = c->next;
+  } else {
+    loop->conns = c->next;
+  }
+  if (c->next) {
+    c->next->prev = c->prev;
+  }
+  bool wake = loop->dead == NULL;
+  c->next = loop->dead;
+  loop->dead = c;
+  pthread_mutex_unlock(&loop->lock);
+  atomic_fetch_sub_explicit(&open_conns, 1, memory_order_relaxed);
+  // The socket is only closed when the loop frees c, and the loop may
+  // be asleep (c was closed by a hashing pool worker), so nudge it.
+  if (wake) {
+    uint64_t one = 1;
+    ssize_t put = write(loop->wake_fd, &one, sizeof(one));
+    (void)put;
+  }
+}
+
+/*
+ * Unlock c, burying it if it has just been closed. Once this returns
+ * the caller must not touch c again unless it is a loop thread
+ * handling events it already had.
+ */
+static void conn_unlock(conn_t *c) {
+  bool bury = c->closed && !c->buried;
+  c->buried = c->buried || bury;
+  pthread_mutex_unlock(&c->lock);
+  if (bury) {
+    conn_bury(c);
+  }
+}
+
+/*
+ * Close c if it has nothing left to do (no requests it could still
+ * answer, no replies waiting, nothing in progress), or otherwise have
+ * epoll watch for what it is waiting on.
+ */
+static void conn_settle(conn_t *c) {
+  if (c->closed || c->processing) {
+    return;
+  }
+  bool idle = !c->busy && c->read_closed && c->out_len == c->out_sent
+           && memchr(c->in, '\n', c->in_len) == NULL;
+  if (!idle) {
+    conn_watch(c);
+    return;
+  }
+  conn_unwatch(c);
+  c->closed = true;
+}
+
+/* The line ending each LOGIN reply, by outcome. */
+static const char *const result_lines[] = {
+  [LOGIN_SUCCESS] = "RESULT 0\n",
+  [LOGIN_FAIL_USER_NOT_FOUND] = "RESULT 1\n",
+  [LOGIN_FAIL_BAD_PASSWORD] = "RESULT 2\n",
+  [LOGIN_FAIL_ACCOUNT_EXPIRED] = "RESULT 3\n",
+  [LOGIN_FAIL_ACCOUNT_BANNED] = "RESULT 4\n",
+  [LOGIN_FAIL_IP_BANNED] = "RESULT 5\n",
+  [LOGIN_FAIL_INTERNAL_ERROR] = "RESULT 6\n",
+};
+
+#define RESULT_LINE_LENGTH (sizeof("RESULT 0\n") - 1)
+
+/* Called when a login handed to handle_login_async_reply() is done. */
+static void conn_replied(login_result_t result, const login_session_data_t *session,
+                         const char *reply, size_t reply_len, void *arg) {
+  (void)session;
+  conn_t *c = arg;
+  pthread_mutex_lock(&c->lock);
+  // The reply and its RESULT line go out in one send.
+  conn_queue(c, reply, reply_len);
+  conn_queue(c, result_lines[result], RESULT_LINE_LENGTH);
+  conn_flush(c);
+  c->busy = false;
+  atomic_fetch_add_explicit(&logins, 1, memory_order_relaxed);
+  // Go on to the next request, unless this is a login that finished
+  // before handle_login_async_reply() returned, whose caller will.
+  conn_process(c);
+  conn_unlock(c);
+  atomic_fetch_sub(&in_flight, 1);
+}
+
+/* Act on one request line. Called with c->lock held, which it may drop. */
+static void conn_request(conn_t *c, char *line) {
+  if (strncmp(line, "LOGIN ", 6) == 0) {
+    char *userid = line + 6;
+    char *space = strchr(userid, ' ');
+    if (!space || space == userid) {
+      conn_error(c, "ERROR usage: LOGIN <userid> <password>\n");
+      return;
+    }
+    if (atomic_load(&stopping)) {
+      conn_error(c, "ERROR server stopping\n");
+      c->read_closed = true;
+      return;
+    }
+    *space = '\0';
+    c->busy = true;
+    atomic_fetch_add(&in_flight, 1);
+    pthread_mutex_unlock(&c->lock);
+    handle_login_async_reply(userid, space + 1, c->ip, wallclock_now(), log_fd, conn_replied, c);
+    pthread_mutex_lock(&c->lock);
+  } else if (strcmp(line, "QUIT") == 0) {
+    c->read_closed = true;
+    explicit_bzero(c->in, c->in_len);
+    c->in_len = 0;
+  } else if (line[0] != '\0') {
+    conn_error(c, "ERROR unknown command\n");
+  }
+}
+
+/*
+ * Work through c's complete request lines, one login at a time: stop
+ * at a LOGIN still in progress (its callback picks up from there), or
+ * while too many replies are waiting to be read. Called with c->lock
+ * held; returns at once if another thread is already at it.
+ */
+static void conn_process(conn_t *c) {
+  if (c->processing) {
+    return;
+  }
+  c->processing = true;
+  while (!c->busy && !c->broken && c->out_len - c->out_sent <= SERVER_MAX_PENDING_OUTPUT) {
+    char *newline = memchr(c->in, '\n', c->in_len);
+    size_t len = newline ? (size_t)(newline - c->in) + 1 : c->in_len;
+    if (len > SERVER_MAX_LINE || (!newline && len == SERVER_MAX_LINE)) {
+      conn_error(c, "ERROR line too long\n");
+      c->read_closed = true;
+      explicit_bzero(c->in, c->in_len);
+      c->in_len = 0;
+      break;
+    }
+    if (!newline) {
+      break;
+    }
+    char line[SERVER_MAX_LINE];
+    memcpy(line, c->in, len);
+    line[len - 1] = '\0';
+    if (len > 1 && line[len - 2] == '\r') {
+      line[len - 2] = '\0';
+    }
+    memmove(c->in, c->in + len, c->in_len - len);
+    explicit_bzero(c->in + c->in_len - len, len);
+    c->in_len -= len;
+    conn_request(c, line);
+    explicit_bzero(line, len);
+  }
+  c->processing = false;
+  conn_settle(c);
+}
+
+/* Read whatever c's client has sent, and act on it. */
+static void conn_read(conn_t *c) {
+  while (!c->read_closed && c->in_len < sizeof(c->in)) {
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if (n > 0) {
+      c->in_len += (size_t)n;
+      continue;
+    }
+    if (n == 0) {
+      c->read_closed = true;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      conn_break(c);
+    }
+    break;
+  }
+  conn_process(c);
+}
+
+static void conn_event(conn_t *c, uint32_t events) {
+  pthread_mutex_lock(&c->lock);
+  if (!c->closed) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+      conn_break(c);
+    }
+    if (events & EPOLLIN) {
+      conn_read(c);
+    }
+    if (events & EPOLLOUT) {
+      conn_flush(c);
+    }
+    // Output may have drained enough to go on with waiting requests.
+    conn_process(c);
+  }
+  conn_unlock(c);
+}
+
+static void conn_free(conn_t *c) {
+  close(c->fd);
+  pthread_mutex_destroy(&c->lock);
+  explicit_bzero(c->in, sizeof(c->in));
+  if (c->out) {
+    explicit_bzero(c->out, c->out_cap);
+    free(c->out);
+  }
+  free(c);
+}
+
+static void loop_accept(loop_t *loop, const listener_t *l) {
+  for (;;) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept4(l->fd, l->is_unix ? NULL : (struct sockaddr *)&addr,
+                     l->is_unix ? NULL : &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_message(LOG_ERROR, "server: accept failed: %s", strerror(errno));
+      }
+      return;
+    }
+    conn_t *c = calloc(1, sizeof(conn_t));
+    if (!c) {
+      log_message(LOG_ERROR, "server: Out of memory for a connection");
+      close(fd);
+      continue;
+    }
+    c->kind = ENTRY_CONN;
+    c->fd = fd;
+    if (l->is_unix) {
+      c->ip = unix_unlimited ? RATELIMIT_NO_ADDRESS : UNIX_CLIENT_IP;
+    } else {
+      c->ip = ntohl(addr.sin_addr.s_addr);
+    }
+    c->loop = loop;
+    pthread_mutex_init(&c->lock, NULL);
+    if (!l->is_unix) {
+      // Replies are small and the client is waiting on each one.
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    pthread_mutex_lock(&loop->lock);
+    c->next = loop->conns;
+    if (loop->conns) {
+      loop->conns->prev = c;
+    }
+    loop->conns = c;
+    pthread_mutex_unlock(&loop->lock);
+    atomic_fetch_add_explicit(&accepted, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&open_conns, 1, memory_order_relaxed);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    pthread_mutex_lock(&c->lock);
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+      c->watched = true;
+      c->events = EPOLLIN;
+    } else {
+      log_message(LOG_ERROR, "server: epoll_ctl failed: %s", strerror(errno));
+      c->read_closed = true;
+      conn_settle(c);
+    }
+    conn_unlock(c);
+  }
+}
+
+/* Free the connections closed since last time. */
+static void loop_free_dead(loop_t *loop) {
+  pthread_mutex_lock(&loop->lock);
+  conn_t *dead = loop->dead;
+  loop->dead = NULL;
+  pthread_mutex_unlock(&loop->lock);
+  while (dead) {
+    conn_t *next = dead->next;
+    conn_free(dead);
+    dead = next;
+  }
+}
+
+static void *loop_main(void *arg) {
+  loop_t *loop = arg;
+  struct epoll_event events[MAX_EVENTS];
+  while (!atomic_load(&stopping)) {
+    int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log_message(LOG_ERROR, "server: epoll_wait failed: %s", strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      entry_kind_t *kind = events[i].data.ptr;
+      if (*kind == ENTRY_LISTENER) {
+        loop_accept(loop, (const listener_t *)kind);
+      } else if (*kind == ENTRY_WAKE) {
+        uint64_t count;
+        ssize_t got = read(loop->wake_fd, &count, sizeof(count));
+        (void)got;
+      } else {
+        conn_event((conn_t *)kind, events[i].events);
+      }
+    }
+    // Only now, with this round's events dealt with, can connections
+    // closed during it be freed.
+    loop_free_dead(loop);
+  }
+  return NULL;
+}
+
+static bool listen_tcp(const char *address, uint16_t port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    log_message(LOG_ERROR, "server: Invalid IPv4 address '%s'", address);
+    return false;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    log_message(LOG_ERROR, "server: socket failed: %s", strerror(errno));
+    return false;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  socklen_t len = sizeof(addr);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0
+      || getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+    log_message(LOG_ERROR, "server: Can't listen on %s:%u: %s", address, port, strerror(errno));
+    close(fd);
+    return false;
+  }
+  tcp_port = ntohs(addr.sin_port);
+  listeners[num_listeners++] = (listener_t){ ENTRY_LISTENER, fd, false };
+  return true;
+}
+
+static bool listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    log_message(LOG_ERROR, "server: Unix socket path too long: %s", path);
+    return false;
+  }
+  memcpy(addr.sun_path, path, strlen(path) + 1);
+  // A socket left behind by an earlier run would stop bind().
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    log_message(LOG_ERROR, "server: socket failed: %s", strerror(errno));
+    return false;
+  }
+  // Only this user may connect, whatever the umask. Nobody can before
+  // listen(), so there is no window in which others could.
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(path, S_IRUSR | S_IWUSR) != 0
+      || listen(fd, SOMAXCONN) != 0) {
+    log_message(LOG_ERROR, "server: Can't listen on %s: %s", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+  unix_path = strdup(path);
+  listeners[num_listeners++] = (listener_t){ ENTRY_LISTENER, fd, true };
+  return true;
+}
+
+static bool loop_start(loop_t *loop) {
+  loop->kind = ENTRY_WAKE;
+  pthread_mutex_init(&loop->lock, NULL);
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->epoll_fd < 0 || loop->wake_fd < 0) {
+    log_message(LOG_ERROR, "server: Can't set up an event loop: %s", strerror(errno));
+    return false;
+  }
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = loop };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < num_listeners; i++) {
+    // Each connection wakes just one loop, which accepts it.
+    ev = (struct epoll_event){ .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &listeners[i] };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listeners[i].fd, &ev) != 0) {
+      log_message(LOG_ERROR, "server: epoll_ctl failed: %s", strerror(errno));
+      return false;
+    }
+  }
+  if (pthread_create(&loop->thread, NULL, loop_main, loop) != 0) {
+    log_message(LOG_ERROR, "server: Can't start an event loop thread");
+    return false;
+  }
+  loop->started = true;
+  return true;
+}
+
+/* Stop the loops, then free everything; the caller holds server_lock. */
+static void teardown(void) {
+  atomic_store(&stopping, true);
+  for (size_t i = 0; i < num_loops; i++) {
+    if (loops[i].started) {
+      uint64_t one = 1;
+      ssize_t put = write(loops[i].wake_fd, &one, sizeof(one));
+      (void)put;
+    }
+  }
+  for (size_t i = 0; i < num_loops; i++) {
+    if (loops[i].started) {
+      pthread_join(loops[i].thread, NULL);
+    }
+  }
+  // Logins still running will write to their connections; let them.
+  while (atomic_load(&in_flight) > 0) {
+    struct timespec pause = { 0, 1000000 };
+    nanosleep(&pause, NULL);
+  }
+  for (size_t i = 0; i < num_loops; i++) {
+    loop_t *loop = &loops[i];
+    loop_free_dead(loop);
+    while (loop->conns) {
+      conn_t *next = loop->conns->next;
+      conn_free(loop->conns);
+      loop->conns = next;
+    }
+    if (loop->epoll_fd >= 0) {
+      close(loop->epoll_fd);
+    }
+    if (loop->wake_fd >= 0) {
+      close(loop->wake_fd);
+    }
+    pthread_mutex_destroy(&loop->lock);
+  }
+  free(loops);
+  loops = NULL;
+  num_loops = 0;
+  for (size_t i = 0; i < num_listeners; i++) {
+    close(listeners[i].fd);
+  }
+  num_listeners = 0;
+  if (unix_path) {
+    unlink(unix_path);
+    free(unix_path);
+    unix_path = NULL;
+  }
+  tcp_port = 0;
+  atomic_store(&open_conns, 0);
+}
+
+bool server_start(const server_config_t *config) {
+  if (config == NULL || (config->tcp_address == NULL && config->unix_path == NULL)) {
+    log_message(LOG_ERROR, "server_start: Nothing to listen on");
+    return false;
+  }
+  pthread_mutex_lock(&server_lock);
+  if (running) {
+    pthread_mutex_unlock(&server_lock);
+    log_message(LOG_ERROR, "server_start: Already running");
+    return false;
+  }
+  atomic_store(&stopping, false);
+  atomic_store(&accepted, 0);
+  atomic_store(&logins, 0);
+  atomic_store(&errors, 0);
+  log_fd = config->log_fd;
+  unix_unlimited = config->unix_unlimited;
+
+  size_t count = config->loops;
+  if (count == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cpus > 0 ? (size_t)cpus : 1;
+  }
+  if (count > MAX_LOOPS) {
+    count = MAX_LOOPS;
+  }
+  bool ok = (config->tcp_address == NULL || listen_tcp(config->tcp_address, config->tcp_port))
+         && (config->unix_path == NULL || listen_unix(config->unix_path));
+  if (ok) {
+    loops = calloc(count, sizeof(loop_t));
+    ok = loops != NULL;
+  }
+  for (size_t i = 0; ok && i < count; i++) {
+    num_loops = i + 1;
+    ok = loop_start(&loops[i]);
+  }
+  if (!ok) {
+    teardown();
+    pthread_mutex_unlock(&server_lock);
+    return false;
+  }
+  running = true;
+  pthread_mutex_unlock(&server_lock);
+  // Logins read the time from the ticker's cache from now on; without
+  // it they read the clock themselves, so failing to start it is fine.
+  wallclock_start();
+  log_message(LOG_INFO, "server: Listening with %zu event loop(s)", count);
+  return true;
+}
+
+uint16_t server_tcp_port(void) {
+  pthread_mutex_lock(&server_lock);
+  uint16_t port = tcp_port;
+  pthread_mutex_unlock(&server_lock);
+  return port;
+}
+
+void server_stop(void) {
+  pthread_mutex_lock(&server_lock);
+  if (running) {
+    teardown();
+    running = false;
+    wallclock_stop();
+  }
+  pthread_mutex_unlock(&server_lock);
+}
+
+void server_stats(server_stats_t *stats) {
+  if (stats == NULL) {
+    return;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->accepted = atomic_load(&accepted);
+  stats->logins = atomic_load(&logins);
+  stats->errors = atomic_load(&errors);
+  stats->open = atomic_load(&open_conns);
+}
@@ -0,0 +1,90 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file server.h
+ * @brief Non-blocking login server on TCP and Unix sockets.
+ *
+ * A small line protocol in front of handle_login_async_reply(), so the
+ * login path can be driven (and load-tested) over real sockets. Each
+ * request is one line:
+ *
+ *   LOGIN <userid> <password>   (the password is the rest of the line)
+ *   QUIT
+ *
+ * and the reply to a LOGIN is what handle_login() would have written
+ * to the client, followed by a line "RESULT <n>", n being the
+ * login_result_t. Anything else gets "ERROR <reason>". Requests may be
+ * pipelined; replies come back in order. A client at a TCP address
+ * logs in as that address, and one on the Unix socket as 127.0.0.1.
+ * The Unix socket is made accessible to the server's own user only
+ * (mode 0600). If unix_unlimited is set, its clients instead log in
+ * with no address (RATELIMIT_NO_ADDRESS), so they aren't rate limited:
+ * for a trusted local front end relaying many users' logins, which
+ * does its own limiting by their addresses.
+ *
+ * Connections are spread over a number of event-loop threads, each
+ * with its own epoll instance, all of them accepting from the
+ * listening sockets. Sockets are non-blocking and every connection
+ * has its own output buffer, so a client that reads slowly only delays
+ * itself. Password checks run on the hashing pool (hashpool.h), and
+ * replies are written, and the connection's next request started, by
+ * whichever thread finishes the login. A connection has at most one
+ * login in progress, and stops starting new ones while more than
+ * SERVER_MAX_PENDING_OUTPUT bytes of replies are waiting for it to
+ * read them.
+ */
+
+/** Longest request line, including the newline. */
+#define SERVER_MAX_LINE 512
+
+/** Reply bytes a connection may leave unread before its requests wait. */
+#define SERVER_MAX_PENDING_OUTPUT (64 * 1024)
+
+typedef struct {
+  const char *tcp_address;  // IPv4 address to listen on, e.g. "127.0.0.1" (NULL: no TCP)
+  uint16_t tcp_port;        // 0 picks a free port (see server_tcp_port())
+  const char *unix_path;    // Unix socket to listen on (NULL: none)
+  bool unix_unlimited;      // don't rate limit Unix socket clients (see above)
+  size_t loops;             // event-loop threads (0: one per CPU)
+  int log_fd;               // handle_login()'s log_fd
+} server_config_t;
+
+typedef struct {
+  uint64_t accepted;        // connections accepted
+  uint64_t logins;          // LOGIN requests answered
+  uint64_t errors;          // malformed requests
+  size_t open;              // connections open now
+} server_stats_t;
+
+/**
+ * Start listening and serving, and start the clock ticker (wallclock.h)
+ * that times out sessions and account expiries. Returns false (and
+ * logs) if the server is already running or a socket or thread can't
+ * be set up.
+ */
+bool server_start(const server_config_t *config);
+
+/**
+ * The TCP port being listened on (useful with tcp_port 0), or 0 if
+ * none.
+ */
+uint16_t server_tcp_port(void);
+
+/**
+ * Stop: close the listening sockets, wait for logins in progress to
+ * finish, and close every connection. Replies not yet written are
+ * dropped. The clock ticker is stopped too.
+ */
+void server_stop(void);
+
+/**
+ * Counters since the server was started.
+ */
+void server_stats(server_stats_t *stats);
+
+#endif // SERVER_H
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+#include "session.h"
+#include "csprng.h"
+#include "logging.h"
+#include "timerwheel.h"
+#include "wallclock.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "banned.h"
+
+/*
+ * Tokens are kept in SESSION_STRIPES independently locked hash tables,
+ * chosen by the low bits of the token's selector, each chaining
+ * entries off a power-of-two array of buckets that doubles as it fills.
+ *
+ * Revocation is by generation: every account that has had its tokens
+ * revoked has a generation number, bumped on each revocation, and a
+ * token is only valid while its account is still at the generation it
+ * was issued in. Revoking is then O(1) however many tokens there are,
+ * and the revoked entries are dropped as they are next seen.
+ *
+ * Each stripe also has a timer wheel holding every entry's expiry, so
+ * entries are dropped once they time out without a sweep looking at
+ * the rest. The clock ticker moves the wheels on every second (see
+ * session_tick()), and issuing moves its own stripe's along, so they
+ * keep up even without the ticker.
+ */
+
+#define SESSION_STRIPES 16
+#define STRIPE_MIN_BUCKETS 64
+
+typedef struct session_entry {
+  struct session_entry *next;
+  uint64_t selector;
+  session_token_t token;
+  login_session_data_t session;
+  time_t expires;
+  uint32_t generation;
+  wheel_timer_t timer;   // on the stripe's wheel, at expires
+} session_entry_t;
+
+typedef struct {
+  _Alignas(64) pthread_mutex_t lock;
+  session_entry_t **buckets;
+  size_t mask;      // number of buckets - 1, or 0 before the first insert
+  size_t count;
+  timerwheel_t wheel;
+} stripe_t;
+
+static stripe_t stripes[SESSION_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+static _Atomic int64_t lifetime = SESSION_DEFAULT_LIFETIME;
+
+/* Account generations: open addressing on account_id, 0 marks a free slot. */
+typedef struct {
+  int64_t account_id;
+  uint32_t generation;
+} generation_slot_t;
+
+static pthread_rwlock_t generation_lock = PTHREAD_RWLOCK_INITIALIZER;
+static generation_slot_t *generations = NULL;
+static size_t generation_mask = 0;
+static size_t generation_count = 0;
+
+static void session_tick(time_t now);
+
+static void stripes_init(void) {
+  time_t now = wallclock_now();
+  for (size_t i = 0; i < SESSION_STRIPES; i++) {
+    pthread_mutex_init(&stripes[i].lock, NULL);
+    timerwheel_init(&stripes[i].wheel, now);
+  }
+  wallclock_on_second(session_tick);
+}
+
+static uint64_t selector_of(const session_token_t *token) {
+  uint64_t selector;
+  memcpy(&selector, token->bytes, sizeof(selector));
+  return selector;
+}
+
+static stripe_t *stripe_of(uint64_t selector) {
+  pthread_once(&stripes_once, stripes_init);
+  return &stripes[selector % SESSION_STRIPES];
+}
+
+static size_t bucket_of(const stripe_t *st, uint64_t selector) {
+  return (size_t)(selector / SESSION_STRIPES) & st->mask;
+}
+
+/* Compare two tokens in time that doesn't depend on where they differ. */
+static bool tokens_equal(const session_token_t *a, const session_token_t *b) {
+  unsigned char diff = 0;
+  for (size_t i = 0; i < SESSION_TOKEN_BYTES; i++) {
+    diff |= a->bytes[i] ^ b->bytes[i];
+  }
+  return diff == 0;
+}
+
+static size_t generation_slot(int64_t account_id) {
+  return (size_t)(((uint64_t)account_id * 0x9E3779B97F4A7C15ULL) >> 32) & generation_mask;
+}
+
+/* The caller holds generation_lock. */
+static uint32_t generation_locked(int64_t account_id) {
+  if (generations == NULL) {
+    return 0;
+  }
+  for (size_t i = generation_slot(account_id); ; i = (i + 1) & generation_mask) {
+    if (generations[i].account_id == account_id) {
+      return generations[i].generation;
+    }
+    if (generations[i].account_id == 0) {
+      return 0;
+    }
+  }
+}
+
+static uint32_t generation_of(int64_t account_id) {
+  pthread_rwlock_rdlock(&generation_lock);
+  uint32_t g = generation_locked(account_id);
+  pthread_rwlock_unlock(&generation_lock);
+  return g;
+}
+
+/* Whether e is still good at time now; the caller holds e's stripe lock. */
+static bool entry_live(const session_entry_t *e, time_t now) {
+  return now < e->expires && e->generation == generation_of(e->session.account_id);
+}
+
+/* Free e, once unlinked from its chain; the caller holds st's lock. */
+static void free_entry(stripe_t *st, session_entry_t *e) {
+  timerwheel_cancel(&st->wheel, &e->timer);
+  explicit_bzero(e, sizeof(*e));
+  free(e);
+}
+
+/* Unlink and free every dead entry in st; the caller holds its lock. */
+static size_t stripe_sweep(stripe_t *st, time_t now) {
+  size_t removed = 0;
+  for (size_t b = 0; st->buckets != NULL && b <= st->mask; b++) {
+    for (session_entry_t **link = &st->buckets[b]; *link != NULL; ) {
+      session_entry_t *e = *link;
+      if (entry_live(e, now)) {
+        link = &e->next;
+        continue;
+      }
+      *link = e->next;
+      free_entry(st, e);
+      removed++;
+    }
+  }
+  st->count -= removed;
+  return removed;
+}
+
+/* Wheel callback: e's expiry has come, so unlink and free it. */
+static void entry_expired(wheel_timer_t *timer, void *arg) {
+  stripe_t *st = arg;
+  session_entry_t *e = (session_entry_t *)((char *)timer - offsetof(session_entry_t, timer));
+  session_entry_t **link = &st->buckets[bucket_of(st, e->selector)];
+  while (*link != e) {
+    link = &(*link)->next;
+  }
+  *link = e->next;
+  st->count--;
+  free_entry(st, e);
+}
+
+/* Drop st's entries that have timed out by now; the caller holds its lock. */
+static size_t stripe_advance(stripe_t *st, time_t now) {
+  return timerwheel_advance(&st->wheel, now, entry_expired, st);
+}
+
+static void session_tick(time_t now) {
+  for (size_t i = 0; i < SESSION_STRIPES; i++) {
+    stripe_t *st = &stripes[i];
+    pthread_mutex_lock(&st->lock);
+    stripe_advance(st, now);
+    pthread_mutex_unlock(&st->lock);
+  }
+}
+
+/* Double st's buckets (or make the first ones); the caller holds its lock. */
+static bool stripe_grow(stripe_t *st) {
+  size_t num = st->buckets ? (st->mask + 1) * 2 : STRIPE_MIN_BUCKETS;
+  session_entry_t **buckets = calloc(num, sizeof(session_entry_t *));
+  if (!buckets) {
+    return false;
+  }
+  size_t old_mask = st->mask;
+  session_entry_t **old = st->buckets;
+  st->buckets = buckets;
+  st->mask = num - 1;
+  for (size_t b = 0; old != NULL && b <= old_mask; b++) {
+    while (old[b] != NULL) {
+      session_entry_t *e = old[b];
+      old[b] = e->next;
+      size_t nb = bucket_of(st, e->selector);
+      e->next = buckets[nb];
+      buckets[nb] = e;
+    }
+  }
+  free(old);
+  return true;
+}
+
+void session_configure(time_t seconds) {
+  atomic_store(&lifetime, seconds > 0 ? (int64_t)seconds : SESSION_DEFAULT_LIFETIME);
+}
+
+bool session_issue(const login_session_data_t *session, session_token_t *token) {
+  if (session == NULL || token == NULL) {
+    log_message(LOG_ERROR, "session_issue: NULL argument(s)");
+    return false;
+  }
+  session_entry_t *e = calloc(1, sizeof(session_entry_t));
+  if (!e) {
+    log_message(LOG_ERROR, "session_issue: Failed to allocate memory");
+    return false;
+  }
+  if (!csprng_bytes(e->token.bytes, SESSION_TOKEN_BYTES)) {
+    log_message(LOG_ERROR, "session_issue: Can't make a random token");
+    free(e);
+    return false;
+  }
+  e->selector = selector_of(&e->token);
+  e->session = *session;
+  e->expires = session->session_start + (time_t)atomic_load(&lifetime);
+  if (session->expiration_time != 0 && session->expiration_time < e->expires) {
+    e->expires = session->expiration_time;
+  }
+  e->generation = generation_of(session->account_id);
+
+  stripe_t *st = stripe_of(e->selector);
+  time_t now = wallclock_now();
+  pthread_mutex_lock(&st->lock);
+  stripe_advance(st, now);
+  // Keep at most one entry per bucket. When full, clear out dead ones,
+  // and grow unless that left the table no more than half full.
+  size_t buckets = st->buckets ? st->mask + 1 : 0;
+  if (st->count >= buckets) {
+    stripe_sweep(st, now);
+    if (st->count * 2 >= buckets && !stripe_grow(st)) {
+      pthread_mutex_unlock(&st->lock);
+      log_message(LOG_ERROR, "session_issue: Failed to allocate memory");
+      explicit_bzero(e, sizeof(*e));
+      free(e);
+      return false;
+    }
+  }
+  size_t b = bucket_of(st, e->selector);
+  e->next = st->buckets[b];
+  st->buckets[b] = e;
+  st->count++;
+  timerwheel_add(&st->wheel, &e->timer, e->expires);
+  *token = e->token;
+  pthread_mutex_unlock(&st->lock);
+  return true;
+}
+
+/**
+ * Find token's entry, returning the link that points to it (so it can
+ * be unlinked), or NULL. The caller holds st's lock.
+ */
+static session_entry_t **find_entry(stripe_t *st, const session_token_t *token,
+                                    uint64_t selector) {
+  if (st->buckets == NULL) {
+    return NULL;
+  }
+  for (session_entry_t **link = &st->buckets[bucket_of(st, selector)]; *link != NULL;
+       link = &(*link)->next) {
+    if ((*link)->selector == selector && tokens_equal(&(*link)->token, token)) {
+      return link;
+    }
+  }
+  return NULL;
+}
+
+/* Unlink and free the entry at *link; the caller holds st's lock. */
+static void remove_entry(stripe_t *st, session_entry_t **link) {
+  session_entry_t *e = *link;
+  *link = e->next;
+  st->count--;
+  free_entry(st, e);
+}
+
+bool session_validate(const session_token_t *token, time_t now, login_session_data_t *session) {
+  if (token == NULL) {
+    return false;
+  }
+  uint64_t selector = selector_of(token);
+  stripe_t *st = stripe_of(selector);
+  pthread_mutex_lock(&st->lock);
+  session_entry_t **link = find_entry(st, token, selector);
+  bool ok = link != NULL && entry_live(*link, now);
+  if (ok && session != NULL) {
+    *session = (*link)->session;
+  } else if (link != NULL && !ok) {
+    remove_entry(st, link);
+  }
+  pthread_mutex_unlock(&st->lock);
+  return ok;
+}
+
+bool session_revoke(const session_token_t *token) {
+  if (token == NULL) {
+    return false;
+  }
+  uint64_t selector = selector_of(token);
+  stripe_t *st = stripe_of(selector);
+  pthread_mutex_lock(&st->lock);
+  session_entry_t **link = find_entry(st, token, selector);
+  if (link != NULL) {
+    remove_entry(st, link);
+  }
+  pthread_mutex_unlock(&st->lock);
+  return link != NULL;
+}
+
+/* Make room for one more account generation; the caller holds generation_lock for writing. */
+static bool generations_reserve(void) {
+  if (generations != NULL && (generation_count + 1) * 10 <= (generation_mask + 1) * 7) {
+    return true;
+  }
+  size_t num = generations ? (generation_mask + 1) * 2 : 64;
+  generation_slot_t *slots = calloc(num, sizeof(generation_slot_t));
+  if (!slots) {
+    return false;
+  }
+  generation_slot_t *old = generations;
+  size_t old_num = generations ? generation_mask + 1 : 0;
+  generations = slots;
+  generation_mask = num - 1;
+  for (size_t i = 0; i < old_num; i++) {
+    if (old[i].account_id == 0) {
+      continue;
+    }
+    size_t j = generation_slot(old[i].account_id);
+    while (slots[j].account_id != 0) {
+      j = (j + 1) & generation_mask;
+    }
+    slots[j] = old[i];
+  }
+  free(old);
+  return true;
+}
+
+void session_revoke_account(int64_t account_id) {
+  if (account_id == 0) {
+    return;
+  }
+  pthread_rwlock_wrlock(&generation_lock);
+  if (!generations_reserve()) {
+    pthread_rwlock_unlock(&generation_lock);
+    log_message(LOG_ERROR, "session_revoke_account: Failed to allocate memory");
+    return;
+  }
+  size_t i = generation_slot(account_id);
+  while (generations[i].account_id != 0 && generations[i].account_id != account_id) {
+    i = (i + 1) & generation_mask;
+  }
+  if (generations[i].account_id == 0) {
+    generations[i].account_id = account_id;
+    generation_count++;
+  }
+  generations[i].generation++;
+  pthread_rwlock_unlock(&generation_lock);
+}
+
+size_t session_expire(time_t now) {
+  pthread_once(&stripes_once, stripes_init);
+  size_t removed = 0;
+  for (size_t i = 0; i < SESSION_STRIPES; i++) {
+    stripe_t *st = &stripes[i];
+    pthread_mutex_lock(&st->lock);
+    removed += stripe_sweep(st, now);
+    pthread_mutex_unlock(&st->lock);
+  }
+  return removed;
+}
+
+size_t session_count(void) {
+  pthread_once(&stripes_once, stripes_init);
+  size_t count = 0;
+  for (size_t i = 0; i < SESSION_STRIPES; i++) {
+    stripe_t *st = &stripes[i];
+    pthread_mutex_lock(&st->lock);
+    count += st->count;
+    pthread_mutex_unlock(&st->lock);
+  }
+  return count;
+}
+
+void session_token_format(const session_token_t *token, char buf[SESSION_TOKEN_TEXT_LENGTH]) {
+  static const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i < SESSION_TOKEN_BYTES; i++) {
+    buf[2 * i] = hex[token->bytes[i] >> 4];
+    buf[2 * i + 1] = hex[token->bytes[i] & 15];
+  }
+  buf[2 * SESSION_TOKEN_BYTES] = '\0';
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+bool session_token_parse(const char *text, session_token_t *token) {
+  if (text == NULL || token == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < SESSION_TOKEN_BYTES; i++) {
+    int hi = hex_value(text[2 * i]);
+    int lo = hi < 0 ? -1 : hex_value(text[2 * i + 1]);
+    if (lo < 0) {
+      return false;
+    }
+    token->bytes[i] = (unsigned char)(hi << 4 | lo);
+  }
+  return text[2 * SESSION_TOKEN_BYTES] == '\0';
+}
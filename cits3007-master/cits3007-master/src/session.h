@@ -0,0 +1,94 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "login.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @file session.h
+ * @brief Session tokens issued on login.
+ *
+ * A successful login is given a random, opaque token, which the client
+ * presents instead of its password on later requests. Checking a token
+ * is a hash table lookup rather than an Argon2 verify.
+ *
+ * A token is valid until the earlier of its session's start plus the
+ * session lifetime and the account's own expiration time. Changing an
+ * account's password or banning it revokes all of its tokens.
+ *
+ * The first SESSION_SELECTOR_BYTES of a token only pick where it is
+ * kept; the whole token is then compared in constant time, so how long
+ * a check takes says nothing about how much of a guess was right.
+ */
+
+#define SESSION_TOKEN_BYTES 32
+#define SESSION_SELECTOR_BYTES 8
+
+/** Length of a token written as hex, including the null terminator. */
+#define SESSION_TOKEN_TEXT_LENGTH (2 * SESSION_TOKEN_BYTES + 1)
+
+/** How long a session lasts unless configured otherwise, in seconds. */
+#define SESSION_DEFAULT_LIFETIME (60 * 60)
+
+typedef struct {
+  unsigned char bytes[SESSION_TOKEN_BYTES];
+} session_token_t;
+
+/**
+ * Set how long new sessions last, in seconds (0 for the default).
+ */
+void session_configure(time_t lifetime);
+
+/**
+ * Issue a token for a session filled in by a successful login. Returns
+ * false (and logs) if no random token could be made or stored.
+ */
+bool session_issue(const login_session_data_t *session, session_token_t *token);
+
+/**
+ * Check a token presented at time `now`. If it is valid, copies its
+ * session to *session (if not NULL) and returns true. Expired and
+ * revoked tokens are forgotten as they are found.
+ */
+bool session_validate(const session_token_t *token, time_t now, login_session_data_t *session);
+
+/**
+ * Forget one token (a logout). Returns false if it wasn't known.
+ */
+bool session_revoke(const session_token_t *token);
+
+/**
+ * Revoke every token issued to account_id so far.
+ */
+void session_revoke_account(int64_t account_id);
+
+/**
+ * Forget all tokens that have expired or been revoked by time `now`.
+ * Returns how many were removed. Tokens are also dropped as they time
+ * out, once a second while the clock ticker (wallclock.h) runs and
+ * whenever a token is issued, and revoked ones when a store fills up.
+ */
+size_t session_expire(time_t now);
+
+/**
+ * Number of tokens currently stored (including any not yet found to be
+ * expired or revoked).
+ */
+size_t session_count(void);
+
+/**
+ * Write a token as lowercase hex into buf.
+ */
+void session_token_format(const session_token_t *token, char buf[SESSION_TOKEN_TEXT_LENGTH]);
+
+/**
+ * Parse a token written by session_token_format(). Returns false if
+ * text isn't exactly that.
+ */
+bool session_token_parse(const char *text, session_token_t *token);
+
+#endif // SESSION_H
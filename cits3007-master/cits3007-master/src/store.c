@@ -0,0 +1,2208 @@
+#define _GNU_SOURCE
+#include "store.h"
+#include "account_internal.h"
+#include "db.h"
+#include "journal.h"
+#include "logging.h"
+#include "mapfile.h"
+#include "session.h"
+#include "timerwheel.h"
+#include "wallclock.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "banned.h"
+
+/*
+ * The store is split into shards by userid hash. Each shard is a
+ * complete store of its own, with its own records, index, secondary
+ * indexes and writer lock, so inserts into different shards proceed in
+ * parallel and each index stays a fraction of the total size.
+ *
+ * Within a shard, account records live in a mapfile, after a one-page
+ * header, in insertion order. Growing the shard maps more of the file
+ * in place, so records never move once written. Only the
+ * authentication fields are kept there; each account's email and
+ * birthdate are held at the same record number in a second, "cold"
+ * mapfile, which logins never touch.
+ *
+ * The userid index is an open-addressing (linear probing) hash table
+ * in a third mapfile. Its slots hold the top 32 bits of the userid
+ * hash plus the record number, so mismatching probes are almost always
+ * rejected without touching the record itself. When the store is file
+ * backed the index is persisted too, so reopening a store is a few map
+ * calls rather than a reload-and-rehash.
+ *
+ * Shard 0 of a store at <path> is kept in <path>, <path>.idx and
+ * <path>.cold; shard i > 0 in <path>.i, <path>.i.idx and <path>.i.cold.
+ * Shard 0's header records the number of shards, and the account id
+ * counter.
+ *
+ * Lookups never take a lock. Writers (inserts, counter updates and
+ * email changes) are serialised among themselves, but readers never
+ * wait for them:
+ *
+ *  - A new record is written in full before its index slot is
+ *    published with a single atomic store, so a reader either finds
+ *    the complete record or doesn't find it yet.
+ *  - When an index grows, the new table is built off to the side and
+ *    swapped in atomically. Readers still probing the old table can
+ *    carry on: retired tables are only unmapped when the store is
+ *    closed, and together they take at most the space of the current
+ *    one.
+ *  - Updates to a record happen under one of a set of striped locks,
+ *    each with a sequence count that is odd while an update is in
+ *    progress. Readers copy what they need and retry if the count
+ *    moved (a seqlock), so they see each update either wholly or not
+ *    at all.
+ *
+ * A persistent store also keeps a write-ahead journal, <path>.wal, of
+ * every change: each insert or update is applied in memory, appended
+ * to the journal while the record is still locked (so the journal
+ * holds each account's changes in order), and only reported done once
+ * the journal has synced it. Records carry the changed fields' new
+ * values rather than deltas, so replaying one that the mapped files
+ * already reflect does no harm. Checkpoints flush the mapped files and
+ * then drop the records that came before; store_sync() takes one, as
+ * does any change that finds the journal has grown past
+ * STORE_JOURNAL_CHECKPOINT_BYTES.
+ *
+ * store_configure_shards(), store_open() and store_close() must not
+ * run concurrently with anything else.
+ */
+
+#define STORE_MAGIC       "OOSTORE"
+#define STORE_INDEX_MAGIC "OOINDEX"
+#define STORE_COLD_MAGIC  "OOCOLD\0"
+#define STORE_VERSION     4
+
+#define STORE_HEADER_SIZE     4096
+#define STORE_INITIAL_RECORDS 1024
+#define STORE_INITIAL_SLOTS   2048   /* must be a power of two */
+
+/* Address space reserved for records (across all shards); nothing is
+   committed until used. */
+#define STORE_RECORDS_RESERVE (64ULL << 30)
+#define STORE_PROFILES_RESERVE (32ULL << 30)
+
+/* Never grow the records mapping by more than this at once. */
+#define STORE_MAX_GROW_BYTES (1ULL << 30)
+
+/* Number of locks serialising in-place record updates; a power of two. */
+#define STORE_LOCK_STRIPES 1024
+
+/* Number of counters tracking acquired records; a power of two. */
+#define STORE_PIN_STRIPES 64
+
+/* Checkpoint the journal once it holds this many bytes of records. */
+#define STORE_JOURNAL_CHECKPOINT_BYTES (64ULL << 20)
+
+/* Grow an index once it is more than 70% full. */
+#define STORE_MAX_LOAD_NUM 7
+#define STORE_MAX_LOAD_DEN 10
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t num_records;
+  uint32_t num_shards;
+  uint32_t shard;                       /* this file's shard number */
+  _Atomic uint64_t next_account_id;     /* next id to assign (shard 0 only) */
+} store_header_t;
+
+/* The cold part of an account. */
+typedef struct {
+  char email[EMAIL_LENGTH];
+  char birthdate[BIRTHDATE_LENGTH];
+} profile_t;
+
+typedef struct {
+  char magic[8];
+  uint64_t num_slots;
+  uint64_t num_records;  /* records covered by this index */
+} index_header_t;
+
+#define INDEX_HEADER_SIZE 64
+
+/*
+ * An index slot is a single 64-bit word, so that it can be published
+ * atomically: the low 32 bits hold the high 32 bits of the userid hash
+ * (the tag) and the high 32 bits the record number + 1, with 0 marking
+ * an empty slot.
+ */
+typedef _Atomic uint64_t index_slot_t;
+
+typedef struct index {
+  mapfile_t map;
+  index_header_t *header;
+  index_slot_t *slots;
+  size_t mask;              /* number of slots - 1 */
+  struct index *retired;    /* the index this one replaced, if any */
+} index_t;
+
+/*
+ * Secondary indexes, by account id and by normalised email. These are
+ * kept in ordinary memory rather than on disk: they are built from the
+ * records the first time they are needed and maintained from then on,
+ * so opening a store and serving logins never pays for them.
+ *
+ * Each id slot holds a record number. Several accounts may share an
+ * email, so each email slot holds the head of a doubly linked chain of
+ * the records with that email, threaded through email_next/email_prev.
+ * A chain that empties keeps its slot until the table is next rebuilt.
+ */
+typedef struct {
+  uint64_t hash;
+  uint32_t rec;   /* record number + 1; 0 marks an empty slot or chain */
+  uint32_t used;  /* nonzero once the slot has been taken */
+} sec_slot_t;
+
+typedef struct {
+  _Alignas(64) size_t number;
+  mapfile_t data_map;
+  mapfile_t cold_map;
+  store_header_t *header;
+  account_auth_t *records;
+  profile_t *profiles;                  /* profiles[i] belongs to records[i] */
+  _Atomic(index_t *) index;
+  atomic_size_t published;              /* records below this are complete */
+  pthread_mutex_t writer_lock;          /* serialises inserts and growth */
+
+  pthread_mutex_t secondary_lock;
+  bool secondary_built;
+  sec_slot_t *id_slots;
+  size_t id_mask;
+  sec_slot_t *email_slots;
+  size_t email_mask;
+  size_t email_used;                    /* email slots taken, chains or not */
+  uint32_t *email_next;                 /* per record: next in chain + 1 */
+  uint32_t *email_prev;                 /* per record: previous in chain + 1 */
+  size_t links_capacity;
+} shard_t;
+
+/* NULL until the store is initialised. */
+static _Atomic(shard_t *) shards = NULL;
+static size_t num_shards = 0;
+static size_t configured_shards = 1;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *store_path = NULL;         /* NULL for an in-memory store */
+
+/* Serialises inserts that bring their own account id. */
+static pthread_mutex_t explicit_id_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* NULL for an in-memory store, and while the journal is replayed. */
+static journal_t *journal = NULL;
+static atomic_flag checkpointing = ATOMIC_FLAG_INIT;
+
+/*
+ * Journal records. Each payload starts with the userid of the account
+ * it changes and gives the new values of the fields it sets.
+ */
+enum {
+  WAL_ADD = 1,          // a new account (wal_account_t)
+  WAL_COUNTERS,         // login counters after a login (wal_counters_t)
+  WAL_PASSWORD,         // new password hash, clearing any ban and failures
+  WAL_UNBAN_TIME,       // wal_time_t
+  WAL_EXPIRATION_TIME,  // wal_time_t
+  WAL_EMAIL,            // wal_email_t
+  WAL_REHASH,           // same password, new hash (wal_password_t); nothing cleared
+};
+
+typedef struct {
+  char userid[USER_ID_LENGTH];
+  int64_t account_id;
+  int64_t unban_time;
+  int64_t expiration_time;
+  int64_t last_login_time;
+  uint32_t login_count;
+  uint32_t login_fail_count;
+  uint32_t last_ip;
+  char password_hash[HASH_LENGTH];
+  char email[EMAIL_LENGTH];
+  char birthdate[BIRTHDATE_LENGTH];
+} wal_account_t;
+
+typedef struct {
+  char userid[USER_ID_LENGTH];
+  int64_t last_login_time;
+  uint32_t login_count;
+  uint32_t login_fail_count;
+  uint32_t last_ip;
+} wal_counters_t;
+
+typedef struct {
+  char userid[USER_ID_LENGTH];
+  char password_hash[HASH_LENGTH];
+} wal_password_t;
+
+typedef struct {
+  char userid[USER_ID_LENGTH];
+  int64_t time;
+} wal_time_t;
+
+typedef struct {
+  char userid[USER_ID_LENGTH];
+  char email[EMAIL_LENGTH];
+} wal_email_t;
+
+/*
+ * Updates to a record are serialised by one of a fixed set of locks,
+ * chosen by shard and record number, and announced to readers through
+ * the stripe's sequence count. Each stripe sits on its own cache line
+ * so that threads updating unrelated accounts don't contend.
+ */
+typedef struct {
+  _Alignas(64) pthread_mutex_t lock;
+  atomic_uint seq;     /* odd while an update is in progress */
+} lock_stripe_t;
+
+static lock_stripe_t stripes[STORE_LOCK_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Records handed out by store_acquire() and not yet released, counted
+ * on per-thread stripes so that readers don't all bounce one cache
+ * line. Only the sum is meaningful.
+ */
+typedef struct {
+  _Alignas(64) atomic_long count;
+} pin_stripe_t;
+
+static pin_stripe_t pins[STORE_PIN_STRIPES];
+static atomic_uint next_pin_stripe = 0;
+static _Thread_local pin_stripe_t *thread_pins = NULL;
+
+static void secondary_free(shard_t *sh);
+static void expiry_clear(void);
+static bool journal_start(void);
+
+/* Final avalanche step of the hashes below. */
+static inline uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * 64-bit FNV-1a over the userid, followed by a final avalanche step
+ * so that the low bits (used for the slot position) and the high bits
+ * (stored as the tag, and used to pick the shard) are both well mixed.
+ */
+uint64_t store_hash_userid(const char *userid) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < USER_ID_LENGTH && userid[i] != '\0'; i++) {
+    h ^= (unsigned char)userid[i];
+    h *= 0x100000001b3ULL;
+  }
+  return mix64(h);
+}
+
+/* As store_hash_userid(), over the email with ASCII letters lowercased. */
+static uint64_t hash_email(const char *email) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < EMAIL_LENGTH && email[i] != '\0'; i++) {
+    h ^= (unsigned char)tolower((unsigned char)email[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return mix64(h);
+}
+
+static inline uint64_t hash_id(int64_t id) {
+  return mix64((uint64_t)id * 0x9e3779b97f4a7c15ULL);
+}
+
+static inline uint32_t hash_tag(uint64_t h) {
+  return (uint32_t)(h >> 32);
+}
+
+/*
+ * The shard holding a userid with hash h. This scales the tag into
+ * [0, num_shards), so the tags within one shard share their top few
+ * bits; with at most STORE_MAX_SHARDS shards that leaves 26 bits or
+ * more to tell entries apart.
+ */
+static inline shard_t *shard_for(shard_t *all, uint64_t h) {
+  return &all[((uint64_t)hash_tag(h) * num_shards) >> 32];
+}
+
+static inline uint64_t slot_pack(uint32_t tag, size_t rec) {
+  return (uint64_t)(rec + 1) << 32 | tag;
+}
+
+static inline uint32_t slot_tag(uint64_t slot) {
+  return (uint32_t)slot;
+}
+
+/* Record number + 1; 0 for an empty slot. */
+static inline uint32_t slot_rec(uint64_t slot) {
+  return (uint32_t)(slot >> 32);
+}
+
+static size_t records_capacity(const shard_t *sh) {
+  return (sh->data_map.size - STORE_HEADER_SIZE) / sizeof(account_auth_t);
+}
+
+static size_t profiles_capacity(const shard_t *sh) {
+  return (sh->cold_map.size - STORE_HEADER_SIZE) / sizeof(profile_t);
+}
+
+static size_t index_bytes(size_t num_slots) {
+  return INDEX_HEADER_SIZE + num_slots * sizeof(index_slot_t);
+}
+
+/*
+ * Path of one of a shard's files (suffix "", ".idx", ".cold" etc.), or
+ * NULL for an in-memory store.
+ */
+static char *shard_path(const shard_t *sh, const char *suffix) {
+  if (store_path == NULL) {
+    return NULL;
+  }
+  size_t len = strlen(store_path) + 24 + strlen(suffix);
+  char *path = malloc(len);
+  if (path && sh->number == 0) {
+    snprintf(path, len, "%s%s", store_path, suffix);
+  } else if (path) {
+    snprintf(path, len, "%s.%zu%s", store_path, sh->number, suffix);
+  }
+  return path;
+}
+
+/**
+ * Place a record in the first free slot of its probe sequence.
+ * The caller guarantees the userid is not already indexed.
+ */
+static void index_place(index_slot_t *table, size_t mask, uint64_t h, size_t rec) {
+  size_t pos = h & mask;
+  while (slot_rec(atomic_load_explicit(&table[pos], memory_order_relaxed)) != 0) {
+    pos = (pos + 1) & mask;
+  }
+  atomic_store_explicit(&table[pos], slot_pack(hash_tag(h), rec), memory_order_release);
+}
+
+/* Make ix the shard's current index, retiring the one it replaces. */
+static void index_install(shard_t *sh, index_t *ix) {
+  ix->retired = atomic_load_explicit(&sh->index, memory_order_relaxed);
+  atomic_store_explicit(&sh->index, ix, memory_order_release);
+}
+
+/* Unmap the shard's current index and every index it replaced. */
+static void index_close_all(shard_t *sh) {
+  index_t *ix = atomic_exchange(&sh->index, NULL);
+  while (ix != NULL) {
+    index_t *retired = ix->retired;
+    mapfile_close(&ix->map);
+    free(ix);
+    ix = retired;
+  }
+}
+
+/**
+ * Build a fresh index with num_slots slots covering every record in
+ * the shard and swap it in. For a file-backed store the new index is
+ * written to a temporary file and renamed over the old one, so an
+ * index file on disk is always complete. Slot positions are recomputed
+ * from the userids, since only the high half of each hash is kept in
+ * the table.
+ */
+static bool index_rebuild(shard_t *sh, size_t num_slots) {
+  char *path = shard_path(sh, ".idx");
+  char *tmp_path = shard_path(sh, ".idx.tmp");
+  if (store_path != NULL && (!path || !tmp_path)) {
+    free(path);
+    free(tmp_path);
+    return false;
+  }
+  if (tmp_path) {
+    unlink(tmp_path);
+  }
+
+  index_t *ix = malloc(sizeof(index_t));
+  if (!ix || !mapfile_open(&ix->map, tmp_path, index_bytes(num_slots), index_bytes(num_slots))) {
+    free(ix);
+    free(path);
+    free(tmp_path);
+    return false;
+  }
+  ix->header = (index_header_t *)ix->map.base;
+  ix->slots = (index_slot_t *)(ix->map.base + INDEX_HEADER_SIZE);
+  ix->mask = num_slots - 1;
+  for (size_t i = 0; i < sh->header->num_records; i++) {
+    index_place(ix->slots, ix->mask, store_hash_userid(sh->records[i].userid), i);
+  }
+  memcpy(ix->header->magic, STORE_INDEX_MAGIC, sizeof(ix->header->magic));
+  ix->header->num_slots = num_slots;
+  ix->header->num_records = sh->header->num_records;
+
+  if (tmp_path && rename(tmp_path, path) != 0) {
+    log_message(LOG_ERROR, "store: Can't install index '%s': %s", path, strerror(errno));
+    mapfile_close(&ix->map);
+    free(ix);
+    unlink(tmp_path);
+    free(path);
+    free(tmp_path);
+    return false;
+  }
+  free(path);
+  free(tmp_path);
+
+  index_install(sh, ix);
+  return true;
+}
+
+/*
+ * Whether every slot of a loaded index names one of the shard's
+ * records, and there is one slot in use per record, so a corrupt or
+ * truncated file can't send a lookup outside records[] or leave it
+ * probing a table with no empty slot.
+ */
+static bool index_slots_valid(const index_t *ix, uint64_t num_records) {
+  uint64_t used = 0;
+  for (size_t pos = 0; pos <= ix->mask; pos++) {
+    uint32_t rec = slot_rec(atomic_load_explicit(&ix->slots[pos], memory_order_relaxed));
+    if (rec > num_records) {
+      return false;
+    }
+    used += rec != 0;
+  }
+  return used == num_records;
+}
+
+/**
+ * Map an existing index file, checking that it matches the shard's
+ * records. Returns false (without logging an error) if it is missing,
+ * stale or corrupt, in which case the caller rebuilds it.
+ */
+static bool index_load(shard_t *sh) {
+  char *path = shard_path(sh, ".idx");
+  if (!path) {
+    return false;
+  }
+  struct stat st;
+  if (stat(path, &st) != 0 || (size_t)st.st_size < INDEX_HEADER_SIZE) {
+    free(path);
+    return false;
+  }
+  index_t *ix = malloc(sizeof(index_t));
+  bool ok = ix && mapfile_open(&ix->map, path, 0, 0);
+  free(path);
+  if (!ok) {
+    free(ix);
+    return false;
+  }
+  index_header_t *ih = (index_header_t *)ix->map.base;
+  if (ix->map.size < INDEX_HEADER_SIZE
+      || memcmp(ih->magic, STORE_INDEX_MAGIC, sizeof(ih->magic)) != 0
+      || ih->num_slots == 0 || (ih->num_slots & (ih->num_slots - 1)) != 0
+      || ix->map.size < index_bytes(ih->num_slots)
+      || ih->num_records != sh->header->num_records) {
+    mapfile_close(&ix->map);
+    free(ix);
+    return false;
+  }
+  ix->header = ih;
+  ix->slots = (index_slot_t *)(ix->map.base + INDEX_HEADER_SIZE);
+  ix->mask = ih->num_slots - 1;
+  if (!index_slots_valid(ix, sh->header->num_records)) {
+    mapfile_close(&ix->map);
+    free(ix);
+    return false;
+  }
+  index_install(sh, ix);
+  return true;
+}
+
+/**
+ * Check a shard file's header page, or write a fresh one if it is new.
+ */
+static bool header_check(mapfile_t *map, const char *magic, size_t record_size,
+                         size_t shard, size_t count) {
+  store_header_t *h = (store_header_t *)map->base;
+  if (h->magic[0] == '\0') {
+    memcpy(h->magic, magic, sizeof(h->magic));
+    h->version = STORE_VERSION;
+    h->record_size = (uint32_t)record_size;
+    h->num_records = 0;
+    h->num_shards = (uint32_t)count;
+    h->shard = (uint32_t)shard;
+    atomic_store(&h->next_account_id, 1);
+    return true;
+  }
+  return memcmp(h->magic, magic, sizeof(h->magic)) == 0
+      && h->version == STORE_VERSION
+      && h->record_size == record_size
+      && h->num_shards == count
+      && h->shard == shard;
+}
+
+static void shard_unmap(shard_t *sh) {
+  mapfile_close(&sh->cold_map);
+  mapfile_close(&sh->data_map);
+  sh->header = NULL;
+  sh->records = NULL;
+  sh->profiles = NULL;
+}
+
+/**
+ * Map a shard's records and profiles files (or anonymous memory) and
+ * its index. A new shard gets fresh headers; an existing one is
+ * checked for a matching format before use.
+ */
+static bool shard_map(shard_t *sh, size_t count) {
+  char *path = shard_path(sh, "");
+  char *cold_path = shard_path(sh, ".cold");
+  if (store_path != NULL && (!path || !cold_path)) {
+    free(path);
+    free(cold_path);
+    return false;
+  }
+  size_t initial = STORE_HEADER_SIZE + STORE_INITIAL_RECORDS * sizeof(account_auth_t);
+  bool ok = mapfile_open(&sh->data_map, path, STORE_RECORDS_RESERVE / count, initial);
+  if (ok) {
+    initial = STORE_HEADER_SIZE + STORE_INITIAL_RECORDS * sizeof(profile_t);
+    ok = mapfile_open(&sh->cold_map, cold_path, STORE_PROFILES_RESERVE / count, initial);
+    if (!ok) {
+      mapfile_close(&sh->data_map);
+    }
+  }
+  free(cold_path);
+  if (!ok) {
+    free(path);
+    return false;
+  }
+  sh->header = (store_header_t *)sh->data_map.base;
+  sh->records = (account_auth_t *)(sh->data_map.base + STORE_HEADER_SIZE);
+  sh->profiles = (profile_t *)(sh->cold_map.base + STORE_HEADER_SIZE);
+
+  if (!header_check(&sh->data_map, STORE_MAGIC, sizeof(account_auth_t), sh->number, count)
+      || !header_check(&sh->cold_map, STORE_COLD_MAGIC, sizeof(profile_t), sh->number, count)
+      || sh->header->num_records > records_capacity(sh)
+      || sh->header->num_records > profiles_capacity(sh)) {
+    log_message(LOG_ERROR, "store: '%s' is not a compatible account store", path);
+    free(path);
+    shard_unmap(sh);
+    return false;
+  }
+  free(path);
+
+  if (!index_load(sh)) {
+    size_t num_slots = STORE_INITIAL_SLOTS;
+    while (sh->header->num_records * STORE_MAX_LOAD_DEN > num_slots * STORE_MAX_LOAD_NUM) {
+      num_slots *= 2;
+    }
+    if (sh->header->num_records > 0) {
+      log_message(LOG_WARN, "store: Rebuilding index for %llu accounts",
+                  (unsigned long long)sh->header->num_records);
+    }
+    if (!index_rebuild(sh, num_slots)) {
+      log_message(LOG_ERROR, "store: Failed to build account index");
+      shard_unmap(sh);
+      return false;
+    }
+  }
+  atomic_store_explicit(&sh->published, sh->header->num_records, memory_order_release);
+  return true;
+}
+
+static void shards_free(shard_t *all, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    pthread_mutex_lock(&all[i].secondary_lock);
+    secondary_free(&all[i]);
+    pthread_mutex_unlock(&all[i].secondary_lock);
+    index_close_all(&all[i]);
+    shard_unmap(&all[i]);
+    pthread_mutex_destroy(&all[i].writer_lock);
+    pthread_mutex_destroy(&all[i].secondary_lock);
+  }
+  free(all);
+}
+
+/**
+ * Map every shard of the store. For an existing file-backed store the
+ * number of shards is taken from shard 0; otherwise it is the
+ * configured number. The caller holds init_lock.
+ */
+static bool store_map(void) {
+  size_t count = configured_shards;
+  if (store_path != NULL) {
+    // An existing store says how many shards it has.
+    int fd = open(store_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      store_header_t h;
+      if (read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h)
+          && memcmp(h.magic, STORE_MAGIC, sizeof(h.magic)) == 0
+          && h.num_shards >= 1 && h.num_shards <= STORE_MAX_SHARDS) {
+        count = h.num_shards;
+      }
+      close(fd);
+    }
+  }
+
+  shard_t *all = aligned_alloc(_Alignof(shard_t), count * sizeof(shard_t));
+  if (!all) {
+    log_message(LOG_ERROR, "store: Failed to allocate memory");
+    return false;
+  }
+  memset(all, 0, count * sizeof(shard_t));
+  for (size_t i = 0; i < count; i++) {
+    shard_t *sh = &all[i];
+    sh->number = i;
+    sh->data_map.fd = sh->cold_map.fd = -1;
+    pthread_mutex_init(&sh->writer_lock, NULL);
+    pthread_mutex_init(&sh->secondary_lock, NULL);
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (!shard_map(&all[i], count)) {
+      shards_free(all, count);
+      return false;
+    }
+  }
+  num_shards = count;
+  atomic_store_explicit(&shards, all, memory_order_release);
+  return true;
+}
+
+static bool store_init(void) {
+  if (atomic_load_explicit(&shards, memory_order_acquire) != NULL) {
+    return true;
+  }
+  pthread_mutex_lock(&init_lock);
+  bool ok = atomic_load_explicit(&shards, memory_order_acquire) != NULL || store_map();
+  pthread_mutex_unlock(&init_lock);
+  return ok;
+}
+
+bool store_configure_shards(size_t count) {
+  if (count < 1 || count > STORE_MAX_SHARDS) {
+    log_message(LOG_ERROR, "store_configure_shards: Shard count must be between 1 and %d",
+                STORE_MAX_SHARDS);
+    return false;
+  }
+  if (atomic_load(&shards) != NULL) {
+    log_message(LOG_ERROR, "store_configure_shards: Account store is already in use");
+    return false;
+  }
+  configured_shards = count;
+  return true;
+}
+
+size_t store_num_shards(void) {
+  return atomic_load(&shards) != NULL ? num_shards : configured_shards;
+}
+
+bool store_open(const char *path) {
+  if (path == NULL) {
+    log_message(LOG_ERROR, "store_open: NULL path");
+    return false;
+  }
+  if (atomic_load(&shards) != NULL) {
+    log_message(LOG_ERROR, "store_open: Account store is already open");
+    return false;
+  }
+  store_path = strdup(path);
+  if (!store_path) {
+    log_message(LOG_ERROR, "store_open: Failed to allocate memory");
+    return false;
+  }
+  pthread_mutex_lock(&init_lock);
+  bool ok = store_map();
+  pthread_mutex_unlock(&init_lock);
+  if (ok && !journal_start()) {
+    shard_t *all = atomic_exchange(&shards, NULL);
+    shards_free(all, num_shards);
+    num_shards = 0;
+    ok = false;
+  }
+  if (!ok) {
+    free(store_path);
+    store_path = NULL;
+    return false;
+  }
+  log_message(LOG_INFO, "store_open: Opened '%s' with %zu accounts in %zu shard(s)", path,
+              store_count(), num_shards);
+  return true;
+}
+
+/* Flush every shard's mapped files. */
+static bool shards_sync(void *ctx) {
+  (void)ctx;
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  bool ok = true;
+  for (size_t i = 0; all != NULL && i < num_shards; i++) {
+    index_t *ix = atomic_load_explicit(&all[i].index, memory_order_acquire);
+    ok = mapfile_sync(&all[i].cold_map) && ok;
+    ok = mapfile_sync(&all[i].data_map) && ok;
+    ok = (!ix || mapfile_sync(&ix->map)) && ok;
+  }
+  return ok;
+}
+
+bool store_sync(void) {
+  return journal ? journal_checkpoint(journal, shards_sync, NULL) : shards_sync(NULL);
+}
+
+void store_close(void) {
+  long held = 0;
+  for (size_t i = 0; i < STORE_PIN_STRIPES; i++) {
+    held += atomic_exchange(&pins[i].count, 0);
+  }
+  if (held != 0) {
+    log_message(LOG_ERROR, "store_close: %ld account record(s) still acquired", held);
+  }
+  shard_t *all = atomic_load(&shards);
+  if (all != NULL) {
+    store_sync();
+    journal_close(journal);
+    journal = NULL;
+    if (store_path == NULL) {
+      for (size_t i = 0; i < num_shards; i++) {
+        explicit_bzero(all[i].records, all[i].header->num_records * sizeof(account_auth_t));
+        explicit_bzero(all[i].profiles, all[i].header->num_records * sizeof(profile_t));
+      }
+    }
+    atomic_store(&shards, NULL);
+    shards_free(all, num_shards);
+    num_shards = 0;
+  }
+  expiry_clear();
+  free(store_path);
+  store_path = NULL;
+}
+
+/**
+ * Find the record number for a userid in its shard, or return -1 if
+ * not present.
+ */
+static long index_find(shard_t *sh, const char *userid, uint64_t h) {
+  const index_t *ix = atomic_load_explicit(&sh->index, memory_order_acquire);
+  if (ix == NULL) {
+    return -1;
+  }
+  uint32_t tag = hash_tag(h);
+  for (size_t pos = h & ix->mask; ; pos = (pos + 1) & ix->mask) {
+    uint64_t slot = atomic_load_explicit(&ix->slots[pos], memory_order_acquire);
+    uint32_t rec = slot_rec(slot);
+    if (rec == 0) {
+      return -1;
+    }
+    if (slot_tag(slot) == tag &&
+        strncmp(sh->records[rec - 1].userid, userid, USER_ID_LENGTH) == 0) {
+      return (long)(rec - 1);
+    }
+  }
+}
+
+/**
+ * Find a userid's record, returning NULL if it is not in the store.
+ */
+static account_auth_t *find_record(const char *userid) {
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  if (all == NULL) {
+    return NULL;
+  }
+  uint64_t h = store_hash_userid(userid);
+  shard_t *sh = shard_for(all, h);
+  long rec = index_find(sh, userid, h);
+  return rec >= 0 ? &sh->records[rec] : NULL;
+}
+
+/**
+ * Grow a table mapping so it holds at least `needed` records of
+ * record_size bytes. The mapping at least doubles (up to
+ * STORE_MAX_GROW_BYTES at a time) so that one-at-a-time inserts don't
+ * remap on every call.
+ */
+static bool table_reserve(mapfile_t *map, size_t needed, size_t record_size) {
+  if (STORE_HEADER_SIZE + needed * record_size <= map->size) {
+    return true;
+  }
+  size_t grow = map->size - STORE_HEADER_SIZE;
+  if (grow > STORE_MAX_GROW_BYTES) {
+    grow = STORE_MAX_GROW_BYTES;
+  }
+  size_t new_size = map->size + grow;
+  if (new_size < STORE_HEADER_SIZE + needed * record_size) {
+    new_size = STORE_HEADER_SIZE + needed * record_size;
+  }
+  return mapfile_grow(map, new_size);
+}
+
+/**
+ * Make room for `extra` more accounts in both a shard's records and
+ * its profiles, extending the mappings in place.
+ */
+static bool records_reserve(shard_t *sh, size_t extra) {
+  size_t needed = sh->header->num_records + extra;
+  if (needed >= UINT32_MAX - 1) {
+    log_message(LOG_ERROR, "store: Account store is full");
+    return false;
+  }
+  return table_reserve(&sh->data_map, needed, sizeof(account_auth_t))
+      && table_reserve(&sh->cold_map, needed, sizeof(profile_t));
+}
+
+/**
+ * Make sure a shard's index can take `extra` more records without
+ * exceeding its maximum load, rebuilding it at a larger size if not.
+ */
+static bool index_reserve(shard_t *sh, size_t extra) {
+  size_t needed = sh->header->num_records + extra;
+  size_t current = atomic_load_explicit(&sh->index, memory_order_relaxed)->mask + 1;
+  size_t num_slots = current;
+  while (needed * STORE_MAX_LOAD_DEN > num_slots * STORE_MAX_LOAD_NUM) {
+    num_slots *= 2;
+  }
+  return num_slots == current || index_rebuild(sh, num_slots);
+}
+
+static size_t secondary_slots_for(size_t count) {
+  size_t num_slots = STORE_INITIAL_SLOTS;
+  while (count * STORE_MAX_LOAD_DEN > num_slots * STORE_MAX_LOAD_NUM) {
+    num_slots *= 2;
+  }
+  return num_slots;
+}
+
+static void secondary_free(shard_t *sh) {
+  free(sh->id_slots);
+  free(sh->email_slots);
+  free(sh->email_next);
+  free(sh->email_prev);
+  sh->id_slots = sh->email_slots = NULL;
+  sh->email_next = sh->email_prev = NULL;
+  sh->id_mask = sh->email_mask = 0;
+  sh->email_used = 0;
+  sh->links_capacity = 0;
+  sh->secondary_built = false;
+}
+
+static long id_find(const shard_t *sh, int64_t id) {
+  uint64_t h = hash_id(id);
+  for (size_t pos = h & sh->id_mask; ; pos = (pos + 1) & sh->id_mask) {
+    const sec_slot_t *slot = &sh->id_slots[pos];
+    if (!slot->used) {
+      return -1;
+    }
+    if (slot->hash == h && sh->records[slot->rec - 1].account_id == id) {
+      return (long)(slot->rec - 1);
+    }
+  }
+}
+
+static void id_place(shard_t *sh, size_t rec) {
+  uint64_t h = hash_id(sh->records[rec].account_id);
+  size_t pos = h & sh->id_mask;
+  while (sh->id_slots[pos].used) {
+    pos = (pos + 1) & sh->id_mask;
+  }
+  sh->id_slots[pos] = (sec_slot_t){ .hash = h, .rec = (uint32_t)(rec + 1), .used = 1 };
+}
+
+/**
+ * Find the slot holding the chain of records with the given email, or
+ * return -1. Emails compare without regard to ASCII case.
+ */
+static long email_slot_find(const shard_t *sh, const char *email, uint64_t h) {
+  for (size_t pos = h & sh->email_mask; ; pos = (pos + 1) & sh->email_mask) {
+    const sec_slot_t *slot = &sh->email_slots[pos];
+    if (!slot->used) {
+      return -1;
+    }
+    if (slot->hash == h && slot->rec != 0
+        && strncasecmp(sh->profiles[slot->rec - 1].email, email, EMAIL_LENGTH) == 0) {
+      return (long)pos;
+    }
+  }
+}
+
+/* Add a record to the chain for its email, at the head. */
+static void email_link(shard_t *sh, size_t rec) {
+  const char *email = sh->profiles[rec].email;
+  uint64_t h = hash_email(email);
+  long pos = email_slot_find(sh, email, h);
+  if (pos < 0) {
+    pos = (long)(h & sh->email_mask);
+    while (sh->email_slots[pos].used) {
+      pos = (long)(((size_t)pos + 1) & sh->email_mask);
+    }
+    sh->email_slots[pos] = (sec_slot_t){ .hash = h, .rec = 0, .used = 1 };
+    sh->email_used++;
+  }
+  uint32_t head = sh->email_slots[pos].rec;
+  sh->email_next[rec] = head;
+  sh->email_prev[rec] = 0;
+  if (head != 0) {
+    sh->email_prev[head - 1] = (uint32_t)(rec + 1);
+  }
+  sh->email_slots[pos].rec = (uint32_t)(rec + 1);
+}
+
+/* Remove a record from the chain for its (current) email. */
+static void email_unlink(shard_t *sh, size_t rec) {
+  uint32_t next = sh->email_next[rec];
+  uint32_t prev = sh->email_prev[rec];
+  if (prev != 0) {
+    sh->email_next[prev - 1] = next;
+  } else {
+    const char *email = sh->profiles[rec].email;
+    long pos = email_slot_find(sh, email, hash_email(email));
+    if (pos >= 0) {
+      sh->email_slots[pos].rec = next;
+    }
+  }
+  if (next != 0) {
+    sh->email_prev[next - 1] = prev;
+  }
+  sh->email_next[rec] = sh->email_prev[rec] = 0;
+}
+
+static bool id_table_build(shard_t *sh, size_t num_slots) {
+  sec_slot_t *table = calloc(num_slots, sizeof(sec_slot_t));
+  if (!table) {
+    return false;
+  }
+  free(sh->id_slots);
+  sh->id_slots = table;
+  sh->id_mask = num_slots - 1;
+  size_t count = atomic_load_explicit(&sh->published, memory_order_relaxed);
+  for (size_t i = 0; i < count; i++) {
+    id_place(sh, i);
+  }
+  return true;
+}
+
+static bool email_table_build(shard_t *sh, size_t num_slots) {
+  sec_slot_t *table = calloc(num_slots, sizeof(sec_slot_t));
+  if (!table) {
+    return false;
+  }
+  free(sh->email_slots);
+  sh->email_slots = table;
+  sh->email_mask = num_slots - 1;
+  sh->email_used = 0;
+  // Link in reverse so that each chain ends up in insertion order.
+  for (size_t i = atomic_load_explicit(&sh->published, memory_order_relaxed); i-- > 0; ) {
+    email_link(sh, i);
+  }
+  return true;
+}
+
+/**
+ * Make sure a shard's secondary indexes (if built) can take `extra`
+ * more records (beyond those published), growing the chain links and
+ * rebuilding either table that would exceed its maximum load. The
+ * caller holds the shard's secondary_lock.
+ */
+static bool secondary_reserve(shard_t *sh, size_t extra) {
+  if (!sh->secondary_built) {
+    return true;
+  }
+  size_t needed = atomic_load_explicit(&sh->published, memory_order_relaxed) + extra;
+  if (needed > sh->links_capacity) {
+    size_t capacity = sh->links_capacity * 2 > needed ? sh->links_capacity * 2 : needed;
+    uint32_t *next = realloc(sh->email_next, capacity * sizeof(uint32_t));
+    if (next) {
+      sh->email_next = next;
+    }
+    uint32_t *prev = realloc(sh->email_prev, capacity * sizeof(uint32_t));
+    if (prev) {
+      sh->email_prev = prev;
+    }
+    if (!next || !prev) {
+      return false;
+    }
+    sh->links_capacity = capacity;
+  }
+  if (needed * STORE_MAX_LOAD_DEN > (sh->id_mask + 1) * STORE_MAX_LOAD_NUM
+      && !id_table_build(sh, secondary_slots_for(needed))) {
+    return false;
+  }
+  if ((sh->email_used + extra) * STORE_MAX_LOAD_DEN > (sh->email_mask + 1) * STORE_MAX_LOAD_NUM
+      && !email_table_build(sh, secondary_slots_for(needed))) {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Build a shard's secondary indexes if they haven't been yet. The
+ * caller holds the shard's secondary_lock, under which inserts publish
+ * their records, so each record is indexed either here or by its
+ * insert.
+ */
+static bool secondary_ready(shard_t *sh) {
+  if (sh->secondary_built) {
+    return true;
+  }
+  size_t count = atomic_load_explicit(&sh->published, memory_order_relaxed);
+  sh->links_capacity = count > STORE_INITIAL_RECORDS ? count : STORE_INITIAL_RECORDS;
+  sh->email_next = calloc(sh->links_capacity, sizeof(uint32_t));
+  sh->email_prev = calloc(sh->links_capacity, sizeof(uint32_t));
+  if (!sh->email_next || !sh->email_prev
+      || !id_table_build(sh, secondary_slots_for(count))
+      || !email_table_build(sh, secondary_slots_for(count))) {
+    log_message(LOG_ERROR, "store: Failed to build secondary indexes");
+    secondary_free(sh);
+    return false;
+  }
+  sh->secondary_built = true;
+  return true;
+}
+
+/* Raise the id counter so it never hands out id (or anything below). */
+static void account_id_claim(store_header_t *counter, int64_t id) {
+  uint64_t next = atomic_load(&counter->next_account_id);
+  while (next <= (uint64_t)id
+         && !atomic_compare_exchange_weak(&counter->next_account_id, &next, (uint64_t)id + 1)) {
+  }
+}
+
+/* Append a record to the journal, if there is one. Returns its position, or 0. */
+static uint64_t journal_log(uint16_t type, const void *payload, size_t len) {
+  return journal ? journal_append(journal, type, payload, len) : 0;
+}
+
+/**
+ * Wait until a change logged with journal_log() is durable, then take
+ * a checkpoint if the journal has grown large (one thread at a time;
+ * others carry on). Returns false (and logs) if the change could not
+ * be made durable. Changes to an in-memory store need nothing.
+ */
+static bool journal_commit(uint64_t pos, const char *caller) {
+  if (journal == NULL) {
+    return true;
+  }
+  if (!journal_wait(journal, pos)) {
+    log_message(LOG_ERROR, "%s: Change could not be written to the journal", caller);
+    return false;
+  }
+  if (journal_size(journal) > STORE_JOURNAL_CHECKPOINT_BYTES
+      && !atomic_flag_test_and_set(&checkpointing)) {
+    journal_checkpoint(journal, shards_sync, NULL);
+    atomic_flag_clear(&checkpointing);
+  }
+  return true;
+}
+
+/* Journal a record just inserted into a shard. */
+static uint64_t journal_log_add(const shard_t *sh, size_t n) {
+  if (journal == NULL) {
+    return 0;
+  }
+  const account_auth_t *auth = &sh->records[n];
+  wal_account_t rec;
+  memset(&rec, 0, sizeof(rec));
+  memcpy(rec.userid, auth->userid, USER_ID_LENGTH);
+  rec.account_id = auth->account_id;
+  rec.unban_time = auth->unban_time;
+  rec.expiration_time = auth->expiration_time;
+  rec.last_login_time = auth->last_login_time;
+  rec.login_count = auth->login_count;
+  rec.login_fail_count = auth->login_fail_count;
+  rec.last_ip = auth->last_ip;
+  memcpy(rec.password_hash, auth->password_hash, HASH_LENGTH);
+  memcpy(rec.email, sh->profiles[n].email, EMAIL_LENGTH);
+  memcpy(rec.birthdate, sh->profiles[n].birthdate, BIRTHDATE_LENGTH);
+  return journal_log(WAL_ADD, &rec, sizeof(rec));
+}
+
+/**
+ * Append a record whose userid is known not to be in the shard; space
+ * must already have been reserved in the records and the indexes. The
+ * caller holds the shard's writer_lock. Returns its record number.
+ */
+static size_t insert_record(shard_t *all, shard_t *sh, const account_t *acc, uint64_t h) {
+  size_t n = sh->header->num_records;
+  // Write and count the record before indexing it. If the process dies
+  // part way through, the index's record count no longer matches the
+  // shard's, and the index is rebuilt when the store is next opened.
+  profile_t *profile = &sh->profiles[n];
+  memcpy(profile->email, acc->email, EMAIL_LENGTH);
+  memcpy(profile->birthdate, acc->birthdate, BIRTHDATE_LENGTH);
+
+  account_auth_t *auth = &sh->records[n];
+  memset(auth, 0, sizeof(*auth));
+  // Ids come from one counter for the whole store, kept in shard 0.
+  store_header_t *counter = all[0].header;
+  if (acc->account_id == 0) {
+    auth->account_id = (int64_t)atomic_fetch_add(&counter->next_account_id, 1);
+  } else {
+    auth->account_id = acc->account_id;
+    account_id_claim(counter, acc->account_id);
+  }
+  auth->unban_time = acc->unban_time;
+  auth->expiration_time = acc->expiration_time;
+  auth->last_login_time = acc->last_login_time;
+  auth->login_count = acc->login_count;
+  auth->login_fail_count = acc->login_fail_count;
+  auth->last_ip = acc->last_ip;
+  memcpy(auth->userid, acc->userid, USER_ID_LENGTH);
+  memcpy(auth->password_hash, acc->password_hash, HASH_LENGTH);
+  sh->header->num_records = n + 1;
+
+  // Publish the record, then index it. Readers that find it through
+  // the index therefore also see it counted.
+  pthread_mutex_lock(&sh->secondary_lock);
+  atomic_store_explicit(&sh->published, n + 1, memory_order_release);
+  if (sh->secondary_built) {
+    id_place(sh, n);
+    email_link(sh, n);
+  }
+  pthread_mutex_unlock(&sh->secondary_lock);
+
+  index_t *ix = atomic_load_explicit(&sh->index, memory_order_relaxed);
+  index_place(ix->slots, ix->mask, h, n);
+  ix->header->num_records = n + 1;
+  return n;
+}
+
+/**
+ * Whether no shard has an account with the given id, building the id
+ * indexes if needed. The caller holds explicit_id_lock.
+ */
+static bool id_unused(shard_t *all, int64_t id) {
+  bool unused = id > 0;
+  for (size_t i = 0; unused && i < num_shards; i++) {
+    pthread_mutex_lock(&all[i].secondary_lock);
+    unused = secondary_ready(&all[i]) && id_find(&all[i], id) < 0;
+    pthread_mutex_unlock(&all[i].secondary_lock);
+  }
+  return unused;
+}
+
+/* Reserve room for `extra` more records everywhere in a shard. */
+static bool shard_reserve(shard_t *sh, size_t extra) {
+  if (!records_reserve(sh, extra) || !index_reserve(sh, extra)) {
+    return false;
+  }
+  pthread_mutex_lock(&sh->secondary_lock);
+  bool ok = secondary_reserve(sh, extra);
+  pthread_mutex_unlock(&sh->secondary_lock);
+  return ok;
+}
+
+bool add_account_to_db(const account_t *acc) {
+    if (!acc || !store_init()) {
+        log_message(LOG_ERROR, "db_add_account: Can't add account to database");
+        return false;
+    }
+    shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+    uint64_t h = store_hash_userid(acc->userid);
+    shard_t *sh = shard_for(all, h);
+
+    // Accounts that bring their own id are checked against every shard,
+    // one at a time; ids the store assigns are always unused.
+    bool explicit_id = acc->account_id != 0;
+    if (explicit_id) {
+        pthread_mutex_lock(&explicit_id_lock);
+    }
+    pthread_mutex_lock(&sh->writer_lock);
+    bool ok = true;
+    uint64_t pos = 0;
+    if (index_find(sh, acc->userid, h) >= 0) {
+        log_message(LOG_WARN, "db_add_account: User ID %s has already been used", acc->userid);
+        ok = false;
+    } else if (explicit_id && !id_unused(all, acc->account_id)) {
+        log_message(LOG_WARN, "db_add_account: Account ID %lld is not available",
+                    (long long)acc->account_id);
+        ok = false;
+    } else if (!shard_reserve(sh, 1)) {
+        log_message(LOG_ERROR, "db_add_account: Can't add account to database");
+        ok = false;
+    } else {
+        pos = journal_log_add(sh, insert_record(all, sh, acc, h));
+    }
+    pthread_mutex_unlock(&sh->writer_lock);
+    if (explicit_id) {
+        pthread_mutex_unlock(&explicit_id_lock);
+    }
+    return ok && journal_commit(pos, "db_add_account");
+}
+
+size_t store_add_batch(const account_t *accs, size_t count) {
+  if (accs == NULL || !store_init()) {
+    log_message(LOG_ERROR, "store_add_batch: Can't add accounts to database");
+    return 0;
+  }
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  uint64_t *hashes = malloc((count ? count : 1) * sizeof(uint64_t));
+  size_t *per_shard = calloc(num_shards, sizeof(size_t));
+  if (!hashes || !per_shard) {
+    free(hashes);
+    free(per_shard);
+    log_message(LOG_ERROR, "store_add_batch: Failed to allocate memory");
+    return 0;
+  }
+  bool explicit_ids = false;
+  for (size_t i = 0; i < count; i++) {
+    hashes[i] = store_hash_userid(accs[i].userid);
+    per_shard[shard_for(all, hashes[i]) - all]++;
+    explicit_ids |= accs[i].account_id != 0;
+  }
+  if (explicit_ids) {
+    pthread_mutex_lock(&explicit_id_lock);
+  }
+
+  // Take the shards one at a time, sizing each for its part of the
+  // batch up front so that it costs at most one remap and one rebuild
+  // of each index.
+  size_t added = 0;
+  uint64_t pos = 0;
+  for (size_t s = 0; s < num_shards; s++) {
+    if (per_shard[s] == 0) {
+      continue;
+    }
+    shard_t *sh = &all[s];
+    pthread_mutex_lock(&sh->writer_lock);
+    if (!shard_reserve(sh, per_shard[s])) {
+      pthread_mutex_unlock(&sh->writer_lock);
+      log_message(LOG_ERROR, "store_add_batch: Can't add accounts to database");
+      continue;
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (shard_for(all, hashes[i]) != sh) {
+        continue;
+      }
+      if (index_find(sh, accs[i].userid, hashes[i]) >= 0) {
+        log_message(LOG_WARN, "store_add_batch: User ID %s has already been used", accs[i].userid);
+        continue;
+      }
+      if (accs[i].account_id != 0 && !id_unused(all, accs[i].account_id)) {
+        log_message(LOG_WARN, "store_add_batch: Account ID %lld is not available",
+                    (long long)accs[i].account_id);
+        continue;
+      }
+      uint64_t logged = journal_log_add(sh, insert_record(all, sh, &accs[i], hashes[i]));
+      if (journal != NULL && logged == 0) {
+        // journal_append() has logged why; it won't survive a restart
+        continue;
+      }
+      pos = logged > pos ? logged : pos;
+      added++;
+    }
+    pthread_mutex_unlock(&sh->writer_lock);
+  }
+
+  if (explicit_ids) {
+    pthread_mutex_unlock(&explicit_id_lock);
+  }
+  free(hashes);
+  free(per_shard);
+  // one sync covers the whole batch
+  if (added > 0 && !journal_commit(pos, "store_add_batch")) {
+    return 0;
+  }
+  return added;
+}
+
+bool store_contains(const char *userid) {
+  return userid != NULL && find_record(userid) != NULL;
+}
+
+bool account_lookup_by_userid(const char *userid, account_t *acc) {
+    if (userid == NULL || acc == NULL) {
+        log_message(LOG_ERROR, "account_lookup_by_userid: NULL argument(s)");
+        return false;
+    }
+
+    const account_auth_t *rec = find_record(userid);
+    if (rec != NULL && store_snapshot(rec, acc)) {
+        log_message(LOG_INFO, "User '%s' found in database", userid);
+        return true;
+    }
+
+    log_message(LOG_WARN, "User '%s' not found", userid);
+    return false;
+}
+
+static pin_stripe_t *my_pins(void) {
+  if (thread_pins == NULL) {
+    unsigned i = atomic_fetch_add_explicit(&next_pin_stripe, 1, memory_order_relaxed);
+    thread_pins = &pins[i & (STORE_PIN_STRIPES - 1)];
+  }
+  return thread_pins;
+}
+
+const account_auth_t *store_acquire(const char *userid) {
+  if (userid == NULL) {
+    log_message(LOG_ERROR, "store_acquire: NULL userid");
+    return NULL;
+  }
+  const account_auth_t *rec = find_record(userid);
+  if (rec != NULL) {
+    atomic_fetch_add_explicit(&my_pins()->count, 1, memory_order_relaxed);
+  }
+  return rec;
+}
+
+/*
+ * Userids looked up together by store_acquire_batch(): enough that the
+ * prefetches of one group overlap, few enough that their lines are
+ * still cached when they are used.
+ */
+#define ACQUIRE_GROUP 16
+
+size_t store_acquire_batch(const char *const *userids, size_t count,
+                           const account_auth_t **out) {
+  if (userids == NULL || out == NULL) {
+    log_message(LOG_ERROR, "store_acquire_batch: NULL argument(s)");
+    return 0;
+  }
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  size_t found = 0;
+  for (size_t base = 0; base < count; base += ACQUIRE_GROUP) {
+    size_t n = count - base < ACQUIRE_GROUP ? count - base : ACQUIRE_GROUP;
+    uint64_t h[ACQUIRE_GROUP];
+    const index_t *ix[ACQUIRE_GROUP];
+    // Start every userid's first index slot loading, then every record
+    // those slots point to, and only then probe; each probe should
+    // then find its lines cached instead of waiting on them one by one.
+    for (size_t i = 0; i < n; i++) {
+      ix[i] = NULL;
+      if (all == NULL || userids[base + i] == NULL) {
+        continue;
+      }
+      h[i] = store_hash_userid(userids[base + i]);
+      ix[i] = atomic_load_explicit(&shard_for(all, h[i])->index, memory_order_acquire);
+      if (ix[i] != NULL) {
+        __builtin_prefetch(&ix[i]->slots[h[i] & ix[i]->mask]);
+      }
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (ix[i] == NULL) {
+        continue;
+      }
+      uint64_t slot = atomic_load_explicit(&ix[i]->slots[h[i] & ix[i]->mask],
+                                           memory_order_relaxed);
+      if (slot_rec(slot) != 0 && slot_tag(slot) == hash_tag(h[i])) {
+        __builtin_prefetch(&shard_for(all, h[i])->records[slot_rec(slot) - 1]);
+      }
+    }
+    for (size_t i = 0; i < n; i++) {
+      out[base + i] = NULL;
+      if (ix[i] == NULL) {
+        continue;
+      }
+      shard_t *sh = shard_for(all, h[i]);
+      long rec = index_find(sh, userids[base + i], h[i]);
+      if (rec >= 0) {
+        out[base + i] = &sh->records[rec];
+        found++;
+      }
+    }
+  }
+  if (found > 0) {
+    atomic_fetch_add_explicit(&my_pins()->count, (long)found, memory_order_relaxed);
+  }
+  return found;
+}
+
+void store_release(const account_auth_t *auth) {
+  if (auth != NULL) {
+    atomic_fetch_sub_explicit(&my_pins()->count, 1, memory_order_relaxed);
+  }
+}
+
+static void stripes_init(void) {
+  for (size_t i = 0; i < STORE_LOCK_STRIPES; i++) {
+    pthread_mutex_init(&stripes[i].lock, NULL);
+  }
+}
+
+/*
+ * Find the shard and record number of auth. Returns NULL if it is not
+ * a published record. The shard is the one its userid hashes to (a
+ * record's userid never changes once published), so only that shard's
+ * metadata is read.
+ */
+static shard_t *record_shard(const account_auth_t *auth, size_t *rec) {
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  if (auth == NULL || all == NULL) {
+    return NULL;
+  }
+  shard_t *sh = shard_for(all, store_hash_userid(auth->userid));
+  size_t count = atomic_load_explicit(&sh->published, memory_order_acquire);
+  if (auth < sh->records || auth >= sh->records + count) {
+    return NULL;
+  }
+  *rec = (size_t)(auth - sh->records);
+  return sh;
+}
+
+static inline lock_stripe_t *stripe_of(const shard_t *sh, size_t rec) {
+  return &stripes[(rec * num_shards + sh->number) & (STORE_LOCK_STRIPES - 1)];
+}
+
+/**
+ * Map a record handed out by store_acquire() back to a writable pointer,
+ * lock its stripe and mark an update as in progress. Returns NULL (and
+ * logs) if auth is not a record in the store; otherwise *shard and
+ * *rec identify it.
+ */
+static account_auth_t *record_lock(const account_auth_t *auth, const char *caller,
+                                   shard_t **shard, size_t *rec) {
+  shard_t *sh = record_shard(auth, rec);
+  if (sh == NULL) {
+    log_message(LOG_ERROR, "%s: Not an account in the store", caller);
+    return NULL;
+  }
+  lock_stripe_t *stripe = stripe_of(sh, *rec);
+  pthread_once(&stripes_once, stripes_init);
+  pthread_mutex_lock(&stripe->lock);
+  unsigned seq = atomic_load_explicit(&stripe->seq, memory_order_relaxed);
+  atomic_store_explicit(&stripe->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  *shard = sh;
+  return &sh->records[*rec];
+}
+
+static void record_unlock(shard_t *sh, size_t rec) {
+  lock_stripe_t *stripe = stripe_of(sh, rec);
+  unsigned seq = atomic_load_explicit(&stripe->seq, memory_order_relaxed);
+  atomic_store_explicit(&stripe->seq, seq + 1, memory_order_release);
+  pthread_mutex_unlock(&stripe->lock);
+}
+
+/*
+ * Reader side of the seqlock: read_begin() waits out any update in
+ * progress and returns the sequence count, and read_retry() says
+ * whether an update started since, in which case whatever was copied
+ * in between must be discarded and read again. The copies themselves
+ * are plain memcpy()s, as is usual for seqlocks; a torn copy is never
+ * used.
+ */
+static inline unsigned read_begin(const lock_stripe_t *stripe) {
+  unsigned seq;
+  while ((seq = atomic_load_explicit(&stripe->seq, memory_order_acquire)) & 1) {
+    sched_yield();
+  }
+  return seq;
+}
+
+static inline bool read_retry(const lock_stripe_t *stripe, unsigned seq) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&stripe->seq, memory_order_relaxed) != seq;
+}
+
+bool store_read_auth(const account_auth_t *auth, account_auth_t *out) {
+  if (auth == NULL || out == NULL) {
+    log_message(LOG_ERROR, "store_read_auth: NULL argument(s)");
+    return false;
+  }
+  size_t rec;
+  shard_t *sh = record_shard(auth, &rec);
+  if (sh == NULL) {
+    // not shared, so there is nothing to race with
+    memcpy(out, auth, sizeof(*out));
+    return true;
+  }
+  const lock_stripe_t *stripe = stripe_of(sh, rec);
+  unsigned seq;
+  do {
+    seq = read_begin(stripe);
+    memcpy(out, auth, sizeof(*out));
+  } while (read_retry(stripe, seq));
+  return true;
+}
+
+bool store_snapshot(const account_auth_t *auth, account_t *acc) {
+  if (acc == NULL) {
+    log_message(LOG_ERROR, "store_snapshot: NULL account");
+    return false;
+  }
+  size_t rec;
+  shard_t *sh = record_shard(auth, &rec);
+  if (sh == NULL) {
+    log_message(LOG_ERROR, "store_snapshot: Not an account in the store");
+    return false;
+  }
+  const lock_stripe_t *stripe = stripe_of(sh, rec);
+  account_auth_t hot;
+  profile_t cold;
+  unsigned seq;
+  do {
+    seq = read_begin(stripe);
+    memcpy(&hot, auth, sizeof(hot));
+    memcpy(&cold, &sh->profiles[rec], sizeof(cold));
+  } while (read_retry(stripe, seq));
+
+  memset(acc, 0, sizeof(*acc));
+  acc->account_id = hot.account_id;
+  memcpy(acc->userid, hot.userid, USER_ID_LENGTH);
+  memcpy(acc->password_hash, hot.password_hash, HASH_LENGTH);
+  memcpy(acc->email, cold.email, EMAIL_LENGTH);
+  acc->unban_time = hot.unban_time;
+  acc->expiration_time = hot.expiration_time;
+  acc->login_count = hot.login_count;
+  acc->login_fail_count = hot.login_fail_count;
+  acc->last_login_time = hot.last_login_time;
+  acc->last_ip = hot.last_ip;
+  memcpy(acc->birthdate, cold.birthdate, BIRTHDATE_LENGTH);
+  explicit_bzero(&hot, sizeof(hot));
+  return true;
+}
+
+bool store_is_banned(const account_auth_t *auth) {
+  account_auth_t cur;
+  if (auth == NULL || !store_read_auth(auth, &cur)) {
+    log_message(LOG_WARN, "NULL account passed to store_is_banned");
+    return false;
+  }
+  return account_ban_active(cur.unban_time);
+}
+
+bool store_is_expired(const account_auth_t *auth) {
+  account_auth_t cur;
+  if (auth == NULL || !store_read_auth(auth, &cur)) {
+    log_message(LOG_WARN, "NULL account passed to store_is_expired");
+    return false;
+  }
+  return account_expiry_passed(cur.expiration_time);
+}
+
+bool store_validate_password(const account_auth_t *auth, const char *plaintext_password) {
+  account_auth_t cur;
+  if (auth == NULL || plaintext_password == NULL || !store_read_auth(auth, &cur)) {
+    log_message(LOG_WARN, "NULL parameter passed to store_validate_password");
+    return false;
+  }
+  bool ok = account_check_password(cur.password_hash, cur.unban_time, cur.expiration_time,
+                                   cur.login_fail_count, plaintext_password);
+  explicit_bzero(&cur, sizeof(cur));
+  return ok;
+}
+
+/* Journal a record's login counters, as they now stand. */
+static uint64_t journal_log_counters(const account_auth_t *rec) {
+  if (journal == NULL) {
+    return 0;
+  }
+  wal_counters_t w;
+  memset(&w, 0, sizeof(w));
+  memcpy(w.userid, rec->userid, USER_ID_LENGTH);
+  w.last_login_time = rec->last_login_time;
+  w.login_count = rec->login_count;
+  w.login_fail_count = rec->login_fail_count;
+  w.last_ip = rec->last_ip;
+  return journal_log(WAL_COUNTERS, &w, sizeof(w));
+}
+
+/*
+ * The counter updates below are those of account_record_login_success()
+ * and account_record_login_failure(), applied to the hot record.
+ */
+
+void store_record_login_success(const account_auth_t *auth, ip4_addr_t ip) {
+  store_record_login_success_at(auth, ip, wallclock_now());
+}
+
+void store_record_login_success_at(const account_auth_t *auth, ip4_addr_t ip, time_t now) {
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_record_login_success", &sh, &n);
+  if (rec) {
+    rec->login_count += 1;
+    rec->login_fail_count = 0;
+    rec->last_login_time = now;
+    rec->last_ip = ip;
+    uint64_t pos = journal_log_counters(rec);
+    record_unlock(sh, n);
+    journal_commit(pos, "store_record_login_success");
+  }
+}
+
+void store_record_login_failure(const account_auth_t *auth) {
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_record_login_failure", &sh, &n);
+  if (rec) {
+    rec->login_fail_count += 1;
+    rec->login_count = 0;
+    uint64_t pos = journal_log_counters(rec);
+    record_unlock(sh, n);
+    journal_commit(pos, "store_record_login_failure");
+  }
+}
+
+bool store_update_password(const account_auth_t *auth, const char *new_plaintext_password) {
+  if (auth == NULL || new_plaintext_password == NULL) {
+    log_message(LOG_WARN, "NULL parameter passed to store_update_password");
+    return false;
+  }
+  if (!account_password_acceptable(new_plaintext_password)) {
+    log_message(LOG_WARN, "Password change rejected due to insufficient complexity");
+    return false;
+  }
+  // Hash before locking the record; hashing takes far longer than
+  // anything else done under the lock.
+  wal_password_t w;
+  memset(&w, 0, sizeof(w));
+  if (!account_hash_password(new_plaintext_password, w.password_hash)) {
+    return false;
+  }
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_update_password", &sh, &n);
+  if (rec == NULL) {
+    return false;
+  }
+  memcpy(rec->password_hash, w.password_hash, HASH_LENGTH);
+  rec->login_fail_count = 0;
+  rec->unban_time = 0;
+  memcpy(w.userid, rec->userid, USER_ID_LENGTH);
+  int64_t account_id = rec->account_id;
+  uint64_t pos = journal_log(WAL_PASSWORD, &w, sizeof(w));
+  record_unlock(sh, n);
+  session_revoke_account(account_id);
+  if (!journal_commit(pos, "store_update_password")) {
+    return false;
+  }
+  log_message(LOG_INFO, "Password successfully updated");
+  return true;
+}
+
+bool store_replace_password_hash(const char *userid, const char *old_hash,
+                                 const char *new_hash) {
+  if (userid == NULL || old_hash == NULL || new_hash == NULL) {
+    log_message(LOG_WARN, "NULL parameter passed to store_replace_password_hash");
+    return false;
+  }
+  const account_auth_t *auth = store_acquire(userid);
+  if (auth == NULL) {
+    return false;
+  }
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_replace_password_hash", &sh, &n);
+  if (rec == NULL) {
+    store_release(auth);
+    return false;
+  }
+  // The password may have been changed since old_hash was read.
+  if (strncmp(rec->password_hash, old_hash, HASH_LENGTH) != 0) {
+    record_unlock(sh, n);
+    store_release(auth);
+    return false;
+  }
+  wal_password_t w;
+  memset(&w, 0, sizeof(w));
+  memcpy(w.userid, rec->userid, USER_ID_LENGTH);
+  strncpy(w.password_hash, new_hash, HASH_LENGTH - 1);
+  memcpy(rec->password_hash, w.password_hash, HASH_LENGTH);
+  uint64_t pos = journal_log(WAL_REHASH, &w, sizeof(w));
+  record_unlock(sh, n);
+  store_release(auth);
+  explicit_bzero(&w, sizeof(w));
+  return journal_commit(pos, "store_replace_password_hash");
+}
+
+/*
+ * Account expiry deadlines. A session's own expiry is capped by its
+ * account's expiration time as it stood at login, so an expiration set
+ * later has to revoke the account's sessions when it comes. An account
+ * whose expiration time is in the future has one deadline on
+ * expiry_wheel, which the clock ticker moves on every second
+ * (wallclock.h). Setting the time again moves the deadline (or, if the
+ * new time isn't in the future, drops it). When one comes, the
+ * account's sessions are revoked if it is still due to have expired by
+ * then. Deadlines are found by account id through a chained hash table
+ * (expiry_buckets), and all of it is guarded by expiry_lock.
+ */
+typedef struct expiry_deadline {
+  wheel_timer_t timer;
+  struct expiry_deadline *link;   // next in its bucket
+  int64_t account_id;
+  char userid[USER_ID_LENGTH];
+} expiry_deadline_t;
+
+#define EXPIRY_MIN_BUCKETS 64
+
+static pthread_mutex_t expiry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t expiry_once = PTHREAD_ONCE_INIT;
+static timerwheel_t expiry_wheel;
+static expiry_deadline_t **expiry_buckets = NULL;
+static size_t expiry_mask = 0;    // number of buckets - 1
+static size_t expiry_count = 0;
+
+static void expiry_tick(time_t now);
+
+static void expiry_init(void) {
+  pthread_mutex_lock(&expiry_lock);
+  timerwheel_init(&expiry_wheel, wallclock_now());
+  pthread_mutex_unlock(&expiry_lock);
+  wallclock_on_second(expiry_tick);
+}
+
+/* Where the account's deadline is, or belongs, in its bucket. */
+static expiry_deadline_t **expiry_link(int64_t account_id) {
+  expiry_deadline_t **link = &expiry_buckets[hash_id(account_id) & expiry_mask];
+  while (*link != NULL && (*link)->account_id != account_id) {
+    link = &(*link)->link;
+  }
+  return link;
+}
+
+/* Double the buckets (or make the first ones). */
+static bool expiry_grow(void) {
+  size_t num = expiry_buckets ? (expiry_mask + 1) * 2 : EXPIRY_MIN_BUCKETS;
+  expiry_deadline_t **buckets = calloc(num, sizeof(expiry_deadline_t *));
+  if (!buckets) {
+    return false;
+  }
+  expiry_deadline_t **old = expiry_buckets;
+  size_t old_num = old ? expiry_mask + 1 : 0;
+  expiry_buckets = buckets;
+  expiry_mask = num - 1;
+  for (size_t b = 0; b < old_num; b++) {
+    while (old[b] != NULL) {
+      expiry_deadline_t *d = old[b];
+      old[b] = d->link;
+      expiry_deadline_t **link = &buckets[hash_id(d->account_id) & expiry_mask];
+      d->link = *link;
+      *link = d;
+    }
+  }
+  free(old);
+  return true;
+}
+
+/*
+ * Wheel callback: take a deadline that has come out of the table, so
+ * it can't be moved again, and onto the list at arg.
+ */
+static void expiry_due(wheel_timer_t *timer, void *arg) {
+  expiry_deadline_t *d = (expiry_deadline_t *)((char *)timer - offsetof(expiry_deadline_t, timer));
+  *expiry_link(d->account_id) = d->link;
+  expiry_count--;
+  wheel_timer_t **due = arg;
+  timer->next = *due;
+  *due = timer;
+}
+
+static void expiry_tick(time_t now) {
+  wheel_timer_t *due = NULL;
+  pthread_mutex_lock(&expiry_lock);
+  timerwheel_advance(&expiry_wheel, now, expiry_due, &due);
+  pthread_mutex_unlock(&expiry_lock);
+  while (due != NULL) {
+    expiry_deadline_t *d = (expiry_deadline_t *)((char *)due - offsetof(expiry_deadline_t, timer));
+    due = due->next;
+    // Decide on a consistent copy: set_time() may be changing it.
+    const account_auth_t *auth = store_acquire(d->userid);
+    account_auth_t state;
+    if (auth != NULL && store_read_auth(auth, &state) && state.account_id == d->account_id
+        && account_expiry_passed_at(state.expiration_time, now)) {
+      session_revoke_account(d->account_id);
+    }
+    store_release(auth);
+    explicit_bzero(&state, sizeof(state));
+    free(d);
+  }
+}
+
+/*
+ * Have the account's sessions revoked at time t, if it is still expired
+ * then, in place of any deadline it already has.
+ */
+static void expiry_schedule(const account_auth_t *rec, time_t t) {
+  pthread_once(&expiry_once, expiry_init);
+  pthread_mutex_lock(&expiry_lock);
+  expiry_deadline_t **link = expiry_buckets ? expiry_link(rec->account_id) : NULL;
+  if (link == NULL || *link == NULL) {
+    // Keep at most one deadline per bucket on average.
+    size_t buckets = expiry_buckets ? expiry_mask + 1 : 0;
+    expiry_deadline_t *d = calloc(1, sizeof(expiry_deadline_t));
+    if (d == NULL || (expiry_count >= buckets && !expiry_grow())) {
+      pthread_mutex_unlock(&expiry_lock);
+      free(d);
+      log_message(LOG_ERROR, "store_set_expiration_time: Failed to allocate memory");
+      return;
+    }
+    d->account_id = rec->account_id;
+    memcpy(d->userid, rec->userid, USER_ID_LENGTH);
+    link = expiry_link(rec->account_id);
+    *link = d;
+    expiry_count++;
+  }
+  timerwheel_add(&expiry_wheel, &(*link)->timer, t);
+  pthread_mutex_unlock(&expiry_lock);
+}
+
+/* Drop the account's deadline, if it has one. */
+static void expiry_cancel(int64_t account_id) {
+  pthread_mutex_lock(&expiry_lock);
+  expiry_deadline_t **link = expiry_buckets ? expiry_link(account_id) : NULL;
+  if (link != NULL && *link != NULL) {
+    expiry_deadline_t *d = *link;
+    *link = d->link;
+    expiry_count--;
+    timerwheel_cancel(&expiry_wheel, &d->timer);
+    free(d);
+  }
+  pthread_mutex_unlock(&expiry_lock);
+}
+
+/* Drop every deadline, as the store is closed. */
+static void expiry_clear(void) {
+  pthread_mutex_lock(&expiry_lock);
+  for (size_t b = 0; expiry_buckets != NULL && b <= expiry_mask; b++) {
+    while (expiry_buckets[b] != NULL) {
+      expiry_deadline_t *d = expiry_buckets[b];
+      expiry_buckets[b] = d->link;
+      timerwheel_cancel(&expiry_wheel, &d->timer);
+      free(d);
+    }
+  }
+  free(expiry_buckets);
+  expiry_buckets = NULL;
+  expiry_mask = 0;
+  expiry_count = 0;
+  pthread_mutex_unlock(&expiry_lock);
+}
+
+size_t store_expiry_pending(void) {
+  pthread_mutex_lock(&expiry_lock);
+  size_t count = expiry_count;
+  pthread_mutex_unlock(&expiry_lock);
+  return count;
+}
+
+/* Set one of a record's times and journal the change. */
+static bool set_time(const account_auth_t *auth, uint16_t type, time_t t, const char *caller) {
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, caller, &sh, &n);
+  if (rec == NULL) {
+    return false;
+  }
+  // A ban lifting needs nothing done: checks compare unban_time with
+  // the shared clock as they go.
+  time_t now = wallclock_now();
+  bool banned = false;
+  bool expiring = false;
+  if (type == WAL_UNBAN_TIME) {
+    rec->unban_time = t;
+    banned = t > now;
+  } else {
+    rec->expiration_time = t;
+    expiring = t > now;
+  }
+  uint64_t pos = 0;
+  if (journal) {
+    wal_time_t w;
+    memset(&w, 0, sizeof(w));
+    memcpy(w.userid, rec->userid, USER_ID_LENGTH);
+    w.time = t;
+    pos = journal_log(type, &w, sizeof(w));
+  }
+  int64_t account_id = rec->account_id;
+  record_unlock(sh, n);
+  if (banned) {
+    session_revoke_account(account_id);
+  }
+  if (expiring) {
+    expiry_schedule(auth, t);
+  } else if (type == WAL_EXPIRATION_TIME) {
+    expiry_cancel(account_id);
+  }
+  return journal_commit(pos, caller);
+}
+
+bool store_set_unban_time(const account_auth_t *auth, time_t t) {
+  return set_time(auth, WAL_UNBAN_TIME, t, "store_set_unban_time");
+}
+
+bool store_set_expiration_time(const account_auth_t *auth, time_t t) {
+  return set_time(auth, WAL_EXPIRATION_TIME, t, "store_set_expiration_time");
+}
+
+/*
+ * Accounts are sharded by userid, so lookups by id and by email ask
+ * each shard's secondary index in turn.
+ */
+
+bool account_lookup_by_id(int64_t account_id, account_t *acc) {
+  if (acc == NULL) {
+    log_message(LOG_ERROR, "account_lookup_by_id: NULL argument(s)");
+    return false;
+  }
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  for (size_t i = 0; all != NULL && i < num_shards; i++) {
+    shard_t *sh = &all[i];
+    pthread_mutex_lock(&sh->secondary_lock);
+    long rec = secondary_ready(sh) ? id_find(sh, account_id) : -1;
+    pthread_mutex_unlock(&sh->secondary_lock);
+    if (rec >= 0 && store_snapshot(&sh->records[rec], acc)) {
+      return true;
+    }
+  }
+  log_message(LOG_WARN, "Account ID %lld not found", (long long)account_id);
+  return false;
+}
+
+bool account_lookup_by_email(const char *email, account_t *acc) {
+  if (email == NULL || acc == NULL) {
+    log_message(LOG_ERROR, "account_lookup_by_email: NULL argument(s)");
+    return false;
+  }
+  uint64_t h = hash_email(email);
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  for (size_t i = 0; all != NULL && i < num_shards; i++) {
+    shard_t *sh = &all[i];
+    pthread_mutex_lock(&sh->secondary_lock);
+    long pos = secondary_ready(sh) ? email_slot_find(sh, email, h) : -1;
+    long rec = pos >= 0 ? (long)sh->email_slots[pos].rec - 1 : -1;
+    pthread_mutex_unlock(&sh->secondary_lock);
+    if (rec >= 0 && store_snapshot(&sh->records[rec], acc)) {
+      return true;
+    }
+  }
+  log_message(LOG_WARN, "No account with email '%s'", email);
+  return false;
+}
+
+size_t store_count_by_email(const char *email) {
+  if (email == NULL) {
+    return 0;
+  }
+  uint64_t h = hash_email(email);
+  size_t count = 0;
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  for (size_t i = 0; all != NULL && i < num_shards; i++) {
+    shard_t *sh = &all[i];
+    pthread_mutex_lock(&sh->secondary_lock);
+    long pos = secondary_ready(sh) ? email_slot_find(sh, email, h) : -1;
+    for (uint32_t rec = pos >= 0 ? sh->email_slots[pos].rec : 0; rec != 0;
+         rec = sh->email_next[rec - 1]) {
+      count++;
+    }
+    pthread_mutex_unlock(&sh->secondary_lock);
+  }
+  return count;
+}
+
+/*
+ * Change a record's email, keeping the email index consistent. The
+ * caller holds the record's lock.
+ */
+static void email_replace(shard_t *sh, size_t n, const char *new_email) {
+  pthread_mutex_lock(&sh->secondary_lock);
+  if (sh->secondary_built) {
+    email_unlink(sh, n);
+  }
+  strncpy(sh->profiles[n].email, new_email, EMAIL_LENGTH - 1);
+  sh->profiles[n].email[EMAIL_LENGTH - 1] = '\0';
+  if (sh->secondary_built) {
+    // Relinking may need a fresh slot; if the table can't grow, drop
+    // the secondary indexes so they are rebuilt on next use.
+    if (secondary_reserve(sh, 1)) {
+      email_link(sh, n);
+    } else {
+      secondary_free(sh);
+    }
+  }
+  pthread_mutex_unlock(&sh->secondary_lock);
+}
+
+bool store_set_email(const account_auth_t *auth, const char *new_email) {
+  if (new_email == NULL) {
+    log_message(LOG_ERROR, "store_set_email: Null input error");
+    return false;
+  }
+  if (!account_email_acceptable(new_email)) {
+    log_message(LOG_ERROR, "store_set_email: Invalid email");
+    return false;
+  }
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_set_email", &sh, &n);
+  if (rec == NULL) {
+    return false;
+  }
+  email_replace(sh, n, new_email);
+  uint64_t pos = 0;
+  if (journal) {
+    wal_email_t w;
+    memset(&w, 0, sizeof(w));
+    memcpy(w.userid, rec->userid, USER_ID_LENGTH);
+    memcpy(w.email, sh->profiles[n].email, EMAIL_LENGTH);
+    pos = journal_log(WAL_EMAIL, &w, sizeof(w));
+  }
+  record_unlock(sh, n);
+  return journal_commit(pos, "store_set_email");
+}
+
+size_t store_count(void) {
+  shard_t *all = atomic_load_explicit(&shards, memory_order_acquire);
+  size_t count = 0;
+  for (size_t i = 0; all != NULL && i < num_shards; i++) {
+    count += atomic_load_explicit(&all[i].published, memory_order_relaxed);
+  }
+  return count;
+}
+
+/*
+ * Journal replay, when a persistent store is opened. Records are
+ * applied in the order they were logged; journal is still NULL, so
+ * they are not journaled again.
+ */
+
+/* Put back every field of an existing account from its insert record. */
+static void restore_account(const account_auth_t *auth, const wal_account_t *w) {
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_open", &sh, &n);
+  if (rec == NULL) {
+    return;
+  }
+  rec->unban_time = w->unban_time;
+  rec->expiration_time = w->expiration_time;
+  rec->last_login_time = w->last_login_time;
+  rec->login_count = w->login_count;
+  rec->login_fail_count = w->login_fail_count;
+  rec->last_ip = w->last_ip;
+  memcpy(rec->password_hash, w->password_hash, HASH_LENGTH);
+  memcpy(sh->profiles[n].birthdate, w->birthdate, BIRTHDATE_LENGTH);
+  email_replace(sh, n, w->email);
+  record_unlock(sh, n);
+}
+
+static bool replay_record(uint16_t type, const void *payload, size_t len, void *ctx) {
+  (void)ctx;
+  static const size_t sizes[] = {
+    [WAL_ADD] = sizeof(wal_account_t),
+    [WAL_COUNTERS] = sizeof(wal_counters_t),
+    [WAL_PASSWORD] = sizeof(wal_password_t),
+    [WAL_UNBAN_TIME] = sizeof(wal_time_t),
+    [WAL_EXPIRATION_TIME] = sizeof(wal_time_t),
+    [WAL_EMAIL] = sizeof(wal_email_t),
+    [WAL_REHASH] = sizeof(wal_password_t),
+  };
+  if (type == 0 || type > WAL_REHASH || len != sizes[type]) {
+    log_message(LOG_ERROR, "store: Unknown journal record (type %u, %zu bytes)", type, len);
+    return false;
+  }
+  union {
+    wal_account_t account;
+    wal_counters_t counters;
+    wal_password_t password;
+    wal_time_t time;
+    wal_email_t email;
+  } w;
+  memcpy(&w, payload, len);
+  // every record starts with the userid
+  char userid[USER_ID_LENGTH];
+  memcpy(userid, payload, USER_ID_LENGTH);
+  userid[USER_ID_LENGTH - 1] = '\0';
+  const account_auth_t *auth = find_record(userid);
+
+  if (type == WAL_ADD) {
+    if (auth != NULL) {
+      restore_account(auth, &w.account);
+      return true;
+    }
+    account_t acc;
+    memset(&acc, 0, sizeof(acc));
+    memcpy(acc.userid, userid, USER_ID_LENGTH);
+    acc.account_id = w.account.account_id;
+    acc.unban_time = w.account.unban_time;
+    acc.expiration_time = w.account.expiration_time;
+    acc.last_login_time = w.account.last_login_time;
+    acc.login_count = w.account.login_count;
+    acc.login_fail_count = w.account.login_fail_count;
+    acc.last_ip = w.account.last_ip;
+    memcpy(acc.password_hash, w.account.password_hash, HASH_LENGTH);
+    memcpy(acc.email, w.account.email, EMAIL_LENGTH);
+    acc.email[EMAIL_LENGTH - 1] = '\0';
+    memcpy(acc.birthdate, w.account.birthdate, BIRTHDATE_LENGTH);
+    bool ok = add_account_to_db(&acc);
+    explicit_bzero(&acc, sizeof(acc));
+    return ok;
+  }
+
+  if (auth == NULL) {
+    log_message(LOG_WARN, "store: Journal record for unknown user '%s'", userid);
+    return true;
+  }
+  shard_t *sh;
+  size_t n;
+  account_auth_t *rec = record_lock(auth, "store_open", &sh, &n);
+  if (rec == NULL) {
+    return false;
+  }
+  switch (type) {
+  case WAL_COUNTERS:
+    rec->last_login_time = w.counters.last_login_time;
+    rec->login_count = w.counters.login_count;
+    rec->login_fail_count = w.counters.login_fail_count;
+    rec->last_ip = w.counters.last_ip;
+    break;
+  case WAL_PASSWORD:
+    memcpy(rec->password_hash, w.password.password_hash, HASH_LENGTH);
+    rec->login_fail_count = 0;
+    rec->unban_time = 0;
+    break;
+  case WAL_REHASH:
+    memcpy(rec->password_hash, w.password.password_hash, HASH_LENGTH);
+    break;
+  case WAL_UNBAN_TIME:
+    rec->unban_time = w.time.time;
+    break;
+  case WAL_EXPIRATION_TIME:
+    rec->expiration_time = w.time.time;
+    break;
+  case WAL_EMAIL:
+    w.email.email[EMAIL_LENGTH - 1] = '\0';
+    email_replace(sh, n, w.email.email);
+    break;
+  }
+  record_unlock(sh, n);
+  return true;
+}
+
+/**
+ * Open the journal of a persistent store, replaying whatever it holds
+ * into the newly mapped shards and then checkpointing it. Does nothing
+ * for an in-memory store.
+ */
+static bool journal_start(void) {
+  if (store_path == NULL) {
+    return true;
+  }
+  shard_t *all = atomic_load(&shards);
+  char *path = shard_path(&all[0], ".wal");
+  if (!path) {
+    log_message(LOG_ERROR, "store_open: Failed to allocate memory");
+    return false;
+  }
+  size_t replayed = 0;
+  journal_t *j = journal_open(path, replay_record, NULL, &replayed);
+  free(path);
+  if (j == NULL) {
+    return false;
+  }
+  journal = j;
+  if (replayed > 0) {
+    log_message(LOG_WARN, "store_open: Recovered %zu change(s) from the journal", replayed);
+    if (!journal_checkpoint(journal, shards_sync, NULL)) {
+      log_message(LOG_WARN, "store_open: Can't checkpoint the journal");
+    }
+  }
+  return true;
+}
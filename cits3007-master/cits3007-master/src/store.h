@@ -0,0 +1,288 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "account.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @file store.h
+ * @brief In-process account store backing the db.h API.
+ *
+ * Accounts are kept in a growable record array and indexed by userid
+ * using an open-addressing hash table. Each index slot stores part of
+ * the userid's hash alongside the record number, so a probe only falls
+ * through to a full userid comparison when the stored hashes match.
+ *
+ * By default the store lives in anonymous memory and is created on
+ * first use. Calling store_open() first makes it persistent: records
+ * are kept in a memory-mapped file that grows in place, and the index
+ * in a companion file "<path>.idx".
+ *
+ * Lookups are lock-free and may run on any number of threads alongside
+ * inserts and updates; writers never block them. Updates to a single
+ * account are atomic with respect to readers of it.
+ *
+ * Each account is split in two. The fields needed to authenticate a
+ * login (ban and expiry times, counters and the password hash) are kept
+ * together in an account_auth_t record, aligned to a cache line, and
+ * the rarely used profile fields (email and birthdate) in a separate
+ * table ("<path>.cold" for a persistent store). Checking a login then
+ * only touches the hot records. A complete account_t can still be had
+ * from account_lookup_by_userid() or store_snapshot().
+ *
+ * The store may be split into shards by userid hash (see
+ * store_configure_shards()), each with its own records, indexes and
+ * writer lock, so that inserts into different shards don't contend.
+ * Shard i > 0 of a persistent store is kept in "<path>.i" and its own
+ * companion files.
+ *
+ * Changes to a persistent store (inserts, password, ban and expiry
+ * changes, email changes and login counters) are also written to a
+ * journal, "<path>.wal", and each call making one returns only once it
+ * is on disk. Concurrent changes share a single fdatasync(). Opening a
+ * store replays anything in the journal that didn't reach the mapped
+ * files before a crash.
+ */
+
+/** Largest number of shards a store may have. */
+#define STORE_MAX_SHARDS 64
+
+/**
+ * The authentication fields of a stored account. The fields consulted
+ * on every login come first, so that they share a cache line.
+ */
+typedef struct {
+  _Alignas(64) int64_t account_id;
+  time_t unban_time;                 // as for account_t
+  time_t expiration_time;
+  time_t last_login_time;
+  unsigned int login_count;
+  unsigned int login_fail_count;
+  ip4_addr_t last_ip;
+  char userid[USER_ID_LENGTH];
+  char password_hash[HASH_LENGTH];
+} account_auth_t;
+
+/**
+ * Hash a userid for indexing.
+ *
+ * At most USER_ID_LENGTH bytes are examined; hashing stops at the
+ * first NUL byte.
+ */
+uint64_t store_hash_userid(const char *userid);
+
+/**
+ * Whether an account with the given userid exists.
+ */
+bool store_contains(const char *userid);
+
+/**
+ * Add several accounts at once. Space for the whole batch is reserved
+ * up front; accounts whose userid is already in the store are skipped
+ * (and logged). Returns the number of accounts added and made durable:
+ * one whose journal record couldn't be appended isn't counted, and if
+ * the batch couldn't be written to the journal at all, 0 (and logs).
+ */
+size_t store_add_batch(const account_t *accs, size_t count);
+
+/**
+ * Look up an account by userid without copying it.
+ *
+ * Returns a read-only pointer to the stored authentication record (not
+ * the complete account), or NULL if there
+ * is no such account. Records never move, so the pointer stays valid
+ * (and reflects later updates to the account) until it is handed back
+ * with store_release(). Callers needing a detached copy should use
+ * account_lookup_by_userid() instead.
+ */
+const account_auth_t *store_acquire(const char *userid);
+
+/**
+ * Look up several userids at once, as store_acquire() would each of
+ * them, setting out[i] to userids[i]'s record or NULL. The index slots
+ * and records of a group of lookups are prefetched together, so their
+ * cache misses overlap rather than following one another. NULL
+ * userids are not found. Returns the number found, each of which must
+ * be released.
+ */
+size_t store_acquire_batch(const char *const *userids, size_t count,
+                           const account_auth_t **out);
+
+/**
+ * Release a record obtained from store_acquire(). NULL is ignored.
+ */
+void store_release(const account_auth_t *auth);
+
+/**
+ * Copy the current state of a record obtained from store_acquire(),
+ * consistently with respect to concurrent updates of it. Returns false
+ * only if an argument is NULL.
+ */
+bool store_read_auth(const account_auth_t *auth, account_auth_t *out);
+
+/**
+ * As for account_is_banned(), account_is_expired() and
+ * account_validate_password(), but for a record obtained from
+ * store_acquire().
+ */
+bool store_is_banned(const account_auth_t *auth);
+bool store_is_expired(const account_auth_t *auth);
+bool store_validate_password(const account_auth_t *auth, const char *plaintext_password);
+
+/**
+ * Fill in *acc with a consistent copy of the complete account whose
+ * record is auth (obtained from store_acquire()). Returns false if auth
+ * is not a record in the store.
+ */
+bool store_snapshot(const account_auth_t *auth, account_t *acc);
+
+/**
+ * Record a successful login against a stored account (see
+ * account_record_login_success()). The update is written to the store
+ * itself and is atomic with respect to other updates of the same
+ * account; updates to different accounts proceed in parallel.
+ *
+ * auth must be a record obtained from store_acquire().
+ */
+void store_record_login_success(const account_auth_t *auth, ip4_addr_t ip);
+
+/**
+ * As store_record_login_success(), with now as the login time rather
+ * than the clock's current reading.
+ */
+void store_record_login_success_at(const account_auth_t *auth, ip4_addr_t ip, time_t now);
+
+/**
+ * Record a failed login against a stored account (see
+ * account_record_login_failure()), as for store_record_login_success().
+ */
+void store_record_login_failure(const account_auth_t *auth);
+
+/*
+ * Secondary lookups. Accounts can also be found by account id and by
+ * email, through indexes that are built the first time either is used
+ * and kept up to date from then on.
+ *
+ * Every stored account has a unique, nonzero account_id. An account
+ * added with account_id 0 is assigned the next free id; one added
+ * with an id already in use is refused.
+ *
+ * Emails are matched without regard to ASCII case. Several accounts
+ * may share an email.
+ */
+
+/**
+ * Look up an account by account id, as account_lookup_by_userid().
+ */
+bool account_lookup_by_id(int64_t account_id, account_t *acc);
+
+/**
+ * Look up an account by email, as account_lookup_by_userid(). If
+ * several accounts have the email, one of them is returned; with a
+ * single shard, it is the most recently added (or most recently given
+ * that email).
+ */
+bool account_lookup_by_email(const char *email, account_t *acc);
+
+/**
+ * Number of accounts with the given email (0 if it is not in use).
+ */
+size_t store_count_by_email(const char *email);
+
+/**
+ * As account_update_password(), for a record obtained from
+ * store_acquire(): the new password is checked and hashed, any ban
+ * and failed logins are cleared, and the account's session tokens
+ * (session.h) are revoked. Returns false (and logs) if the password is
+ * rejected or the change could not be saved.
+ */
+bool store_update_password(const account_auth_t *auth, const char *new_plaintext_password);
+
+/**
+ * Replace the password hash of userid with new_hash, a fresh hash of
+ * the same password (for example with stronger settings), provided the
+ * stored hash is still old_hash. Unlike a password change, failed
+ * logins and bans are left alone. Returns false if there is no such
+ * account, its hash has changed since, or the change couldn't be saved.
+ */
+bool store_replace_password_hash(const char *userid, const char *old_hash,
+                                 const char *new_hash);
+
+/**
+ * As account_set_unban_time() and account_set_expiration_time(), for a
+ * record obtained from store_acquire(). Setting an unban time in the
+ * future also revokes the account's session tokens (session.h), and
+ * setting an expiration time in the future revokes them when it comes,
+ * provided the clock ticker (wallclock.h) is running by then. An
+ * account has at most one such deadline waiting: setting its
+ * expiration time again replaces it. Return false (and log) if auth is
+ * not a record in the store or the change could not be saved.
+ */
+bool store_set_unban_time(const account_auth_t *auth, time_t t);
+bool store_set_expiration_time(const account_auth_t *auth, time_t t);
+
+/**
+ * Number of accounts whose expiration time is yet to come, and whose
+ * sessions will be revoked when it does (see above).
+ */
+size_t store_expiry_pending(void);
+
+/**
+ * Change the email of a stored account, as account_set_email() does for
+ * a detached account_t, keeping the email index consistent. auth must
+ * be a record obtained from store_acquire(). Returns false (and logs)
+ * if the email is invalid.
+ */
+bool store_set_email(const account_auth_t *auth, const char *new_email);
+
+/**
+ * Number of accounts currently held in the store.
+ */
+size_t store_count(void);
+
+/**
+ * Set the number of shards (1 to STORE_MAX_SHARDS) for a store created
+ * from now on. Must be called before the store is first used or
+ * opened; returns false and logs an error otherwise. An existing
+ * persistent store keeps the number of shards it was created with.
+ */
+bool store_configure_shards(size_t count);
+
+/**
+ * Number of shards in the store, or that it will be created with if it
+ * is not in use yet.
+ */
+size_t store_num_shards(void);
+
+/**
+ * Open (creating if necessary) a persistent account store at path.
+ *
+ * Must be called before the store is first used; returns false and
+ * logs an error if a store is already open, or if the file exists but
+ * is not a compatible account store.
+ */
+bool store_open(const char *path);
+
+/**
+ * Flush a persistent store to disk and checkpoint its journal, so that
+ * the journal no longer needs replaying. Returns true on success, and
+ * always for an in-memory store.
+ */
+bool store_sync(void);
+
+/**
+ * Flush and close the store, dropping any expiry deadlines. An
+ * in-memory store is discarded. The store is re-initialised (in
+ * memory) on next use, or store_open() may be called again. The
+ * configured number of shards is kept.
+ *
+ * Every record obtained from store_acquire() must have been released
+ * first; records still held are reported as an error.
+ */
+void store_close(void);
+
+#endif // STORE_H
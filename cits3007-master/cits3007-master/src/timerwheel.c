@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include "timerwheel.h"
+
+#include <stdint.h>
+#include <string.h>
+#include "banned.h"
+
+#define SLOT_MASK ((uint64_t)TIMERWHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) (TIMERWHEEL_SLOT_BITS * (level))
+
+/* The slot of `level` that second t falls in. */
+static size_t slot_of(time_t t, int level) {
+  return (size_t)(((uint64_t)t >> LEVEL_SHIFT(level)) & SLOT_MASK);
+}
+
+static void link_timer(timerwheel_t *w, wheel_timer_t *t, int level, size_t slot) {
+  wheel_timer_t **head = &w->slots[level][slot];
+  t->next = *head;
+  if (t->next) {
+    t->next->pprev = &t->next;
+  }
+  t->pprev = head;
+  *head = t;
+  t->level = level;
+  w->level_count[level]++;
+  w->count++;
+}
+
+static void unlink_timer(timerwheel_t *w, wheel_timer_t *t) {
+  *t->pprev = t->next;
+  if (t->next) {
+    t->next->pprev = t->pprev;
+  }
+  t->next = NULL;
+  t->pprev = NULL;
+  w->level_count[t->level]--;
+  w->count--;
+}
+
+/*
+ * Put t in the lowest level whose range from w->now covers its
+ * deadline. A level's slot is picked by the deadline itself, so it is
+ * reached (and cascaded) at the start of the span holding the deadline.
+ * A deadline before `earliest`, the first second not yet handled, is
+ * treated as due then.
+ */
+static void place(timerwheel_t *w, wheel_timer_t *t, time_t earliest) {
+  time_t expires = t->expires > earliest ? t->expires : earliest;
+  uint64_t delta = (uint64_t)(expires - w->now);
+  int level = 0;
+  while (level < TIMERWHEEL_LEVELS - 1 && delta >= (uint64_t)1 << LEVEL_SHIFT(level + 1)) {
+    level++;
+  }
+  if (delta >= (uint64_t)1 << LEVEL_SHIFT(TIMERWHEEL_LEVELS)) {
+    // Out of range: the top level's current slot comes round again
+    // after a full turn, when the timer is placed afresh.
+    link_timer(w, t, level, slot_of(w->now, level));
+    return;
+  }
+  link_timer(w, t, level, slot_of(expires, level));
+}
+
+/*
+ * Take the list in a slot off the wheel. Its first timer's pprev points
+ * at *list, so timers in it can still be unlinked (by cancels from a
+ * callback) while it is worked through.
+ */
+static void detach(timerwheel_t *w, int level, size_t slot, wheel_timer_t **list) {
+  *list = w->slots[level][slot];
+  w->slots[level][slot] = NULL;
+  if (*list) {
+    (*list)->pprev = list;
+  }
+}
+
+void timerwheel_init(timerwheel_t *wheel, time_t now) {
+  memset(wheel, 0, sizeof(*wheel));
+  wheel->now = now;
+}
+
+void timerwheel_add(timerwheel_t *wheel, wheel_timer_t *timer, time_t expires) {
+  if (timer->pprev) {
+    unlink_timer(wheel, timer);
+  }
+  timer->expires = expires;
+  place(wheel, timer, wheel->now + 1);
+}
+
+void timerwheel_cancel(timerwheel_t *wheel, wheel_timer_t *timer) {
+  if (timer->pprev) {
+    unlink_timer(wheel, timer);
+  }
+}
+
+bool timerwheel_pending(const wheel_timer_t *timer) {
+  return timer->pprev != NULL;
+}
+
+/* Handle second t, which w->now has just reached. */
+static size_t step(timerwheel_t *w, time_t t, timerwheel_fn expired, void *arg) {
+  wheel_timer_t *list;
+  // Cascade from the top, so timers moved down a level are in place
+  // before that level's own slot is handled.
+  int top = 0;
+  while (top < TIMERWHEEL_LEVELS - 1 && ((uint64_t)t & (((uint64_t)1 << LEVEL_SHIFT(top + 1)) - 1)) == 0) {
+    top++;
+  }
+  for (int level = top; level > 0; level--) {
+    detach(w, level, slot_of(t, level), &list);
+    for (wheel_timer_t *timer; (timer = list) != NULL;) {
+      unlink_timer(w, timer);
+      place(w, timer, t);
+    }
+  }
+
+  size_t fired = 0;
+  detach(w, 0, slot_of(t, 0), &list);
+  for (wheel_timer_t *timer; (timer = list) != NULL;) {
+    unlink_timer(w, timer);
+    fired++;
+    expired(timer, arg);
+  }
+  return fired;
+}
+
+size_t timerwheel_advance(timerwheel_t *wheel, time_t now, timerwheel_fn expired, void *arg) {
+  size_t fired = 0;
+  while (wheel->now < now) {
+    if (wheel->count == 0) {
+      wheel->now = now;
+      break;
+    }
+    // Nothing happens before the next slot of the lowest level with
+    // timers in it, so skip straight there.
+    int level = 0;
+    while (wheel->level_count[level] == 0) {
+      level++;
+    }
+    uint64_t span = (uint64_t)1 << LEVEL_SHIFT(level);
+    time_t next = (time_t)(((uint64_t)wheel->now / span + 1) * span);
+    if (next > now) {
+      wheel->now = now;
+      break;
+    }
+    wheel->now = next;
+    fired += step(wheel, next, expired, arg);
+  }
+  return fired;
+}
@@ -0,0 +1,81 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * @file timerwheel.h
+ * @brief Hierarchical timer wheel with one-second resolution.
+ *
+ * Keeps track of deadlines (session timeouts, account expiries) so
+ * that adding or cancelling one is O(1), and finding the ones that
+ * have passed costs nothing for those that haven't.
+ *
+ * There are TIMERWHEEL_LEVELS wheels of TIMERWHEEL_SLOTS slots each.
+ * A slot of level 0 holds the timers due in one particular second; a
+ * slot of each level above spans TIMERWHEEL_SLOTS times as long as one
+ * of the level below. A timer goes in the lowest level whose range
+ * covers its deadline, and as time reaches each slot of a higher
+ * level, its timers are moved down (cascaded) to where they now
+ * belong. A timer further off than the top level reaches waits in the
+ * top level for a whole turn, and is placed again after it.
+ *
+ * Timers are embedded in whatever they time (see wheel_timer_t), so
+ * the wheel never allocates. It has no lock of its own: the caller
+ * serializes all calls on one wheel.
+ */
+
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_SLOT_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+
+/** A deadline on a wheel. Zero-initialize before first use. */
+typedef struct wheel_timer {
+  struct wheel_timer *next;
+  struct wheel_timer **pprev;  // NULL while not on a wheel
+  time_t expires;
+  int level;
+} wheel_timer_t;
+
+typedef struct {
+  time_t now;                  // the second the wheel has reached
+  size_t count;                // timers on the wheel
+  size_t level_count[TIMERWHEEL_LEVELS];
+  wheel_timer_t *slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+} timerwheel_t;
+
+/** Called for each timer that expires, after it is off the wheel. */
+typedef void (*timerwheel_fn)(wheel_timer_t *timer, void *arg);
+
+/**
+ * Set up an empty wheel whose time is now.
+ */
+void timerwheel_init(timerwheel_t *wheel, time_t now);
+
+/**
+ * Put timer on the wheel to expire at `expires` (moving it, if it was
+ * already on it). A deadline already reached expires at the next
+ * advance.
+ */
+void timerwheel_add(timerwheel_t *wheel, wheel_timer_t *timer, time_t expires);
+
+/**
+ * Take timer off the wheel, if it is on it.
+ */
+void timerwheel_cancel(timerwheel_t *wheel, wheel_timer_t *timer);
+
+/** Whether timer is on a wheel. */
+bool timerwheel_pending(const wheel_timer_t *timer);
+
+/**
+ * Move the wheel's time on to now, calling expired for every timer
+ * whose deadline that reaches, in order of deadline (and in no
+ * particular order within a second). expired may add and cancel
+ * timers, including freeing the one it is given. Returns how many
+ * expired; moving time backwards does nothing.
+ */
+size_t timerwheel_advance(timerwheel_t *wheel, time_t now, timerwheel_fn expired, void *arg);
+
+#endif // TIMERWHEEL_H
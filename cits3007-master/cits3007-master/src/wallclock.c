@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include "wallclock.h"
+#include "logging.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "banned.h"
+
+/*
+ * cached is 0 whenever the ticker isn't running. The ticker sleeps on
+ * ticker_wake, which uses the monotonic clock so that a change to the
+ * time of day doesn't stretch or cut short its sleep, and which
+ * wallclock_stop() signals to end it at once.
+ */
+static _Atomic int64_t cached = 0;
+
+static pthread_mutex_t ticker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ticker_wake;
+static pthread_once_t ticker_once = PTHREAD_ONCE_INIT;
+static pthread_t ticker;
+static bool running = false;
+static bool stopping = false;
+static wallclock_hook_fn hooks[WALLCLOCK_MAX_HOOKS];
+static size_t hook_count = 0;
+
+static void ticker_init(void) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&ticker_wake, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+static time_t read_clock(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) != 0) {
+    return time(NULL);
+  }
+  return ts.tv_sec;
+}
+
+time_t wallclock_now(void) {
+  int64_t t = atomic_load_explicit(&cached, memory_order_relaxed);
+  return t != 0 ? (time_t)t : read_clock();
+}
+
+static void *ticker_main(void *arg) {
+  (void)arg;
+  time_t last = 0;
+  pthread_mutex_lock(&ticker_lock);
+  while (!stopping) {
+    wallclock_hook_fn due[WALLCLOCK_MAX_HOOKS];
+    size_t n = hook_count;
+    for (size_t i = 0; i < n; i++) {
+      due[i] = hooks[i];
+    }
+    pthread_mutex_unlock(&ticker_lock);
+
+    time_t now = read_clock();
+    atomic_store_explicit(&cached, (int64_t)now, memory_order_relaxed);
+    if (now != last) {
+      last = now;
+      for (size_t i = 0; i < n; i++) {
+        due[i](now);
+      }
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += (long)WALLCLOCK_TICK_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&ticker_lock);
+    if (!stopping) {
+      pthread_cond_timedwait(&ticker_wake, &ticker_lock, &deadline);
+    }
+  }
+  pthread_mutex_unlock(&ticker_lock);
+  return NULL;
+}
+
+bool wallclock_start(void) {
+  pthread_once(&ticker_once, ticker_init);
+  pthread_mutex_lock(&ticker_lock);
+  if (running) {
+    pthread_mutex_unlock(&ticker_lock);
+    return true;
+  }
+  // Prime the cache so readers are served from it straight away.
+  atomic_store(&cached, (int64_t)read_clock());
+  stopping = false;
+  if (pthread_create(&ticker, NULL, ticker_main, NULL) != 0) {
+    atomic_store(&cached, 0);
+    pthread_mutex_unlock(&ticker_lock);
+    log_message(LOG_ERROR, "wallclock_start: Can't start the clock thread");
+    return false;
+  }
+  running = true;
+  pthread_mutex_unlock(&ticker_lock);
+  return true;
+}
+
+void wallclock_stop(void) {
+  pthread_once(&ticker_once, ticker_init);
+  pthread_mutex_lock(&ticker_lock);
+  if (!running) {
+    pthread_mutex_unlock(&ticker_lock);
+    return;
+  }
+  stopping = true;
+  pthread_cond_signal(&ticker_wake);
+  pthread_mutex_unlock(&ticker_lock);
+  pthread_join(ticker, NULL);
+
+  pthread_mutex_lock(&ticker_lock);
+  running = false;
+  atomic_store(&cached, 0);
+  pthread_mutex_unlock(&ticker_lock);
+}
+
+bool wallclock_running(void) {
+  pthread_mutex_lock(&ticker_lock);
+  bool r = running;
+  pthread_mutex_unlock(&ticker_lock);
+  return r;
+}
+
+bool wallclock_on_second(wallclock_hook_fn fn) {
+  pthread_mutex_lock(&ticker_lock);
+  for (size_t i = 0; i < hook_count; i++) {
+    if (hooks[i] == fn) {
+      pthread_mutex_unlock(&ticker_lock);
+      return true;
+    }
+  }
+  if (hook_count == WALLCLOCK_MAX_HOOKS) {
+    pthread_mutex_unlock(&ticker_lock);
+    log_message(LOG_ERROR, "wallclock_on_second: Too many hooks");
+    return false;
+  }
+  hooks[hook_count++] = fn;
+  pthread_mutex_unlock(&ticker_lock);
+  return true;
+}
@@ -0,0 +1,61 @@
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * @file wallclock.h
+ * @brief Shared coarse time of day, for deadline checks on hot paths.
+ *
+ * Bans, account expiry and sessions all only care about whole seconds,
+ * yet each check used to read the clock for itself, so that a single
+ * login read it several times over and the checks could disagree about
+ * what time it was. wallclock_now() is the one clock they share.
+ *
+ * While the ticker is running (wallclock_start()), wallclock_now() is a
+ * load of a timestamp the ticker refreshes from CLOCK_REALTIME_COARSE
+ * every WALLCLOCK_TICK_MS milliseconds, so it may be that much behind
+ * the real time. Once a second the ticker also calls the hooks given to
+ * wallclock_on_second(), which is what moves deadlines (timerwheel.h)
+ * along. Without the ticker, wallclock_now() reads CLOCK_REALTIME_COARSE
+ * itself: still no system call, and never stale.
+ */
+
+/** How often the ticker refreshes the time, in milliseconds. */
+#define WALLCLOCK_TICK_MS 100
+
+/** Most hooks wallclock_on_second() takes. */
+#define WALLCLOCK_MAX_HOOKS 8
+
+/** Called by the ticker each time the second changes. */
+typedef void (*wallclock_hook_fn)(time_t now);
+
+/**
+ * The current time in seconds since the epoch.
+ */
+time_t wallclock_now(void);
+
+/**
+ * Start the ticker thread, if it isn't running. Returns false (and
+ * logs) if the thread couldn't be started, in which case
+ * wallclock_now() goes on reading the clock itself.
+ */
+bool wallclock_start(void);
+
+/**
+ * Stop the ticker thread, if it is running, and wait for it to finish.
+ */
+void wallclock_stop(void);
+
+/** Whether the ticker is running. */
+bool wallclock_running(void);
+
+/**
+ * Have the ticker call fn with the new time whenever the second
+ * changes, from now on. Adding the same fn again does nothing. Returns
+ * false (and logs) if WALLCLOCK_MAX_HOOKS are already taken.
+ */
+bool wallclock_on_second(wallclock_hook_fn fn);
+
+#endif // WALLCLOCK_H
@@ -0,0 +1,56 @@
+#include "test_csprng.h"
+#include "../src/csprng.h"
+#include <check.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+START_TEST(test_csprng_bytes) {
+    unsigned char a[16], b[16], zero[16] = { 0 };
+    ck_assert(csprng_bytes(a, sizeof(a)));
+    ck_assert(csprng_bytes(b, sizeof(b)));
+    ck_assert(memcmp(a, b, sizeof(a)) != 0);
+    ck_assert(memcmp(a, zero, sizeof(a)) != 0);
+
+    /* Requests spanning refills, and bigger than the buffer */
+    static unsigned char big[3 * CSPRNG_BUFFER_BYTES + 7];
+    for (int i = 0; i < 3; i++) {
+        ck_assert(csprng_bytes(big, CSPRNG_BUFFER_BYTES - 5));
+    }
+    ck_assert(csprng_bytes(big, sizeof(big)));
+    ck_assert(memcmp(big, zero, sizeof(zero)) != 0);
+    ck_assert(memcmp(big + sizeof(big) - sizeof(zero), zero, sizeof(zero)) != 0);
+    ck_assert(!csprng_bytes(NULL, 1));
+} END_TEST
+
+START_TEST(test_csprng_fork) {
+    /* With a partly used buffer, parent and child must not go on to
+       produce the same bytes */
+    unsigned char mine[32], theirs[32];
+    ck_assert(csprng_bytes(mine, 8));
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    pid_t pid = fork();
+    ck_assert_int_ge(pid, 0);
+    if (pid == 0) {
+        bool ok = csprng_bytes(theirs, sizeof(theirs));
+        _exit(ok && write(fds[1], theirs, sizeof(theirs)) == (ssize_t)sizeof(theirs) ? 0 : 1);
+    }
+    int status;
+    ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+    ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ck_assert_int_eq(read(fds[0], theirs, sizeof(theirs)), (ssize_t)sizeof(theirs));
+    ck_assert(csprng_bytes(mine, sizeof(mine)));
+    ck_assert(memcmp(mine, theirs, sizeof(mine)) != 0);
+    close(fds[0]);
+    close(fds[1]);
+} END_TEST
+
+TCase* make_csprng_tests(void) {
+    TCase *tc = tcase_create("CSPRNG Tests");
+
+    tcase_add_test(tc, test_csprng_bytes);
+    tcase_add_test(tc, test_csprng_fork);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_CSPRNG_H
+#define TEST_CSPRNG_H
+
+#include <check.h>
+
+TCase* make_csprng_tests(void);
+
+#endif // TEST_CSPRNG_H
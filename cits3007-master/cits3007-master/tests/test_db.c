@@ -1,25 +1,663 @@
+#define _GNU_SOURCE
 #include "test_db.h"
 #include "../src/db.h"
+#include "../src/store.h"
 #include <check.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_STORE_FILE "test_store.db"
+#define TEST_STORE_INDEX "test_store.db.idx"
+#define TEST_STORE_COLD "test_store.db.cold"
+#define TEST_STORE_WAL "test_store.db.wal"
+
+/* Helper to build a record without going through password hashing */
+static account_t make_record(const char *userid) {
+    account_t acc;
+    memset(&acc, 0, sizeof(acc));
+    strncpy(acc.userid, userid, USER_ID_LENGTH - 1);
+    strncpy(acc.email, "db@example.com", EMAIL_LENGTH - 1);
+    memcpy(acc.birthdate, "2000-01-01", BIRTHDATE_LENGTH);
+    return acc;
+}
 
 START_TEST(test_account_lookup_found) {
-    // Test cases will go here
+    account_t acc = make_record("dbuser");
+    ck_assert(add_account_to_db(&acc));
+
+    account_t result;
+    ck_assert(account_lookup_by_userid("dbuser", &result));
+    ck_assert_str_eq(result.userid, "dbuser");
+    ck_assert_str_eq(result.email, "db@example.com");
 } END_TEST
 
 START_TEST(test_account_lookup_not_found) {
-    // Test cases will go here
+    account_t acc = make_record("dbuser");
+    ck_assert(add_account_to_db(&acc));
+
+    account_t result;
+    ck_assert(!account_lookup_by_userid("nobody", &result));
+    ck_assert(!account_lookup_by_userid("dbuse", &result));
+    ck_assert(!account_lookup_by_userid("dbuser2", &result));
 } END_TEST
 
 START_TEST(test_account_lookup_invalid) {
-    // Test cases will go here
+    account_t result;
+    ck_assert(!account_lookup_by_userid(NULL, &result));
+    ck_assert(!account_lookup_by_userid("dbuser", NULL));
+    ck_assert(!add_account_to_db(NULL));
+} END_TEST
+
+START_TEST(test_add_account_duplicate) {
+    account_t acc = make_record("dupuser");
+    ck_assert(add_account_to_db(&acc));
+    ck_assert(!add_account_to_db(&acc));
+    ck_assert_uint_eq(store_count(), 1);
+} END_TEST
+
+START_TEST(test_store_growth) {
+    /* Enough accounts to force both the records and the index to grow */
+    char userid[USER_ID_LENGTH];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(userid, sizeof(userid), "grow%d", i);
+        account_t acc = make_record(userid);
+        ck_assert(add_account_to_db(&acc));
+    }
+    ck_assert_uint_eq(store_count(), 20000);
+
+    account_t result;
+    for (int i = 0; i < 20000; i += 997) {
+        snprintf(userid, sizeof(userid), "grow%d", i);
+        ck_assert(account_lookup_by_userid(userid, &result));
+        ck_assert_str_eq(result.userid, userid);
+    }
+    ck_assert(!account_lookup_by_userid("grow20000", &result));
+} END_TEST
+
+START_TEST(test_store_acquire_release) {
+    account_t acc = make_record("pinned");
+    ck_assert(add_account_to_db(&acc));
+
+    const account_auth_t *rec = store_acquire("pinned");
+    ck_assert_ptr_nonnull(rec);
+    ck_assert_str_eq(rec->userid, "pinned");
+    ck_assert_ptr_null(store_acquire("unpinned"));
+    ck_assert_ptr_null(store_acquire(NULL));
+
+    /* The record must not move while the store grows around it */
+    char userid[USER_ID_LENGTH];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(userid, sizeof(userid), "filler%d", i);
+        account_t filler = make_record(userid);
+        ck_assert(add_account_to_db(&filler));
+    }
+    const account_auth_t *again = store_acquire("pinned");
+    ck_assert_ptr_eq(again, rec);
+    ck_assert_str_eq(rec->userid, "pinned");
+
+    store_release(again);
+    store_release(rec);
+    store_release(NULL);
+} END_TEST
+
+START_TEST(test_store_acquire_batch) {
+    /* More than one prefetch group, with misses and NULLs among them */
+    enum { COUNT = 40 };
+    char names[COUNT][USER_ID_LENGTH];
+    const char *userids[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "%s%d", i % 3 == 0 ? "batchmiss" : "batchhit", i);
+        userids[i] = names[i];
+        if (i % 3 != 0) {
+            account_t acc = make_record(names[i]);
+            ck_assert(add_account_to_db(&acc));
+        }
+    }
+    userids[7] = NULL;
+
+    const account_auth_t *found[COUNT];
+    size_t hits = store_acquire_batch(userids, COUNT, found);
+    size_t expected = 0;
+    for (int i = 0; i < COUNT; i++) {
+        if (userids[i] == NULL || i % 3 == 0) {
+            ck_assert_ptr_null(found[i]);
+            continue;
+        }
+        expected++;
+        ck_assert_ptr_eq(found[i], store_acquire(userids[i]));
+        store_release(found[i]);
+        store_release(found[i]);
+    }
+    ck_assert_uint_eq(hits, expected);
+    ck_assert_uint_eq(store_acquire_batch(NULL, COUNT, found), 0);
+} END_TEST
+
+START_TEST(test_store_snapshot) {
+    account_t acc = make_record("split");
+    acc.account_id = 42;
+    acc.unban_time = time(NULL) + 3600;
+    strncpy(acc.password_hash, "$argon2id$placeholder", HASH_LENGTH - 1);
+    ck_assert(add_account_to_db(&acc));
+
+    /* The hot record carries the authentication fields only... */
+    const account_auth_t *auth = store_acquire("split");
+    ck_assert_ptr_nonnull(auth);
+    ck_assert_uint_eq((uintptr_t)auth % 64, 0);
+    ck_assert_int_eq(auth->account_id, 42);
+    ck_assert_str_eq(auth->password_hash, "$argon2id$placeholder");
+    ck_assert(store_is_banned(auth));
+    ck_assert(!store_is_expired(auth));
+
+    /* ...and the complete account is reassembled on demand */
+    account_t view;
+    ck_assert(store_snapshot(auth, &view));
+    ck_assert_mem_eq(&view, &acc, sizeof(acc));
+    ck_assert(!store_snapshot(NULL, &view));
+    store_release(auth);
+} END_TEST
+
+START_TEST(test_lookup_by_id) {
+    account_t acc = make_record("first");
+    ck_assert(add_account_to_db(&acc));
+    acc = make_record("second");
+    ck_assert(add_account_to_db(&acc));
+
+    /* Ids are assigned by the store, and the index is built on demand */
+    account_t result;
+    ck_assert(account_lookup_by_id(1, &result));
+    ck_assert_str_eq(result.userid, "first");
+    ck_assert(account_lookup_by_id(2, &result));
+    ck_assert_str_eq(result.userid, "second");
+    ck_assert(!account_lookup_by_id(3, &result));
+
+    /* Once built it follows later inserts, including explicit ids */
+    acc = make_record("third");
+    acc.account_id = 100;
+    ck_assert(add_account_to_db(&acc));
+    acc = make_record("fourth");
+    ck_assert(add_account_to_db(&acc));
+    ck_assert(account_lookup_by_id(100, &result));
+    ck_assert_str_eq(result.userid, "third");
+    ck_assert(account_lookup_by_id(101, &result));
+    ck_assert_str_eq(result.userid, "fourth");
+
+    /* Ids in use are refused */
+    acc = make_record("fifth");
+    acc.account_id = 2;
+    ck_assert(!add_account_to_db(&acc));
+    ck_assert(!account_lookup_by_id(0, &result));
+    ck_assert(!account_lookup_by_id(1, NULL));
+} END_TEST
+
+START_TEST(test_lookup_by_email) {
+    char userid[USER_ID_LENGTH];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(userid, sizeof(userid), "mail%d", i);
+        account_t acc = make_record(userid);
+        snprintf(acc.email, EMAIL_LENGTH, "user%d@Example.com", i % 2500);
+        ck_assert(add_account_to_db(&acc));
+    }
+
+    account_t result;
+    ck_assert(account_lookup_by_email("USER7@example.COM", &result));
+    ck_assert(strcmp(result.userid, "mail7") == 0 || strcmp(result.userid, "mail2507") == 0);
+    ck_assert_uint_eq(store_count_by_email("user7@example.com"), 2);
+    ck_assert_uint_eq(store_count_by_email("nobody@example.com"), 0);
+    ck_assert(!account_lookup_by_email("nobody@example.com", &result));
+
+    /* Changing a stored email moves the account in the index */
+    const account_auth_t *auth = store_acquire("mail7");
+    ck_assert_ptr_nonnull(auth);
+    ck_assert(store_set_email(auth, "moved@example.org"));
+    ck_assert(!store_set_email(auth, "not an email"));
+    store_release(auth);
+
+    ck_assert_uint_eq(store_count_by_email("user7@example.com"), 1);
+    ck_assert(account_lookup_by_email("user7@example.com", &result));
+    ck_assert_str_eq(result.userid, "mail2507");
+    ck_assert(account_lookup_by_email("Moved@Example.org", &result));
+    ck_assert_str_eq(result.userid, "mail7");
+    ck_assert_str_eq(result.email, "moved@example.org");
+
+    /* New accounts are indexed as they are added */
+    account_t acc = make_record("latecomer");
+    strncpy(acc.email, "moved@example.org", EMAIL_LENGTH - 1);
+    ck_assert(add_account_to_db(&acc));
+    ck_assert_uint_eq(store_count_by_email("moved@example.org"), 2);
+} END_TEST
+
+#define UPDATE_THREADS 8
+#define UPDATES_PER_THREAD 10000
+
+static void *record_failures(void *arg) {
+    const account_auth_t *rec = arg;
+    for (int i = 0; i < UPDATES_PER_THREAD; i++) {
+        store_record_login_failure(rec);
+    }
+    return NULL;
+}
+
+START_TEST(test_store_record_login) {
+    account_t acc = make_record("counted");
+    ck_assert(add_account_to_db(&acc));
+    const account_auth_t *rec = store_acquire("counted");
+    ck_assert_ptr_nonnull(rec);
+
+    /* Concurrent updates to one account must not lose increments */
+    pthread_t threads[UPDATE_THREADS];
+    for (int i = 0; i < UPDATE_THREADS; i++) {
+        ck_assert_int_eq(pthread_create(&threads[i], NULL, record_failures, (void *)rec), 0);
+    }
+    for (int i = 0; i < UPDATE_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    account_t result;
+    ck_assert(account_lookup_by_userid("counted", &result));
+    ck_assert_uint_eq(result.login_fail_count, UPDATE_THREADS * UPDATES_PER_THREAD);
+
+    store_record_login_success(rec, 0x7F000001);
+    ck_assert(account_lookup_by_userid("counted", &result));
+    ck_assert_uint_eq(result.login_count, 1);
+    ck_assert_uint_eq(result.login_fail_count, 0);
+    ck_assert_uint_eq(result.last_ip, 0x7F000001);
+
+    /* Records that aren't in the store are refused */
+    account_auth_t outside;
+    memset(&outside, 0, sizeof(outside));
+    store_record_login_failure(&outside);
+    store_record_login_failure(NULL);
+    ck_assert_uint_eq(outside.login_fail_count, 0);
+    store_release(rec);
+} END_TEST
+
+#define STRESS_READERS 8
+#define STRESS_STABLE 2000
+#define STRESS_INSERTS 30000
+
+static atomic_bool stress_stop;
+static atomic_long stress_errors;
+static atomic_long stress_reads;
+
+/* Look up existing accounts while the store grows and "hot" is updated */
+static void *stress_reader(void *arg) {
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    char userid[USER_ID_LENGTH];
+    while (!atomic_load(&stress_stop)) {
+        snprintf(userid, sizeof(userid), "stable%d", rand_r(&seed) % STRESS_STABLE);
+        const account_auth_t *rec = store_acquire(userid);
+        if (rec == NULL || strcmp(rec->userid, userid) != 0) {
+            atomic_fetch_add(&stress_errors, 1);
+        }
+        store_release(rec);
+
+        /* Every update of "hot" sets last_ip to the new login count, so a
+           torn read would show them differing */
+        const account_auth_t *hot = store_acquire("hot");
+        account_auth_t state;
+        if (hot == NULL || !store_read_auth(hot, &state) || state.last_ip != state.login_count) {
+            atomic_fetch_add(&stress_errors, 1);
+        }
+        store_release(hot);
+        atomic_fetch_add(&stress_reads, 1);
+    }
+    return NULL;
+}
+
+static void *stress_writer(void *arg) {
+    const account_auth_t *hot = arg;
+    for (unsigned int i = 1; !atomic_load(&stress_stop); i++) {
+        store_record_login_success(hot, i);
+    }
+    return NULL;
+}
+
+START_TEST(test_store_concurrent_readers) {
+    char userid[USER_ID_LENGTH];
+    for (int i = 0; i < STRESS_STABLE; i++) {
+        snprintf(userid, sizeof(userid), "stable%d", i);
+        account_t acc = make_record(userid);
+        ck_assert(add_account_to_db(&acc));
+    }
+    account_t acc = make_record("hot");
+    ck_assert(add_account_to_db(&acc));
+    const account_auth_t *hot = store_acquire("hot");
+
+    atomic_store(&stress_stop, false);
+    atomic_store(&stress_errors, 0);
+    atomic_store(&stress_reads, 0);
+    pthread_t readers[STRESS_READERS], writer;
+    for (int i = 0; i < STRESS_READERS; i++) {
+        ck_assert_int_eq(pthread_create(&readers[i], NULL, stress_reader, (void *)(uintptr_t)(i + 1)), 0);
+    }
+    ck_assert_int_eq(pthread_create(&writer, NULL, stress_writer, (void *)hot), 0);
+
+    /* Inserts grow the records and rebuild the index under the readers */
+    for (int i = 0; i < STRESS_INSERTS; i++) {
+        snprintf(userid, sizeof(userid), "new%d", i);
+        account_t fresh = make_record(userid);
+        ck_assert(add_account_to_db(&fresh));
+    }
+    atomic_store(&stress_stop, true);
+    for (int i = 0; i < STRESS_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    pthread_join(writer, NULL);
+    store_release(hot);
+
+    ck_assert_int_eq(atomic_load(&stress_errors), 0);
+    ck_assert_int_gt(atomic_load(&stress_reads), 0);
+    ck_assert_uint_eq(store_count(), STRESS_STABLE + 1 + STRESS_INSERTS);
+    for (int i = 0; i < STRESS_INSERTS; i += 1009) {
+        snprintf(userid, sizeof(userid), "new%d", i);
+        ck_assert(store_contains(userid));
+    }
+} END_TEST
+
+/* Overwrite every slot of an index file (after its 64-byte header) */
+static void corrupt_index(const char *path, int fill) {
+    int fd = open(path, O_RDWR);
+    ck_assert_int_ge(fd, 0);
+    struct stat st;
+    ck_assert_int_eq(fstat(fd, &st), 0);
+    char buf[4096];
+    memset(buf, fill, sizeof(buf));
+    for (off_t off = 64; off < st.st_size; off += (off_t)sizeof(buf)) {
+        size_t len = st.st_size - off < (off_t)sizeof(buf) ? (size_t)(st.st_size - off) : sizeof(buf);
+        ck_assert_int_eq(pwrite(fd, buf, len, off), (ssize_t)len);
+    }
+    close(fd);
+}
+
+START_TEST(test_store_persistent_reopen) {
+    unlink(TEST_STORE_FILE);
+    unlink(TEST_STORE_INDEX);
+    unlink(TEST_STORE_COLD);
+    unlink(TEST_STORE_WAL);
+
+    ck_assert(store_open(TEST_STORE_FILE));
+    ck_assert(!store_open(TEST_STORE_FILE));  /* already open */
+    char userid[USER_ID_LENGTH];
+    for (int i = 0; i < 3000; i++) {
+        snprintf(userid, sizeof(userid), "persist%d", i);
+        account_t acc = make_record(userid);
+        ck_assert(add_account_to_db(&acc));
+    }
+    store_close();
+
+    /* Reopen: records and index come straight from the files */
+    ck_assert(store_open(TEST_STORE_FILE));
+    ck_assert_uint_eq(store_count(), 3000);
+    account_t result;
+    ck_assert(account_lookup_by_userid("persist0", &result));
+    ck_assert(account_lookup_by_userid("persist2999", &result));
+    ck_assert_str_eq(result.email, "db@example.com");
+    account_t dup = make_record("persist42");
+    ck_assert(!add_account_to_db(&dup));
+    store_close();
+
+    /* A missing index is rebuilt from the records */
+    unlink(TEST_STORE_INDEX);
+    ck_assert(store_open(TEST_STORE_FILE));
+    ck_assert(account_lookup_by_userid("persist1234", &result));
+    ck_assert(!account_lookup_by_userid("persist3000", &result));
+    store_close();
+
+    /* So is one whose slots name records that aren't there, or whose
+       slots don't cover every record */
+    for (int fill = 0xff; fill >= 0; fill -= 0xff) {
+        corrupt_index(TEST_STORE_INDEX, fill);
+        ck_assert(store_open(TEST_STORE_FILE));
+        ck_assert(account_lookup_by_userid("persist2999", &result));
+        ck_assert(account_lookup_by_userid("persist7", &result));
+        ck_assert(!account_lookup_by_userid("persist3000", &result));
+        store_close();
+    }
+
+    unlink(TEST_STORE_FILE);
+    unlink(TEST_STORE_INDEX);
+    unlink(TEST_STORE_COLD);
+    unlink(TEST_STORE_WAL);
+} END_TEST
+
+START_TEST(test_store_sharded) {
+    static const char *suffixes[] = { "", ".idx", ".cold", ".wal" };
+    char path[64];
+    store_close();
+    ck_assert(!store_configure_shards(0));
+    ck_assert(!store_configure_shards(STORE_MAX_SHARDS + 1));
+    ck_assert(store_configure_shards(4));
+    for (int s = 0; s < 4; s++) {
+        for (int f = 0; f < 4; f++) {
+            if (s == 0) {
+                snprintf(path, sizeof(path), "%s%s", TEST_STORE_FILE, suffixes[f]);
+            } else {
+                snprintf(path, sizeof(path), "%s.%d%s", TEST_STORE_FILE, s, suffixes[f]);
+            }
+            unlink(path);
+        }
+    }
+
+    ck_assert(store_open(TEST_STORE_FILE));
+    ck_assert_uint_eq(store_num_shards(), 4);
+    ck_assert(!store_configure_shards(2));  /* already in use */
+    char userid[USER_ID_LENGTH];
+    for (int i = 0; i < 4000; i++) {
+        snprintf(userid, sizeof(userid), "shard%d", i);
+        account_t acc = make_record(userid);
+        ck_assert(add_account_to_db(&acc));
+    }
+    account_t dup = make_record("shard17");
+    ck_assert(!add_account_to_db(&dup));
+
+    /* Ids are unique across shards, explicit ones included */
+    account_t result;
+    ck_assert(account_lookup_by_id(4000, &result));
+    account_t taken = make_record("shardtaken");
+    taken.account_id = 1234;
+    ck_assert(!add_account_to_db(&taken));
+    taken.account_id = 9000;
+    ck_assert(add_account_to_db(&taken));
+    ck_assert(account_lookup_by_id(9000, &result));
+    ck_assert_str_eq(result.userid, "shardtaken");
+    ck_assert_uint_eq(store_count_by_email("DB@example.com"), 4001);
+
+    const account_auth_t *rec = store_acquire("shard3999");
+    ck_assert_ptr_nonnull(rec);
+    store_record_login_success(rec, 7);
+    ck_assert(store_set_email(rec, "moved@example.com"));
+    store_release(rec);
+    store_close();
+
+    /* Reopening finds the shards whatever is configured */
+    ck_assert(store_configure_shards(1));
+    ck_assert(store_open(TEST_STORE_FILE));
+    ck_assert_uint_eq(store_num_shards(), 4);
+    ck_assert_uint_eq(store_count(), 4001);
+    for (int i = 0; i < 4000; i += 97) {
+        snprintf(userid, sizeof(userid), "shard%d", i);
+        ck_assert(account_lookup_by_userid(userid, &result));
+    }
+    ck_assert(account_lookup_by_email("moved@example.com", &result));
+    ck_assert_str_eq(result.userid, "shard3999");
+    ck_assert_uint_eq(result.login_count, 1);
+    account_t next = make_record("shardnext");
+    ck_assert(add_account_to_db(&next));
+    ck_assert(account_lookup_by_userid("shardnext", &result));
+    ck_assert_int_eq(result.account_id, 9001);
+    store_close();
+
+    for (int s = 0; s < 4; s++) {
+        for (int f = 0; f < 4; f++) {
+            if (s == 0) {
+                snprintf(path, sizeof(path), "%s%s", TEST_STORE_FILE, suffixes[f]);
+            } else {
+                snprintf(path, sizeof(path), "%s.%d%s", TEST_STORE_FILE, s, suffixes[f]);
+            }
+            unlink(path);
+        }
+    }
+} END_TEST
+
+static void copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    ck_assert_ptr_nonnull(in);
+    ck_assert_ptr_nonnull(out);
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        ck_assert_uint_eq(fwrite(buf, 1, n, out), n);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+START_TEST(test_store_journal_recovery) {
+    static const char *files[] = { TEST_STORE_FILE, TEST_STORE_INDEX, TEST_STORE_COLD };
+    char backup[64];
+    store_close();
+    for (int f = 0; f < 3; f++) {
+        unlink(files[f]);
+    }
+    unlink(TEST_STORE_WAL);
+
+    pid_t pid = fork();
+    ck_assert_int_ge(pid, 0);
+    if (pid == 0) {
+        /* Child: checkpoint, keep a copy of the files as they are, then
+           make changes and die without closing the store */
+        if (!store_open(TEST_STORE_FILE)) {
+            _exit(1);
+        }
+        char userid[USER_ID_LENGTH];
+        for (int i = 0; i < 100; i++) {
+            snprintf(userid, sizeof(userid), "wal%d", i);
+            account_t acc = make_record(userid);
+            if (!add_account_to_db(&acc)) {
+                _exit(1);
+            }
+        }
+        if (!store_sync()) {
+            _exit(1);
+        }
+        for (int f = 0; f < 3; f++) {
+            snprintf(backup, sizeof(backup), "%s.bak", files[f]);
+            copy_file(files[f], backup);
+        }
+        account_t acc = make_record("walnew");
+        bool ok = add_account_to_db(&acc);
+        const account_auth_t *rec = store_acquire("wal5");
+        store_record_login_success(rec, 9);
+        store_release(rec);
+        rec = store_acquire("wal6");
+        ok = ok && store_set_unban_time(rec, 12345);
+        store_release(rec);
+        rec = store_acquire("wal7");
+        ok = ok && store_set_expiration_time(rec, 777);
+        store_release(rec);
+        rec = store_acquire("wal8");
+        ok = ok && store_update_password(rec, "N3w!Password");
+        store_release(rec);
+        rec = store_acquire("wal9");
+        ok = ok && store_set_email(rec, "nine@example.com");
+        store_release(rec);
+        /* A rehash keeps the ban; one against a changed hash is refused */
+        rec = store_acquire("wal10");
+        ok = ok && store_set_unban_time(rec, 555);
+        store_release(rec);
+        ok = ok && store_replace_password_hash("wal10", "", "$argon2id$rehashed");
+        ok = ok && !store_replace_password_hash("wal11", "$argon2id$other", "$argon2id$stale");
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+    ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* Lose everything that reached the mapped files after the
+       checkpoint; only the journal has it now */
+    for (int f = 0; f < 3; f++) {
+        snprintf(backup, sizeof(backup), "%s.bak", files[f]);
+        ck_assert_int_eq(rename(backup, files[f]), 0);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        /* The second pass opens the store as the first one's checkpoint left it */
+        ck_assert(store_open(TEST_STORE_FILE));
+        ck_assert_uint_eq(store_count(), 101);
+        account_t result;
+        ck_assert(account_lookup_by_userid("walnew", &result));
+        ck_assert_int_eq(result.account_id, 101);
+        ck_assert(account_lookup_by_userid("wal5", &result));
+        ck_assert_uint_eq(result.login_count, 1);
+        ck_assert_uint_eq(result.last_ip, 9);
+        ck_assert(account_lookup_by_userid("wal6", &result));
+        ck_assert_int_eq(result.unban_time, 12345);
+        ck_assert(account_lookup_by_userid("wal7", &result));
+        ck_assert_int_eq(result.expiration_time, 777);
+        ck_assert(account_lookup_by_userid("wal9", &result));
+        ck_assert_str_eq(result.email, "nine@example.com");
+        ck_assert(account_lookup_by_email("nine@example.com", &result));
+        ck_assert(account_lookup_by_userid("wal10", &result));
+        ck_assert_str_eq(result.password_hash, "$argon2id$rehashed");
+        ck_assert_int_eq(result.unban_time, 555);
+        ck_assert(account_lookup_by_userid("wal11", &result));
+        ck_assert_str_eq(result.password_hash, "");
+        const account_auth_t *rec = store_acquire("wal8");
+        ck_assert(store_validate_password(rec, "N3w!Password"));
+        store_release(rec);
+        store_close();
+    }
+
+    for (int f = 0; f < 3; f++) {
+        unlink(files[f]);
+    }
+    unlink(TEST_STORE_WAL);
+} END_TEST
+
+START_TEST(test_store_open_invalid) {
+    ck_assert(!store_open(NULL));
+
+    /* A file that isn't an account store is rejected */
+    unlink(TEST_STORE_FILE);
+    FILE *fp = fopen(TEST_STORE_FILE, "w");
+    ck_assert_ptr_nonnull(fp);
+    fputs("not an account store", fp);
+    fclose(fp);
+    ck_assert(!store_open(TEST_STORE_FILE));
+    unlink(TEST_STORE_FILE);
+    unlink(TEST_STORE_INDEX);
+    unlink(TEST_STORE_COLD);
+    unlink(TEST_STORE_WAL);
 } END_TEST
 
 TCase* make_db_tests(void) {
     TCase *tc = tcase_create("Database Tests");
-    
+
     tcase_add_test(tc, test_account_lookup_found);
     tcase_add_test(tc, test_account_lookup_not_found);
     tcase_add_test(tc, test_account_lookup_invalid);
-    
+    tcase_add_test(tc, test_add_account_duplicate);
+    tcase_add_test(tc, test_store_growth);
+    tcase_add_test(tc, test_store_acquire_release);
+    tcase_add_test(tc, test_store_acquire_batch);
+    tcase_add_test(tc, test_store_snapshot);
+    tcase_add_test(tc, test_lookup_by_id);
+    tcase_add_test(tc, test_lookup_by_email);
+    tcase_add_test(tc, test_store_record_login);
+    tcase_add_test(tc, test_store_concurrent_readers);
+    tcase_add_test(tc, test_store_persistent_reopen);
+    tcase_add_test(tc, test_store_sharded);
+    tcase_add_test(tc, test_store_journal_recovery);
+    tcase_add_test(tc, test_store_open_invalid);
+
     return tc;
-} 
\ No newline at end of file
+}
@@ -0,0 +1,94 @@
+#include "test_hasharena.h"
+#include "../src/hasharena.h"
+#include "../src/hashprofile.h"
+#include "../src/account_internal.h"
+#include <argon2.h>
+#include <check.h>
+#include <string.h>
+
+#define ARENA_PASSWORD "Ar3na!Password"
+
+START_TEST(test_hash_arena_slabs) {
+    hash_arena_release();
+    hash_arena_stats_t before, after;
+    hash_arena_stats(&before);
+
+    ck_assert(hash_arena_reserve(2, 1 << 20));
+    hash_arena_stats(&after);
+    ck_assert_uint_eq(after.free, before.free + 2);
+
+    /* Reserved slabs are reused, and come back when freed */
+    uint8_t *a, *b;
+    ck_assert_int_eq(hash_arena_alloc(&a, 1 << 20), 0);
+    ck_assert_int_eq(hash_arena_alloc(&b, 1000), 0);
+    ck_assert_ptr_ne(a, b);
+    memset(a, 0xaa, 1 << 20);
+    hash_arena_stats(&after);
+    ck_assert_uint_eq(after.reused, before.reused + 2);
+    ck_assert_uint_eq(after.free, before.free);
+    hash_arena_free(a, 1 << 20);
+    hash_arena_free(b, 1000);
+
+    /* Nothing big enough: a new slab is mapped */
+    ck_assert_int_eq(hash_arena_alloc(&a, 3 << 20), 0);
+    hash_arena_stats(&after);
+    ck_assert_uint_eq(after.mapped, before.mapped + 1);
+    hash_arena_free(a, 3 << 20);
+
+    /* Disabled, it is just malloc */
+    hash_arena_configure(false, false);
+    ck_assert(!hash_arena_enabled());
+    ck_assert_int_eq(hash_arena_alloc(&a, 1 << 20), 0);
+    hash_arena_free(a, 1 << 20);
+    hash_arena_configure(true, false);
+    hash_arena_stats(&after);
+    ck_assert_uint_eq(after.fallback, before.fallback + 1);
+
+    hash_arena_release();
+    hash_arena_stats(&after);
+    ck_assert_uint_eq(after.slabs, 0);
+} END_TEST
+
+START_TEST(test_hash_arena_hashes) {
+    hash_profile_t original = hash_profile_get();
+    hash_profile_t small = { .t_cost = 2, .m_cost = 1024, .parallelism = 2 };
+    ck_assert(hash_profile_set(&small));
+
+    /* Hashes made through the arena read back with plain libargon2... */
+    char hash[HASH_LENGTH];
+    ck_assert(account_hash_password(ARENA_PASSWORD, hash));
+    ck_assert_ptr_nonnull(strstr(hash, "$argon2id$v=19$m=1024,t=2,p=2$"));
+    ck_assert_int_eq(argon2id_verify(hash, ARENA_PASSWORD, strlen(ARENA_PASSWORD)), ARGON2_OK);
+    ck_assert(account_verify_hash(hash, ARENA_PASSWORD));
+    ck_assert(!account_verify_hash(hash, "Wr0ng!Password"));
+
+    /* ...and the other way round */
+    char theirs[HASH_LENGTH];
+    ck_assert_int_eq(argon2id_hash_encoded(1, 512, 1, ARENA_PASSWORD, strlen(ARENA_PASSWORD),
+                                           "sixteen byte slt", 16, 24, theirs, sizeof(theirs)),
+                     ARGON2_OK);
+    ck_assert(account_verify_hash(theirs, ARENA_PASSWORD));
+    ck_assert(!account_verify_hash(theirs, "Wr0ng!Password"));
+
+    /* Damaged hashes never verify */
+    char broken[HASH_LENGTH];
+    strcpy(broken, theirs);
+    broken[strlen(broken) - 1] = '!';
+    ck_assert(!account_verify_hash(broken, ARENA_PASSWORD));
+    strcpy(broken, theirs);
+    *strrchr(broken, '$') = '\0';
+    ck_assert(!account_verify_hash(broken, ARENA_PASSWORD));
+    ck_assert(!account_verify_hash("$argon2i$v=19$m=512,t=1,p=1$c2FsdHNhbHQ$aGFzaA",
+                                   ARENA_PASSWORD));
+
+    ck_assert(hash_profile_set(&original));
+} END_TEST
+
+TCase* make_hasharena_tests(void) {
+    TCase *tc = tcase_create("Hash Arena Tests");
+
+    tcase_add_test(tc, test_hash_arena_slabs);
+    tcase_add_test(tc, test_hash_arena_hashes);
+
+    return tc;
+}
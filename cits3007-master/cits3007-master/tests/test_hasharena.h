@@ -0,0 +1,8 @@
+#ifndef TEST_HASHARENA_H
+#define TEST_HASHARENA_H
+
+#include <check.h>
+
+TCase* make_hasharena_tests(void);
+
+#endif // TEST_HASHARENA_H
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include "test_hashbudget.h"
+#include "../src/hashbudget.h"
+#include <check.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MIB (1 << 20)
+
+START_TEST(test_hash_budget_deadline) {
+    hash_budget_stats_t before, after;
+    hash_budget_configure(2 * MIB, 20);
+    hash_budget_stats(&before);
+    ck_assert_uint_eq(before.budget, 2 * MIB);
+
+    ck_assert(hash_budget_acquire(MIB));
+    ck_assert(hash_budget_acquire(MIB));
+    hash_budget_stats(&after);
+    ck_assert_uint_eq(after.in_use, before.in_use + 2 * MIB);
+
+    /* Full: gives up at the deadline */
+    ck_assert(!hash_budget_acquire(MIB));
+    hash_budget_stats(&after);
+    ck_assert_uint_eq(after.rejected, before.rejected + 1);
+    ck_assert_uint_eq(after.waiting, 0);
+    ck_assert_uint_ge(after.max_waiting, 1);
+    ck_assert_uint_ge(after.max_wait_ns, 20 * 1000000ULL);
+
+    /* Bigger than the whole budget: admitted only once nothing is held */
+    hash_budget_release(MIB);
+    ck_assert(!hash_budget_acquire(3 * MIB));
+    hash_budget_release(MIB);
+    ck_assert(hash_budget_acquire(3 * MIB));
+    hash_budget_release(3 * MIB);
+
+    hash_budget_stats(&after);
+    ck_assert_uint_eq(after.in_use, before.in_use);
+    ck_assert_uint_eq(after.admitted, before.admitted + 3);
+    hash_budget_configure(0, 0);
+} END_TEST
+
+static void *release_later(void *arg) {
+    (void)arg;
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 20 * 1000000L };
+    nanosleep(&pause, NULL);
+    hash_budget_release(MIB);
+    return NULL;
+}
+
+START_TEST(test_hash_budget_waits) {
+    hash_budget_configure(MIB, 5000);
+    hash_budget_stats_t before, after;
+    hash_budget_stats(&before);
+
+    /* A waiter is let in as soon as memory is released */
+    ck_assert(hash_budget_acquire(MIB));
+    pthread_t releaser;
+    pthread_create(&releaser, NULL, release_later, NULL);
+    ck_assert(hash_budget_acquire(MIB));
+    pthread_join(releaser, NULL);
+    hash_budget_release(MIB);
+
+    hash_budget_stats(&after);
+    ck_assert_uint_eq(after.delayed, before.delayed + 1);
+    ck_assert_uint_eq(after.rejected, before.rejected);
+    ck_assert_uint_gt(after.wait_ns, before.wait_ns);
+    ck_assert_uint_lt(after.max_wait_ns, 5000 * 1000000ULL);
+    hash_budget_configure(0, 0);
+} END_TEST
+
+TCase* make_hashbudget_tests(void) {
+    TCase *tc = tcase_create("Hash Budget Tests");
+
+    tcase_add_test(tc, test_hash_budget_deadline);
+    tcase_add_test(tc, test_hash_budget_waits);
+
+    return tc;
+}
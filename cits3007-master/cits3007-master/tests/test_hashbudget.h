@@ -0,0 +1,8 @@
+#ifndef TEST_HASHBUDGET_H
+#define TEST_HASHBUDGET_H
+
+#include <check.h>
+
+TCase* make_hashbudget_tests(void);
+
+#endif // TEST_HASHBUDGET_H
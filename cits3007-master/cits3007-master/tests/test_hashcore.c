@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include "test_hashcore.h"
+#include "../src/hashcore.h"
+#include "../src/hasharena.h"
+#include <argon2.h>
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* RFC 9106, section 5.3: the Argon2id test vector */
+START_TEST(test_hash_core_rfc9106) {
+    static const unsigned char expected[32] = {
+        0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37, 0xa3, 0x4a, 0x8b, 0x53, 0xc9,
+        0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75, 0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59,
+    };
+    unsigned char pwd[32], salt[16], secret[8], ad[12], out[32];
+    memset(pwd, 0x01, sizeof(pwd));
+    memset(salt, 0x02, sizeof(salt));
+    memset(secret, 0x03, sizeof(secret));
+    memset(ad, 0x04, sizeof(ad));
+
+    hash_kernel_t chosen = hash_core_kernel();
+    ck_assert(hash_core_kernel_supported(chosen));
+    for (int k = 0; k < HASH_KERNEL_COUNT; k++) {
+        if (!hash_core_set_kernel((hash_kernel_t)k)) {
+            continue;
+        }
+        argon2_context ctx = {
+            .out = out, .outlen = sizeof(out),
+            .pwd = pwd, .pwdlen = sizeof(pwd), .salt = salt, .saltlen = sizeof(salt),
+            .secret = secret, .secretlen = sizeof(secret), .ad = ad, .adlen = sizeof(ad),
+            .t_cost = 3, .m_cost = 32, .lanes = 4, .threads = 4, .version = ARGON2_VERSION_13,
+        };
+        memset(out, 0, sizeof(out));
+        ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_OK);
+        ck_assert_msg(memcmp(out, expected, sizeof(out)) == 0, "kernel %s", hash_core_kernel_name(k));
+    }
+    ck_assert(hash_core_set_kernel(chosen));
+} END_TEST
+
+#define RANDOM_CASES 60
+
+/* Random byte string of 0 to max bytes (at least min) at buf */
+static uint32_t random_bytes(unsigned *seed, unsigned char *buf, uint32_t min, uint32_t max) {
+    uint32_t len = min + (uint32_t)rand_r(seed) % (max - min + 1);
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (unsigned char)rand_r(seed);
+    }
+    return len;
+}
+
+/*
+ * Every kernel agrees with the first one this build supports (upstream's
+ * reference code, with the bundled Argon2) over randomly drawn
+ * parameters: time and memory cost, lanes, version, output length
+ * (either side of the 64 bytes a single BLAKE2b gives), and the lengths
+ * of password, salt, secret and associated data. A few draws are out of
+ * range, and then all must refuse them with the same error. The seed is
+ * fixed, so a failure can be reproduced. With the system libargon2
+ * there is only the one kernel, and this checks nothing.
+ */
+START_TEST(test_hash_core_kernels_agree) {
+    unsigned char pwd[64], salt[64], secret[32], ad[32], mine[160], theirs[160];
+    hash_kernel_t chosen = hash_core_kernel();
+    hash_kernel_t first = HASH_KERNEL_LIBRARY;
+    while (!hash_core_kernel_supported(first)) {
+        first++;
+    }
+    unsigned seed = 9106;
+    for (int i = 0; i < RANDOM_CASES; i++) {
+        uint32_t lanes = 1 + (uint32_t)rand_r(&seed) % 8;
+        argon2_context base = {
+            .out = theirs, .outlen = 1 + (uint32_t)rand_r(&seed) % sizeof(theirs),
+            .pwd = pwd, .pwdlen = random_bytes(&seed, pwd, 0, sizeof(pwd)),
+            .salt = salt, .saltlen = random_bytes(&seed, salt, 6, sizeof(salt)),
+            .t_cost = 1 + (uint32_t)rand_r(&seed) % 4,
+            .m_cost = 1 + (uint32_t)rand_r(&seed) % 2048,
+            .lanes = lanes, .threads = lanes,
+            .version = rand_r(&seed) % 2 ? ARGON2_VERSION_13 : ARGON2_VERSION_10,
+        };
+        if (rand_r(&seed) % 2) {
+            base.secret = secret;
+            base.secretlen = random_bytes(&seed, secret, 1, sizeof(secret));
+        }
+        if (rand_r(&seed) % 2) {
+            base.ad = ad;
+            base.adlen = random_bytes(&seed, ad, 1, sizeof(ad));
+        }
+        if (rand_r(&seed) % 2) {
+            base.allocate_cbk = hash_arena_alloc;
+            base.free_cbk = hash_arena_free;
+        }
+
+        argon2_context ctx = base;
+        ck_assert(hash_core_set_kernel(first));
+        memset(theirs, 0xff, sizeof(theirs));
+        int expected = hash_core_argon2id(&ctx);
+        for (int k = first + 1; k < HASH_KERNEL_COUNT; k++) {
+            if (!hash_core_set_kernel((hash_kernel_t)k)) {
+                continue;
+            }
+            ctx = base;
+            ctx.out = mine;
+            memset(mine, 0, sizeof(mine));
+            ck_assert_msg(hash_core_argon2id(&ctx) == expected,
+                          "kernel %s, case %d: t=%u m=%u p=%u out=%u salt=%u",
+                          hash_core_kernel_name(k), i, ctx.t_cost, ctx.m_cost, ctx.lanes,
+                          ctx.outlen, ctx.saltlen);
+            if (expected == ARGON2_OK) {
+                ck_assert_msg(memcmp(mine, theirs, ctx.outlen) == 0,
+                              "kernel %s, case %d: t=%u m=%u p=%u out=%u salt=%u",
+                              hash_core_kernel_name(k), i, ctx.t_cost, ctx.m_cost, ctx.lanes,
+                              ctx.outlen, ctx.saltlen);
+            }
+        }
+    }
+    ck_assert(hash_core_set_kernel(chosen));
+} END_TEST
+
+static unsigned runner_calls;
+static unsigned runner_lanes;
+
+/* Fills a slice's lanes last to first, which no lane may depend on */
+static void run_lanes_backwards(hash_lane_fn fn, void *arg, uint32_t count) {
+    runner_calls++;
+    while (count > 0) {
+        fn(arg, --count);
+        runner_lanes++;
+    }
+}
+
+/* The bundled Argon2 fills every slice's lanes through the lane runner */
+START_TEST(test_hash_core_lane_runner) {
+    const char *password = "Core!Password1";
+    unsigned char salt[16], mine[32], theirs[32];
+    memset(salt, 0x44, sizeof(salt));
+    argon2_context ctx = {
+        .out = theirs, .outlen = sizeof(theirs),
+        .pwd = (uint8_t *)password, .pwdlen = (uint32_t)strlen(password),
+        .salt = salt, .saltlen = sizeof(salt),
+        .t_cost = 3, .m_cost = 256, .lanes = 4, .threads = 4, .version = ARGON2_VERSION_13,
+    };
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_OK);
+
+    runner_calls = runner_lanes = 0;
+    hash_core_set_lane_runner(run_lanes_backwards);
+    ctx.out = mine;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_OK);
+    hash_core_set_lane_runner(NULL);
+    ck_assert(memcmp(mine, theirs, sizeof(mine)) == 0);
+    if (hash_core_bundled()) {
+        ck_assert_uint_eq(runner_calls, 3 * ARGON2_SYNC_POINTS);
+        ck_assert_uint_eq(runner_lanes, 3 * ARGON2_SYNC_POINTS * 4);
+    } else {
+        ck_assert_uint_eq(runner_calls, 0);
+    }
+
+    /* One lane, or one thread, needs no runner */
+    runner_calls = 0;
+    hash_core_set_lane_runner(run_lanes_backwards);
+    ctx.threads = 1;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_OK);
+    hash_core_set_lane_runner(NULL);
+    ck_assert(memcmp(mine, theirs, sizeof(mine)) == 0);
+    ck_assert_uint_eq(runner_calls, 0);
+} END_TEST
+
+START_TEST(test_hash_core_verify) {
+    const char *password = "Core!Password1";
+    unsigned char salt[16], tag[32], out[32];
+    memset(salt, 0x33, sizeof(salt));
+    argon2_context ctx = {
+        .out = tag, .outlen = sizeof(tag),
+        .pwd = (uint8_t *)password, .pwdlen = (uint32_t)strlen(password),
+        .salt = salt, .saltlen = sizeof(salt),
+        .t_cost = 2, .m_cost = 64, .lanes = 1, .threads = 1, .version = ARGON2_VERSION_13,
+    };
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_OK);
+
+    ctx.out = out;
+    ck_assert_int_eq(hash_core_argon2id_verify(&ctx, (const char *)tag), ARGON2_OK);
+    tag[31] ^= 1;
+    ck_assert_int_eq(hash_core_argon2id_verify(&ctx, (const char *)tag), ARGON2_VERIFY_MISMATCH);
+
+    /* Bad parameters are refused */
+    ctx.m_cost = 7;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_MEMORY_TOO_LITTLE);
+    ctx.m_cost = 64;
+    ctx.saltlen = 4;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_SALT_TOO_SHORT);
+    ctx.saltlen = sizeof(salt);
+    ctx.t_cost = 0;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_TIME_TOO_SMALL);
+    ctx.t_cost = 2;
+    ctx.lanes = 0;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_LANES_TOO_FEW);
+    ctx.lanes = 1;
+    ctx.out = NULL;
+    ck_assert_int_eq(hash_core_argon2id(&ctx), ARGON2_OUTPUT_PTR_NULL);
+} END_TEST
+
+TCase* make_hashcore_tests(void) {
+    TCase *tc = tcase_create("Hash Core Tests");
+    tcase_set_timeout(tc, 30);
+
+    tcase_add_test(tc, test_hash_core_rfc9106);
+    tcase_add_test(tc, test_hash_core_kernels_agree);
+    tcase_add_test(tc, test_hash_core_lane_runner);
+    tcase_add_test(tc, test_hash_core_verify);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_HASHCORE_H
+#define TEST_HASHCORE_H
+
+#include <check.h>
+
+TCase* make_hashcore_tests(void);
+
+#endif // TEST_HASHCORE_H
@@ -0,0 +1,129 @@
+#include "test_hashpool.h"
+#include "../src/hashpool.h"
+#include "../src/hashcore.h"
+#include "../src/hashprofile.h"
+#include "../src/account_internal.h"
+#include <check.h>
+#include <string.h>
+
+#define POOL_PASSWORD "P00l!Password"
+
+START_TEST(test_hashpool_hash_and_verify) {
+    hash_future_t hashed;
+    hash_future_init(&hashed);
+    ck_assert(hashpool_submit_hash(POOL_PASSWORD, hash_future_done, &hashed));
+    const hash_result_t *r = hash_future_wait(&hashed);
+    ck_assert_int_eq(r->kind, HASH_JOB_HASH);
+    ck_assert(r->ok);
+    ck_assert_ptr_nonnull(strstr(r->hash, "$argon2id$"));
+
+    hash_future_t good, bad;
+    hash_future_init(&good);
+    hash_future_init(&bad);
+    ck_assert(hashpool_submit_verify(r->hash, POOL_PASSWORD, hash_future_done, &good));
+    ck_assert(hashpool_submit_verify(r->hash, "Wr0ng!Password", hash_future_done, &bad));
+    ck_assert(hash_future_wait(&good)->ok);
+    ck_assert(!hash_future_wait(&bad)->ok);
+    ck_assert_int_eq(hash_future_wait(&bad)->kind, HASH_JOB_VERIFY);
+    hash_future_destroy(&hashed);
+    hash_future_destroy(&good);
+    hash_future_destroy(&bad);
+
+    ck_assert(!hashpool_submit_hash(NULL, hash_future_done, &good));
+    ck_assert(!hashpool_submit_verify("x", POOL_PASSWORD, NULL, NULL));
+} END_TEST
+
+START_TEST(test_hashpool_backpressure) {
+    hashpool_stop();
+    ck_assert(hashpool_start(1, 1));
+    ck_assert(!hashpool_start(1, 1));  /* already running */
+
+    /* One worker and room for one more job: of a quick burst, at most
+       two are accepted and the rest are turned away */
+    enum { BURST = 6 };
+    hash_future_t futures[BURST];
+    bool accepted[BURST];
+    int count = 0;
+    for (int i = 0; i < BURST; i++) {
+        hash_future_init(&futures[i]);
+        accepted[i] = hashpool_submit_hash(POOL_PASSWORD, hash_future_done, &futures[i]);
+        count += accepted[i];
+    }
+    ck_assert_int_ge(count, 1);
+    ck_assert_int_le(count, 2);
+    hashpool_stats_t stats;
+    hashpool_stats(&stats);
+    ck_assert_uint_eq(stats.workers, 1);
+    ck_assert_uint_eq(stats.capacity, 1);
+    ck_assert_uint_eq(stats.rejected, (uint64_t)(BURST - count));
+
+    /* Stopping finishes what was accepted */
+    hashpool_stop();
+    for (int i = 0; i < BURST; i++) {
+        if (accepted[i]) {
+            ck_assert(hash_future_wait(&futures[i])->ok);
+        }
+        hash_future_destroy(&futures[i]);
+    }
+    hashpool_stats(&stats);
+    ck_assert_uint_eq(stats.workers, 0);
+} END_TEST
+
+START_TEST(test_hashpool_lanes) {
+    hashpool_stop();
+    ck_assert(hashpool_start(4, 0));
+    hashpool_stats_t stats;
+    char hash[HASH_LENGTH];
+
+    if (!hash_core_bundled()) {
+        /* libargon2 runs lanes on threads of its own, so workers stay free */
+        ck_assert_uint_eq(hashpool_claim_lanes(3), 0);
+        hash_profile_set_max_lanes(4);
+        ck_assert(account_hash_password(POOL_PASSWORD, hash));
+        ck_assert_ptr_nonnull(strstr(hash, ",p=1$"));
+        hashpool_stats(&stats);
+        ck_assert_uint_eq(stats.lanes_claimed, 0);
+        hash_profile_set_max_lanes(0);
+        hashpool_stop();
+        return;
+    }
+
+    /* Extra lanes come from idle workers, and run out */
+    ck_assert_uint_eq(hashpool_claim_lanes(3), 3);
+    ck_assert_uint_eq(hashpool_claim_lanes(3), 1);
+    ck_assert_uint_eq(hashpool_claim_lanes(1), 0);
+    hashpool_stats(&stats);
+    ck_assert_uint_eq(stats.lanes_claimed, 4);
+
+    /* With every worker claimed, new hashes keep to the profile's one lane */
+    hash_profile_set_max_lanes(4);
+    ck_assert(account_hash_password(POOL_PASSWORD, hash));
+    ck_assert_ptr_nonnull(strstr(hash, ",p=1$"));
+    hashpool_release_lanes(4);
+
+    /* Idle, they spread over the workers, and still count as current;
+       verifying runs the stored four lanes on the pool too */
+    hashpool_stats(&stats);
+    uint64_t helped = stats.lanes_helped;
+    ck_assert(account_hash_password(POOL_PASSWORD, hash));
+    ck_assert_ptr_nonnull(strstr(hash, ",p=4$"));
+    ck_assert(account_verify_hash(hash, POOL_PASSWORD));
+    hashpool_stats(&stats);
+    ck_assert_uint_gt(stats.lanes_helped, helped);
+    ck_assert_uint_eq(stats.lanes_claimed, 0);
+    ck_assert(!account_hash_outdated(hash));
+    hash_profile_set_max_lanes(0);
+    ck_assert(account_hash_outdated(hash));
+
+    hashpool_stop();
+} END_TEST
+
+TCase* make_hashpool_tests(void) {
+    TCase *tc = tcase_create("Hash Pool Tests");
+
+    tcase_add_test(tc, test_hashpool_hash_and_verify);
+    tcase_add_test(tc, test_hashpool_backpressure);
+    tcase_add_test(tc, test_hashpool_lanes);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_HASHPOOL_H
+#define TEST_HASHPOOL_H
+
+#include <check.h>
+
+TCase* make_hashpool_tests(void);
+
+#endif // TEST_HASHPOOL_H
@@ -0,0 +1,74 @@
+#include "test_hashprofile.h"
+#include "../src/hashprofile.h"
+#include "../src/account_internal.h"
+#include <check.h>
+#include <string.h>
+
+START_TEST(test_hash_profile_parse) {
+    hash_profile_t p;
+    ck_assert(hash_profile_parse("m=65536,t=3,p=1", &p));
+    ck_assert_uint_eq(p.m_cost, 65536);
+    ck_assert_uint_eq(p.t_cost, 3);
+    ck_assert_uint_eq(p.parallelism, 1);
+
+    /* Any order, and stops at the end of the list as in an encoded hash */
+    ck_assert(hash_profile_parse("t=2,p=4,m=1024$c2FsdA", &p));
+    ck_assert_uint_eq(p.m_cost, 1024);
+    ck_assert_uint_eq(p.t_cost, 2);
+    ck_assert_uint_eq(p.parallelism, 4);
+
+    char text[64];
+    ck_assert(hash_profile_format(&p, text, sizeof(text)));
+    ck_assert_str_eq(text, "m=1024,t=2,p=4");
+    ck_assert(!hash_profile_format(&p, text, 5));
+
+    const char *bad[] = { "", "m=1024,t=2", "m=1024,t=2,p=0", "m=1024,t=2,p=1,m=8",
+                          "x=1,t=2,p=1", "m=,t=2,p=1", "m=-1,t=2,p=1",
+                          "m=99999999999,t=2,p=1" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        ck_assert_msg(!hash_profile_parse(bad[i], &p), "accepted \"%s\"", bad[i]);
+    }
+    ck_assert(!hash_profile_parse(NULL, &p));
+} END_TEST
+
+START_TEST(test_hash_profile_set) {
+    hash_profile_t original = hash_profile_get();
+    ck_assert_uint_eq(original.m_cost, ACCOUNT_HASH_M_COST);
+
+    hash_profile_t weak = { .t_cost = 1, .m_cost = 8, .parallelism = 2 };
+    ck_assert(!hash_profile_set(&weak));  /* under 8 KiB per lane */
+    weak.parallelism = 1;
+    ck_assert(hash_profile_set(&weak));
+
+    /* New hashes carry the profile; they still verify afterwards */
+    char hash[HASH_LENGTH];
+    ck_assert(account_hash_password("Pr0file!Password", hash));
+    ck_assert_ptr_nonnull(strstr(hash, "$m=8,t=1,p=1$"));
+    ck_assert(hash_profile_set(&original));
+    ck_assert(account_verify_hash(hash, "Pr0file!Password"));
+} END_TEST
+
+START_TEST(test_hash_profile_calibrate) {
+    hash_calibration_t goal = { .target_p99_ms = 10000, .max_m_cost = 1024, .samples = 2 };
+    hash_profile_t chosen;
+    double p99 = -1;
+    ck_assert(hash_profile_calibrate(&goal, &chosen, &p99));
+    ck_assert_uint_eq(chosen.m_cost, 1024);
+    ck_assert_uint_ge(chosen.t_cost, 1);
+    ck_assert_uint_eq(chosen.parallelism, 1);
+    ck_assert(p99 >= 0 && p99 <= goal.target_p99_ms);
+    ck_assert_uint_eq(hash_profile_get().m_cost, ACCOUNT_HASH_M_COST);  /* unchanged */
+
+    goal.target_p99_ms = 1e-6;
+    ck_assert(!hash_profile_calibrate(&goal, &chosen, NULL));
+} END_TEST
+
+TCase* make_hashprofile_tests(void) {
+    TCase *tc = tcase_create("Hash Profile Tests");
+
+    tcase_add_test(tc, test_hash_profile_parse);
+    tcase_add_test(tc, test_hash_profile_set);
+    tcase_add_test(tc, test_hash_profile_calibrate);
+
+    return tc;
+}
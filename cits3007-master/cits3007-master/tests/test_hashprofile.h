@@ -0,0 +1,8 @@
+#ifndef TEST_HASHPROFILE_H
+#define TEST_HASHPROFILE_H
+
+#include <check.h>
+
+TCase* make_hashprofile_tests(void);
+
+#endif // TEST_HASHPROFILE_H
@@ -0,0 +1,79 @@
+#include "test_import.h"
+#include "../src/import.h"
+#include "../src/account.h"
+#include "../src/db.h"
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IMPORT_FILE "test_import.tsv"
+
+START_TEST(test_import_batch) {
+    import_entry_t entries[] = {
+        { "imp1", "Str0ng!Pass", "imp1@example.com", "1990-01-01" },
+        { "imp2", "Str0ng!Pass", "imp2@example.com", "1990-01-02" },
+        { "imp1", "Str0ng!Pass", "again@example.com", "1990-01-03" },  /* duplicate in batch */
+        { "imp3", "weak", "imp3@example.com", "1990-01-04" },           /* weak password */
+        { "imp4", "Str0ng!Pass", "imp4@example.com", "1990-02-30" },    /* bad birthdate */
+        { "imp5", NULL, "imp5@example.com", "1990-01-05" },             /* missing field */
+    };
+    import_stats_t stats;
+    ck_assert(account_import(entries, sizeof(entries) / sizeof(entries[0]), 2, &stats));
+    ck_assert_uint_eq(stats.entries, 6);
+    ck_assert_uint_eq(stats.imported, 2);
+    ck_assert_uint_eq(stats.duplicates, 1);
+    ck_assert_uint_eq(stats.invalid, 3);
+    ck_assert_uint_eq(stats.failed, 0);
+
+    account_t acc;
+    ck_assert(account_lookup_by_userid("imp1", &acc));
+    ck_assert_str_eq(acc.email, "imp1@example.com");
+    ck_assert(account_validate_password(&acc, "Str0ng!Pass"));
+    ck_assert(account_lookup_by_userid("imp2", &acc));
+    ck_assert(!account_lookup_by_userid("imp3", &acc));
+
+    /* Userids already in the store are duplicates too */
+    ck_assert(account_import(entries, 1, 0, &stats));
+    ck_assert_uint_eq(stats.imported, 0);
+    ck_assert_uint_eq(stats.duplicates, 1);
+
+    ck_assert(account_import(NULL, 0, 0, &stats));
+    ck_assert_uint_eq(stats.entries, 0);
+} END_TEST
+
+START_TEST(test_import_file) {
+    FILE *fp = fopen(IMPORT_FILE, "w");
+    ck_assert_ptr_nonnull(fp);
+    fputs("# userid\tpassword\temail\tbirthdate\n", fp);
+    fputs("file1\tStr0ng!Pass\tfile1@example.com\t1985-05-05\r\n", fp);
+    fputs("\n", fp);
+    fputs("file2\tStr0ng!Pass\tfile2@example.com\n", fp);   /* three fields */
+    fputs("file3\tStr0ng!Pass\tfile3@example.com\t1985-05-06", fp);  /* no trailing newline */
+    fclose(fp);
+
+    import_stats_t stats;
+    ck_assert(account_import_file(IMPORT_FILE, 1, &stats));
+    ck_assert_uint_eq(stats.entries, 3);
+    ck_assert_uint_eq(stats.imported, 2);
+    ck_assert_uint_eq(stats.invalid, 1);
+
+    account_t acc;
+    ck_assert(account_lookup_by_userid("file1", &acc));
+    ck_assert_str_eq(acc.email, "file1@example.com");
+    ck_assert(account_lookup_by_userid("file3", &acc));
+    ck_assert(!account_lookup_by_userid("file2", &acc));
+
+    remove(IMPORT_FILE);
+    ck_assert(!account_import_file(IMPORT_FILE, 1, &stats));
+    ck_assert(!account_import_file(NULL, 1, &stats));
+} END_TEST
+
+TCase* make_import_tests(void) {
+    TCase *tc = tcase_create("Import Tests");
+
+    tcase_add_test(tc, test_import_batch);
+    tcase_add_test(tc, test_import_file);
+
+    return tc;
+}
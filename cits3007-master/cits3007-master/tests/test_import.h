@@ -0,0 +1,8 @@
+#ifndef TEST_IMPORT_H
+#define TEST_IMPORT_H
+
+#include <check.h>
+
+TCase* make_import_tests(void);
+
+#endif // TEST_IMPORT_H
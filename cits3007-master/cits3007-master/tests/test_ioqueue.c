@@ -0,0 +1,146 @@
+#include "test_ioqueue.h"
+#include "../src/ioqueue.h"
+#include "../src/login.h"
+#include "../src/db.h"
+#include "../src/ratelimit.h"
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IOQUEUE_PASSWORD "Queu3d!Pass"
+#define BIG_WRITE (IOQUEUE_BATCH_BYTES + 100)
+
+/* Read everything from a pipe whose write end is closed. */
+static size_t read_all(int fd, char *buf, size_t size) {
+    size_t len = 0;
+    ssize_t n;
+    while (len < size - 1 && (n = read(fd, buf + len, size - 1 - len)) > 0) {
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+START_TEST(test_ioqueue_order) {
+    bool uring = ioqueue_enable(true);
+    ck_assert(ioqueue_enabled() == uring);
+    ioqueue_stats_t before, after;
+    ioqueue_stats(&before);
+
+    int a[2], b[2];
+    ck_assert_int_eq(pipe(a), 0);
+    ck_assert_int_eq(pipe(b), 0);
+    char *expect_a = malloc(BIG_WRITE + 4096);
+    char *expect_b = malloc(4096);
+    char *big = malloc(BIG_WRITE);
+    ck_assert_ptr_nonnull(expect_a);
+    ck_assert_ptr_nonnull(expect_b);
+    ck_assert_ptr_nonnull(big);
+    memset(big, 'x', BIG_WRITE);
+    size_t len_a = 0, len_b = 0;
+
+    /* More writes than one submission holds, interleaved over two pipes,
+     * with one too big to queue in the middle */
+    for (int i = 0; i < 3 * IOQUEUE_DEPTH; i++) {
+        char line[16];
+        int n = snprintf(line, sizeof(line), "%c%03d\n", i % 3 ? 'a' : 'b', i);
+        int fd = i % 3 ? a[1] : b[1];
+        ioqueue_write(fd, line, (size_t)n);
+        if (i % 3) {
+            memcpy(expect_a + len_a, line, (size_t)n);
+            len_a += (size_t)n;
+        } else {
+            memcpy(expect_b + len_b, line, (size_t)n);
+            len_b += (size_t)n;
+        }
+        if (i == IOQUEUE_DEPTH + 1) {
+            ioqueue_write(a[1], big, BIG_WRITE);
+            memcpy(expect_a + len_a, big, BIG_WRITE);
+            len_a += BIG_WRITE;
+        }
+        if (i % 50 == 0) {
+            ioqueue_submit();
+        }
+    }
+    ioqueue_drain();
+    close(a[1]);
+    close(b[1]);
+
+    char *got = malloc(BIG_WRITE + 8192);
+    ck_assert_ptr_nonnull(got);
+    ck_assert_uint_eq(read_all(a[0], got, BIG_WRITE + 8192), len_a);
+    ck_assert(memcmp(got, expect_a, len_a) == 0);
+    ck_assert_uint_eq(read_all(b[0], got, BIG_WRITE + 8192), len_b);
+    ck_assert(memcmp(got, expect_b, len_b) == 0);
+
+    ioqueue_stats(&after);
+    ck_assert_uint_eq(after.failed, before.failed);
+    if (uring) {
+        ck_assert_uint_eq(after.queued - before.queued, 3 * IOQUEUE_DEPTH);
+        ck_assert_uint_lt(after.submits - before.submits, IOQUEUE_DEPTH);
+    } else {
+        ck_assert_uint_eq(after.queued, before.queued);
+    }
+
+    ck_assert(!ioqueue_enable(false));
+    ck_assert(!ioqueue_enabled());
+    close(a[0]);
+    close(b[0]);
+    free(expect_a);
+    free(expect_b);
+    free(big);
+    free(got);
+} END_TEST
+
+START_TEST(test_ioqueue_login) {
+    account_t *acc = account_create("ioqueued", IOQUEUE_PASSWORD, "queue@example.com", "1990-01-01");
+    ck_assert_ptr_nonnull(acc);
+    account_free(acc);
+    bool uring = ioqueue_enable(true);
+
+    int client[2], log[2];
+    ck_assert_int_eq(pipe(client), 0);
+    ck_assert_int_eq(pipe(log), 0);
+    ioqueue_stats_t before, after;
+    ioqueue_stats(&before);
+    login_session_data_t session;
+    ck_assert_int_eq(handle_login("ioqueued", IOQUEUE_PASSWORD, 0x0A000201, time(NULL),
+                                  client[1], log[1], &session), LOGIN_SUCCESS);
+    ck_assert_int_eq(handle_login("ioqueued", "WrongP@ss1", 0x0A000201, time(NULL),
+                                  client[1], log[1], &session), LOGIN_FAIL_BAD_PASSWORD);
+    /* Replies and log lines are all written before handle_login()
+       returns, since the caller may close its descriptors at once: with
+       io_uring, by one io_uring_enter() per login */
+    ioqueue_stats(&after);
+    if (uring) {
+        ck_assert_uint_eq(after.direct - before.direct, 0);
+        ck_assert_uint_eq(after.submits - before.submits, 2);
+    }
+    close(client[1]);
+    close(log[1]);
+    ioqueue_enable(false);
+
+    char text[1024];
+    read_all(client[0], text, sizeof(text));
+    const char *token = "Login successful!\nSession token: ";
+    ck_assert(strncmp(text, token, strlen(token)) == 0);
+    const char *rest = strchr(text + strlen(token), '\n');
+    ck_assert_ptr_nonnull(rest);
+    ck_assert_str_eq(rest + 1, "Login failed: incorrect password.\n");
+    read_all(log[0], text, sizeof(text));
+    ck_assert_str_eq(text, "INFO: user 'ioqueued' logged in successfully\n");
+    close(client[0]);
+    close(log[0]);
+} END_TEST
+
+TCase* make_ioqueue_tests(void) {
+    TCase *tc = tcase_create("IOQueue Tests");
+
+    tcase_add_test(tc, test_ioqueue_order);
+    tcase_add_test(tc, test_ioqueue_login);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_IOQUEUE_H
+#define TEST_IOQUEUE_H
+
+#include <check.h>
+
+TCase* make_ioqueue_tests(void);
+
+#endif // TEST_IOQUEUE_H
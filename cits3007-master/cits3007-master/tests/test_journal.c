@@ -0,0 +1,191 @@
+#include "test_journal.h"
+#include "../src/journal.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_JOURNAL_FILE "test_journal.wal"
+
+typedef struct {
+    int count;
+    int last;
+    size_t bytes;
+} replay_log_t;
+
+/* Records replayed must come back in order: the payload is an int. */
+static bool collect(uint16_t type, const void *payload, size_t len, void *ctx) {
+    replay_log_t *log = ctx;
+    int value;
+    if (type != 7 || len != sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, payload, sizeof(value));
+    if (value != log->last + 1) {
+        return false;
+    }
+    log->last = value;
+    log->count++;
+    log->bytes += len;
+    return true;
+}
+
+static bool sync_ok(void *ctx) {
+    (void)ctx;
+    return true;
+}
+
+static void append_range(journal_t *j, int from, int to) {
+    uint64_t pos = 0;
+    for (int i = from; i <= to; i++) {
+        pos = journal_append(j, 7, &i, sizeof(i));
+        ck_assert_uint_gt(pos, 0);
+    }
+    ck_assert(journal_wait(j, pos));
+}
+
+START_TEST(test_journal_replay) {
+    unlink(TEST_JOURNAL_FILE);
+    replay_log_t log = { 0, 0, 0 };
+    size_t replayed = 99;
+    journal_t *j = journal_open(TEST_JOURNAL_FILE, collect, &log, &replayed);
+    ck_assert_ptr_nonnull(j);
+    ck_assert_uint_eq(replayed, 0);
+    append_range(j, 1, 500);
+    journal_close(j);
+
+    log = (replay_log_t){ 0, 0, 0 };
+    j = journal_open(TEST_JOURNAL_FILE, collect, &log, &replayed);
+    ck_assert_ptr_nonnull(j);
+    ck_assert_uint_eq(replayed, 500);
+    ck_assert_int_eq(log.last, 500);
+    /* appends carry on after the replayed records */
+    append_range(j, 501, 510);
+    journal_close(j);
+
+    /* A torn final record is dropped, and so is anything after it */
+    FILE *fp = fopen(TEST_JOURNAL_FILE, "ab");
+    ck_assert_ptr_nonnull(fp);
+    fputs("\x04\x00\x00\x00\x07\x00", fp);
+    fclose(fp);
+    log = (replay_log_t){ 0, 0, 0 };
+    j = journal_open(TEST_JOURNAL_FILE, collect, &log, &replayed);
+    ck_assert_ptr_nonnull(j);
+    ck_assert_uint_eq(replayed, 510);
+    append_range(j, 511, 511);
+    journal_close(j);
+    log = (replay_log_t){ 0, 0, 0 };
+    j = journal_open(TEST_JOURNAL_FILE, collect, &log, &replayed);
+    ck_assert_uint_eq(replayed, 511);
+    journal_close(j);
+    unlink(TEST_JOURNAL_FILE);
+} END_TEST
+
+START_TEST(test_journal_checkpoint) {
+    unlink(TEST_JOURNAL_FILE);
+    replay_log_t log = { 0, 0, 0 };
+    journal_t *j = journal_open(TEST_JOURNAL_FILE, collect, &log, NULL);
+    ck_assert_ptr_nonnull(j);
+    append_range(j, 1, 100);
+    ck_assert_uint_gt(journal_size(j), 100 * sizeof(int));
+    ck_assert(journal_checkpoint(j, sync_ok, NULL));
+    ck_assert_uint_eq(journal_size(j), 0);
+    journal_close(j);
+
+    /* The checkpointed records are gone; those after it remain */
+    log = (replay_log_t){ 0, 100, 0 };
+    size_t replayed;
+    j = journal_open(TEST_JOURNAL_FILE, collect, &log, &replayed);
+    ck_assert_uint_eq(replayed, 0);
+    append_range(j, 101, 150);
+    journal_close(j);
+    log = (replay_log_t){ 0, 100, 0 };
+    j = journal_open(TEST_JOURNAL_FILE, collect, &log, &replayed);
+    ck_assert_uint_eq(replayed, 50);
+    journal_close(j);
+    unlink(TEST_JOURNAL_FILE);
+} END_TEST
+
+#define GROUP_THREADS 8
+#define GROUP_RECORDS 200
+
+static journal_t *group_journal;
+
+/* Returns NULL, or arg (the writer's index) if an append failed */
+static void *group_writer(void *arg) {
+    int value = 0;
+    for (int i = 0; i < GROUP_RECORDS; i++) {
+        uint64_t pos = journal_append(group_journal, 8, &value, sizeof(value));
+        if (pos == 0 || !journal_wait(group_journal, pos)) {
+            return arg;
+        }
+    }
+    return NULL;
+}
+
+static bool count_only(uint16_t type, const void *payload, size_t len, void *ctx) {
+    (void)payload;
+    (void)len;
+    *(size_t *)ctx += type == 8;
+    return true;
+}
+
+START_TEST(test_journal_group_commit) {
+    unlink(TEST_JOURNAL_FILE);
+    size_t seen = 0;
+    group_journal = journal_open(TEST_JOURNAL_FILE, count_only, &seen, NULL);
+    ck_assert_ptr_nonnull(group_journal);
+    pthread_t tids[GROUP_THREADS];
+    int ids[GROUP_THREADS];
+    for (int t = 0; t < GROUP_THREADS; t++) {
+        ids[t] = t;
+        ck_assert_int_eq(pthread_create(&tids[t], NULL, group_writer, &ids[t]), 0);
+    }
+    for (int t = 0; t < GROUP_THREADS; t++) {
+        void *failed;
+        pthread_join(tids[t], &failed);
+        ck_assert_ptr_null(failed);
+    }
+    uint64_t records, syncs;
+    journal_stats(group_journal, &records, &syncs);
+    ck_assert_uint_eq(records, GROUP_THREADS * GROUP_RECORDS);
+    ck_assert_uint_le(syncs, records);
+    journal_close(group_journal);
+
+    size_t replayed;
+    group_journal = journal_open(TEST_JOURNAL_FILE, count_only, &seen, &replayed);
+    ck_assert_uint_eq(replayed, GROUP_THREADS * GROUP_RECORDS);
+    journal_close(group_journal);
+    unlink(TEST_JOURNAL_FILE);
+} END_TEST
+
+START_TEST(test_journal_invalid) {
+    ck_assert_ptr_null(journal_open(NULL, collect, NULL, NULL));
+    unlink(TEST_JOURNAL_FILE);
+    FILE *fp = fopen(TEST_JOURNAL_FILE, "w");
+    ck_assert_ptr_nonnull(fp);
+    fputs("not a journal at all", fp);
+    fclose(fp);
+    ck_assert_ptr_null(journal_open(TEST_JOURNAL_FILE, collect, NULL, NULL));
+    unlink(TEST_JOURNAL_FILE);
+
+    replay_log_t log = { 0, 0, 0 };
+    journal_t *j = journal_open(TEST_JOURNAL_FILE, collect, &log, NULL);
+    static char big[JOURNAL_MAX_PAYLOAD + 1];
+    ck_assert_uint_eq(journal_append(j, 7, big, sizeof(big)), 0);
+    ck_assert(!journal_wait(j, 0));
+    journal_close(j);
+    unlink(TEST_JOURNAL_FILE);
+} END_TEST
+
+TCase* make_journal_tests(void) {
+    TCase *tc = tcase_create("Journal Tests");
+
+    tcase_add_test(tc, test_journal_replay);
+    tcase_add_test(tc, test_journal_checkpoint);
+    tcase_add_test(tc, test_journal_group_commit);
+    tcase_add_test(tc, test_journal_invalid);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_JOURNAL_H
+#define TEST_JOURNAL_H
+
+#include <check.h>
+
+TCase* make_journal_tests(void);
+
+#endif // TEST_JOURNAL_H
@@ -1,30 +1,434 @@
 #include "test_login.h"
 #include "../src/login.h"
+#include "../src/login_async.h"
+#include "../src/login_batch.h"
+#include "../src/db.h"
+#include "../src/hashbudget.h"
+#include "../src/hashpool.h"
+#include "../src/hashprofile.h"
+#include "../src/ratelimit.h"
+#include "../src/rehash.h"
+#include "../src/session.h"
 #include <check.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOGIN_PASSWORD "TestP@ss123"
+
+/* Create a stored account that can be logged in to */
+static void create_login_account(const char *userid) {
+    account_t *acc = account_create(userid, LOGIN_PASSWORD, "login@example.com", "1990-01-01");
+    if (acc == NULL) {
+        ck_abort_msg("Failed to create test account");
+    }
+    account_free(acc);
+}
+
+/* Store an account directly, with the given ban and expiry times */
+static void store_account_with_times(const char *userid, time_t unban, time_t expiry) {
+    account_t acc;
+    memset(&acc, 0, sizeof(acc));
+    strncpy(acc.userid, userid, USER_ID_LENGTH - 1);
+    acc.unban_time = unban;
+    acc.expiration_time = expiry;
+    ck_assert(add_account_to_db(&acc));
+}
 
 START_TEST(test_handle_login_success) {
-    // Test cases will go here
+    create_login_account("loginok");
+    int devnull = open("/dev/null", O_WRONLY);
+    ip4_addr_t ip = 0x0A000001;  /* 10.0.0.1 */
+    time_t now = time(NULL);
+
+    login_session_data_t session;
+    ck_assert_int_eq(handle_login("loginok", LOGIN_PASSWORD, ip, now, devnull, devnull, &session),
+                     LOGIN_SUCCESS);
+    ck_assert_int_eq(session.session_start, now);
+
+    /* The login is recorded in the store itself */
+    account_t stored;
+    ck_assert(account_lookup_by_userid("loginok", &stored));
+    ck_assert_uint_eq(stored.login_count, 1);
+    ck_assert_uint_eq(stored.login_fail_count, 0);
+    ck_assert_uint_eq(stored.last_ip, ip);
+    ck_assert_int_ge(stored.last_login_time, now);
+
+    ck_assert_int_eq(handle_login("loginok", LOGIN_PASSWORD, ip, now, devnull, devnull, &session),
+                     LOGIN_SUCCESS);
+    ck_assert(account_lookup_by_userid("loginok", &stored));
+    ck_assert_uint_eq(stored.login_count, 2);
+
+    ck_assert_int_eq(handle_login(NULL, LOGIN_PASSWORD, ip, now, devnull, devnull, &session),
+                     LOGIN_FAIL_INTERNAL_ERROR);
+    ck_assert_int_eq(handle_login("loginok", LOGIN_PASSWORD, ip, now, devnull, devnull, NULL),
+                     LOGIN_FAIL_INTERNAL_ERROR);
+    close(devnull);
 } END_TEST
 
 START_TEST(test_handle_login_failure) {
-    // Test cases will go here
+    create_login_account("loginbad");
+    int devnull = open("/dev/null", O_WRONLY);
+    time_t now = time(NULL);
+    login_session_data_t session;
+
+    ck_assert_int_eq(handle_login("nosuchuser", LOGIN_PASSWORD, 0, now, devnull, devnull, &session),
+                     LOGIN_FAIL_USER_NOT_FOUND);
+
+    ck_assert_int_eq(handle_login("loginbad", "WrongP@ss123", 0, now, devnull, devnull, &session),
+                     LOGIN_FAIL_BAD_PASSWORD);
+    account_t stored;
+    ck_assert(account_lookup_by_userid("loginbad", &stored));
+    ck_assert_uint_eq(stored.login_fail_count, 1);
+
+    /* Failures persist, so repeated guessing ends in rate limiting:
+       even the right password is refused */
+    for (int i = 0; i < 5; i++) {
+        handle_login("loginbad", "WrongP@ss123", 0, now, devnull, devnull, &session);
+    }
+    ck_assert(account_lookup_by_userid("loginbad", &stored));
+    ck_assert_uint_eq(stored.login_fail_count, 6);
+    ck_assert_int_eq(handle_login("loginbad", LOGIN_PASSWORD, 0, now, devnull, devnull, &session),
+                     LOGIN_FAIL_BAD_PASSWORD);
+    close(devnull);
 } END_TEST
 
 START_TEST(test_handle_login_banned) {
-    // Test cases will go here
+    time_t now = time(NULL);
+    store_account_with_times("loginbanned", now + 3600, 0);
+    int devnull = open("/dev/null", O_WRONLY);
+    login_session_data_t session;
+
+    ck_assert_int_eq(handle_login("loginbanned", LOGIN_PASSWORD, 0, now, devnull, devnull, &session),
+                     LOGIN_FAIL_ACCOUNT_BANNED);
+    /* The ban is judged as of the caller's login_time, not the clock
+       (the account has no password, so it gets no further) */
+    ck_assert_int_eq(handle_login("loginbanned", LOGIN_PASSWORD, 0, now + 3600, devnull, devnull,
+                                  &session), LOGIN_FAIL_BAD_PASSWORD);
+    close(devnull);
 } END_TEST
 
 START_TEST(test_handle_login_expired) {
-    // Test cases will go here
+    time_t now = time(NULL);
+    store_account_with_times("loginexpired", 0, now - 3600);
+    int devnull = open("/dev/null", O_WRONLY);
+    login_session_data_t session;
+
+    ck_assert_int_eq(handle_login("loginexpired", LOGIN_PASSWORD, 0, now, devnull, devnull, &session),
+                     LOGIN_FAIL_ACCOUNT_EXPIRED);
+    /* As is expiry */
+    ck_assert_int_eq(handle_login("loginexpired", LOGIN_PASSWORD, 0, now - 7200, devnull, devnull,
+                                  &session), LOGIN_FAIL_BAD_PASSWORD);
+    close(devnull);
+} END_TEST
+
+/* Completion state for handle_login_async() */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int calls;
+    login_result_t result;
+    login_session_data_t session;
+    pthread_t thread;
+} async_login_t;
+
+static void async_done(login_result_t result, const login_session_data_t *session, void *arg) {
+    async_login_t *a = arg;
+    pthread_mutex_lock(&a->lock);
+    a->calls++;
+    a->result = result;
+    a->thread = pthread_self();
+    if (session) {
+        a->session = *session;
+    }
+    pthread_cond_signal(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+static login_result_t async_wait(async_login_t *a) {
+    pthread_mutex_lock(&a->lock);
+    while (a->calls == 0) {
+        pthread_cond_wait(&a->cond, &a->lock);
+    }
+    pthread_mutex_unlock(&a->lock);
+    ck_assert_int_eq(a->calls, 1);
+    return a->result;
+}
+
+static void async_init(async_login_t *a) {
+    memset(a, 0, sizeof(*a));
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+}
+
+START_TEST(test_handle_login_async) {
+    create_login_account("loginasync");
+    store_account_with_times("asyncbanned", time(NULL) + 3600, 0);
+    int devnull = open("/dev/null", O_WRONLY);
+    time_t now = time(NULL);
+    async_login_t a;
+
+    /* Cheap rejections complete on the calling thread */
+    async_init(&a);
+    handle_login_async("nosuchuser", LOGIN_PASSWORD, 0, now, devnull, devnull, async_done, &a);
+    ck_assert_int_eq(a.calls, 1);
+    ck_assert_int_eq(a.result, LOGIN_FAIL_USER_NOT_FOUND);
+    ck_assert(pthread_equal(a.thread, pthread_self()));
+    async_init(&a);
+    handle_login_async("asyncbanned", LOGIN_PASSWORD, 0, now, devnull, devnull, async_done, &a);
+    ck_assert_int_eq(a.calls, 1);
+    ck_assert_int_eq(a.result, LOGIN_FAIL_ACCOUNT_BANNED);
+
+    /* Password checks complete on a pool worker */
+    async_init(&a);
+    handle_login_async("loginasync", LOGIN_PASSWORD, 0x0A000002, now, devnull, devnull,
+                       async_done, &a);
+    ck_assert_int_eq(async_wait(&a), LOGIN_SUCCESS);
+    ck_assert(!pthread_equal(a.thread, pthread_self()));
+    ck_assert_int_eq(a.session.session_start, now);
+    account_t stored;
+    ck_assert(account_lookup_by_userid("loginasync", &stored));
+    ck_assert_int_eq(a.session.account_id, stored.account_id);
+    ck_assert_uint_eq(stored.login_count, 1);
+    ck_assert_uint_eq(stored.last_ip, 0x0A000002);
+
+    async_init(&a);
+    handle_login_async("loginasync", "WrongP@ss123", 0, now, devnull, devnull, async_done, &a);
+    ck_assert_int_eq(async_wait(&a), LOGIN_FAIL_BAD_PASSWORD);
+    ck_assert(account_lookup_by_userid("loginasync", &stored));
+    ck_assert_uint_eq(stored.login_fail_count, 1);
+    close(devnull);
+} END_TEST
+
+START_TEST(test_handle_login_overloaded) {
+    create_login_account("loginbusy");
+    int devnull = open("/dev/null", O_WRONLY);
+    time_t now = time(NULL);
+
+    /* With the hash memory budget all taken, logins are turned away
+       without counting as failures */
+    hash_budget_configure(1 << 20, 20);
+    ck_assert(hash_budget_acquire(1 << 20));
+    login_session_data_t session;
+    ck_assert_int_eq(handle_login("loginbusy", LOGIN_PASSWORD, 0, now, devnull, devnull, &session),
+                     LOGIN_FAIL_INTERNAL_ERROR);
+    async_login_t a;
+    async_init(&a);
+    handle_login_async("loginbusy", LOGIN_PASSWORD, 0, now, devnull, devnull, async_done, &a);
+    ck_assert_int_eq(async_wait(&a), LOGIN_FAIL_INTERNAL_ERROR);
+    account_t stored;
+    ck_assert(account_lookup_by_userid("loginbusy", &stored));
+    ck_assert_uint_eq(stored.login_fail_count, 0);
+    hash_budget_stats_t stats;
+    hash_budget_stats(&stats);
+    ck_assert_uint_ge(stats.rejected, 2);
+
+    hash_budget_release(1 << 20);
+    ck_assert_int_eq(handle_login("loginbusy", LOGIN_PASSWORD, 0, now, devnull, devnull, &session),
+                     LOGIN_SUCCESS);
+    hash_budget_configure(0, 0);
+    close(devnull);
+} END_TEST
+
+START_TEST(test_handle_login_ip_banned) {
+    create_login_account("loginflood");
+    int devnull = open("/dev/null", O_WRONLY);
+    time_t now = time(NULL);
+    login_session_data_t session;
+    ratelimit_config_t limits = { .ip_limit = 3, .subnet_limit = 10, .window_seconds = 60 };
+    ratelimit_configure(&limits);
+    ratelimit_reset();
+
+    /* After three guesses the address is turned away before anything is
+       looked up, so even the right password isn't checked or counted */
+    ip4_addr_t ip = 0x0A0000FE;
+    for (int i = 0; i < 3; i++) {
+        ck_assert_int_eq(handle_login("loginflood", "WrongP@ss123", ip, now, devnull, devnull, &session),
+                         LOGIN_FAIL_BAD_PASSWORD);
+    }
+    ck_assert_int_eq(handle_login("loginflood", LOGIN_PASSWORD, ip, now, devnull, devnull, &session),
+                     LOGIN_FAIL_IP_BANNED);
+    async_login_t a;
+    async_init(&a);
+    handle_login_async("loginflood", LOGIN_PASSWORD, ip, now, devnull, devnull, async_done, &a);
+    ck_assert_int_eq(async_wait(&a), LOGIN_FAIL_IP_BANNED);
+    account_t stored;
+    ck_assert(account_lookup_by_userid("loginflood", &stored));
+    ck_assert_uint_eq(stored.login_fail_count, 3);
+
+    /* Other addresses are unaffected */
+    ck_assert_int_eq(handle_login("loginflood", LOGIN_PASSWORD, 0x0B000001, now, devnull, devnull, &session),
+                     LOGIN_SUCCESS);
+
+    limits = (ratelimit_config_t){ RATELIMIT_DEFAULT_IP_LIMIT, RATELIMIT_DEFAULT_SUBNET_LIMIT,
+                                   RATELIMIT_DEFAULT_WINDOW };
+    ratelimit_configure(&limits);
+    ratelimit_reset();
+    close(devnull);
+} END_TEST
+
+START_TEST(test_handle_login_batch) {
+    create_login_account("batchone");
+    create_login_account("batchtwo");
+    store_account_with_times("batchbanned", time(NULL) + 3600, 0);
+    int devnull = open("/dev/null", O_WRONLY);
+    int first[2], second[2];
+    ck_assert_int_eq(pipe(first), 0);
+    ck_assert_int_eq(pipe(second), 0);
+    ip4_addr_t ip = 0x0A000101;
+    time_t now = time(NULL);
+
+    login_request_t requests[] = {
+        { "batchone", LOGIN_PASSWORD, ip, now, first[1] },
+        { "batchtwo", "WrongP@ss123", ip, now, first[1] },
+        { "batchnobody", LOGIN_PASSWORD, ip, now, first[1] },
+        { "batchtwo", LOGIN_PASSWORD, ip, now + 5, second[1] },
+        { "batchbanned", LOGIN_PASSWORD, ip, now, first[1] },
+        { "batchone", NULL, ip, now, first[1] },
+    };
+    login_outcome_t outcomes[6];
+    ck_assert_uint_eq(handle_login_batch(requests, outcomes, 6, devnull), 2);
+    ck_assert_int_eq(outcomes[0].result, LOGIN_SUCCESS);
+    ck_assert_int_eq(outcomes[1].result, LOGIN_FAIL_BAD_PASSWORD);
+    ck_assert_int_eq(outcomes[2].result, LOGIN_FAIL_USER_NOT_FOUND);
+    ck_assert_int_eq(outcomes[3].result, LOGIN_SUCCESS);
+    ck_assert_int_eq(outcomes[4].result, LOGIN_FAIL_ACCOUNT_BANNED);
+    ck_assert_int_eq(outcomes[5].result, LOGIN_FAIL_INTERNAL_ERROR);
+    /* Each login is as of its own login_time */
+    ck_assert_int_eq(outcomes[0].session.session_start, now);
+    ck_assert_int_eq(outcomes[3].session.session_start, now + 5);
+
+    account_t one, two;
+    ck_assert(account_lookup_by_userid("batchone", &one));
+    ck_assert(account_lookup_by_userid("batchtwo", &two));
+    ck_assert_int_eq(outcomes[0].session.account_id, one.account_id);
+    ck_assert_int_eq(outcomes[3].session.account_id, two.account_id);
+    ck_assert_uint_eq(one.login_count, 1);
+    ck_assert_uint_eq(two.login_count, 1);
+    ck_assert_uint_eq(two.login_fail_count, 0);
+
+    /* Each descriptor gets its logins' replies together, in batch order */
+    close(first[1]);
+    close(second[1]);
+    char text[1024];
+    ssize_t n = read(first[0], text, sizeof(text) - 1);
+    ck_assert_int_gt(n, 0);
+    text[n] = '\0';
+    const char *token = "Login successful!\nSession token: ";
+    ck_assert(strncmp(text, token, strlen(token)) == 0);
+    const char *rest = strchr(text + strlen(token), '\n');
+    ck_assert_ptr_nonnull(rest);
+    ck_assert_str_eq(rest + 1, "Login failed: incorrect password.\n"
+                               "Login failed: user not found.\n"
+                               "Login failed: account banned.\n"
+                               "Login failed: internal error.\n");
+    n = read(second[0], text, sizeof(text) - 1);
+    ck_assert_int_gt(n, 0);
+    text[n] = '\0';
+    ck_assert(strncmp(text, token, strlen(token)) == 0);
+    close(first[0]);
+    close(second[0]);
+    close(devnull);
+} END_TEST
+
+START_TEST(test_login_rehash) {
+    create_login_account("loginrehash");
+    int devnull = open("/dev/null", O_WRONLY);
+    time_t now = time(NULL);
+    hash_profile_t original = hash_profile_get();
+    hash_profile_t cheaper = { .t_cost = 1, .m_cost = 1024, .parallelism = 1 };
+    rehash_stats_t before, after;
+    rehash_stats(&before);
+    account_t stored;
+
+    /* After the profile changes, a login moves the hash to it... */
+    ck_assert(hash_profile_set(&cheaper));
+    login_session_data_t session;
+    ck_assert_int_eq(handle_login("loginrehash", LOGIN_PASSWORD, 0, now, devnull, devnull,
+                                  &session), LOGIN_SUCCESS);
+    hashpool_stop();  /* finishes the rehash */
+    ck_assert(account_lookup_by_userid("loginrehash", &stored));
+    ck_assert_ptr_nonnull(strstr(stored.password_hash, "$m=1024,t=1,p=1$"));
+    ck_assert_uint_eq(stored.login_count, 1);
+
+    /* ...which goes on working, and needs no further rehash */
+    ck_assert_int_eq(handle_login("loginrehash", LOGIN_PASSWORD, 0, now, devnull, devnull,
+                                  &session), LOGIN_SUCCESS);
+    ck_assert_int_eq(handle_login("loginrehash", "WrongP@ss123", 0, now, devnull, devnull,
+                                  &session), LOGIN_FAIL_BAD_PASSWORD);
+    hashpool_stop();
+    rehash_stats(&after);
+    ck_assert_uint_eq(after.queued, before.queued + 1);
+    ck_assert_uint_eq(after.upgraded, before.upgraded + 1);
+
+    /* The asynchronous path does the same */
+    ck_assert(hash_profile_set(&original));
+    async_login_t a;
+    async_init(&a);
+    handle_login_async("loginrehash", LOGIN_PASSWORD, 0, now, devnull, devnull, async_done, &a);
+    ck_assert_int_eq(async_wait(&a), LOGIN_SUCCESS);
+    hashpool_stop();
+    ck_assert(account_lookup_by_userid("loginrehash", &stored));
+    ck_assert_ptr_nonnull(strstr(stored.password_hash, "$m=65536,t=3,p=1$"));
+    rehash_stats(&after);
+    ck_assert_uint_eq(after.upgraded, before.upgraded + 2);
+    close(devnull);
+} END_TEST
+
+START_TEST(test_login_replies) {
+    create_login_account("loginreply");
+    time_t now = time(NULL);
+    store_account_with_times("loginreplyold", 0, now - 3600);
+    int client[2], log[2];
+    ck_assert_int_eq(pipe(client), 0);
+    ck_assert_int_eq(pipe(log), 0);
+    login_session_data_t session;
+    char text[512];
+
+    /* A success's reply and session token line come in one write */
+    ck_assert_int_eq(handle_login("loginreply", LOGIN_PASSWORD, 0x0A000301, now, client[1], log[1],
+                                  &session), LOGIN_SUCCESS);
+    ssize_t n = read(client[0], text, sizeof(text) - 1);
+    ck_assert_int_eq(n, strlen("Login successful!\nSession token: \n") + SESSION_TOKEN_TEXT_LENGTH - 1);
+    text[n] = '\0';
+    ck_assert(strncmp(text, "Login successful!\nSession token: ", 33) == 0);
+    ck_assert_int_eq(text[n - 1], '\n');
+    n = read(log[0], text, sizeof(text) - 1);
+    ck_assert_int_gt(n, 0);
+    text[n] = '\0';
+    ck_assert_str_eq(text, "INFO: user 'loginreply' logged in successfully\n");
+
+    /* Each failure gets its own message */
+    ck_assert_int_eq(handle_login("loginreplyold", LOGIN_PASSWORD, 0x0A000301, now, client[1], log[1],
+                                  &session), LOGIN_FAIL_ACCOUNT_EXPIRED);
+    ck_assert_int_eq(handle_login("loginreply", NULL, 0x0A000301, now, client[1], log[1],
+                                  &session), LOGIN_FAIL_INTERNAL_ERROR);
+    close(client[1]);
+    close(log[1]);
+    n = read(client[0], text, sizeof(text) - 1);
+    ck_assert_int_gt(n, 0);
+    text[n] = '\0';
+    ck_assert_str_eq(text, "Login failed: account expired.\nLogin failed: internal error.\n");
+    ck_assert_int_eq(read(log[0], text, sizeof(text)), 0);   /* warnings go to log_message() */
+    close(client[0]);
+    close(log[0]);
 } END_TEST
 
 TCase* make_login_tests(void) {
     TCase *tc = tcase_create("Login Tests");
-    
+
     tcase_add_test(tc, test_handle_login_success);
     tcase_add_test(tc, test_handle_login_failure);
     tcase_add_test(tc, test_handle_login_banned);
     tcase_add_test(tc, test_handle_login_expired);
-    
+    tcase_add_test(tc, test_handle_login_async);
+    tcase_add_test(tc, test_handle_login_overloaded);
+    tcase_add_test(tc, test_handle_login_ip_banned);
+    tcase_add_test(tc, test_handle_login_batch);
+    tcase_add_test(tc, test_login_rehash);
+    tcase_add_test(tc, test_login_replies);
+
     return tc;
-} 
\ No newline at end of file
+}
@@ -0,0 +1,141 @@
+#include "test_ratelimit.h"
+#include "../src/ratelimit.h"
+#include <check.h>
+#include <pthread.h>
+
+#define BASE_TIME 1699999980   /* the start of a 60-second window */
+
+static void set_limits(uint32_t ip, uint32_t subnet, uint32_t window) {
+    ratelimit_config_t config = { .ip_limit = ip, .subnet_limit = subnet, .window_seconds = window };
+    ratelimit_configure(&config);
+    ratelimit_reset();
+}
+
+static void restore_limits(void) {
+    set_limits(RATELIMIT_DEFAULT_IP_LIMIT, RATELIMIT_DEFAULT_SUBNET_LIMIT, RATELIMIT_DEFAULT_WINDOW);
+}
+
+START_TEST(test_ratelimit_limits) {
+    set_limits(3, 5, 60);
+    time_t now = BASE_TIME;
+    ip4_addr_t ip = 0xC0A80101;   /* 192.168.1.1 */
+
+    for (int i = 0; i < 3; i++) {
+        ck_assert_int_eq(ratelimit_admit(ip, now), RATELIMIT_ADMIT);
+    }
+    ck_assert_int_eq(ratelimit_admit(ip, now), RATELIMIT_SHED_IP);
+
+    /* Neighbours share the /24's limit: 3 counted so far, so two more */
+    ck_assert_int_eq(ratelimit_admit(ip + 1, now), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip + 2, now), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip + 3, now), RATELIMIT_SHED_SUBNET);
+    ck_assert_int_eq(ratelimit_admit(0xC0A80201, now), RATELIMIT_ADMIT);
+
+    ratelimit_stats_t stats;
+    ratelimit_stats(&stats);
+    ck_assert_uint_eq(stats.shed_ip, 1);
+    ck_assert_uint_eq(stats.shed_subnet, 1);
+
+    /* Being turned away by the /24 doesn't use up an address's own
+       attempts */
+    set_limits(2, 2, 60);
+    ck_assert_int_eq(ratelimit_admit(ip, now), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip, now), RATELIMIT_ADMIT);
+    for (int i = 0; i < 3; i++) {
+        ck_assert_int_eq(ratelimit_admit(ip + 1, now), RATELIMIT_SHED_SUBNET);
+    }
+    ratelimit_config_t wider = { .ip_limit = 2, .subnet_limit = 10, .window_seconds = 60 };
+    ratelimit_configure(&wider);
+    ck_assert_int_eq(ratelimit_admit(ip + 1, now), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip + 1, now), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip + 1, now), RATELIMIT_SHED_IP);
+
+    /* 0 turns a limit off; limits are capped */
+    ratelimit_config_t config = { .ip_limit = 0, .subnet_limit = 5000, .window_seconds = 0 };
+    ratelimit_configure(&config);
+    config = ratelimit_config();
+    ck_assert_uint_eq(config.subnet_limit, RATELIMIT_MAX_LIMIT);
+    ck_assert_uint_eq(config.window_seconds, RATELIMIT_DEFAULT_WINDOW);
+    for (int i = 0; i < 10; i++) {
+        ck_assert_int_eq(ratelimit_admit(0x0A000001, now), RATELIMIT_ADMIT);
+    }
+    restore_limits();
+} END_TEST
+
+START_TEST(test_ratelimit_window) {
+    set_limits(4, 0, 60);
+    time_t now = BASE_TIME;
+    ip4_addr_t ip = 0x0B000001;
+    for (int i = 0; i < 4; i++) {
+        ck_assert_int_eq(ratelimit_admit(ip, now), RATELIMIT_ADMIT);
+    }
+    ck_assert_int_eq(ratelimit_admit(ip, now + 59), RATELIMIT_SHED_IP);
+
+    /* Halfway through the next window, half the old attempts still count */
+    ck_assert_int_eq(ratelimit_admit(ip, now + 90), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip, now + 90), RATELIMIT_ADMIT);
+    ck_assert_int_eq(ratelimit_admit(ip, now + 90), RATELIMIT_SHED_IP);
+
+    /* Two windows on, everything is forgotten */
+    for (int i = 0; i < 4; i++) {
+        ck_assert_int_eq(ratelimit_admit(ip, now + 180), RATELIMIT_ADMIT);
+    }
+    restore_limits();
+} END_TEST
+
+START_TEST(test_ratelimit_many_addresses) {
+    /* Far more addresses than entries: memory stays fixed, the busiest
+       addresses are still limited */
+    set_limits(5, 0, 60);
+    time_t now = BASE_TIME;
+    for (uint32_t i = 0; i < 4 * RATELIMIT_SLOTS; i++) {
+        ratelimit_admit(0x20000000 + i * 7919, now);
+    }
+    ratelimit_stats_t stats;
+    ratelimit_stats(&stats);
+    ck_assert_uint_gt(stats.evicted, 0);
+    ip4_addr_t busy = 0x0C000001;
+    for (int i = 0; i < 5; i++) {
+        ck_assert_int_eq(ratelimit_admit(busy, now), RATELIMIT_ADMIT);
+    }
+    ck_assert_int_eq(ratelimit_admit(busy, now), RATELIMIT_SHED_IP);
+    restore_limits();
+} END_TEST
+
+enum { HAMMER_THREADS = 4, HAMMER_TRIES = 2000 };
+
+static void *hammer(void *arg) {
+    int *admitted = arg;
+    for (int i = 0; i < HAMMER_TRIES; i++) {
+        *admitted += ratelimit_admit(0x0D000001, BASE_TIME) == RATELIMIT_ADMIT;
+    }
+    return NULL;
+}
+
+START_TEST(test_ratelimit_concurrent) {
+    /* However the updates interleave, exactly the limit gets through */
+    set_limits(500, 0, 60);
+    pthread_t threads[HAMMER_THREADS];
+    int admitted[HAMMER_THREADS] = { 0 };
+    for (int i = 0; i < HAMMER_THREADS; i++) {
+        ck_assert_int_eq(pthread_create(&threads[i], NULL, hammer, &admitted[i]), 0);
+    }
+    int total = 0;
+    for (int i = 0; i < HAMMER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += admitted[i];
+    }
+    ck_assert_int_eq(total, 500);
+    restore_limits();
+} END_TEST
+
+TCase* make_ratelimit_tests(void) {
+    TCase *tc = tcase_create("Rate Limit Tests");
+
+    tcase_add_test(tc, test_ratelimit_limits);
+    tcase_add_test(tc, test_ratelimit_window);
+    tcase_add_test(tc, test_ratelimit_many_addresses);
+    tcase_add_test(tc, test_ratelimit_concurrent);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_RATELIMIT_H
+#define TEST_RATELIMIT_H
+
+#include <check.h>
+
+TCase* make_ratelimit_tests(void);
+
+#endif // TEST_RATELIMIT_H
@@ -3,6 +3,20 @@
 #include "test_account.h"
 #include "test_login.h"
 #include "test_db.h"
+#include "test_import.h"
+#include "test_journal.h"
+#include "test_hashpool.h"
+#include "test_hashprofile.h"
+#include "test_hasharena.h"
+#include "test_hashbudget.h"
+#include "test_session.h"
+#include "test_csprng.h"
+#include "test_hashcore.h"
+#include "test_ratelimit.h"
+#include "test_server.h"
+#include "test_ioqueue.h"
+#include "test_timerwheel.h"
+#include "test_wallclock.h"
 
 int main(void) {
     int number_failed;
@@ -12,6 +26,20 @@ int main(void) {
     suite_add_tcase(s, make_account_tests());
     suite_add_tcase(s, make_login_tests());
     suite_add_tcase(s, make_db_tests());
+    suite_add_tcase(s, make_import_tests());
+    suite_add_tcase(s, make_journal_tests());
+    suite_add_tcase(s, make_hashpool_tests());
+    suite_add_tcase(s, make_hashprofile_tests());
+    suite_add_tcase(s, make_hasharena_tests());
+    suite_add_tcase(s, make_hashbudget_tests());
+    suite_add_tcase(s, make_session_tests());
+    suite_add_tcase(s, make_csprng_tests());
+    suite_add_tcase(s, make_hashcore_tests());
+    suite_add_tcase(s, make_ratelimit_tests());
+    suite_add_tcase(s, make_server_tests());
+    suite_add_tcase(s, make_ioqueue_tests());
+    suite_add_tcase(s, make_timerwheel_tests());
+    suite_add_tcase(s, make_wallclock_tests());
     
     SRunner *sr = srunner_create(s);
     srunner_run_all(sr, CK_NORMAL);
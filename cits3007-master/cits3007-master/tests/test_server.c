@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include "test_server.h"
+#include "../src/server.h"
+#include "../src/db.h"
+#include "../src/ratelimit.h"
+#include <arpa/inet.h>
+#include <check.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_PASSWORD "Serv3r!Pass"
+#define TEST_SOCKET "test_server.sock"
+
+static int devnull = -1;
+
+static void start_server(bool unix_unlimited) {
+    ratelimit_config_t unlimited = { 0, 0, 0 };
+    ratelimit_configure(&unlimited);
+    devnull = open("/dev/null", O_WRONLY);
+    server_config_t config = {
+        .tcp_address = "127.0.0.1",
+        .tcp_port = 0,
+        .unix_path = TEST_SOCKET,
+        .unix_unlimited = unix_unlimited,
+        .loops = 2,
+        .log_fd = devnull,
+    };
+    ck_assert(server_start(&config));
+    ck_assert(!server_start(&config));
+    ck_assert_uint_gt(server_tcp_port(), 0);
+}
+
+static void stop_server(void) {
+    server_stop();
+    close(devnull);
+    ratelimit_config_t limits = { RATELIMIT_DEFAULT_IP_LIMIT, RATELIMIT_DEFAULT_SUBNET_LIMIT,
+                                  RATELIMIT_DEFAULT_WINDOW };
+    ratelimit_configure(&limits);
+    ck_assert_int_ne(access(TEST_SOCKET, F_OK), 0);
+}
+
+static int connect_tcp(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(server_tcp_port()) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ck_assert_int_eq(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    return fd;
+}
+
+static int connect_unix(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, TEST_SOCKET);
+    ck_assert_int_eq(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    return fd;
+}
+
+static void send_text(int fd, const char *text) {
+    ck_assert_int_eq(write(fd, text, strlen(text)), (ssize_t)strlen(text));
+}
+
+/* Complete RESULT and ERROR lines in text. */
+static int count_replies(const char *text) {
+    int count = 0;
+    for (const char *line = text; *line; ) {
+        const char *end = strchr(line, '\n');
+        if (!end) {
+            break;
+        }
+        if (strncmp(line, "RESULT ", 7) == 0 || strncmp(line, "ERROR ", 6) == 0) {
+            count++;
+        }
+        line = end + 1;
+    }
+    return count;
+}
+
+/* Read until `replies` RESULT or ERROR lines have arrived, or EOF. */
+static void read_replies(int fd, int replies, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    while (count_replies(buf) < replies && len < size - 1) {
+        ssize_t n = read(fd, buf + len, size - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+        buf[len] = '\0';
+    }
+}
+
+START_TEST(test_server_login) {
+    account_t *acc = account_create("serverok", SERVER_PASSWORD, "server@example.com", "1990-01-01");
+    ck_assert_ptr_nonnull(acc);
+    account_free(acc);
+    start_server(false);
+
+    int fd = connect_tcp();
+    char buf[2048];
+    send_text(fd, "LOGIN serverok " SERVER_PASSWORD "\n");
+    read_replies(fd, 1, buf, sizeof(buf));
+    ck_assert_ptr_nonnull(strstr(buf, "Login successful!\nSession token: "));
+    ck_assert_ptr_nonnull(strstr(buf, "RESULT 0\n"));
+
+    /* Pipelined requests are answered in order */
+    send_text(fd, "LOGIN serverok WrongP@ss1\nLOGIN servernobody x\r\nLOGIN serverok "
+                  SERVER_PASSWORD "\n");
+    read_replies(fd, 3, buf, sizeof(buf));
+    char *bad = strstr(buf, "Login failed: incorrect password.\nRESULT 2\n");
+    char *missing = strstr(buf, "Login failed: user not found.\nRESULT 1\n");
+    char *good = strstr(buf, "RESULT 0\n");
+    ck_assert_ptr_nonnull(bad);
+    ck_assert_ptr_nonnull(missing);
+    ck_assert_ptr_nonnull(good);
+    ck_assert(bad < missing && missing < good);
+    close(fd);
+
+    /* Only this user may use the Unix socket, whose clients log in as
+       127.0.0.1 */
+    struct stat st;
+    ck_assert_int_eq(stat(TEST_SOCKET, &st), 0);
+    ck_assert_int_eq(st.st_mode & 0777, 0600);
+    ratelimit_config_t strict = { 1, 1, 60 };
+    ratelimit_configure(&strict);
+    fd = connect_unix();
+    send_text(fd, "LOGIN serverok " SERVER_PASSWORD "\nLOGIN serverok " SERVER_PASSWORD
+                  "\nQUIT\n");
+    read_replies(fd, 2, buf, sizeof(buf));
+    good = strstr(buf, "RESULT 0\n");
+    char *limited = strstr(buf, "RESULT 5\n");
+    ck_assert_ptr_nonnull(good);
+    ck_assert_ptr_nonnull(limited);
+    ck_assert(good < limited);
+    ck_assert_int_eq(read(fd, buf, sizeof(buf)), 0);   // closed after QUIT
+    close(fd);
+    account_t stored;
+    ck_assert(account_lookup_by_userid("serverok", &stored));
+    ck_assert_uint_eq(stored.last_ip, 0x7F000001);
+
+    server_stats_t stats;
+    server_stats(&stats);
+    ck_assert_uint_eq(stats.accepted, 2);
+    ck_assert_uint_eq(stats.logins, 6);
+    stop_server();
+
+    /* Unless told they are a trusted front end: then they have no
+       address, so aren't rate limited */
+    start_server(true);
+    ratelimit_configure(&strict);
+    fd = connect_unix();
+    send_text(fd, "LOGIN serverok " SERVER_PASSWORD "\nLOGIN serverok " SERVER_PASSWORD
+                  "\nLOGIN serverok " SERVER_PASSWORD "\nQUIT\n");
+    read_replies(fd, 3, buf, sizeof(buf));
+    char *result = buf;
+    for (int i = 0; i < 3; i++) {
+        result = strstr(result, "RESULT 0\n");
+        ck_assert_ptr_nonnull(result);
+        result++;
+    }
+    ck_assert_int_eq(read(fd, buf, sizeof(buf)), 0);
+    close(fd);
+    ck_assert(account_lookup_by_userid("serverok", &stored));
+    ck_assert_uint_eq(stored.last_ip, RATELIMIT_NO_ADDRESS);
+    server_stats(&stats);
+    ck_assert_uint_eq(stats.logins, 3);
+    stop_server();
+} END_TEST
+
+START_TEST(test_server_protocol) {
+    start_server(false);
+    int fd = connect_tcp();
+    char buf[2048];
+    send_text(fd, "HELLO\n\nLOGIN onlyuser\n");
+    read_replies(fd, 2, buf, sizeof(buf));
+    ck_assert_str_eq(buf, "ERROR unknown command\nERROR usage: LOGIN <userid> <password>\n");
+
+    /* An over-long line ends the connection */
+    char line[SERVER_MAX_LINE + 2];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    send_text(fd, line);
+    read_replies(fd, 1, buf, sizeof(buf));
+    ck_assert_str_eq(buf, "ERROR line too long\n");
+    ck_assert_int_eq(read(fd, buf, sizeof(buf)), 0);
+    close(fd);
+
+    /* A client that hangs up mid-request is just dropped */
+    fd = connect_unix();
+    send_text(fd, "LOGIN someone");
+    close(fd);
+
+    server_stats_t stats;
+    server_stats(&stats);
+    ck_assert_uint_eq(stats.errors, 3);
+    stop_server();
+    server_stats(&stats);
+    ck_assert_uint_eq(stats.open, 0);
+} END_TEST
+
+TCase* make_server_tests(void) {
+    TCase *tc = tcase_create("Server Tests");
+
+    tcase_add_test(tc, test_server_login);
+    tcase_add_test(tc, test_server_protocol);
+
+    return tc;
+}
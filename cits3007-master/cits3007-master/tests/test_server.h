@@ -0,0 +1,8 @@
+#ifndef TEST_SERVER_H
+#define TEST_SERVER_H
+
+#include <check.h>
+
+TCase* make_server_tests(void);
+
+#endif // TEST_SERVER_H
@@ -0,0 +1,162 @@
+#include "test_session.h"
+#include "../src/session.h"
+#include "../src/store.h"
+#include "../src/db.h"
+#include <check.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SESSION_PASSWORD "Sess10n!Pass"
+
+static login_session_data_t make_session(int account_id, time_t start, time_t expiry) {
+    login_session_data_t s = { .account_id = account_id, .session_start = start,
+                               .expiration_time = expiry };
+    return s;
+}
+
+START_TEST(test_session_issue_validate) {
+    time_t t = time(NULL);
+    login_session_data_t s = make_session(7001, t, 0), out;
+    session_token_t token, other;
+    ck_assert(session_issue(&s, &token));
+    ck_assert(session_issue(&s, &other));
+    ck_assert(memcmp(&token, &other, sizeof(token)) != 0);
+
+    ck_assert(session_validate(&token, t + 1, &out));
+    ck_assert_int_eq(out.account_id, 7001);
+    ck_assert_int_eq(out.session_start, t);
+
+    /* Text form round trip */
+    char text[SESSION_TOKEN_TEXT_LENGTH];
+    session_token_format(&token, text);
+    ck_assert_uint_eq(strlen(text), 2 * SESSION_TOKEN_BYTES);
+    session_token_t parsed;
+    ck_assert(session_token_parse(text, &parsed));
+    ck_assert(session_validate(&parsed, t + 1, NULL));
+    text[5] = 'x';
+    ck_assert(!session_token_parse(text, &parsed));
+    ck_assert(!session_token_parse("abcd", &parsed));
+
+    /* Any change to a token, in or out of its selector, is rejected */
+    parsed = token;
+    parsed.bytes[SESSION_TOKEN_BYTES - 1] ^= 1;
+    ck_assert(!session_validate(&parsed, t + 1, NULL));
+    parsed = token;
+    parsed.bytes[0] ^= 1;
+    ck_assert(!session_validate(&parsed, t + 1, NULL));
+
+    /* Logging out forgets just that token */
+    ck_assert(session_revoke(&token));
+    ck_assert(!session_revoke(&token));
+    ck_assert(!session_validate(&token, t + 1, NULL));
+    ck_assert(session_validate(&other, t + 1, NULL));
+    ck_assert(session_revoke(&other));
+} END_TEST
+
+START_TEST(test_session_expiry) {
+    time_t t = time(NULL);
+    session_configure(60);
+    login_session_data_t s = make_session(7002, t, 0);
+    session_token_t token, capped;
+    ck_assert(session_issue(&s, &token));
+    /* The account expires before the session would */
+    s.expiration_time = t + 30;
+    ck_assert(session_issue(&s, &capped));
+    session_configure(0);
+
+    ck_assert(session_validate(&token, t + 59, NULL));
+    ck_assert(session_validate(&capped, t + 29, NULL));
+    ck_assert(!session_validate(&capped, t + 30, NULL));
+    size_t count = session_count();
+    ck_assert(!session_validate(&token, t + 60, NULL));
+    ck_assert_uint_eq(session_count(), count - 1);
+    ck_assert(!session_validate(&token, t, NULL));  /* forgotten once seen expired */
+} END_TEST
+
+START_TEST(test_session_revoke_account) {
+    time_t t = time(NULL);
+    login_session_data_t a = make_session(7003, t, 0), b = make_session(7004, t, 0);
+    session_token_t a1, a2, b1, a3;
+    ck_assert(session_issue(&a, &a1));
+    ck_assert(session_issue(&a, &a2));
+    ck_assert(session_issue(&b, &b1));
+    session_revoke_account(7003);
+    ck_assert(!session_validate(&a1, t + 1, NULL));
+    ck_assert(!session_validate(&a2, t + 1, NULL));
+    ck_assert(session_validate(&b1, t + 1, NULL));
+    /* Tokens issued afterwards are fine */
+    ck_assert(session_issue(&a, &a3));
+    ck_assert(session_validate(&a3, t + 1, NULL));
+
+    /* Many tokens: the tables grow, and a sweep clears them out */
+    enum { MANY = 5000 };
+    static session_token_t many[MANY];
+    size_t before = session_count();
+    for (int i = 0; i < MANY; i++) {
+        login_session_data_t s = make_session(8000 + i, t, 0);
+        ck_assert(session_issue(&s, &many[i]));
+    }
+    ck_assert_uint_eq(session_count(), before + MANY);
+    for (int i = 0; i < MANY; i++) {
+        ck_assert(session_validate(&many[i], t + 1, NULL));
+    }
+    session_expire(1L << 40);
+    ck_assert_uint_eq(session_count(), 0);
+} END_TEST
+
+START_TEST(test_session_login) {
+    account_t *acc = account_create("sessionuser", SESSION_PASSWORD, "s@example.com", "1990-01-01");
+    ck_assert_ptr_nonnull(acc);
+    account_free(acc);
+
+    /* A successful login sends the client a token */
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    int devnull = open("/dev/null", O_WRONLY);
+    time_t now = time(NULL);
+    login_session_data_t session, out;
+    ck_assert_int_eq(handle_login("sessionuser", SESSION_PASSWORD, 0, now, fds[1], devnull,
+                                  &session), LOGIN_SUCCESS);
+    char output[256] = { 0 };
+    ck_assert_int_gt(read(fds[0], output, sizeof(output) - 1), 0);
+    const char *line = strstr(output, "Session token: ");
+    ck_assert_ptr_nonnull(line);
+    char text[SESSION_TOKEN_TEXT_LENGTH];
+    memcpy(text, line + strlen("Session token: "), SESSION_TOKEN_TEXT_LENGTH - 1);
+    text[SESSION_TOKEN_TEXT_LENGTH - 1] = '\0';
+    session_token_t token;
+    ck_assert(session_token_parse(text, &token));
+    ck_assert(session_validate(&token, now + 1, &out));
+    ck_assert_int_eq(out.account_id, session.account_id);
+
+    /* Changing the password revokes it */
+    const account_auth_t *rec = store_acquire("sessionuser");
+    ck_assert(store_update_password(rec, "N3w!Sess10n"));
+    store_release(rec);
+    ck_assert(!session_validate(&token, now + 1, NULL));
+
+    /* So does a ban */
+    ck_assert_int_eq(handle_login("sessionuser", "N3w!Sess10n", 0, now, devnull, devnull,
+                                  &session), LOGIN_SUCCESS);
+    login_session_data_t again = make_session(session.account_id, now, 0);
+    ck_assert(session_issue(&again, &token));
+    rec = store_acquire("sessionuser");
+    ck_assert(store_set_unban_time(rec, now + 3600));
+    store_release(rec);
+    ck_assert(!session_validate(&token, now + 1, NULL));
+    close(fds[0]);
+    close(fds[1]);
+    close(devnull);
+} END_TEST
+
+TCase* make_session_tests(void) {
+    TCase *tc = tcase_create("Session Tests");
+
+    tcase_add_test(tc, test_session_issue_validate);
+    tcase_add_test(tc, test_session_expiry);
+    tcase_add_test(tc, test_session_revoke_account);
+    tcase_add_test(tc, test_session_login);
+
+    return tc;
+}
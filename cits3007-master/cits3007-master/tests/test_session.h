@@ -0,0 +1,8 @@
+#ifndef TEST_SESSION_H
+#define TEST_SESSION_H
+
+#include <check.h>
+
+TCase* make_session_tests(void);
+
+#endif // TEST_SESSION_H
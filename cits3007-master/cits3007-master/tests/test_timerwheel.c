@@ -0,0 +1,132 @@
+#include "test_timerwheel.h"
+#include "../src/timerwheel.h"
+#include <check.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Unaligned, so deadlines straddle slot boundaries at every level. */
+#define BASE ((time_t)1700000003)
+
+typedef struct {
+    wheel_timer_t timer;
+    time_t fired_at;          // wheel time when it expired, 0 if not yet
+    wheel_timer_t *cancel;    // a timer to cancel when this one expires
+} test_timer_t;
+
+static time_t wheel_now;
+
+static void on_expired(wheel_timer_t *timer, void *arg) {
+    test_timer_t *t = (test_timer_t *)((char *)timer - offsetof(test_timer_t, timer));
+    t->fired_at = wheel_now;
+    if (t->cancel) {
+        timerwheel_cancel(arg, t->cancel);
+    }
+}
+
+/* Advance w to now a second at a time, so fired_at is exact. */
+static size_t advance_to(timerwheel_t *w, time_t now) {
+    size_t fired = 0;
+    while (wheel_now < now) {
+        wheel_now++;
+        fired += timerwheel_advance(w, wheel_now, on_expired, w);
+    }
+    return fired;
+}
+
+START_TEST(test_timerwheel_deadlines) {
+    static const time_t deltas[] = {
+        1, 2, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 300000,
+    };
+    const size_t n = sizeof(deltas) / sizeof(deltas[0]);
+    timerwheel_t *w = malloc(sizeof(timerwheel_t));
+    test_timer_t *timers = calloc(n, sizeof(test_timer_t));
+    ck_assert_ptr_nonnull(w);
+    ck_assert_ptr_nonnull(timers);
+    timerwheel_init(w, BASE);
+    wheel_now = BASE;
+    for (size_t i = 0; i < n; i++) {
+        timerwheel_add(w, &timers[i].timer, BASE + deltas[i]);
+        ck_assert(timerwheel_pending(&timers[i].timer));
+    }
+    ck_assert_uint_eq(w->count, n);
+
+    /* Each expires in exactly its own second. */
+    ck_assert_uint_eq(advance_to(w, BASE + deltas[n - 1]), n);
+    for (size_t i = 0; i < n; i++) {
+        ck_assert_int_eq(timers[i].fired_at, BASE + deltas[i]);
+        ck_assert(!timerwheel_pending(&timers[i].timer));
+    }
+    ck_assert_uint_eq(w->count, 0);
+    free(timers);
+    free(w);
+} END_TEST
+
+START_TEST(test_timerwheel_far_and_past) {
+    timerwheel_t *w = malloc(sizeof(timerwheel_t));
+    ck_assert_ptr_nonnull(w);
+    test_timer_t past = { 0 }, far = { 0 }, farther = { 0 };
+    timerwheel_init(w, BASE);
+    wheel_now = BASE;
+    /* A deadline already reached expires at the next advance. */
+    timerwheel_add(w, &past.timer, BASE - 100);
+    /* Beyond what the top level reaches (64^4 seconds). */
+    timerwheel_add(w, &far.timer, BASE + 20000000);
+    timerwheel_add(w, &farther.timer, BASE + 40000000);
+
+    ck_assert_uint_eq(timerwheel_advance(w, BASE + 1, on_expired, w), 1);
+    ck_assert(!timerwheel_pending(&past.timer));
+    /* Big jumps fire nothing early... */
+    ck_assert_uint_eq(timerwheel_advance(w, BASE + 19999999, on_expired, w), 0);
+    ck_assert(timerwheel_pending(&far.timer));
+    /* ...and everything due, however far they go. */
+    ck_assert_uint_eq(timerwheel_advance(w, BASE + 20000000, on_expired, w), 1);
+    ck_assert(!timerwheel_pending(&far.timer));
+    ck_assert_uint_eq(timerwheel_advance(w, BASE + 39999999, on_expired, w), 0);
+    ck_assert_uint_eq(timerwheel_advance(w, BASE + 50000000, on_expired, w), 1);
+    ck_assert_uint_eq(w->count, 0);
+    /* Time doesn't go backwards. */
+    ck_assert_uint_eq(timerwheel_advance(w, BASE, on_expired, w), 0);
+    ck_assert_int_eq(w->now, BASE + 50000000);
+    free(w);
+} END_TEST
+
+START_TEST(test_timerwheel_cancel) {
+    timerwheel_t *w = malloc(sizeof(timerwheel_t));
+    ck_assert_ptr_nonnull(w);
+    test_timer_t a = { 0 }, b = { 0 }, c = { 0 }, moved = { 0 };
+    timerwheel_init(w, BASE);
+    wheel_now = BASE;
+    timerwheel_add(w, &a.timer, BASE + 10);
+    timerwheel_add(w, &b.timer, BASE + 10);
+    timerwheel_add(w, &c.timer, BASE + 10);
+    timerwheel_add(w, &moved.timer, BASE + 10);
+    timerwheel_add(w, &moved.timer, BASE + 5000);   /* moved, not added twice */
+    ck_assert_uint_eq(w->count, 4);
+
+    timerwheel_cancel(w, &b.timer);
+    ck_assert(!timerwheel_pending(&b.timer));
+    timerwheel_cancel(w, &b.timer);                 /* cancelling again is harmless */
+    ck_assert_uint_eq(w->count, 3);
+
+    /* Whichever of a and c expires first cancels the other. */
+    a.cancel = &c.timer;
+    c.cancel = &a.timer;
+    ck_assert_uint_eq(advance_to(w, BASE + 10), 1);
+    ck_assert(a.fired_at == 0 || c.fired_at == 0);
+    ck_assert_int_eq(b.fired_at, 0);
+    ck_assert_int_eq(moved.fired_at, 0);
+    ck_assert_uint_eq(advance_to(w, BASE + 5000), 1);
+    ck_assert_int_eq(moved.fired_at, BASE + 5000);
+    ck_assert_uint_eq(w->count, 0);
+    free(w);
+} END_TEST
+
+TCase* make_timerwheel_tests(void) {
+    TCase *tc = tcase_create("TimerWheel Tests");
+
+    tcase_add_test(tc, test_timerwheel_deadlines);
+    tcase_add_test(tc, test_timerwheel_far_and_past);
+    tcase_add_test(tc, test_timerwheel_cancel);
+
+    return tc;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_TIMERWHEEL_H
+#define TEST_TIMERWHEEL_H
+
+#include <check.h>
+
+TCase* make_timerwheel_tests(void);
+
+#endif // TEST_TIMERWHEEL_H
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include "test_wallclock.h"
+#include "../src/wallclock.h"
+#include "../src/session.h"
+#include "../src/store.h"
+#include "../src/db.h"
+#include <check.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Long enough for the ticker to have seen a couple of new seconds. */
+#define WAIT_MS 3000
+
+static atomic_int ticks;
+static _Atomic long long last_tick;
+
+static void count_tick(time_t now) {
+    atomic_store(&last_tick, (long long)now);
+    atomic_fetch_add(&ticks, 1);
+}
+
+/* Wait until *value is at least want, for up to WAIT_MS. */
+static bool wait_for(atomic_int *value, int want) {
+    for (int ms = 0; ms < WAIT_MS && atomic_load(value) < want; ms += 50) {
+        usleep(50 * 1000);
+    }
+    return atomic_load(value) >= want;
+}
+
+START_TEST(test_wallclock_now) {
+    ck_assert(!wallclock_running());
+    time_t before = time(NULL);
+    time_t now = wallclock_now();
+    ck_assert_int_le(before - 1, now);
+    ck_assert_int_le(now, time(NULL) + 1);
+
+    /* With the ticker running it is read from its cache */
+    ck_assert(wallclock_start());
+    ck_assert(wallclock_start());   /* already running */
+    ck_assert(wallclock_running());
+    now = wallclock_now();
+    ck_assert_int_le(before - 1, now);
+    ck_assert_int_le(now, time(NULL) + 1);
+    wallclock_stop();
+    ck_assert(!wallclock_running());
+    wallclock_stop();               /* already stopped */
+} END_TEST
+
+START_TEST(test_wallclock_hooks) {
+    atomic_store(&ticks, 0);
+    ck_assert(wallclock_on_second(count_tick));
+    ck_assert(wallclock_on_second(count_tick));   /* only added once */
+    ck_assert(wallclock_start());
+    /* Called at once, then once every new second */
+    ck_assert(wait_for(&ticks, 3));
+    wallclock_stop();
+    int seen = atomic_load(&ticks);
+    ck_assert_int_le(seen, 5);
+    ck_assert_int_le(time(NULL) - 1, (time_t)atomic_load(&last_tick));
+    usleep(1200 * 1000);
+    ck_assert_int_eq(atomic_load(&ticks), seen);  /* nothing once stopped */
+} END_TEST
+
+START_TEST(test_wallclock_sessions) {
+    /* A session that has timed out is dropped by the ticker unseen */
+    time_t now = wallclock_now();
+    session_configure(1);
+    login_session_data_t s = { .account_id = 7101, .session_start = now - 1 };
+    session_token_t token;
+    size_t before = session_count();
+    ck_assert(session_issue(&s, &token));
+    session_configure(0);
+    ck_assert_uint_eq(session_count(), before + 1);
+
+    /* So are those of an account once its expiration time comes */
+    account_t *acc = account_create("clockuser", "Cl0ck!Pass", "c@example.com", "1990-01-01");
+    ck_assert_ptr_nonnull(acc);
+    account_free(acc);
+    const account_auth_t *rec = store_acquire("clockuser");
+    ck_assert_ptr_nonnull(rec);
+    login_session_data_t user = { .account_id = rec->account_id, .session_start = now };
+    session_token_t user_token;
+    ck_assert(session_issue(&user, &user_token));
+    ck_assert(store_set_expiration_time(rec, now + 1));
+    store_release(rec);
+
+    atomic_store(&ticks, 0);
+    ck_assert(wallclock_on_second(count_tick));
+    ck_assert(wallclock_start());
+    ck_assert(wait_for(&ticks, 3));
+    wallclock_stop();
+    ck_assert(!session_validate(&user_token, now, NULL));
+    ck_assert_uint_le(session_count(), before);
+} END_TEST
+
+START_TEST(test_wallclock_expiry_deadlines) {
+    /* An account has one expiry deadline, however often it is set */
+    time_t now = wallclock_now();
+    account_t *acc = account_create("deadlineuser", "Dead!L1ne", "d@example.com", "1990-01-01");
+    ck_assert_ptr_nonnull(acc);
+    account_free(acc);
+    const account_auth_t *rec = store_acquire("deadlineuser");
+    ck_assert_ptr_nonnull(rec);
+    size_t before = store_expiry_pending();
+    for (int i = 0; i < 100; i++) {
+        ck_assert(store_set_expiration_time(rec, now + 3600 + i));
+    }
+    ck_assert_uint_eq(store_expiry_pending(), before + 1);
+    /* None while it has no expiration time to come */
+    ck_assert(store_set_expiration_time(rec, 0));
+    ck_assert_uint_eq(store_expiry_pending(), before);
+
+    /* Brought forward, it is still kept once, and comes when it should */
+    login_session_data_t s = { .account_id = rec->account_id, .session_start = now };
+    session_token_t token;
+    ck_assert(session_issue(&s, &token));
+    ck_assert(store_set_expiration_time(rec, now + 3600));
+    ck_assert(store_set_expiration_time(rec, now + 1));
+    ck_assert_uint_eq(store_expiry_pending(), before + 1);
+    atomic_store(&ticks, 0);
+    ck_assert(wallclock_on_second(count_tick));
+    ck_assert(wallclock_start());
+    ck_assert(wait_for(&ticks, 3));
+    wallclock_stop();
+    ck_assert(!session_validate(&token, now, NULL));
+    ck_assert_uint_eq(store_expiry_pending(), before);
+
+    /* Closing the store drops those left */
+    ck_assert(store_set_expiration_time(rec, now + 3600));
+    ck_assert_uint_eq(store_expiry_pending(), before + 1);
+    store_release(rec);
+    store_close();
+    ck_assert_uint_eq(store_expiry_pending(), 0);
+} END_TEST
+
+TCase* make_wallclock_tests(void) {
+    TCase *tc = tcase_create("WallClock Tests");
+    tcase_set_timeout(tc, 20);
+
+    tcase_add_test(tc, test_wallclock_now);
+    tcase_add_test(tc, test_wallclock_hooks);
+    tcase_add_test(tc, test_wallclock_sessions);
+    tcase_add_test(tc, test_wallclock_expiry_deadlines);
+
+    return tc;
+}
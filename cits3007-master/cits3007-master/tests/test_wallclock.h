@@ -0,0 +1,8 @@
+#ifndef TEST_WALLCLOCK_H
+#define TEST_WALLCLOCK_H
+
+#include <check.h>
+
+TCase* make_wallclock_tests(void);
+
+#endif // TEST_WALLCLOCK_H